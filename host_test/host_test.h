@@ -0,0 +1,50 @@
+#ifndef HOST_TEST
+#define HOST_TEST
+
+// Shared by the host tests: checks that keep going and count failures, and
+// a clock for benchmarks. Each test is one program; it returns
+// host_test_result() from main, nonzero if any check failed.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+static int host_test_failures;
+
+#define CHECK(cond) do {                                                    \
+        if (!(cond)) {                                                      \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__,          \
+                    __LINE__, #cond);                                       \
+            host_test_failures++;                                           \
+        }                                                                   \
+    } while (0)
+
+// Checks that |actual - expected| <= tolerance, printing both on failure.
+#define CHECK_NEAR(actual, expected, tolerance) do {                        \
+        double a_ = (actual);                                               \
+        double e_ = (expected);                                             \
+        if (a_ - e_ > (tolerance) || e_ - a_ > (tolerance)) {               \
+            fprintf(stderr, "%s:%d: %s = %g, expected %g +- %g\n",          \
+                    __FILE__, __LINE__, #actual, a_, e_,                    \
+                    (double)(tolerance));                                   \
+            host_test_failures++;                                           \
+        }                                                                   \
+    } while (0)
+
+static inline int host_test_result(const char* name) {
+    printf("%s: %s\n", name, host_test_failures ? "FAILED" : "ok");
+    return host_test_failures != 0;
+}
+
+static inline double host_test_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Keeps a benchmark's result alive without a volatile store per iteration.
+static inline void host_test_keep(uint64_t value) {
+    __asm__ volatile("" : : "r"(value) : "memory");
+}
+
+#endif // HOST_TEST
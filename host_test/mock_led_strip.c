@@ -0,0 +1,79 @@
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+#include "led_strip.h"
+#include "esp_timer.h"
+
+struct led_strip_t {
+    uint8_t pixel[3];
+};
+
+static struct led_strip_t g_strip;
+static uint32_t g_refresh_us;
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static mock_strip_frame_t g_log[MOCK_STRIP_LOG];
+static uint32_t g_frames;
+
+esp_err_t led_strip_new_rmt_device(const led_strip_config_t* config,
+                                   const led_strip_rmt_config_t* rmt_config,
+                                   led_strip_handle_t* out) {
+    if (config->max_leds != 1) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    *out = &g_strip;
+    return ESP_OK;
+}
+
+esp_err_t led_strip_set_pixel(led_strip_handle_t strip, uint32_t index,
+                              uint32_t red, uint32_t green, uint32_t blue) {
+    if (index != 0 || red > 255 || green > 255 || blue > 255) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    strip->pixel[0] = red;
+    strip->pixel[1] = green;
+    strip->pixel[2] = blue;
+    return ESP_OK;
+}
+
+esp_err_t led_strip_refresh(led_strip_handle_t strip) {
+    if (g_refresh_us && host_stub_fake_time()) {
+        host_stub_set_time_us(esp_timer_get_time() + g_refresh_us);
+    } else if (g_refresh_us) {
+        usleep(g_refresh_us);
+    }
+    pthread_mutex_lock(&g_lock);
+    mock_strip_frame_t* f = &g_log[g_frames % MOCK_STRIP_LOG];
+    f->at = esp_timer_get_time();
+    memcpy(f->rgb, strip->pixel, 3);
+    g_frames++;
+    pthread_mutex_unlock(&g_lock);
+    return ESP_OK;
+}
+
+esp_err_t led_strip_clear(led_strip_handle_t strip) {
+    memset(strip->pixel, 0, 3);
+    return ESP_OK;
+}
+
+void mock_strip_set_refresh_us(uint32_t us) {
+    g_refresh_us = us;
+}
+
+uint32_t mock_strip_frames(void) {
+    pthread_mutex_lock(&g_lock);
+    uint32_t n = g_frames;
+    pthread_mutex_unlock(&g_lock);
+    return n;
+}
+
+int mock_strip_frame(uint32_t i, mock_strip_frame_t* frame) {
+    int ok;
+
+    pthread_mutex_lock(&g_lock);
+    ok = i < g_frames && g_frames - i <= MOCK_STRIP_LOG;
+    if (ok) {
+        *frame = g_log[i % MOCK_STRIP_LOG];
+    }
+    pthread_mutex_unlock(&g_lock);
+    return ok;
+}
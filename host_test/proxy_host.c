@@ -0,0 +1,36 @@
+// Linux host build of the display link proxy, for tools/proxy_replay.py:
+// both proxy tasks on the pty driver, started as main.c starts them. On
+// SIGTERM or SIGINT it prints what "proxy" prints on the console and exits.
+//
+//     ../tools/proxy_replay.py replay corpus.txt -- build/proxy_host
+
+#include <signal.h>
+#include <stdint.h>
+#include "esp_console.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "uart_proxy.h"
+
+int main(void) {
+    sigset_t stop;
+    int sig;
+    int ret;
+
+    // Blocked before the tasks start, so only sigwait() below sees them.
+    sigemptyset(&stop);
+    sigaddset(&stop, SIGTERM);
+    sigaddset(&stop, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &stop, NULL);
+
+    uart_proxy_init();
+    for (int side = 0; side < UART_PROXY_SIDES; side++) {
+        xTaskCreateStaticPinnedToCore(uart_proxy_task, "Proxy", 0,
+                                      (void*)(intptr_t)side, 0, NULL, NULL, 0);
+    }
+
+    sigwait(&stop, &sig);
+    host_log_info = 1;
+    esp_console_run("proxy", &ret);
+    return 0;
+}
@@ -0,0 +1,21 @@
+#ifndef ESP_CONSOLE_H
+#define ESP_CONSOLE_H
+
+#include "esp_err.h"
+
+typedef int (*esp_console_cmd_func_t)(int argc, char** argv);
+
+typedef struct {
+    const char* command;
+    const char* help;
+    const char* hint;
+    esp_console_cmd_func_t func;
+    void* argtable;
+} esp_console_cmd_t;
+
+esp_err_t esp_console_cmd_register(const esp_console_cmd_t* cmd);
+// Splits the line on spaces and runs the command; ESP_ERR_NOT_FOUND if no
+// command of that name was registered.
+esp_err_t esp_console_run(const char* cmdline, int* ret);
+
+#endif // ESP_CONSOLE_H
@@ -0,0 +1,22 @@
+#ifndef ESP_LOG_H
+#define ESP_LOG_H
+
+#include <stdio.h>
+#include "esp_err.h"
+
+// Errors and warnings go to stderr; info is only shown with HOST_TEST_LOG
+// set, so test output stays readable.
+extern int host_log_info;
+
+#define ESP_LOGE(tag, fmt, ...) \
+    fprintf(stderr, "E %s: " fmt "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGW(tag, fmt, ...) \
+    fprintf(stderr, "W %s: " fmt "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGI(tag, fmt, ...) do {                                        \
+        if (host_log_info) {                                                \
+            fprintf(stderr, "I %s: " fmt "\n", tag, ##__VA_ARGS__);         \
+        }                                                                   \
+    } while (0)
+#define ESP_LOGD(tag, fmt, ...) do { } while (0)
+
+#endif // ESP_LOG_H
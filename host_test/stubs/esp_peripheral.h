@@ -0,0 +1,17 @@
+#ifndef H_ESP_PERIPHERAL_
+#define H_ESP_PERIPHERAL_
+
+// What main/ uses of nimble_peripheral_utils/esp_peripheral.h.
+
+#include <stdbool.h>
+#include "esp_err.h"
+#include "nimble/ble.h"
+#include "modlog/modlog.h"
+
+#define SCLI_REMOTE_LINE_MAX 128
+
+typedef void (*scli_done_fn)(const char *line, esp_err_t err, int ret);
+
+bool scli_run_line(const char *line, scli_done_fn done);
+
+#endif // H_ESP_PERIPHERAL_
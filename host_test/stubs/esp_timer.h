@@ -0,0 +1,42 @@
+#ifndef ESP_TIMER_H
+#define ESP_TIMER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+// Microseconds on CLOCK_MONOTONIC, unless a test drives the clock itself
+// with host_stub_set_time_us(). Callbacks run on a thread per timer on the
+// real clock, and from host_stub_run_until() on the simulated one.
+
+typedef struct esp_timer* esp_timer_handle_t;
+typedef void (*esp_timer_cb_t)(void* arg);
+
+typedef struct {
+    esp_timer_cb_t callback;
+    void* arg;
+    int dispatch_method;
+    const char* name;
+    bool skip_unhandled_events;
+} esp_timer_create_args_t;
+
+int64_t esp_timer_get_time(void);
+esp_err_t esp_timer_create(const esp_timer_create_args_t* args,
+                           esp_timer_handle_t* out);
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us);
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period_us);
+esp_err_t esp_timer_stop(esp_timer_handle_t timer);
+
+// Host only: esp_timer_get_time() returns us from now on. For discrete-event
+// tests; from then on timers only fire in host_stub_run_until().
+void host_stub_set_time_us(int64_t us);
+bool host_stub_fake_time(void);
+
+// Host only, on the simulated clock: fires every timer due up to us in due
+// order, each at its due time, and waits after each for the tasks it woke
+// to block again, so tasks run in lockstep with the clock. Tasks may move
+// the clock forward themselves while they run (a mock peripheral that takes
+// time); the clock ends at us or later.
+void host_stub_run_until(int64_t us);
+
+#endif // ESP_TIMER_H
@@ -0,0 +1,29 @@
+#ifndef FREERTOS_TASK_H
+#define FREERTOS_TASK_H
+
+#include <sched.h>
+#include "freertos/FreeRTOS.h"
+
+typedef struct host_task* TaskHandle_t;
+typedef void (*TaskFunction_t)(void* param);
+
+// Runs fn on a new thread; stack, priority and core are ignored.
+TaskHandle_t xTaskCreateStaticPinnedToCore(TaskFunction_t fn, const char* name,
+                                           uint32_t stack_size, void* param,
+                                           UBaseType_t prio, StackType_t* stack,
+                                           StaticTask_t* tcb, BaseType_t core);
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+const char* pcTaskGetName(TaskHandle_t task);
+
+void vTaskDelay(TickType_t ticks);
+TickType_t xTaskGetTickCount(void);
+#define taskYIELD() sched_yield()
+
+void xTaskNotifyGive(TaskHandle_t task);
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks);
+
+// Host only: returns once every created task is waiting in
+// ulTaskNotifyTake() with nothing to take.
+void host_stub_wait_idle(void);
+
+#endif // FREERTOS_TASK_H
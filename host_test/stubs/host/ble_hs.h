@@ -0,0 +1,29 @@
+#ifndef HOST_BLE_HS_H
+#define HOST_BLE_HS_H
+
+// The few NimBLE host definitions the modules under test use. The mbuf
+// pool, and where notifications go, are whatever the test says.
+
+#include <stdint.h>
+
+#define BLE_HS_CONN_HANDLE_NONE 0xffff
+#define BLE_HCI_CONN_ITVL 1250 // us per connection interval unit
+
+#define BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN 0x0d
+#define BLE_ATT_ERR_INSUFFICIENT_RES 0x11
+#define BLE_ATT_ERR_VALUE_NOT_ALLOWED 0x13
+
+struct os_mbuf;
+
+struct ble_gap_conn_desc {
+    uint16_t conn_handle;
+    uint16_t conn_itvl;
+};
+
+int os_msys_num_free(void);
+struct os_mbuf* ble_hs_mbuf_from_flat(const void* buf, uint16_t len);
+int ble_gap_conn_find(uint16_t conn_handle, struct ble_gap_conn_desc* desc);
+int ble_gatts_notify_custom(uint16_t conn_handle, uint16_t att_handle,
+                            struct os_mbuf* om);
+
+#endif // HOST_BLE_HS_H
@@ -0,0 +1,377 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "esp_console.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+int host_log_info;
+
+__attribute__((constructor)) static void host_stubs_init(void) {
+    host_log_info = getenv("HOST_TEST_LOG") != NULL;
+}
+
+static void deadline_after_us(struct timespec* ts, int64_t us) {
+    clock_gettime(CLOCK_MONOTONIC, ts);
+    ts->tv_sec += us / 1000000;
+    ts->tv_nsec += (us % 1000000) * 1000;
+    if (ts->tv_nsec >= 1000000000) {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000;
+    }
+}
+
+static void cond_init_monotonic(pthread_cond_t* cond) {
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+/* Tasks */
+
+struct host_task {
+    char name[16];
+    TaskFunction_t fn;
+    void* param;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint32_t notified;
+    bool blocked;
+};
+
+static __thread TaskHandle_t t_current;
+
+// Created tasks that are not waiting for a notification, for
+// host_stub_wait_idle(). A task counts as running again from the moment it
+// is notified, not from when its thread wakes up.
+static pthread_mutex_t g_sched_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_sched_idle = PTHREAD_COND_INITIALIZER;
+static int g_running;
+
+static void sched_add_running(int n) {
+    pthread_mutex_lock(&g_sched_lock);
+    g_running += n;
+    if (g_running == 0) {
+        pthread_cond_broadcast(&g_sched_idle);
+    }
+    pthread_mutex_unlock(&g_sched_lock);
+}
+
+void host_stub_wait_idle(void) {
+    pthread_mutex_lock(&g_sched_lock);
+    while (g_running > 0) {
+        pthread_cond_wait(&g_sched_idle, &g_sched_lock);
+    }
+    pthread_mutex_unlock(&g_sched_lock);
+}
+
+static TaskHandle_t task_new(const char* name) {
+    TaskHandle_t task = calloc(1, sizeof(*task));
+    strncpy(task->name, name, sizeof(task->name) - 1);
+    pthread_mutex_init(&task->lock, NULL);
+    cond_init_monotonic(&task->cond);
+    return task;
+}
+
+static void* task_main(void* arg) {
+    TaskHandle_t task = arg;
+    t_current = task;
+    task->fn(task->param);
+    return NULL;
+}
+
+TaskHandle_t xTaskCreateStaticPinnedToCore(TaskFunction_t fn, const char* name,
+                                           uint32_t stack_size, void* param,
+                                           UBaseType_t prio, StackType_t* stack,
+                                           StaticTask_t* tcb, BaseType_t core) {
+    TaskHandle_t task = task_new(name);
+    pthread_t thread;
+
+    task->fn = fn;
+    task->param = param;
+    sched_add_running(1);
+    if (pthread_create(&thread, NULL, task_main, task) != 0) {
+        abort();
+    }
+    pthread_detach(thread);
+    return task;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void) {
+    if (t_current == NULL) {
+        t_current = task_new("main");
+    }
+    return t_current;
+}
+
+const char* pcTaskGetName(TaskHandle_t task) {
+    return task->name;
+}
+
+void vTaskDelay(TickType_t ticks) {
+    struct timespec ts = {
+        .tv_sec = ticks / 1000,
+        .tv_nsec = (ticks % 1000) * 1000000L,
+    };
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {
+    }
+}
+
+TickType_t xTaskGetTickCount(void) {
+    return esp_timer_get_time() / 1000;
+}
+
+void xTaskNotifyGive(TaskHandle_t task) {
+    pthread_mutex_lock(&task->lock);
+    task->notified++;
+    if (task->blocked) {
+        task->blocked = false;
+        sched_add_running(1);
+    }
+    pthread_cond_signal(&task->cond);
+    pthread_mutex_unlock(&task->lock);
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks) {
+    TaskHandle_t task = xTaskGetCurrentTaskHandle();
+    struct timespec deadline;
+    uint32_t value;
+
+    deadline_after_us(&deadline, (int64_t)ticks * 1000);
+    pthread_mutex_lock(&task->lock);
+    while (task->notified == 0) {
+        if (!task->blocked && task->fn != NULL) {
+            task->blocked = true;
+            sched_add_running(-1);
+        }
+        if (ticks == portMAX_DELAY) {
+            pthread_cond_wait(&task->cond, &task->lock);
+        } else if (pthread_cond_timedwait(&task->cond, &task->lock,
+                                          &deadline) == ETIMEDOUT) {
+            break;
+        }
+    }
+    if (task->blocked) {
+        task->blocked = false;
+        sched_add_running(1);
+    }
+    value = task->notified;
+    if (value > 0) {
+        task->notified = clear ? 0 : value - 1;
+    }
+    pthread_mutex_unlock(&task->lock);
+    return value;
+}
+
+/* esp_timer */
+
+struct esp_timer {
+    esp_timer_create_args_t args;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool armed;
+    int64_t due;
+    uint64_t period;
+};
+
+#define MAX_TIMERS 16
+
+static esp_timer_handle_t g_timers[MAX_TIMERS];
+static int g_num_timers;
+static _Atomic bool g_fake_time;
+static _Atomic int64_t g_fake_time_us;
+
+void host_stub_set_time_us(int64_t us) {
+    g_fake_time_us = us;
+    g_fake_time = true;
+}
+
+bool host_stub_fake_time(void) {
+    return g_fake_time;
+}
+
+int64_t esp_timer_get_time(void) {
+    if (g_fake_time) {
+        return g_fake_time_us;
+    }
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void* timer_main(void* arg) {
+    esp_timer_handle_t timer = arg;
+
+    pthread_mutex_lock(&timer->lock);
+    while (true) {
+        // On the simulated clock, host_stub_run_until() fires timers.
+        if (!timer->armed || g_fake_time) {
+            pthread_cond_wait(&timer->cond, &timer->lock);
+            continue;
+        }
+        int64_t wait = timer->due - esp_timer_get_time();
+        if (wait > 0) {
+            struct timespec deadline;
+            deadline_after_us(&deadline, wait);
+            pthread_cond_timedwait(&timer->cond, &timer->lock, &deadline);
+            continue;
+        }
+        if (timer->period) {
+            timer->due += timer->period;
+        } else {
+            timer->armed = false;
+        }
+        pthread_mutex_unlock(&timer->lock);
+        timer->args.callback(timer->args.arg);
+        pthread_mutex_lock(&timer->lock);
+    }
+    return NULL;
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t* args,
+                           esp_timer_handle_t* out) {
+    esp_timer_handle_t timer = calloc(1, sizeof(*timer));
+    pthread_t thread;
+
+    timer->args = *args;
+    pthread_mutex_init(&timer->lock, NULL);
+    cond_init_monotonic(&timer->cond);
+    pthread_mutex_lock(&g_sched_lock);
+    if (g_num_timers == MAX_TIMERS) {
+        pthread_mutex_unlock(&g_sched_lock);
+        return ESP_ERR_NO_MEM;
+    }
+    g_timers[g_num_timers++] = timer;
+    pthread_mutex_unlock(&g_sched_lock);
+    if (pthread_create(&thread, NULL, timer_main, timer) != 0) {
+        return ESP_ERR_NO_MEM;
+    }
+    pthread_detach(thread);
+    *out = timer;
+    return ESP_OK;
+}
+
+static esp_err_t timer_start(esp_timer_handle_t timer, uint64_t us,
+                             uint64_t period) {
+    esp_err_t err = ESP_OK;
+
+    pthread_mutex_lock(&timer->lock);
+    if (timer->armed) {
+        err = ESP_ERR_INVALID_STATE;
+    } else {
+        timer->armed = true;
+        timer->due = esp_timer_get_time() + us;
+        timer->period = period;
+        pthread_cond_signal(&timer->cond);
+    }
+    pthread_mutex_unlock(&timer->lock);
+    return err;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us) {
+    return timer_start(timer, timeout_us, 0);
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer,
+                                   uint64_t period_us) {
+    return timer_start(timer, period_us, period_us);
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer) {
+    esp_err_t err = ESP_OK;
+
+    pthread_mutex_lock(&timer->lock);
+    if (!timer->armed) {
+        err = ESP_ERR_INVALID_STATE;
+    }
+    timer->armed = false;
+    pthread_cond_signal(&timer->cond);
+    pthread_mutex_unlock(&timer->lock);
+    return err;
+}
+
+// Earliest armed timer due at or before until, or NULL.
+static esp_timer_handle_t next_timer(int64_t until) {
+    esp_timer_handle_t next = NULL;
+    int64_t next_due = until;
+
+    pthread_mutex_lock(&g_sched_lock);
+    int n = g_num_timers;
+    pthread_mutex_unlock(&g_sched_lock);
+    for (int i = 0; i < n; i++) {
+        esp_timer_handle_t timer = g_timers[i];
+        pthread_mutex_lock(&timer->lock);
+        if (timer->armed && timer->due <= next_due) {
+            next = timer;
+            next_due = timer->due;
+        }
+        pthread_mutex_unlock(&timer->lock);
+    }
+    return next;
+}
+
+void host_stub_run_until(int64_t us) {
+    esp_timer_handle_t timer;
+
+    host_stub_wait_idle();
+    while ((timer = next_timer(us)) != NULL) {
+        pthread_mutex_lock(&timer->lock);
+        if (timer->due > g_fake_time_us) {
+            g_fake_time_us = timer->due;
+        }
+        if (timer->period) {
+            timer->due += timer->period;
+        } else {
+            timer->armed = false;
+        }
+        pthread_mutex_unlock(&timer->lock);
+        timer->args.callback(timer->args.arg);
+        host_stub_wait_idle();
+    }
+    if (us > g_fake_time_us) {
+        g_fake_time_us = us;
+    }
+}
+
+/* esp_console */
+
+#define MAX_CMDS 32
+#define MAX_ARGS 8
+
+static esp_console_cmd_t g_cmds[MAX_CMDS];
+static int g_num_cmds;
+
+esp_err_t esp_console_cmd_register(const esp_console_cmd_t* cmd) {
+    if (g_num_cmds == MAX_CMDS) {
+        return ESP_ERR_NO_MEM;
+    }
+    g_cmds[g_num_cmds++] = *cmd;
+    return ESP_OK;
+}
+
+esp_err_t esp_console_run(const char* cmdline, int* ret) {
+    char line[128];
+    char* argv[MAX_ARGS];
+    int argc = 0;
+    char* save;
+
+    strncpy(line, cmdline, sizeof(line) - 1);
+    line[sizeof(line) - 1] = '\0';
+    for (char* tok = strtok_r(line, " ", &save); tok && argc < MAX_ARGS;
+         tok = strtok_r(NULL, " ", &save)) {
+        argv[argc++] = tok;
+    }
+    for (int i = 0; argc > 0 && i < g_num_cmds; i++) {
+        if (strcmp(g_cmds[i].command, argv[0]) == 0) {
+            *ret = g_cmds[i].func(argc, argv);
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NOT_FOUND;
+}
@@ -0,0 +1,46 @@
+#ifndef LED_STRIP_H
+#define LED_STRIP_H
+
+// Mock of the espressif/led_strip component: one pixel, kept in memory.
+// Every refresh is logged with its esp_timer time and the pixel it showed,
+// for tests to check frame timing and content against.
+
+#include <stdint.h>
+#include "esp_err.h"
+
+typedef struct led_strip_t* led_strip_handle_t;
+
+typedef struct {
+    int strip_gpio_num;
+    uint32_t max_leds;
+} led_strip_config_t;
+
+typedef struct {
+    uint32_t resolution_hz;
+} led_strip_rmt_config_t;
+
+esp_err_t led_strip_new_rmt_device(const led_strip_config_t* config,
+                                   const led_strip_rmt_config_t* rmt_config,
+                                   led_strip_handle_t* out);
+esp_err_t led_strip_set_pixel(led_strip_handle_t strip, uint32_t index,
+                              uint32_t red, uint32_t green, uint32_t blue);
+esp_err_t led_strip_refresh(led_strip_handle_t strip);
+esp_err_t led_strip_clear(led_strip_handle_t strip);
+
+typedef struct {
+    int64_t at;       // esp_timer_get_time() when the refresh finished
+    uint8_t rgb[3];
+} mock_strip_frame_t;
+
+// How long each refresh takes, to model the RMT transfer. On the simulated
+// clock (host_stub_set_time_us()) a refresh moves the clock on by this much
+// instead of sleeping.
+void mock_strip_set_refresh_us(uint32_t us);
+// Refreshes so far; the log keeps the most recent MOCK_STRIP_LOG of them.
+#define MOCK_STRIP_LOG 4096
+uint32_t mock_strip_frames(void);
+// Frame i (counting from 0 at the first refresh); false if it has dropped
+// out of the log or not happened yet.
+int mock_strip_frame(uint32_t i, mock_strip_frame_t* frame);
+
+#endif // LED_STRIP_H
@@ -0,0 +1,6 @@
+#ifndef MODLOG_MODLOG_H
+#define MODLOG_MODLOG_H
+
+#define MODLOG_DFLT(level, fmt, ...) do { } while (0)
+
+#endif // MODLOG_MODLOG_H
@@ -0,0 +1,6 @@
+#ifndef NIMBLE_BLE_H
+#define NIMBLE_BLE_H
+
+#include <stdint.h>
+
+#endif // NIMBLE_BLE_H
@@ -0,0 +1,7 @@
+#ifndef NIMBLE_PORT_FREERTOS_H
+#define NIMBLE_PORT_FREERTOS_H
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#endif // NIMBLE_PORT_FREERTOS_H
@@ -0,0 +1,25 @@
+#ifndef NVS_H
+#define NVS_H
+
+// NVS blobs, enough for the modules under test; tests that use them
+// provide the functions, so they can fail them at will.
+
+#include <stddef.h>
+#include "esp_err.h"
+
+typedef unsigned nvs_handle_t;
+typedef enum {
+    NVS_READONLY,
+    NVS_READWRITE,
+} nvs_open_mode_t;
+
+esp_err_t nvs_open(const char* name, nvs_open_mode_t mode,
+                   nvs_handle_t* handle);
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char* key, void* value,
+                       size_t* len);
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char* key,
+                       const void* value, size_t len);
+esp_err_t nvs_commit(nvs_handle_t handle);
+void nvs_close(nvs_handle_t handle);
+
+#endif // NVS_H
@@ -0,0 +1,39 @@
+#ifndef OS_ENDIAN_H
+#define OS_ENDIAN_H
+
+#include <stdint.h>
+
+static inline void put_le16(void* buf, uint16_t x) {
+    uint8_t* b = buf;
+    b[0] = x;
+    b[1] = x >> 8;
+}
+
+static inline void put_le32(void* buf, uint32_t x) {
+    uint8_t* b = buf;
+    b[0] = x;
+    b[1] = x >> 8;
+    b[2] = x >> 16;
+    b[3] = x >> 24;
+}
+
+static inline void put_le64(void* buf, uint64_t x) {
+    put_le32(buf, x);
+    put_le32((uint8_t*)buf + 4, x >> 32);
+}
+
+static inline uint16_t get_le16(const void* buf) {
+    const uint8_t* b = buf;
+    return b[0] | b[1] << 8;
+}
+
+static inline uint32_t get_le32(const void* buf) {
+    const uint8_t* b = buf;
+    return b[0] | b[1] << 8 | b[2] << 16 | (uint32_t)b[3] << 24;
+}
+
+static inline uint64_t get_le64(const void* buf) {
+    return get_le32(buf) | (uint64_t)get_le32((const uint8_t*)buf + 4) << 32;
+}
+
+#endif // OS_ENDIAN_H
@@ -0,0 +1,27 @@
+#ifndef SDKCONFIG_H
+#define SDKCONFIG_H
+
+// The options the modules under test read, at their Kconfig defaults except
+// where a test needs the optional code compiled in.
+
+#define CONFIG_APP_TASK_CORE 1
+#define CONFIG_APP_LED_TASK_STACK_SIZE 3072
+#define CONFIG_APP_SCLI_TASK_STACK_SIZE 4096
+#define CONFIG_APP_CTRL_TASK_STACK_SIZE 2048
+#define CONFIG_APP_STATIC_RAM_BUDGET 24576
+#define CONFIG_BT_NIMBLE_MAX_CONNECTIONS 3
+
+#define CONFIG_APP_ATT_LIMIT 1
+#define CONFIG_APP_ATT_READ_RATE 20
+#define CONFIG_APP_ATT_WRITE_RATE 100
+#define CONFIG_APP_ATT_BURST 20
+#define CONFIG_APP_ATT_NOTIFY_RATE 50
+#define CONFIG_APP_ATT_NOTIFY_BURST 16
+#define CONFIG_APP_ATT_MBUF_RESERVE 4
+
+#define CONFIG_APP_CYCLING_NOTIFY_HZ 2
+
+#define CONFIG_APP_ASSIST 1
+#define CONFIG_APP_UART_PROXY 1
+
+#endif // SDKCONFIG_H
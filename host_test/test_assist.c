@@ -0,0 +1,216 @@
+// Assist curves: the compiled tables against tsdz2_assist_reference_ma()
+// over every cadence the motor reports and pedal torque in 7 mNm steps, for
+// a linear and two spline curves; lookup cost; then the characteristic's
+// validation, NVS round trip and table refresh in assist.c.
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "assist.h"
+#include "esp_console.h"
+#include "host_test.h"
+#include "host/ble_hs.h"
+#include "nvs.h"
+
+// Largest difference from the exact curve allowed anywhere. Between two
+// torque samples 0.512 Nm apart the table is a straight line, so where a
+// curve bends inside a step, the chord misses it by up to a quarter step
+// times the change of slope: 20 mA for the default curves' knee at 5 Nm,
+// 22 mA at the steepest spline measured. Rounding both tables adds under
+// 1.5 mA.
+#define ASSIST_TOL_MA 25
+
+#define TORQUE_MAX_MNM 140000
+#define TORQUE_STEP_MNM 7
+#define CADENCE_MAX_RPM 140
+
+/*** NVS: one blob in memory. */
+
+static uint8_t g_blob[sizeof(tsdz2_assist_curve_t) * TSDZ2_ASSIST_LEVELS];
+static size_t g_blob_len;
+
+esp_err_t nvs_open(const char* name, nvs_open_mode_t mode,
+                   nvs_handle_t* handle) {
+    *handle = 1;
+    return ESP_OK;
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char* key, void* value,
+                       size_t* len) {
+    if (g_blob_len == 0) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    memcpy(value, g_blob, g_blob_len < *len ? g_blob_len : *len);
+    *len = g_blob_len;
+    return ESP_OK;
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char* key,
+                       const void* value, size_t len) {
+    memcpy(g_blob, value, len);
+    g_blob_len = len;
+    return ESP_OK;
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle) {
+    return ESP_OK;
+}
+
+void nvs_close(nvs_handle_t handle) {}
+
+/*** Accuracy and cost. */
+
+static const tsdz2_assist_curve_t g_linear = {
+    .interp = TSDZ2_ASSIST_LINEAR,
+    .torque_knots = 3,
+    .torque_dnm = { 0, 50, 800 },
+    .current_ma = { 0, 0, 16000 },
+    .cadence_knots = 4,
+    .cadence_rpm = { 0, 20, 100, 120 },
+    .gain_pct = { 0, 100, 100, 60 },
+};
+
+static const tsdz2_assist_curve_t g_spline5 = {
+    .interp = TSDZ2_ASSIST_SPLINE,
+    .torque_knots = 5,
+    .torque_dnm = { 0, 50, 200, 500, 800 },
+    .current_ma = { 0, 0, 3000, 9000, 16000 },
+    .cadence_knots = 4,
+    .cadence_rpm = { 0, 20, 100, 120 },
+    .gain_pct = { 0, 100, 100, 60 },
+};
+
+static const tsdz2_assist_curve_t g_spline8 = {
+    .interp = TSDZ2_ASSIST_SPLINE,
+    .torque_knots = 8,
+    .torque_dnm = { 0, 30, 70, 150, 300, 500, 800, 1200 },
+    .current_ma = { 0, 500, 1500, 3500, 7000, 11000, 15000, 18000 },
+    .cadence_knots = 8,
+    .cadence_rpm = { 0, 5, 10, 20, 40, 80, 100, 120 },
+    .gain_pct = { 0, 20, 50, 90, 100, 110, 100, 50 },
+};
+
+static void check_curve(const char* name, const tsdz2_assist_curve_t* c) {
+    static tsdz2_assist_table_t t;
+    double max_err = 0;
+    double sum_err = 0;
+    uint32_t n = 0;
+
+    CHECK(tsdz2_assist_curve_valid(c));
+    double start = host_test_now_ns();
+    tsdz2_assist_compile(&t, c);
+    double compile_us = (host_test_now_ns() - start) / 1e3;
+
+    for (int rpm = 0; rpm <= CADENCE_MAX_RPM; rpm++) {
+        for (uint32_t mnm = 0; mnm <= TORQUE_MAX_MNM; mnm += TORQUE_STEP_MNM) {
+            double err = fabs(tsdz2_assist_current_ma(&t, mnm, rpm) -
+                              tsdz2_assist_reference_ma(c, mnm, rpm));
+            max_err = err > max_err ? err : max_err;
+            sum_err += err;
+            n++;
+        }
+    }
+    printf("%-8s max error %5.2f mA, mean %.3f mA over %u points; "
+           "compiled in %.1f us\n", name, max_err, sum_err / n, n,
+           compile_us);
+    CHECK(max_err <= ASSIST_TOL_MA);
+}
+
+static void bench_lookup(const tsdz2_assist_curve_t* c) {
+    enum { N = 1 << 20, ROUNDS = 10 };
+    static tsdz2_assist_table_t t;
+    static uint32_t torque[N];
+    static uint8_t cadence[N];
+    uint64_t sum = 0;
+
+    tsdz2_assist_compile(&t, c);
+    srand(1);
+    for (int i = 0; i < N; i++) {
+        torque[i] = rand() % TORQUE_MAX_MNM;
+        cadence[i] = rand() % CADENCE_MAX_RPM;
+    }
+    double start = host_test_now_ns();
+    for (int r = 0; r < ROUNDS; r++) {
+        for (int i = 0; i < N; i++) {
+            sum += tsdz2_assist_current_ma(&t, torque[i], cadence[i]);
+        }
+    }
+    double lookup_ns = (host_test_now_ns() - start) / ((double)N * ROUNDS);
+
+    double ref = 0;
+    start = host_test_now_ns();
+    for (int i = 0; i < N / 16; i++) {
+        ref += tsdz2_assist_reference_ma(c, torque[i], cadence[i]);
+    }
+    double ref_ns = (host_test_now_ns() - start) / (N / 16);
+    host_test_keep(sum + (uint64_t)ref);
+    printf("lookup %.2f ns (%.0f M evaluations/s), exact curve %.1f ns\n",
+           lookup_ns, 1e3 / lookup_ns, ref_ns);
+}
+
+/*** The characteristic. */
+
+static void test_characteristic(void) {
+    static assist_tables_t tables;
+    uint8_t buf[ASSIST_CURVE_MAX];
+    // Level 3, spline, 3 torque and 2 cadence knots: 0 Nm 0 mA, 80 Nm
+    // 8000 mA, 120 Nm 10000 mA; full gain from 0 to 120 rpm.
+    const uint8_t curve[] = {
+        3, 1, 3, 2,
+        0x00, 0x00, 0x00, 0x00,
+        0x20, 0x03, 0x40, 0x1f,
+        0xb0, 0x04, 0x10, 0x27,
+        0, 100, 120, 100,
+    };
+
+    assist_init();
+    assist_tables_refresh(&tables);
+    uint32_t version = tables.version;
+    CHECK(version != 0);
+    // Defaults: 8 A at 80 Nm for level 2, nothing when off.
+    CHECK_NEAR(assist_current_ma(&tables, 2, 80000, 60), 8000,
+               ASSIST_TOL_MA);
+    CHECK(assist_current_ma(&tables, 0, 80000, 60) == 0);
+    CHECK(assist_current_ma(&tables, 5, 80000, 60) == 0);
+
+    // Nothing changed: no recompile.
+    assist_tables_refresh(&tables);
+    CHECK(tables.version == version);
+
+    CHECK(assist_on_write(curve, sizeof(curve)) == 0);
+    CHECK(assist_on_read(buf) == sizeof(curve));
+    CHECK(memcmp(buf, curve, sizeof(curve)) == 0);
+    assist_tables_refresh(&tables);
+    CHECK(tables.version != version);
+    CHECK_NEAR(assist_current_ma(&tables, 3, 80000, 60), 8000,
+               ASSIST_TOL_MA);
+    CHECK(g_blob_len == sizeof(tsdz2_assist_curve_t) * TSDZ2_ASSIST_LEVELS);
+
+    // Rejected: knots out of order, cut short, no such level.
+    uint8_t bad[sizeof(curve)];
+    memcpy(bad, curve, sizeof(curve));
+    bad[8] = 0x00;
+    bad[9] = 0x00;
+    CHECK(assist_on_write(bad, sizeof(bad)) == BLE_ATT_ERR_VALUE_NOT_ALLOWED);
+    CHECK(assist_on_write(curve, 5) == BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN);
+    CHECK(assist_on_write((const uint8_t[]){ 5 }, 1) ==
+          BLE_ATT_ERR_VALUE_NOT_ALLOWED);
+
+    // The level byte alone selects what reads return.
+    CHECK(assist_on_write((const uint8_t[]){ 1 }, 1) == 0);
+    CHECK(assist_on_read(buf) == 4 + 3 * 4 + 4 * 2);
+    CHECK(buf[0] == 1);
+
+    // The console evaluates through the compiled tables too.
+    int ret = -1;
+    CHECK(esp_console_run("assist 3 80 60", &ret) == ESP_OK && ret == 0);
+}
+
+int main(void) {
+    check_curve("linear", &g_linear);
+    check_curve("spline 5", &g_spline5);
+    check_curve("spline 8", &g_spline8);
+    bench_lookup(&g_spline8);
+    test_characteristic();
+    return host_test_result("test_assist");
+}
@@ -0,0 +1,160 @@
+// Token buckets on a simulated clock, then a stress test: a discrete-event
+// model of the host task serving ATT writes in arrival order, with one
+// central flooding the LED characteristics and one writing a few times a
+// second. Prints the well-behaved central's latency with and without the
+// limits, at increasing flood rates.
+
+#include <math.h>
+#include <stdlib.h>
+#include "att_limit.h"
+#include "host_test.h"
+#include "esp_timer.h"
+#include "host/ble_hs.h"
+
+// Host task time per write: one served by the LED code, one answered with
+// an error before it got there.
+#define SERVE_US 400
+#define REJECT_US 5
+#define SIM_US 60000000
+#define FLOOD_CONN 1
+#define GOOD_CONN 2
+#define GOOD_HZ 5
+
+static int g_mbufs_free = 12;
+
+int os_msys_num_free(void) {
+    return g_mbufs_free;
+}
+
+static void test_buckets(void) {
+    int64_t now = 1000000;
+    int served = 0;
+
+    host_stub_set_time_us(now);
+    att_limit_init();
+    att_limit_on_connect(FLOOD_CONN);
+    // A burst straight away, then the configured rate.
+    for (int i = 0; i < 1000; i++) {
+        served += att_limit_access(FLOOD_CONN, true) == 0;
+    }
+    CHECK(served == CONFIG_APP_ATT_BURST);
+    for (int i = 0; i < 10000; i++) {
+        host_stub_set_time_us(now += 100);
+        served += att_limit_access(FLOOD_CONN, true) == 0;
+    }
+    CHECK_NEAR(served, CONFIG_APP_ATT_BURST + CONFIG_APP_ATT_WRITE_RATE, 1);
+    CHECK(att_limit_access(FLOOD_CONN, true) == BLE_ATT_ERR_INSUFFICIENT_RES);
+    // Reads have a bucket of their own.
+    CHECK(att_limit_access(FLOOD_CONN, false) == 0);
+    // As does every other connection, and unknown ones are not limited.
+    att_limit_on_connect(GOOD_CONN);
+    CHECK(att_limit_access(GOOD_CONN, true) == 0);
+    CHECK(att_limit_access(7, true) == 0);
+    att_limit_on_disconnect(FLOOD_CONN);
+    att_limit_on_disconnect(GOOD_CONN);
+
+    // Notifications: one shared pool, and nothing while mbufs are short.
+    att_limit_stats_t stats;
+    int sent = 0;
+    for (int i = 0; i < 100; i++) {
+        sent += att_limit_notify(i % 3);
+    }
+    CHECK(sent == CONFIG_APP_ATT_NOTIFY_BURST);
+    host_stub_set_time_us(now += 1000000);
+    g_mbufs_free = CONFIG_APP_ATT_MBUF_RESERVE;
+    CHECK(!att_limit_notify(0));
+    g_mbufs_free = 12;
+    CHECK(att_limit_notify(0));
+    att_limit_get_stats(&stats);
+    CHECK(stats.notifies == CONFIG_APP_ATT_NOTIFY_BURST + 1);
+    CHECK(stats.notifies_throttled == 100 - CONFIG_APP_ATT_NOTIFY_BURST);
+    CHECK(stats.notifies_low_mbuf == 1);
+}
+
+typedef struct {
+    int64_t at;
+    uint16_t conn;
+} write_t;
+
+static int cmp_write(const void* a, const void* b) {
+    int64_t x = ((const write_t*)a)->at;
+    int64_t y = ((const write_t*)b)->at;
+    return (x > y) - (x < y);
+}
+
+static int cmp_i64(const void* a, const void* b) {
+    int64_t x = *(const int64_t*)a;
+    int64_t y = *(const int64_t*)b;
+    return (x > y) - (x < y);
+}
+
+// Poisson arrivals at hz, appended to writes.
+static uint32_t arrivals(write_t* writes, uint32_t n, uint16_t conn,
+                         double hz) {
+    for (double t = 0; t < SIM_US;
+         t -= 1e6 / hz * log((rand() + 1.0) / (RAND_MAX + 2.0))) {
+        writes[n++] = (write_t){ .at = t, .conn = conn };
+    }
+    return n;
+}
+
+// Returns the good central's p99 latency in us.
+static int64_t stress(bool limit, uint32_t flood_hz) {
+    static write_t writes[SIM_US / 1000000 * 12000];
+    static int64_t latency[SIM_US / 1000000 * GOOD_HZ * 2];
+    uint32_t n = 0;
+    uint32_t n_lat = 0;
+    uint32_t throttled = 0;
+    int64_t busy_until = 0;
+
+    srand(flood_hz);
+    n = arrivals(writes, n, FLOOD_CONN, flood_hz);
+    n = arrivals(writes, n, GOOD_CONN, GOOD_HZ);
+    qsort(writes, n, sizeof(writes[0]), cmp_write);
+    if (limit) {
+        host_stub_set_time_us(0);
+        att_limit_on_connect(FLOOD_CONN);
+        att_limit_on_connect(GOOD_CONN);
+    }
+
+    // The host task serves one write at a time, in arrival order.
+    for (uint32_t i = 0; i < n; i++) {
+        int64_t start = writes[i].at > busy_until ? writes[i].at : busy_until;
+        host_stub_set_time_us(start);
+        int rc = limit ? att_limit_access(writes[i].conn, true) : 0;
+        busy_until = start + (rc ? REJECT_US : SERVE_US);
+        if (writes[i].conn == GOOD_CONN) {
+            CHECK(rc == 0);
+            latency[n_lat++] = busy_until - writes[i].at;
+        } else {
+            throttled += rc != 0;
+        }
+    }
+    if (limit) {
+        att_limit_on_disconnect(FLOOD_CONN);
+        att_limit_on_disconnect(GOOD_CONN);
+    }
+
+    qsort(latency, n_lat, sizeof(latency[0]), cmp_i64);
+    int64_t p99 = latency[n_lat * 99 / 100];
+    printf("flood %5u/s, %-9s good central p50 %8.2f p99 %8.2f max %8.2f ms"
+           ", flood %u%% throttled\n", flood_hz,
+           limit ? "limited:" : "unlimited:", latency[n_lat / 2] / 1e3,
+           p99 / 1e3, latency[n_lat - 1] / 1e3,
+           throttled * 100 / (n - n_lat));
+    return p99;
+}
+
+int main(void) {
+    static const uint32_t flood_hz[] = { 500, 2400, 10000 };
+
+    test_buckets();
+    for (int i = 0; i < 3; i++) {
+        int64_t unlimited = stress(false, flood_hz[i]);
+        int64_t limited = stress(true, flood_hz[i]);
+        // Bounded by a handful of writes ahead of it, whatever the flood.
+        CHECK(limited <= 5 * SERVE_US);
+        CHECK(limited <= unlimited);
+    }
+    return host_test_result("test_att_limit");
+}
@@ -0,0 +1,162 @@
+// SPSC ring edge cases, then the control path end to end: a producer
+// thread standing in for the host task calls ctrlSubmit() while the control
+// task drains the ring, once dropping on a full ring and once waiting for
+// room. Prints commands per second and queue depth.
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include "app_tasks.h"
+#include "ctrl_task.h"
+#include "host_test.h"
+#include "led_task.h"
+#include "spsc_ring.h"
+#include "freertos/task.h"
+
+#define BENCH_COMMANDS 1000000
+
+static void test_ring(void) {
+    uint32_t storage[4];
+    spsc_ring_t ring;
+    uint32_t v;
+
+    spsc_ring_init(&ring, storage, sizeof(uint32_t), 4);
+    CHECK(!spsc_ring_pop(&ring, &v));
+    // Run the indices past a wrap of the storage several times.
+    for (uint32_t i = 0; i < 10; i++) {
+        for (uint32_t j = 0; j < 4; j++) {
+            v = i * 4 + j;
+            CHECK(spsc_ring_push(&ring, &v));
+        }
+        v = 99;
+        CHECK(!spsc_ring_push(&ring, &v));
+        CHECK(spsc_ring_depth(&ring) == 4);
+        for (uint32_t j = 0; j < 4; j++) {
+            CHECK(spsc_ring_pop(&ring, &v) && v == i * 4 + j);
+        }
+    }
+    CHECK(ring.pushed == 40 && ring.dropped == 10 && ring.max_depth == 4);
+
+    // Free-running indices across the 32-bit wrap.
+    atomic_store(&ring.head, UINT32_MAX - 1);
+    atomic_store(&ring.tail, UINT32_MAX - 1);
+    for (v = 0; v < 3; v++) {
+        CHECK(spsc_ring_push(&ring, &v));
+    }
+    CHECK(spsc_ring_depth(&ring) == 3);
+    CHECK(spsc_ring_pop(&ring, &v) && v == 0);
+}
+
+static void test_validation(void) {
+    static const uint8_t bad[][6] = {
+        { 0x09 },                             // unknown opcode
+        { CTRL_OP_SET_RGB, 1, 2 },            // short
+        { CTRL_OP_SET_COLOR, NO_COLOR, 1 },   // no such color
+        { CTRL_OP_SET_DELAY, 0x61, 0xea, 0, 0 }, // 60001 ms
+    };
+    static const uint16_t bad_len[] = { 1, 3, 3, 5 };
+    ctrl_stats_t before;
+    ctrl_stats_t after;
+
+    getCtrlStats(&before);
+    for (int i = 0; i < 4; i++) {
+        CHECK(ctrlSubmit(bad[i], bad_len[i]) == CTRL_ERR_INVALID);
+    }
+    CHECK(ctrlSubmit(bad[0], 0) == CTRL_ERR_INVALID);
+    getCtrlStats(&after);
+    CHECK(after.invalid - before.invalid == 5);
+    CHECK(after.accepted == before.accepted);
+}
+
+static uint32_t g_last_accepted;
+
+// With arg set, waits for room instead of dropping, to find the rate the
+// control task sustains; otherwise drops on a full ring like the host task.
+static void* producer(void* arg) {
+    uint8_t cmd[4] = { CTRL_OP_SET_RGB };
+
+    for (uint32_t i = 0; i < BENCH_COMMANDS; i++) {
+        cmd[1] = i;
+        cmd[2] = i >> 8;
+        cmd[3] = i >> 16;
+        ctrl_status_t status;
+        while ((status = ctrlSubmit(cmd, sizeof(cmd))) == CTRL_ERR_FULL &&
+               arg != NULL) {
+            sched_yield();
+        }
+        if (status == CTRL_OK) {
+            g_last_accepted = i & 0xffffff;
+        }
+    }
+    return NULL;
+}
+
+static void bench_ring(void) {
+    uint8_t storage[APP_CTRL_QUEUE_LEN][APP_CTRL_CMD_SIZE];
+    uint8_t elem[APP_CTRL_CMD_SIZE] = { 0 };
+    spsc_ring_t ring;
+    const uint32_t n = 20000000;
+
+    spsc_ring_init(&ring, storage, APP_CTRL_CMD_SIZE, APP_CTRL_QUEUE_LEN);
+    double start = host_test_now_ns();
+    for (uint32_t i = 0; i < n; i++) {
+        elem[0] = i;
+        spsc_ring_push(&ring, elem);
+        spsc_ring_pop(&ring, elem);
+    }
+    double ns = (host_test_now_ns() - start) / n;
+    host_test_keep(elem[0]);
+    printf("ring push+pop, one thread: %.1f ns per command\n", ns);
+}
+
+static void bench_ctrl(bool wait) {
+    ctrl_stats_t stats;
+    pthread_t thread;
+
+    getCtrlStats(&stats);
+    uint32_t applied_before = stats.applied;
+    uint32_t accepted_before = stats.accepted;
+    uint32_t dropped_before = stats.dropped;
+    double start = host_test_now_ns();
+    pthread_create(&thread, NULL, producer, wait ? &thread : NULL);
+    pthread_join(thread, NULL);
+    do {
+        vTaskDelay(pdMS_TO_TICKS(1));
+        getCtrlStats(&stats);
+    } while (stats.applied - applied_before <
+             stats.accepted - accepted_before);
+    double seconds = (host_test_now_ns() - start) / 1e9;
+    uint32_t accepted = stats.accepted - accepted_before;
+    uint32_t dropped = stats.dropped - dropped_before;
+
+    printf("control path, %s: %.0f submits/s, %.0f applied/s, %u accepted, "
+           "%u refused (ring full), max depth %u/%u\n",
+           wait ? "producer waits for room" : "flood",
+           (accepted + dropped) / seconds,
+           (stats.applied - applied_before) / seconds, accepted, dropped,
+           stats.max_depth, APP_CTRL_QUEUE_LEN);
+    CHECK(wait ? accepted == BENCH_COMMANDS
+               : accepted + dropped == BENCH_COMMANDS);
+    CHECK(stats.applied - applied_before == accepted);
+    CHECK(stats.max_depth <= APP_CTRL_QUEUE_LEN);
+    // Applied in order, so the LEDs end up at the last accepted command.
+    CHECK((uint32_t)(getColor(RED) | getColor(GREEN) << 8 |
+                     getColor(BLUE) << 16) == g_last_accepted);
+}
+
+int main(void) {
+    test_ring();
+    initLedState();
+    initCtrl();
+    test_validation();
+    bench_ring();
+
+    static StackType_t stack[CONFIG_APP_CTRL_TASK_STACK_SIZE];
+    static StaticTask_t tcb;
+    xTaskCreateStaticPinnedToCore(runCtrlTask, "Control", sizeof(stack),
+                                  NULL, APP_CTRL_TASK_PRIO, stack, &tcb, 1);
+    vTaskDelay(pdMS_TO_TICKS(10));
+    bench_ctrl(false);
+    bench_ctrl(true);
+    return host_test_result("test_ctrl");
+}
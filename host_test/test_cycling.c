@@ -0,0 +1,220 @@
+// Cycling Power and CSC notifications on the simulated clock, without
+// sensors: "cycling sim" rates reach the measurements through the notify
+// timer and the revolution counts keep advancing between commands; every
+// subscriber gets the same encoding on one shared timer; the timer stops
+// with the last subscriber. Then the cost of a notify cycle by who is
+// subscribed, with malloc and memcpy standing in for the host's mbuf copy.
+
+#include <stdlib.h>
+#include <string.h>
+#include "cycling.h"
+#include "att_limit.h"
+#include "esp_console.h"
+#include "esp_timer.h"
+#include "host_test.h"
+#include "host/ble_hs.h"
+#include "os/endian.h"
+#include "subs.h"
+
+#define T0_US (1 << 20)
+#define PERIOD_US (1000000 / CONFIG_APP_CYCLING_NOTIFY_HZ)
+#define MAX_CONN 4
+
+/*** The host: notifications are recorded per connection. */
+
+struct os_mbuf {
+    uint16_t len;
+    uint8_t buf[32];
+};
+
+typedef struct {
+    uint32_t count;
+    int64_t last_us;
+    uint8_t last[32];
+    uint16_t len;
+} sent_t;
+
+static struct os_mbuf g_mbuf;
+static sent_t g_sent[MAX_CONN][GATT_SVR_CHR_COUNT];
+static bool g_bench;
+
+int os_msys_num_free(void) {
+    return 12;
+}
+
+uint16_t gatt_svr_chr_val_handle(enum gatt_svr_chr_id id) {
+    return 0x100 + id;
+}
+
+struct os_mbuf* ble_hs_mbuf_from_flat(const void* buf, uint16_t len) {
+    struct os_mbuf* om = g_bench ? malloc(sizeof(*om)) : &g_mbuf;
+    om->len = len;
+    memcpy(om->buf, buf, len);
+    return om;
+}
+
+int ble_gatts_notify_custom(uint16_t conn_handle, uint16_t att_handle,
+                            struct os_mbuf* om) {
+    if (g_bench) {
+        host_test_keep(om->buf[0]);
+        free(om);
+        return 0;
+    }
+    sent_t* s = &g_sent[conn_handle][att_handle - 0x100];
+    s->count++;
+    s->last_us = esp_timer_get_time();
+    s->len = om->len;
+    memcpy(s->last, om->buf, om->len);
+    return 0;
+}
+
+static void subscribe(uint16_t conn, enum gatt_svr_chr_id id, bool on) {
+    subs_on_subscribe(conn, gatt_svr_chr_val_handle(id), on, false);
+}
+
+static void console(const char* line) {
+    int ret = -1;
+    CHECK(esp_console_run(line, &ret) == ESP_OK && ret == 0);
+}
+
+static uint32_t csc_wheel_revs(const sent_t* s) {
+    return get_le32(s->last + 1);
+}
+
+static uint16_t csc_crank_revs(const sent_t* s) {
+    return get_le16(s->last + 7);
+}
+
+static void test_sim(void) {
+    const sent_t* csc = &g_sent[1][GATT_SVR_CHR_CSC_MEASUREMENT];
+    const sent_t* cp = &g_sent[2][GATT_SVR_CHR_CP_MEASUREMENT];
+
+    // 200 W, 90 rpm, 2 s a wheel revolution, set once.
+    console("cycling sim 200 90 2000");
+    subscribe(1, GATT_SVR_CHR_CSC_MEASUREMENT, true);
+    host_stub_run_until(T0_US + 10000000);
+
+    // One notification a period; the first sample starts the clock, the
+    // other 19 add 9.5 s: 14.25 crank and 4.75 wheel revolutions.
+    CHECK(csc->count == 20);
+    CHECK(csc->len == 11);
+    CHECK(csc->last[0] == 0x03);
+    CHECK(csc_crank_revs(csc) == 14);
+    CHECK(csc_wheel_revs(csc) == 4);
+    // Last crank revolution at 14 * 2/3 s after the first sample, in
+    // 1/1024 s.
+    CHECK_NEAR(get_le16(csc->last + 9),
+               (T0_US + PERIOD_US + 14 * 666666) * 1024.0 / 1e6, 1);
+
+    // A second connection on CP joins the same timer: both hear in the
+    // same callback, and CP carries the simulated power.
+    subscribe(2, GATT_SVR_CHR_CP_MEASUREMENT, true);
+    host_stub_run_until(T0_US + 15000000);
+    CHECK(csc->count == 30);
+    CHECK(cp->count == 10);
+    CHECK(cp->last_us == csc->last_us);
+    CHECK(get_le16(cp->last + 2) == 200);
+    CHECK(get_le16(cp->last + 10) == csc_crank_revs(csc));
+    CHECK(get_le32(cp->last + 4) == csc_wheel_revs(csc));
+    CHECK(g_sent[1][GATT_SVR_CHR_CP_MEASUREMENT].count == 0);
+    CHECK(g_sent[2][GATT_SVR_CHR_CSC_MEASUREMENT].count == 0);
+
+    // Stopped: no power, the counts hold.
+    console("cycling sim off");
+    host_stub_run_until(T0_US + 15500000);
+    uint16_t crank = csc_crank_revs(csc);
+    uint32_t wheel = csc_wheel_revs(csc);
+    host_stub_run_until(T0_US + 20000000);
+    CHECK(get_le16(cp->last + 2) == 0);
+    CHECK(csc_crank_revs(csc) == crank);
+    CHECK(csc_wheel_revs(csc) == wheel);
+
+    cycling_stats_t stats;
+    cycling_get_stats(&stats);
+    CHECK(stats.subscribers == 2);
+    CHECK(stats.csc_sent == 40);
+    CHECK(stats.cp_sent == 20);
+    CHECK(stats.failed == 0);
+
+    // The last subscriber leaves: the timer stops.
+    subscribe(1, GATT_SVR_CHR_CSC_MEASUREMENT, false);
+    subs_on_disconnect(2);
+    host_stub_run_until(T0_US + 30000000);
+    CHECK(csc->count == 40);
+    CHECK(cp->count == 20);
+    printf("sim: %u CSC and %u CP notifications, %u crank and %u wheel "
+           "revolutions\n", csc->count, cp->count, crank, wheel);
+}
+
+static void empty_cb(void* arg) {}
+
+// Simulated time spent running n periods of whatever timers are started.
+static double run_periods_ns(int64_t* now, int n) {
+    double start = host_test_now_ns();
+    *now += (int64_t)n * PERIOD_US;
+    host_stub_run_until(*now);
+    return host_test_now_ns() - start;
+}
+
+static void bench_cycle(void) {
+    static const struct {
+        const char* name;
+        int cp;
+        int csc;
+    } cases[] = {
+        { "no subscribers", 0, 0 },
+        { "CSC only, 1 connection", 0, 1 },
+        { "both, 1 connection", 1, 1 },
+        { "both, 3 connections", 3, 3 },
+    };
+    enum { N = 200000 };
+    int64_t now = T0_US + 40000000;
+    esp_timer_handle_t empty;
+    const esp_timer_create_args_t args = { .callback = empty_cb };
+
+    g_bench = true;
+    console("cycling sim 250 85 1900");
+    // What the host stub takes to fire a timer, taken off the rest.
+    CHECK(esp_timer_create(&args, &empty) == ESP_OK);
+    esp_timer_start_periodic(empty, PERIOD_US);
+    double dispatch_ns = run_periods_ns(&now, N) / N;
+    esp_timer_stop(empty);
+
+    printf("notify cycle (timer dispatch of %.0f ns taken off):\n",
+           dispatch_ns);
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        cycling_stats_t before;
+        cycling_stats_t after;
+        for (int c = 1; c <= 3; c++) {
+            subscribe(c, GATT_SVR_CHR_CP_MEASUREMENT, c <= cases[i].cp);
+            subscribe(c, GATT_SVR_CHR_CSC_MEASUREMENT, c <= cases[i].csc);
+        }
+        cycling_get_stats(&before);
+        double ns = run_periods_ns(&now, N) / N;
+        cycling_get_stats(&after);
+        bool idle = cases[i].cp + cases[i].csc == 0;
+        printf("  %-24s %6.1f ns\n", cases[i].name,
+               idle ? ns : ns - dispatch_ns);
+        CHECK(after.cp_sent - before.cp_sent == (uint32_t)N * cases[i].cp);
+        CHECK(after.csc_sent - before.csc_sent ==
+              (uint32_t)N * cases[i].csc);
+        // With nobody subscribed the timer is stopped: nothing runs.
+        if (idle) {
+            CHECK(ns < dispatch_ns);
+        }
+    }
+    for (int c = 1; c <= 3; c++) {
+        subs_on_disconnect(c);
+    }
+    g_bench = false;
+}
+
+int main(void) {
+    host_stub_set_time_us(T0_US);
+    subs_init();
+    att_limit_init();
+    cycling_init();
+    test_sim();
+    bench_cycle();
+    return host_test_result("test_cycling");
+}
@@ -0,0 +1,171 @@
+// Topic semantics (order, overrun, latest), then publish and consume cost
+// on one thread and end to end with one and four reader threads, checking
+// that no reader ever accepts a torn or out-of-order event.
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include "evbus.h"
+#include "host_test.h"
+
+#define BENCH_EVENTS 20000000u
+#define THREAD_EVENTS 2000000u
+#define BATCH 32
+
+// LED settings sized, with a check field that is only right if the event
+// was read whole.
+typedef struct {
+    uint8_t r, g, b;
+    uint32_t n;
+    int64_t check;
+} bench_ev_t;
+
+EVBUS_TOPIC_DEFINE(bench_topic, bench_ev_t, 64);
+EVBUS_TOPIC_DECLARE(bench_topic, bench_ev_t);
+
+EVBUS_TOPIC_DEFINE(small_topic, uint32_t, 4);
+EVBUS_TOPIC_DECLARE(small_topic, uint32_t);
+
+static void test_topic(void) {
+    evbus_reader_t a;
+    evbus_reader_t b;
+    uint32_t v;
+
+    CHECK(!small_topic_latest(&v));
+    evbus_reader_init(&a, &small_topic);
+    for (v = 1; v <= 3; v++) {
+        small_topic_publish(&v);
+    }
+    evbus_reader_init(&b, &small_topic);
+    CHECK(small_topic_read(&a, &v) && v == 1);
+    // b starts after what was already there.
+    CHECK(!small_topic_read(&b, &v));
+
+    // a is two behind; eight more overrun the four slots.
+    for (v = 4; v <= 11; v++) {
+        small_topic_publish(&v);
+    }
+    CHECK(small_topic_read(&a, &v) && v == 8);
+    CHECK(a.lost == 6);
+    CHECK(small_topic_read(&b, &v) && v == 8 && b.lost == 4);
+    CHECK(small_topic_latest(&v) && v == 11);
+    CHECK(evbus_published(&small_topic) == 11);
+
+    // An event overwritten while peeked is reported, not handed over.
+    const uint32_t* p = small_topic_peek(&a);
+    CHECK(p != NULL && *p == 9);
+    for (v = 12; v <= 15; v++) {
+        small_topic_publish(&v);
+    }
+    CHECK(!evbus_done(&a));
+}
+
+static void publish(uint32_t n) {
+    bench_ev_t ev = { 1, 2, 3, n, (int64_t)n * 3 };
+    bench_topic_publish(&ev);
+}
+
+static void bench_single_thread(void) {
+    evbus_reader_t r;
+    const bench_ev_t* p;
+    uint64_t sum = 0;
+    uint32_t consumed = 0;
+    uint32_t n = 0;
+    double consume_ns = 0;
+
+    double start = host_test_now_ns();
+    while (n < BENCH_EVENTS) {
+        publish(++n);
+    }
+    double publish_ns = (host_test_now_ns() - start) / BENCH_EVENTS;
+
+    evbus_reader_init(&r, &bench_topic);
+    for (uint32_t i = 0; i < BENCH_EVENTS / BATCH; i++) {
+        for (int k = 0; k < BATCH; k++) {
+            publish(++n);
+        }
+        start = host_test_now_ns();
+        while ((p = bench_topic_peek(&r)) != NULL) {
+            sum += p->n;
+            consumed += evbus_done(&r);
+        }
+        consume_ns += host_test_now_ns() - start;
+    }
+    host_test_keep(sum);
+    CHECK(consumed == BENCH_EVENTS && r.lost == 0);
+    printf("one thread: publish %.1f ns/event, consume in place %.1f "
+           "ns/event\n", publish_ns, consume_ns / consumed);
+}
+
+typedef struct {
+    evbus_reader_t r;
+    uint32_t got;
+    uint32_t bad;
+} reader_t;
+
+static uint32_t g_end; // number of the last event to publish, plus 1
+static atomic_int g_ready;
+
+static void* reader_main(void* arg) {
+    reader_t* rd = arg;
+    const bench_ev_t* e;
+    uint32_t last = 0;
+
+    evbus_reader_init(&rd->r, &bench_topic);
+    atomic_fetch_add(&g_ready, 1);
+    while (rd->r.next != g_end) {
+        while ((e = bench_topic_peek(&rd->r)) != NULL) {
+            uint32_t n = e->n;
+            int64_t check = e->check;
+            if (evbus_done(&rd->r)) {
+                rd->got++;
+                rd->bad += check != (int64_t)n * 3 || n <= last;
+                last = n;
+            }
+        }
+        sched_yield();
+    }
+    return NULL;
+}
+
+static void bench_threads(int readers) {
+    reader_t rd[4] = { 0 };
+    pthread_t threads[4];
+    uint32_t base = evbus_published(&bench_topic);
+
+    g_end = base + THREAD_EVENTS;
+    atomic_store(&g_ready, 0);
+    for (int i = 0; i < readers; i++) {
+        pthread_create(&threads[i], NULL, reader_main, &rd[i]);
+    }
+    while (atomic_load(&g_ready) < readers) {
+        sched_yield();
+    }
+    double start = host_test_now_ns();
+    for (uint32_t i = 1; i <= THREAD_EVENTS; i++) {
+        publish(base + i);
+        // Give readers a chance on a host with fewer cores than threads.
+        if (i % BATCH == 0) {
+            sched_yield();
+        }
+    }
+    double ns = (host_test_now_ns() - start) / THREAD_EVENTS;
+
+    printf("%d reader thread(s): %.1f ns/event published", readers, ns);
+    for (int i = 0; i < readers; i++) {
+        pthread_join(threads[i], NULL);
+        printf(" | got %.1f%% lost %u", 100.0 * rd[i].got / THREAD_EVENTS,
+               rd[i].r.lost);
+        CHECK(rd[i].bad == 0);
+        CHECK(rd[i].got + rd[i].r.lost == THREAD_EVENTS);
+    }
+    printf("\n");
+}
+
+int main(void) {
+    test_topic();
+    bench_single_thread();
+    bench_threads(1);
+    bench_threads(4);
+    return host_test_result("test_evbus");
+}
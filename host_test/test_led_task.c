@@ -0,0 +1,154 @@
+// Frame scheduler arithmetic, then the LED task itself against the mock
+// strip on the simulated clock: frame times with a slow refresh, latency of
+// a color change, and frames dropped when the refresh overruns the period.
+
+#include <string.h>
+#include "frame_sched.h"
+#include "host_test.h"
+#include "led_strip.h"
+#include "led_task.h"
+#include "esp_timer.h"
+#include "freertos/task.h"
+
+static void test_sched_on_time(void) {
+    frame_sched_t sched;
+    frame_stats_t stats;
+    static const int jitter[] = { 0, 30, -20, 10, 0, -40, 25, 5 };
+    int64_t now = 1000;
+
+    frame_sched_init(&sched, 10000, now);
+    for (int i = 0; i < 8; i++) {
+        frame_sched_frame_start(&sched, now + jitter[i]);
+        int64_t wait = frame_sched_wait_us(&sched, now + jitter[i] + 500);
+        CHECK(wait == 10000 - jitter[i] - 500);
+        now += 10000;
+    }
+    frame_sched_get_stats(&sched, &stats);
+    CHECK(stats.frames == 8);
+    CHECK(stats.missed == 0);
+    CHECK(stats.jitter_max_us == 40);
+    CHECK(stats.period_min_us == 10000 - 50);
+    CHECK(stats.period_max_us == 10000 + 65);
+    // Deadlines stay on the original grid whatever the jitter.
+    CHECK(sched.deadline == 1000 + 8 * 10000);
+}
+
+static void test_sched_overrun(void) {
+    frame_sched_t sched;
+    frame_stats_t stats;
+
+    frame_sched_init(&sched, 10000, 1000);
+    frame_sched_frame_start(&sched, 1000);
+    // 35 ms late: the frames due at 11, 21 and 31 ms are lost, the next is
+    // at 41 ms, on the same phase.
+    CHECK(frame_sched_wait_us(&sched, 36000) == 5000);
+    frame_sched_frame_start(&sched, 41000);
+    frame_sched_get_stats(&sched, &stats);
+    CHECK(stats.missed == 3);
+    CHECK(stats.period_max_us == 40000);
+
+    // A period change re-anchors at now and does not count as a period.
+    frame_sched_set_period(&sched, 2000, 42000);
+    CHECK(frame_sched_wait_us(&sched, 42000) == 2000 + 2000);
+    frame_sched_reset_stats(&sched);
+    frame_sched_get_stats(&sched, &stats);
+    CHECK(stats.frames == 0 && stats.missed == 0);
+}
+
+// Checks that the strip refreshes from frame first on ended period_us apart,
+// starting at at, and showed rgb if it is not NULL.
+static void check_refreshes(uint32_t first, uint32_t n, int64_t at,
+                            uint32_t period_us, const uint8_t* rgb) {
+    mock_strip_frame_t f;
+    uint32_t bad = 0;
+
+    for (uint32_t i = 0; i < n; i++) {
+        if (!mock_strip_frame(first + i, &f) ||
+            f.at != at + (int64_t)i * period_us ||
+            (rgb != NULL && memcmp(f.rgb, rgb, 3) != 0)) {
+            bad++;
+        }
+    }
+    CHECK(bad == 0);
+}
+
+// The LED task on the simulated clock: the frame timer fires exactly at
+// each deadline and a refresh takes exactly its mock time, so frame counts,
+// periods and latencies are exact whatever the host is doing.
+static void test_led_task(void) {
+    static StackType_t stack[CONFIG_APP_LED_TASK_STACK_SIZE];
+    static StaticTask_t tcb;
+    static const uint8_t rgb[3] = { 10, 20, 30 };
+    const int64_t t0 = 1000000;
+    frame_stats_t stats;
+    lat_summary_t lat;
+    uint32_t superseded;
+
+    // A refresh that takes a fifth of the period: the old vTaskDelay()
+    // loop would have run at 12 ms instead of 10.
+    host_stub_set_time_us(t0);
+    mock_strip_set_refresh_us(2000);
+    initLedState();
+    setDelay(10, t0);
+    xTaskCreateStaticPinnedToCore(runLedTask, "Rainbow LED",
+                                  sizeof(stack), NULL, 1, stack, &tcb, 1);
+    host_stub_run_until(t0 + 2000000);
+
+    // A frame starts on every 10 ms deadline from t0 to t0 + 2 s.
+    CHECK(mock_strip_frames() == 201);
+    check_refreshes(0, 201, t0 + 2000, 10000, NULL);
+    getLedFrameStats(&stats);
+    printf("rainbow at 10 ms, 2 ms refresh: %u frames, period min/avg/max "
+           "%u/%u/%u us, jitter max %u us, missed %u\n", stats.frames,
+           stats.period_min_us, stats.period_avg_us, stats.period_max_us,
+           stats.jitter_max_us, stats.missed);
+    CHECK(stats.frames == 201 && stats.missed == 0);
+    CHECK(stats.period_min_us == 10000 && stats.period_avg_us == 10000 &&
+          stats.period_max_us == 10000);
+    CHECK(stats.jitter_max_us == 0);
+
+    // Static color, written 8 ms before the next frame: that frame shows it
+    // and the period becomes STATIC_PERIOD_MS from there.
+    int64_t now = esp_timer_get_time();
+    CHECK(now == t0 + 2002000);
+    resetLedLatency();
+    setColors(rgb[0], rgb[1], rgb[2], now);
+    setDelay(0, now);
+    host_stub_run_until(t0 + 3012000);
+    CHECK(mock_strip_frames() == 201 + 11);
+    check_refreshes(201, 1, t0 + 2012000, 0, rgb);
+    check_refreshes(202, 10, t0 + 2114000, 100000, rgb);
+    CHECK(getColor(GREEN) == 20);
+
+    // Both writes land in one frame: one is superseded, the other is shown
+    // 8 ms to the deadline plus 2 ms of refresh after it was written.
+    getLedLatency(&lat, &superseded);
+    printf("write-to-refresh latency: n %u max %u us, superseded %u\n",
+           lat.count, lat.max, superseded);
+    CHECK(lat.count == 1 && lat.max == 10000 && superseded == 1);
+
+    // A refresh longer than the period: every frame misses the next two
+    // deadlines and the task stays on the 10 ms grid, 30 ms apart.
+    mock_strip_set_refresh_us(25000);
+    setDelay(10, esp_timer_get_time());
+    host_stub_run_until(t0 + 3500000);
+    frame_stats_t before;
+    getLedFrameStats(&before);
+    uint32_t first = mock_strip_frames();
+    mock_strip_frame_t f;
+    CHECK(mock_strip_frame(first - 1, &f));
+    host_stub_run_until(t0 + 3800000);
+    getLedFrameStats(&stats);
+    printf("25 ms refresh at 10 ms: %u frames, %u missed in 300 ms\n",
+           stats.frames - before.frames, stats.missed - before.missed);
+    CHECK(stats.frames - before.frames == 10);
+    CHECK(stats.missed - before.missed == 20);
+    check_refreshes(first, 10, f.at + 30000, 30000, NULL);
+}
+
+int main(void) {
+    test_sched_on_time();
+    test_sched_overrun();
+    test_led_task();
+    return host_test_result("test_led_task");
+}
@@ -0,0 +1,302 @@
+// LZSS round trips on a synthetic 1 h ride log at 10 Hz (binary records
+// and the same as CSV), a console log and random bytes, fed through in
+// random pieces into random output buffers on both sides; the C encoder's
+// streams decoded by tools/lzss.py and the reverse; then ratio, speed and
+// the RAM each side needs. Run from host_test/, as make does.
+
+#include <stdlib.h>
+#include <string.h>
+#include "lzss.h"
+#include "host_test.h"
+#include "os/endian.h"
+
+#define RECORDS 36000
+#define RECORD_LEN 18
+#define MAX_DATA (2 * 1024 * 1024)
+#define MAX_PIECE 300
+#define MAX_CAP 244
+#define PY "python3 ../tools/lzss.py"
+
+typedef struct {
+    const char* name;
+    uint8_t* data;
+    size_t len;
+    double min_ratio;     // 0: incompressible
+} dataset_t;
+
+static uint8_t g_comp[MAX_DATA + MAX_DATA / 8 + 16];
+static uint8_t g_out[MAX_DATA];
+
+static size_t rand_between(size_t lo, size_t hi) {
+    return lo + (size_t)rand() % (hi - lo + 1);
+}
+
+/*** Inputs. */
+
+// Slowly varying rider and motor values with sensor noise.
+typedef struct {
+    uint32_t t_ms;
+    uint16_t speed_dkmh;
+    uint8_t cadence;
+    uint16_t power_w;
+    uint16_t battery_mv;
+    uint16_t current_ma;
+    uint8_t temp_c;
+    uint8_t level;
+    uint16_t torque_dnm;
+    uint8_t flags;
+} ride_rec_t;
+
+static void ride_step(ride_rec_t* r, int i) {
+    int phase = i / 600 % 6; // a minute of each: climb, cruise, stop...
+    static const int target_kmh[] = { 14, 25, 25, 0, 32, 18 };
+    int target = target_kmh[phase] * 10;
+    r->t_ms = i * 100;
+    r->speed_dkmh += (target > r->speed_dkmh) - (target < r->speed_dkmh) +
+                     (rand() % 3 - 1) * (r->speed_dkmh > 0);
+    r->cadence = r->speed_dkmh ? 70 + rand() % 20 : 0;
+    r->torque_dnm = r->cadence ? 150 + phase * 40 + rand() % 60 : 0;
+    r->power_w = r->torque_dnm * r->cadence / 95;
+    r->level = phase == 0 ? 3 : 2;
+    r->current_ma = r->torque_dnm * r->level * 9 + rand() % 50;
+    r->battery_mv = 52000 - i / 10 - r->current_ma / 100;
+    r->temp_c = 25 + i / 2000;
+    r->flags = r->speed_dkmh == 0;
+}
+
+static size_t make_records(uint8_t* p) {
+    ride_rec_t r = { 0 };
+    for (int i = 0; i < RECORDS; i++) {
+        ride_step(&r, i);
+        uint8_t* q = p + i * RECORD_LEN;
+        put_le32(q, r.t_ms);
+        put_le16(q + 4, r.speed_dkmh);
+        q[6] = r.cadence;
+        put_le16(q + 7, r.power_w);
+        put_le16(q + 9, r.battery_mv);
+        put_le16(q + 11, r.current_ma);
+        q[13] = r.temp_c;
+        q[14] = r.level;
+        put_le16(q + 15, r.torque_dnm);
+        q[17] = r.flags;
+    }
+    return RECORDS * RECORD_LEN;
+}
+
+static size_t make_csv(uint8_t* p) {
+    ride_rec_t r = { 0 };
+    size_t n = sprintf((char*)p, "t_ms,speed_kmh,cadence,power_w,battery_mv,"
+                       "current_ma,temp_c,level,torque_nm,flags\n");
+    for (int i = 0; i < RECORDS; i++) {
+        ride_step(&r, i);
+        n += sprintf((char*)p + n, "%u,%u.%u,%u,%u,%u,%u,%u,%u,%u.%u,%u\n",
+                     r.t_ms, r.speed_dkmh / 10, r.speed_dkmh % 10, r.cadence,
+                     r.power_w, r.battery_mv, r.current_ma, r.temp_c, r.level,
+                     r.torque_dnm / 10, r.torque_dnm % 10, r.flags);
+    }
+    return n;
+}
+
+// What the firmware's console prints over an hour of riding.
+static size_t make_console_log(uint8_t* p) {
+    size_t n = 0;
+    uint32_t ms = 812;
+    for (int i = 0; n < 300 * 1024; i++) {
+        ms += 50 + rand() % 900;
+        switch (rand() % 8) {
+        case 0:
+            n += sprintf((char*)p + n, "I (%u) GATT: subscribe event; "
+                         "conn_handle=%d attr_handle=%d reason=1 "
+                         "prevn=0 curn=1 previ=0 curi=0\n", ms, 1 + rand() % 3,
+                         20 + rand() % 30);
+            break;
+        case 1:
+            n += sprintf((char*)p + n, "I (%u) PROXY: motor frame %u bytes, "
+                         "%u us\n", ms, 9, 400 + rand() % 200);
+            break;
+        case 2:
+            n += sprintf((char*)p + n, "W (%u) ATT_LIMIT: conn %d: read "
+                         "throttled\n", ms, 1 + rand() % 3);
+            break;
+        case 3:
+            n += sprintf((char*)p + n, "I (%u) CYCLING: subscribers %d sent "
+                         "cp %d csc %d failed 0\n", ms, 1 + rand() % 2, i, i);
+            break;
+        default:
+            n += sprintf((char*)p + n, "I (%u) LED: color %d %d %d delay %d "
+                         "latency %d us\n", ms, rand() % 256, rand() % 256,
+                         rand() % 256, 100 * (1 + rand() % 10),
+                         900 + rand() % 400);
+            break;
+        }
+    }
+    return n;
+}
+
+static size_t make_random(uint8_t* p) {
+    const size_t len = 256 * 1024;
+    for (size_t i = 0; i < len; i++) {
+        p[i] = rand();
+    }
+    return len;
+}
+
+/*** Streaming in pieces. */
+
+// Compresses in input pieces of 1..max_piece bytes into output buffers of
+// 2..max_cap; returns the stream length.
+static size_t compress(const uint8_t* data, size_t len, uint8_t* comp,
+                       size_t max_piece, size_t max_cap) {
+    static lzss_enc_t e;
+    size_t clen = 0;
+    size_t off = 0;
+    size_t n;
+
+    lzss_enc_init(&e);
+    do {
+        size_t piece = rand_between(1, max_piece);
+        if (piece > len - off) {
+            piece = len - off;
+        }
+        const uint8_t* in = data + off;
+        size_t in_len = piece;
+        bool finish = off + piece == len;
+        do {
+            n = lzss_enc_run(&e, &in, &in_len, comp + clen,
+                             rand_between(2, max_cap), finish);
+            clen += n;
+        } while (n > 0 || in_len > 0);
+        off += piece;
+    } while (off < len);
+    return clen;
+}
+
+static size_t decompress(const uint8_t* comp, size_t clen, uint8_t* out,
+                         size_t max_piece, size_t max_cap) {
+    static lzss_dec_t d;
+    size_t len = 0;
+    size_t off = 0;
+    size_t n;
+
+    lzss_dec_init(&d);
+    while (off < clen) {
+        size_t piece = rand_between(1, max_piece);
+        if (piece > clen - off) {
+            piece = clen - off;
+        }
+        const uint8_t* in = comp + off;
+        size_t in_len = piece;
+        do {
+            n = lzss_dec_run(&d, &in, &in_len, out + len,
+                             rand_between(1, max_cap));
+            len += n;
+        } while (n > 0 || in_len > 0);
+        off += piece;
+    }
+    return len;
+}
+
+static void test_round_trip(const dataset_t* ds) {
+    for (int round = 0; round < 3; round++) {
+        size_t clen = compress(ds->data, ds->len, g_comp, MAX_PIECE, MAX_CAP);
+        size_t len = decompress(g_comp, clen, g_out, MAX_PIECE, MAX_CAP);
+        CHECK(len == ds->len && memcmp(g_out, ds->data, len) == 0);
+    }
+    // A stream is the same however it was cut up.
+    size_t a = compress(ds->data, ds->len, g_comp, 1, 2);
+    static uint8_t whole[sizeof(g_comp)];
+    size_t b = compress(ds->data, ds->len, whole, ds->len, sizeof(whole));
+    CHECK(a == b && memcmp(g_comp, whole, a) == 0);
+}
+
+/*** tools/lzss.py. */
+
+static bool run_tool(const char* args, const uint8_t* in, size_t in_len,
+                     uint8_t* out, size_t cap, size_t* out_len) {
+    char cmd[256];
+    const char* path = "build/lzss_tool_in";
+    FILE* f = fopen(path, "wb");
+    if (f == NULL) {
+        return false;
+    }
+    fwrite(in, 1, in_len, f);
+    fclose(f);
+    snprintf(cmd, sizeof(cmd), PY " %s %s", args, path);
+    FILE* p = popen(cmd, "r");
+    if (p == NULL) {
+        return false;
+    }
+    *out_len = fread(out, 1, cap, p);
+    return pclose(p) == 0;
+}
+
+static void test_python(const dataset_t* ds) {
+    size_t clen = compress(ds->data, ds->len, g_comp, MAX_PIECE, MAX_CAP);
+    size_t len;
+    CHECK(run_tool("", g_comp, clen, g_out, sizeof(g_out), &len));
+    CHECK(len == ds->len && memcmp(g_out, ds->data, len) == 0);
+}
+
+// The reference encoder is slow; a few KB of each kind.
+static void test_python_encoder(const dataset_t* ds) {
+    size_t in_len = ds->len < 2048 ? ds->len : 2048;
+    size_t clen;
+    CHECK(run_tool("-c", ds->data, in_len, g_comp, sizeof(g_comp), &clen));
+    size_t len = decompress(g_comp, clen, g_out, MAX_PIECE, MAX_CAP);
+    CHECK(len == in_len && memcmp(g_out, ds->data, len) == 0);
+}
+
+/*** Numbers. */
+
+static void bench(const dataset_t* ds) {
+    double enc_ns = 1e30;
+    double dec_ns = 1e30;
+    size_t clen = 0;
+
+    for (int i = 0; i < 5; i++) {
+        double start = host_test_now_ns();
+        clen = compress(ds->data, ds->len, g_comp, 4096, 4096);
+        double mid = host_test_now_ns();
+        decompress(g_comp, clen, g_out, 4096, 4096);
+        double end = host_test_now_ns();
+        enc_ns = mid - start < enc_ns ? mid - start : enc_ns;
+        dec_ns = end - mid < dec_ns ? end - mid : dec_ns;
+    }
+    printf("  %-16s %8zu B  ratio %5.2f  compress %6.1f MB/s  "
+           "decompress %6.1f MB/s\n", ds->name, ds->len,
+           (double)ds->len / clen, ds->len / (enc_ns / 1e3),
+           ds->len / (dec_ns / 1e3));
+    if (ds->min_ratio == 0) {
+        // Nothing to find: a literal is 9 bits.
+        CHECK(clen <= ds->len * 9 / 8 + 1);
+    } else {
+        CHECK((double)ds->len / clen >= ds->min_ratio);
+    }
+}
+
+int main(void) {
+    static uint8_t records[RECORDS * RECORD_LEN];
+    static uint8_t csv[MAX_DATA];
+    static uint8_t log[MAX_DATA];
+    static uint8_t random[MAX_DATA];
+    dataset_t sets[4];
+
+    srand(1);
+    sets[0] = (dataset_t){ "18-byte records", records, make_records(records),
+                           1.3 };
+    sets[1] = (dataset_t){ "the same as CSV", csv, make_csv(csv), 2.4 };
+    sets[2] = (dataset_t){ "console log", log, make_console_log(log), 3 };
+    sets[3] = (dataset_t){ "random", random, make_random(random), 0 };
+
+    for (int i = 0; i < 4; i++) {
+        test_round_trip(&sets[i]);
+        test_python(&sets[i]);
+        test_python_encoder(&sets[i]);
+    }
+    printf("lzss, best of 5 (1 KiB window; state %zu B to compress, %zu B "
+           "to decompress):\n", sizeof(lzss_enc_t), sizeof(lzss_dec_t));
+    for (int i = 0; i < 4; i++) {
+        bench(&sets[i]);
+    }
+    return host_test_result("test_lzss");
+}
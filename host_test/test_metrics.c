@@ -0,0 +1,149 @@
+// tsdz2_metrics.h against a double-precision reference over the full input
+// ranges, then conversions per second for a mixed motor packet.
+
+#include <math.h>
+#include "host_test.h"
+#include "tsdz2_metrics.h"
+
+#define BENCH_SAMPLES 50000000
+
+static tsdz2_metrics_t g_m;
+
+// TSDZ2 defaults: 700c x 2.1" wheel, 250 kHz period counter, 13S pack.
+static const tsdz2_calib_t g_calib = {
+    .wheel_circumference_mm = 2100,
+    .wheel_tick_hz = 250000,
+    .torque_adc_offset = 150,
+    .torque_mnm_per_step = 556,
+    .battery_uv_per_step = 86600,
+    .current_ua_per_step = 160000,
+    .battery_cells = 13,
+};
+
+static void test_recip(void) {
+    double max_rel = 0;
+
+    for (uint64_t d = 2; d <= UINT32_MAX; d += d < 1000000 ? 1 : d / 997) {
+        double exact = 4294967296.0 / d;
+        double rel = fabs(tsdz2_recip32(d) - exact) / exact;
+        // Below 2^20 the truncation to an integer dominates.
+        if (exact > 1 << 20 && rel > max_rel) {
+            max_rel = rel;
+        }
+    }
+    printf("reciprocal: max relative error %.2g\n", max_rel);
+    CHECK(max_rel < 1.0 / (1 << 15));
+    CHECK(tsdz2_recip32(0) == UINT32_MAX && tsdz2_recip32(1) == UINT32_MAX);
+}
+
+// Worst error in km/h x10 over every period, against the exact speed
+// saturated at UINT16_MAX.
+static double speed_error(uint16_t circumference_mm, uint32_t tick_hz) {
+    tsdz2_calib_t c = g_calib;
+    double max_err = 0;
+
+    c.wheel_circumference_mm = circumference_mm;
+    c.wheel_tick_hz = tick_hz;
+    tsdz2_metrics_configure(&g_m, &c);
+    for (uint32_t t = 1; t < UINT16_MAX; t++) {
+        double exact = circumference_mm / 1e6 / (t / (double)tick_hz) * 36000;
+        double err = fabs(tsdz2_speed_kmh_x10(&g_m, t) - fmin(exact, UINT16_MAX));
+        // Rounding, plus the reciprocal's relative error.
+        err -= fmin(exact, UINT16_MAX) / (1 << 15);
+        if (err > max_err) {
+            max_err = err;
+        }
+    }
+    return max_err;
+}
+
+static void test_speed(void) {
+    static const uint32_t tick_hz[] = { 250000, 1000000, 16000000, 80000000 };
+
+    for (int i = 0; i < 4; i++) {
+        double err = speed_error(2300, tick_hz[i]);
+        printf("speed, %u Hz tick: max error %.2f km/h x10 beyond the "
+               "reciprocal's\n", tick_hz[i], err);
+        CHECK(err <= 0.5);
+    }
+    // At 80 MHz speed_k needs 33 bits; every 16-bit period is then faster
+    // than UINT16_MAX and must saturate rather than wrap.
+    CHECK(tsdz2_speed_kmh_x10(&g_m, 60000) == UINT16_MAX);
+    // Stopped: no pulse yet, or the counter saturated.
+    CHECK(tsdz2_speed_kmh_x10(&g_m, 0) == 0);
+    CHECK(tsdz2_speed_kmh_x10(&g_m, UINT16_MAX) == 0);
+}
+
+static void test_power(void) {
+    double max_human = 0;
+    double max_motor = 0;
+
+    tsdz2_metrics_configure(&g_m, &g_calib);
+    CHECK(tsdz2_torque_mnm(&g_m, 100) == 0);
+    CHECK(tsdz2_torque_mnm(&g_m, 160) == 10 * 556);
+    for (uint32_t mnm = 0; mnm < 200000; mnm += 997) {
+        for (uint32_t rpm = 0; rpm < 256; rpm++) {
+            double exact = mnm / 1000.0 * rpm * 2 * M_PI / 60;
+            double err = fabs(tsdz2_human_power_w(&g_m, mnm, rpm) -
+                              fmin(exact, UINT16_MAX));
+            max_human = fmax(max_human, err);
+        }
+    }
+    for (uint32_t v = 0; v < TSDZ2_BATTERY_ADC_STEPS; v++) {
+        for (uint32_t i = 0; i < 256; i++) {
+            double exact = v * 0.0866 * i * 0.16;
+            double err = fabs(tsdz2_motor_power_w(&g_m, v, i) - exact);
+            max_motor = fmax(max_motor, err);
+        }
+    }
+    printf("power: max error human %.2f W, motor %.2f W\n", max_human,
+           max_motor);
+    CHECK(max_human <= 1);
+    CHECK(max_motor <= 1);
+}
+
+static void test_battery(void) {
+    // 630 steps = 54.56 V = 4.197 V per cell, 554 = 47.98 V = 3.69 V.
+    CHECK_NEAR(tsdz2_battery_mv(&g_m, 630), 630 * 86.6, 1);
+    CHECK(tsdz2_battery_pct(&g_m, 630) == 99);
+    CHECK(tsdz2_battery_pct(&g_m, 554) == 41);
+    // Below an empty pack: 0, not wrapped to anything else.
+    CHECK(tsdz2_battery_pct(&g_m, 0) == 0);
+    CHECK(tsdz2_battery_pct(&g_m, 400) == 0);
+    // 640 = 4.26 V per cell, a charger's overshoot: full. 646 = 4.30 V
+    // and up cannot be a 13-cell pack.
+    CHECK(tsdz2_battery_pct(&g_m, 640) == 100);
+    CHECK(tsdz2_battery_pct(&g_m, 646) == TSDZ2_BATTERY_PCT_INVALID);
+    // Out of the ADC range: invalid, never full.
+    CHECK(tsdz2_battery_pct(&g_m, TSDZ2_BATTERY_ADC_STEPS - 1) ==
+          TSDZ2_BATTERY_PCT_INVALID);
+    CHECK(tsdz2_battery_pct(&g_m, 1024) == TSDZ2_BATTERY_PCT_INVALID);
+    CHECK(tsdz2_battery_pct(&g_m, UINT16_MAX) == TSDZ2_BATTERY_PCT_INVALID);
+}
+
+static void bench(void) {
+    uint64_t sum = 0;
+
+    tsdz2_metrics_configure(&g_m, &g_calib);
+    double start = host_test_now_ns();
+    for (uint32_t i = 0; i < BENCH_SAMPLES; i++) {
+        uint32_t torque = tsdz2_torque_mnm(&g_m, (i >> 3) & 1023);
+        sum += tsdz2_speed_kmh_x10(&g_m, (i & 0xfff) + 100);
+        sum += tsdz2_human_power_w(&g_m, torque, i & 127);
+        sum += tsdz2_motor_power_w(&g_m, i & 1023, i & 255);
+        sum += tsdz2_battery_pct(&g_m, i & 1023);
+    }
+    double seconds = (host_test_now_ns() - start) / 1e9;
+    host_test_keep(sum);
+    printf("speed + torque + 2 powers + battery: %.1f M packets/s\n",
+           BENCH_SAMPLES / seconds / 1e6);
+}
+
+int main(void) {
+    test_recip();
+    test_speed();
+    test_power();
+    test_battery();
+    bench();
+    return host_test_result("test_metrics");
+}
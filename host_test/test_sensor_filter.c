@@ -0,0 +1,187 @@
+// Every filter against a brute-force reference over a window of recent
+// samples, then ns per sample for each stage and a typical chain.
+
+#include <stdlib.h>
+#include "host_test.h"
+#include "sensor_filter.h"
+
+#define MAX_WINDOW 40
+#define BENCH_SAMPLES 20000000
+
+static int cmp_i32(const void* a, const void* b) {
+    int32_t x = *(const int32_t*)a;
+    int32_t y = *(const int32_t*)b;
+    return (x > y) - (x < y);
+}
+
+// Noise with an occasional spike, as from a torque sensor.
+static int32_t noisy_sample(uint32_t n) {
+    int32_t x = rand() % 2001 - 1000;
+    return n % 97 == 0 ? x * 30 : x;
+}
+
+static void test_windowed(void) {
+    for (uint16_t w = 1; w <= MAX_WINDOW; w++) {
+        filter_median_node_t nodes[MAX_WINDOW];
+        filter_median_t median;
+        int32_t ma_buf[MAX_WINDOW];
+        filter_ma_t ma;
+        int32_t win[MAX_WINDOW];
+        int32_t sorted[MAX_WINDOW];
+        uint32_t bad_median = 0;
+        uint32_t bad_ma = 0;
+
+        filter_median_init(&median, nodes, w);
+        filter_ma_init(&ma, ma_buf, w);
+        for (uint32_t n = 0; n < 5000; n++) {
+            int32_t x = noisy_sample(n);
+            // Primed with the first sample, then shifted along.
+            for (int i = 0; i < w; i++) {
+                win[i] = n == 0 || i == w - 1 ? x : win[i + 1];
+            }
+            int64_t sum = 0;
+            for (int i = 0; i < w; i++) {
+                sorted[i] = win[i];
+                sum += win[i];
+            }
+            qsort(sorted, w, sizeof(sorted[0]), cmp_i32);
+            int32_t expected = w & 1 ? sorted[w / 2]
+                : (int32_t)(((int64_t)sorted[w / 2 - 1] + sorted[w / 2]) >> 1);
+            bad_median += filter_median_push(&median, x) != expected;
+            bad_ma += filter_ma_push(&ma, x) != (int32_t)(sum / w);
+        }
+        CHECK(bad_median == 0);
+        CHECK(bad_ma == 0);
+    }
+}
+
+static void test_ema_decim(void) {
+    filter_ema_t ema;
+    filter_decim_t decim;
+    int32_t out;
+    int32_t y = 0;
+    int emitted = 0;
+
+    // Alpha 1/8: a step settles to within rounding in 100 samples.
+    filter_ema_init(&ema, 65536 / 8);
+    CHECK(filter_ema_push(&ema, 0) == 0);
+    for (int i = 0; i < 100; i++) {
+        y = filter_ema_push(&ema, 1000);
+    }
+    CHECK(y == 1000);
+    filter_ema_init(&ema, 65536);
+    CHECK(filter_ema_push(&ema, 5) == 5 && filter_ema_push(&ema, -7) == -7);
+
+    filter_decim_init(&decim, 4);
+    for (int i = 0; i < 16; i++) {
+        if (filter_decim_push(&decim, i, &out)) {
+            // Mean of i-3..i, rounded down.
+            CHECK(out == (4 * i - 6) / 4);
+            emitted++;
+        }
+    }
+    CHECK(emitted == 4);
+}
+
+static void test_chain(void) {
+    filter_median_node_t nodes[3];
+    filter_median_t median;
+    filter_decim_t decim;
+    const filter_stage_t chain[] = {
+        FILTER_STAGE_MEDIAN(&median), FILTER_STAGE_DECIM(&decim),
+    };
+    int32_t out;
+
+    filter_median_init(&median, nodes, 3);
+    filter_decim_init(&decim, 2);
+    // The spike never reaches the decimator.
+    CHECK(!filter_chain_push(chain, 2, 10, &out));
+    CHECK(filter_chain_push(chain, 2, 10000, &out) && out == 10);
+    CHECK(!filter_chain_push(chain, 2, 12, &out));
+    CHECK(filter_chain_push(chain, 2, 12, &out) && out == 12);
+}
+
+static int32_t* g_in;
+
+static void report(const char* name, double start, int32_t sink) {
+    host_test_keep(sink);
+    printf("%-26s %6.2f ns/sample\n", name,
+           (host_test_now_ns() - start) / BENCH_SAMPLES);
+}
+
+static void bench(void) {
+    static filter_median_node_t nodes[101];
+    static const uint16_t median_windows[] = { 5, 15, 31, 101 };
+    int32_t ma_buf[16];
+    filter_ma_t ma;
+    filter_ema_t ema;
+    filter_median_t median;
+    filter_decim_t decim;
+    int32_t sink = 0;
+    int32_t out;
+    char name[32];
+    double start;
+
+    g_in = malloc(BENCH_SAMPLES * sizeof(*g_in));
+    for (uint32_t i = 0; i < BENCH_SAMPLES; i++) {
+        g_in[i] = rand() % 4096;
+    }
+
+    filter_ma_init(&ma, ma_buf, 16);
+    start = host_test_now_ns();
+    for (uint32_t i = 0; i < BENCH_SAMPLES; i++) {
+        sink += filter_ma_push(&ma, g_in[i]);
+    }
+    report("moving average, 16", start, sink);
+
+    filter_ema_init(&ema, 4096);
+    start = host_test_now_ns();
+    for (uint32_t i = 0; i < BENCH_SAMPLES; i++) {
+        sink += filter_ema_push(&ema, g_in[i]);
+    }
+    report("EMA", start, sink);
+
+    for (int k = 0; k < 4; k++) {
+        filter_median_init(&median, nodes, median_windows[k]);
+        start = host_test_now_ns();
+        for (uint32_t i = 0; i < BENCH_SAMPLES; i++) {
+            sink += filter_median_push(&median, g_in[i]);
+        }
+        snprintf(name, sizeof(name), "median, %u", median_windows[k]);
+        report(name, start, sink);
+    }
+
+    filter_decim_init(&decim, 8);
+    start = host_test_now_ns();
+    for (uint32_t i = 0; i < BENCH_SAMPLES; i++) {
+        if (filter_decim_push(&decim, g_in[i], &out)) {
+            sink += out;
+        }
+    }
+    report("decimate, 8", start, sink);
+
+    const filter_stage_t chain[] = {
+        FILTER_STAGE_MEDIAN(&median), FILTER_STAGE_MA(&ma),
+        FILTER_STAGE_DECIM(&decim),
+    };
+    filter_median_init(&median, nodes, 5);
+    filter_ma_init(&ma, ma_buf, 8);
+    filter_decim_init(&decim, 8);
+    start = host_test_now_ns();
+    for (uint32_t i = 0; i < BENCH_SAMPLES; i++) {
+        if (filter_chain_push(chain, 3, g_in[i], &out)) {
+            sink += out;
+        }
+    }
+    report("median 5 + MA 8 + dec. 8", start, sink);
+    free(g_in);
+}
+
+int main(void) {
+    srand(1);
+    test_windowed();
+    test_ema_decim();
+    test_chain();
+    bench();
+    return host_test_result("test_sensor_filter");
+}
@@ -0,0 +1,197 @@
+// Snapshot reads against the mailbox-and-encode path they replaced: retry
+// semantics, uncontended read cost of a 28-byte value (the LED latency
+// summary's size), then read latency and jitter with a writer publishing
+// continuously on the same CPU, checking that no read is ever torn.
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include "host_test.h"
+#include "mailbox.h"
+#include "os/endian.h"
+#include "snapshot.h"
+
+#define VALUE_LEN 28
+#define BENCH_READS 10000000u
+#define TIMED_READS 1000000u
+
+typedef struct {
+    uint32_t n;
+    uint32_t v[6];
+} value_t;
+
+static uint8_t g_snap_buf[2 * VALUE_LEN];
+static snapshot_t g_snap;
+static value_t g_box_buf;
+static mailbox_t g_box;
+static atomic_bool g_stop;
+
+// Every byte follows from n, so a value mixing two publishes shows.
+static void encode(uint8_t* p, const value_t* v) {
+    put_le32(p, v->n);
+    for (int i = 0; i < 6; i++) {
+        put_le32(p + 4 + 4 * i, v->v[i]);
+    }
+}
+
+static void make_value(value_t* v, uint32_t n) {
+    v->n = n;
+    for (int i = 0; i < 6; i++) {
+        v->v[i] = n * (i + 3);
+    }
+}
+
+static bool whole(const uint8_t* p) {
+    uint32_t n = get_le32(p);
+    for (int i = 0; i < 6; i++) {
+        if (get_le32(p + 4 + 4 * i) != n * (i + 3)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void snap_publish(uint32_t n) {
+    value_t v;
+    make_value(&v, n);
+    encode(snapshot_back(&g_snap), &v);
+    snapshot_commit(&g_snap, VALUE_LEN);
+}
+
+static void snap_read(uint8_t* out) {
+    const uint8_t* data;
+    uint16_t len;
+    uint32_t seq;
+    do {
+        seq = snapshot_read_begin(&g_snap, &data, &len);
+        memcpy(out, data, len);
+    } while (snapshot_read_retry(&g_snap, seq));
+}
+
+static void box_publish(uint32_t n) {
+    value_t v;
+    make_value(&v, n);
+    mailbox_publish(&g_box, &v);
+}
+
+static void box_read(uint8_t* out) {
+    value_t v;
+    mailbox_read(&g_box, &v);
+    encode(out, &v);
+}
+
+static void test_retry(void) {
+    const uint8_t* data;
+    uint16_t len;
+
+    snap_publish(1);
+    uint32_t seq = snapshot_read_begin(&g_snap, &data, &len);
+    CHECK(len == VALUE_LEN && whole(data) && get_le32(data) == 1);
+    CHECK(!snapshot_read_retry(&g_snap, seq));
+    // One publish goes to the other buffer, but the reader cannot tell
+    // whether a second has come back to its own, so it retries either way.
+    snap_publish(2);
+    CHECK(snapshot_read_retry(&g_snap, seq));
+    CHECK(get_le32(data) == 1);
+    snap_publish(3);
+    CHECK(snapshot_read_retry(&g_snap, seq));
+    seq = snapshot_read_begin(&g_snap, &data, &len);
+    CHECK(get_le32(data) == 3 && !snapshot_read_retry(&g_snap, seq));
+}
+
+static void bench_uncontended(void) {
+    uint8_t out[VALUE_LEN];
+    uint64_t sum = 0;
+
+    box_publish(7);
+    double start = host_test_now_ns();
+    for (uint32_t i = 0; i < BENCH_READS; i++) {
+        box_read(out);
+        sum += out[i & 3];
+    }
+    double box_ns = (host_test_now_ns() - start) / BENCH_READS;
+
+    snap_publish(7);
+    start = host_test_now_ns();
+    for (uint32_t i = 0; i < BENCH_READS; i++) {
+        snap_read(out);
+        sum += out[i & 3];
+    }
+    double snap_ns = (host_test_now_ns() - start) / BENCH_READS;
+    host_test_keep(sum);
+    printf("uncontended %d-byte read: snapshot %.1f ns, mailbox read and "
+           "encode %.1f ns\n", VALUE_LEN, snap_ns, box_ns);
+}
+
+static void pin_to_cpu0(void) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(0, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+static void* writer(void* arg) {
+    void (*publish)(uint32_t) = arg;
+    pin_to_cpu0();
+    for (uint32_t n = 1; !atomic_load_explicit(&g_stop, memory_order_relaxed);
+         n++) {
+        publish(n);
+    }
+    return NULL;
+}
+
+static int cmp_u32(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*)a;
+    uint32_t y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+// Times every read with a writer thread on the same CPU, so some reads
+// preempt a publish half done and some are preempted themselves.
+static void bench_contended(const char* name, void (*publish)(uint32_t),
+                            void (*read)(uint8_t*)) {
+    static uint32_t lat_ns[TIMED_READS];
+    uint8_t out[VALUE_LEN];
+    uint32_t torn = 0;
+    pthread_t t;
+
+    publish(0);
+    atomic_store(&g_stop, false);
+    pthread_create(&t, NULL, writer, publish);
+    for (uint32_t i = 0; i < TIMED_READS; i++) {
+        double start = host_test_now_ns();
+        read(out);
+        lat_ns[i] = host_test_now_ns() - start;
+        torn += !whole(out);
+    }
+    atomic_store(&g_stop, true);
+    pthread_join(t, NULL);
+
+    qsort(lat_ns, TIMED_READS, sizeof(lat_ns[0]), cmp_u32);
+    printf("  %-28s p50 %5u ns  p99 %6u ns  p99.9 %8u ns  max %9u ns\n",
+           name, lat_ns[TIMED_READS / 2], lat_ns[TIMED_READS * 99 / 100],
+           lat_ns[TIMED_READS * 999 / 1000], lat_ns[TIMED_READS - 1]);
+    CHECK(torn == 0);
+}
+
+static void bench_jitter(void) {
+    double start = host_test_now_ns();
+    double overhead_ns = host_test_now_ns() - start;
+
+    pin_to_cpu0();
+    printf("%u timed reads on one CPU with a writer publishing continuously "
+           "(timer %.0f ns):\n", TIMED_READS, overhead_ns);
+    bench_contended("snapshot", snap_publish, snap_read);
+    bench_contended("mailbox read and encode", box_publish, box_read);
+}
+
+int main(void) {
+    snapshot_init(&g_snap, g_snap_buf, VALUE_LEN);
+    mailbox_init(&g_box, &g_box_buf, sizeof(g_box_buf));
+    test_retry();
+    bench_uncontended();
+    bench_jitter();
+    return host_test_result("test_snapshot");
+}
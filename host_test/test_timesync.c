@@ -0,0 +1,164 @@
+// The phone clock estimate from simulated exchanges: a phone clock with an
+// offset and a drift, and links whose two legs take different times and
+// jitter, with now and then a retransmission hundreds of ms late. After
+// every exchange the estimate must be within the error bound it reports.
+// Prints what the error and drift settle at; then a clock step.
+
+#include <math.h>
+#include <stdlib.h>
+#include "timesync.h"
+#include "esp_timer.h"
+#include "host_test.h"
+#include "host/ble_hs.h"
+
+#define PHONE_EPOCH_US 1760000000000000LL
+#define EXCHANGE_US 2000000
+
+int os_msys_num_free(void) {
+    return 12;
+}
+
+int ble_gap_conn_find(uint16_t conn_handle, struct ble_gap_conn_desc* desc) {
+    return 1;
+}
+
+typedef struct {
+    const char* name;
+    double drift_ppm;     // phone clock rate relative to ours, minus one
+    int32_t up_us;        // phone to us, least
+    int32_t down_us;      // us to phone, least
+    int32_t jitter_us;    // added to either leg, uniform
+    int32_t spike_pct;    // exchanges with one leg 100-400 ms late
+    int32_t turn_us;      // t3 - t2: the connection event of the response
+} link_t;
+
+typedef struct {
+    double max_err_us;
+    double final_err_us;
+    uint32_t final_bound_us;
+    int32_t drift_ppb;
+    uint32_t violations;
+} result_t;
+
+static int64_t g_local_us = 1000000;
+static int64_t g_offset_us = PHONE_EPOCH_US;
+static int64_t g_drift_from_us;
+
+// The phone's clock when ours reads local.
+static uint64_t phone_us(const link_t* l, int64_t local) {
+    return g_offset_us + local +
+           (int64_t)((local - g_drift_from_us) * l->drift_ppm * 1e-6);
+}
+
+// A new phone: an hour away from the last, which the estimator takes for
+// a step and starts over from.
+static void new_phone(void) {
+    g_offset_us += 3600000000LL;
+    g_drift_from_us = g_local_us;
+}
+
+static int32_t leg_us(const link_t* l, int32_t least) {
+    int32_t d = least + (l->jitter_us ? rand() % l->jitter_us : 0);
+    if (rand() % 100 < l->spike_pct) {
+        d += 100000 + rand() % 300000;
+    }
+    return d;
+}
+
+// Runs exchanges every EXCHANGE_US for dur_s, checking the bound after
+// each; returns the state at the end.
+static void run(const link_t* l, int dur_s, result_t* r) {
+    int64_t end = g_local_us + (int64_t)dur_s * 1000000;
+
+    *r = (result_t){ 0 };
+    for (; g_local_us < end; g_local_us += EXCHANGE_US) {
+        uint64_t t1 = phone_us(l, g_local_us);
+        int64_t t2 = g_local_us + leg_us(l, l->up_us);
+        int64_t t3 = t2 + l->turn_us;
+        uint64_t t4 = phone_us(l, t3 + leg_us(l, l->down_us));
+        timesync_exchange(t1, t2, t3, t4);
+
+        timesync_state_t s;
+        int64_t unix_us;
+        host_stub_set_time_us(t3);
+        timesync_get_state(&s);
+        CHECK(timesync_local_to_unix_us(t3, &unix_us));
+        double err = fabs((double)(unix_us - (int64_t)phone_us(l, t3)));
+        // 2 us for rounding.
+        if (err > s.error_us + 2) {
+            r->violations++;
+        }
+        r->max_err_us = err > r->max_err_us ? err : r->max_err_us;
+        r->final_err_us = err;
+        r->final_bound_us = s.error_us;
+        r->drift_ppb = s.drift_ppb;
+    }
+}
+
+static void report(const link_t* l, const result_t* r) {
+    printf("  %-26s error %7.0f us (bound %6u us), worst %7.0f us, drift "
+           "%7.3f ppm (true %.3f)\n", l->name, r->final_err_us,
+           r->final_bound_us, r->max_err_us, r->drift_ppb / 1000.0,
+           l->drift_ppm);
+}
+
+static void test_links(void) {
+    static const link_t links[] = {
+        { "symmetric, steady", 0, 7500, 7500, 0, 0, 15000 },
+        { "symmetric, 40 ppm drift", 40, 7500, 7500, 0, 0, 15000 },
+        { "asymmetric 5/25 ms", 0, 5000, 25000, 0, 0, 15000 },
+        { "asymmetric, jitter", 20, 5000, 25000, 30000, 0, 30000 },
+        { "asymmetric, jitter, spikes", -35, 5000, 25000, 30000, 10, 30000 },
+    };
+    result_t r;
+
+    printf("10 minutes of exchanges every %d s:\n", EXCHANGE_US / 1000000);
+    for (size_t i = 0; i < sizeof(links) / sizeof(links[0]); i++) {
+        const link_t* l = &links[i];
+        srand(1);
+        new_phone();
+        run(l, 600, &r);
+        report(l, &r);
+        CHECK(r.violations == 0);
+        // The asymmetry is invisible to any two-way exchange: the offset
+        // is off by half the difference of the legs, within the bound.
+        CHECK_NEAR(r.final_err_us, (l->down_us - l->up_us) / 2.0,
+                   l->jitter_us / 2.0 + 2);
+        // Without jitter the fit finds the drift; with it, the offsets it
+        // rests on scatter by a few ms over an 8 minute baseline.
+        if (l->jitter_us == 0) {
+            CHECK_NEAR(r.drift_ppb, l->drift_ppm * 1000, 10);
+        }
+    }
+}
+
+static void test_step(void) {
+    const link_t l = { "after a 2 s step", 10, 7500, 7500, 2000, 0, 15000 };
+    result_t r;
+    timesync_state_t s;
+
+    srand(2);
+    new_phone();
+    run(&l, 120, &r);
+    uint32_t exchanges_before;
+    timesync_get_state(&s);
+    exchanges_before = s.exchanges;
+
+    // The phone steps its clock: the very next exchange starts over rather
+    // than averaging the old offset in.
+    g_offset_us += 2000000;
+    run(&l, 2, &r);
+    timesync_get_state(&s);
+    CHECK(s.exchanges == exchanges_before + 1);
+    CHECK(r.violations == 0);
+    CHECK(r.final_err_us <= s.error_us + 2);
+    report(&l, &r);
+}
+
+int main(void) {
+    host_stub_set_time_us(g_local_us);
+    timesync_init();
+    test_links();
+    test_step();
+    return host_test_result("test_timesync");
+}
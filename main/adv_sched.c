@@ -0,0 +1,228 @@
+#include <string.h>
+#include "adv_sched.h"
+#include "esp_console.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "host/ble_store.h"
+#include "nimble/hci_common.h"
+#include "sdkconfig.h"
+
+#define TAG "ADV"
+
+#define MS_TO_ADV_ITVL(ms) ((ms) * 1000 / 625)
+
+// Longest high-duty directed advertising the spec allows.
+#define DIRECTED_DURATION_MS 1280
+// High-duty directed events repeat at least every 3.75 ms.
+#define DIRECTED_EVENT_US 3750
+
+// Estimated radio-on time per advertising event on all three channels: the
+// PDU at 1M PHY plus the receive window that follows it.
+#define UNDIRECTED_EVENT_RADIO_US (3 * (376 + 150))
+#define DIRECTED_EVENT_RADIO_US   (3 * (176 + 150))
+
+static const char* const g_phase_names[ADV_PHASE_COUNT] = {
+    "directed", "fast", "slow",
+};
+
+static adv_phase_t g_phase;
+static bool g_have_peer;
+static ble_addr_t g_peer;
+
+static bool g_advertising;
+static int64_t g_started_at;
+static int64_t g_disconnected_at; // 0 until the first disconnect
+
+// Statistics.
+static int64_t g_phase_us[ADV_PHASE_COUNT];
+static int64_t g_radio_us;
+static uint32_t g_connects[ADV_PHASE_COUNT];
+static uint32_t g_reconnects;
+static uint32_t g_reconnect_last_ms;
+static uint32_t g_reconnect_max_ms;
+static uint64_t g_reconnect_sum_ms;
+
+// A directed advertisement only reaches a peer that connects from its
+// identity address. The bond only records that address, never the
+// resolvable private ones a peer with privacy connects from, so go by what
+// it distributed when pairing: a peer that sent an IRK uses RPAs, and
+// reaching it would need privacy and the controller's resolving list,
+// which this firmware does not set up. Don't waste the time on it.
+static bool peer_reachable(const ble_addr_t* id_addr) {
+    struct ble_store_key_sec key = { .peer_addr = *id_addr };
+    struct ble_store_value_sec bond;
+
+    if (ble_store_read_peer_sec(&key, &bond) == 0 && bond.irk_present) {
+        return false;
+    }
+    return id_addr->type == BLE_ADDR_PUBLIC ||
+           (id_addr->type == BLE_ADDR_RANDOM &&
+            (id_addr->val[5] & 0xc0) == 0xc0);
+}
+
+static adv_phase_t first_phase(void) {
+#if CONFIG_APP_ADV_DIRECTED
+    if (g_have_peer) {
+        return ADV_PHASE_DIRECTED;
+    }
+#endif
+    return ADV_PHASE_FAST;
+}
+
+// Up to 10 ms of slack for the controller, within the largest interval
+// the HCI allows; at the top of the Kconfig range there is none.
+static uint16_t itvl_max(uint16_t itvl_min) {
+    uint32_t itvl = itvl_min + MS_TO_ADV_ITVL(10);
+    return itvl > BLE_HCI_ADV_ITVL_MAX ? BLE_HCI_ADV_ITVL_MAX : itvl;
+}
+
+void adv_sched_current(adv_step_t* step) {
+    memset(step, 0, sizeof(*step));
+    step->phase = g_phase;
+    switch (g_phase) {
+        case ADV_PHASE_DIRECTED:
+            step->peer = g_peer;
+            step->duration_ms = DIRECTED_DURATION_MS;
+            break;
+        case ADV_PHASE_FAST:
+            step->itvl_min = MS_TO_ADV_ITVL(CONFIG_APP_ADV_FAST_INTERVAL_MS);
+            step->itvl_max = itvl_max(step->itvl_min);
+            step->duration_ms = CONFIG_APP_ADV_FAST_DURATION_S * 1000;
+            break;
+        default:
+            step->itvl_min = MS_TO_ADV_ITVL(CONFIG_APP_ADV_SLOW_INTERVAL_MS);
+            step->itvl_max = itvl_max(step->itvl_min);
+            step->duration_ms = BLE_HS_FOREVER;
+            break;
+    }
+}
+
+// Estimated radio-on time for advertising `elapsed` us in the current phase.
+static int64_t radio_us(int64_t elapsed) {
+    if (g_phase == ADV_PHASE_DIRECTED) {
+        return elapsed * DIRECTED_EVENT_RADIO_US / DIRECTED_EVENT_US;
+    }
+    adv_step_t step;
+    adv_sched_current(&step);
+    // The controller adds 0-10 ms of random delay to every interval.
+    int64_t event_us = step.itvl_min * 625 + 5000;
+    return elapsed * UNDIRECTED_EVENT_RADIO_US / event_us;
+}
+
+// Charges the time spent advertising in the current phase.
+static void account(void) {
+    if (!g_advertising) {
+        return;
+    }
+    int64_t elapsed = esp_timer_get_time() - g_started_at;
+    g_phase_us[g_phase] += elapsed;
+    g_radio_us += radio_us(elapsed);
+    g_advertising = false;
+}
+
+void adv_sched_disconnected(void) {
+    account();
+    g_disconnected_at = esp_timer_get_time();
+    g_phase = first_phase();
+}
+
+void adv_sched_started(void) {
+    account();
+    g_advertising = true;
+    g_started_at = esp_timer_get_time();
+    ESP_LOGI(TAG, "advertising: %s", g_phase_names[g_phase]);
+}
+
+void adv_sched_timed_out(void) {
+    account();
+    if (g_phase < ADV_PHASE_SLOW) {
+        g_phase++;
+    }
+}
+
+void adv_sched_connected(void) {
+    int64_t now = esp_timer_get_time();
+
+    account();
+    g_connects[g_phase]++;
+    // The directed peer is the one that connected; advertising for the
+    // remaining connection slots goes on undirected.
+    if (g_phase == ADV_PHASE_DIRECTED) {
+        g_phase = ADV_PHASE_FAST;
+    }
+    if (g_disconnected_at != 0) {
+        uint32_t ms = (now - g_disconnected_at) / 1000;
+        g_reconnects++;
+        g_reconnect_last_ms = ms;
+        g_reconnect_sum_ms += ms;
+        if (ms > g_reconnect_max_ms) {
+            g_reconnect_max_ms = ms;
+        }
+        ESP_LOGI(TAG, "reconnected after %u ms (%s)", ms,
+                 g_phase_names[g_phase]);
+    }
+}
+
+void adv_sched_set_peer(const ble_addr_t* id_addr) {
+    if (peer_reachable(id_addr)) {
+        g_peer = *id_addr;
+        g_have_peer = true;
+    }
+}
+
+// Runs in the console task while the host task updates the counters, so
+// the numbers are approximate; they are only for humans.
+static int adv_cmd_handler(int argc, char *argv[]) {
+    int64_t uptime = esp_timer_get_time();
+    int64_t ongoing = g_advertising ? uptime - g_started_at : 0;
+    int64_t phase_us[ADV_PHASE_COUNT];
+    memcpy(phase_us, g_phase_us, sizeof(phase_us));
+    phase_us[g_phase] += ongoing;
+    int64_t total_radio_us = g_radio_us + radio_us(ongoing);
+
+    ESP_LOGI(TAG, "phase %s%s, directed target %s",
+             g_phase_names[g_phase], g_advertising ? "" : " (stopped)",
+             g_have_peer ? "set" : "none");
+    for (int i = 0; i < ADV_PHASE_COUNT; i++) {
+        ESP_LOGI(TAG, "  %-8s %6u s advertised, %u connects",
+                 g_phase_names[i], (uint32_t)(phase_us[i] / 1000000),
+                 g_connects[i]);
+    }
+    ESP_LOGI(TAG, "reconnect n %u last %u avg %u max %u ms",
+             g_reconnects, g_reconnect_last_ms,
+             g_reconnects ? (uint32_t)(g_reconnect_sum_ms / g_reconnects) : 0,
+             g_reconnect_max_ms);
+    ESP_LOGI(TAG, "estimated advertising radio duty cycle %u.%02u%% of uptime",
+             (uint32_t)(total_radio_us * 100 / uptime),
+             (uint32_t)(total_radio_us * 10000 / uptime % 100));
+    return 0;
+}
+
+static const esp_console_cmd_t g_adv_cmd = {
+    .command = "adv",
+    .help = "Print advertising phase, reconnect times and duty cycle",
+    .func = adv_cmd_handler,
+};
+
+// Called once the host has synced, so bonds have been loaded from NVS. A
+// host reset syncs again; keep the statistics and the current phase then.
+void adv_sched_init(void) {
+    static bool initialized;
+    ble_addr_t peers[CONFIG_BT_NIMBLE_MAX_BONDS];
+    int count = 0;
+
+    if (initialized) {
+        return;
+    }
+    initialized = true;
+
+    if (ble_store_util_bonded_peers(peers, &count,
+                                    CONFIG_BT_NIMBLE_MAX_BONDS) == 0) {
+        // The store keeps bonds oldest first.
+        for (int i = count - 1; i >= 0 && !g_have_peer; i--) {
+            adv_sched_set_peer(&peers[i]);
+        }
+    }
+    g_phase = first_phase();
+    esp_console_cmd_register(&g_adv_cmd);
+}
@@ -0,0 +1,50 @@
+#ifndef ADV_SCHED
+#define ADV_SCHED
+
+// Advertising schedule: after boot or a disconnect, try high-duty directed
+// advertising to the last bonded peer, then advertise undirected at a fast
+// interval for a short burst, then back off to a slow interval for as long
+// as it takes. After a connect the schedule carries on from where it was,
+// undirected, while connection slots remain. The GAP calls stay in main.c;
+// this module only decides what the next step is and keeps reconnect-time
+// and radio duty-cycle statistics.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "host/ble_hs.h"
+
+typedef enum {
+    ADV_PHASE_DIRECTED,
+    ADV_PHASE_FAST,
+    ADV_PHASE_SLOW,
+    ADV_PHASE_COUNT,
+} adv_phase_t;
+
+typedef struct {
+    adv_phase_t phase;
+    ble_addr_t peer;      // ADV_PHASE_DIRECTED only
+    uint16_t itvl_min;    // 0.625 ms units, unused for directed
+    uint16_t itvl_max;
+    int32_t duration_ms;  // BLE_HS_FOREVER for the last phase
+} adv_step_t;
+
+void adv_sched_init(void);
+
+// The step to run now.
+void adv_sched_current(adv_step_t* step);
+
+// Starts over from the first phase and the reconnect clock.
+void adv_sched_disconnected(void);
+
+// Advertising for the current step started, or stopped because its
+// duration ran out (which moves on to the next phase) or a peer connected.
+void adv_sched_started(void);
+void adv_sched_timed_out(void);
+void adv_sched_connected(void);
+
+// Remembers a bonded peer as the target of directed advertising, unless
+// its bond says it connects from resolvable private addresses. Call once
+// the bond is stored.
+void adv_sched_set_peer(const ble_addr_t* id_addr);
+
+#endif // ADV_SCHED
@@ -0,0 +1,76 @@
+#ifndef APP_TASKS
+#define APP_TASKS
+
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+
+// All application tasks share one core; the NimBLE host and controller keep
+// the other one to themselves on dual-core targets.
+#define APP_TASK_CORE               CONFIG_APP_TASK_CORE
+
+#if !CONFIG_FREERTOS_UNICORE && defined(CONFIG_BT_NIMBLE_PINNED_TO_CORE) && \
+    CONFIG_BT_NIMBLE_PINNED_TO_CORE == CONFIG_APP_TASK_CORE
+#warning "Application tasks are pinned to the NimBLE host core"
+#endif
+
+// Stack sizes are in bytes: ESP-IDF's FreeRTOS uses a one-byte StackType_t.
+#define APP_LED_TASK_STACK_SIZE     CONFIG_APP_LED_TASK_STACK_SIZE
+#define APP_LED_TASK_PRIO           1
+
+#define APP_SCLI_TASK_STACK_SIZE    CONFIG_APP_SCLI_TASK_STACK_SIZE
+#define APP_SCLI_TASK_PRIO          3
+
+#define APP_CTRL_TASK_STACK_SIZE    CONFIG_APP_CTRL_TASK_STACK_SIZE
+#define APP_CTRL_TASK_PRIO          2
+#define APP_CTRL_QUEUE_LEN          32 // commands; power of two
+#define APP_CTRL_CMD_SIZE           16
+
+#if CONFIG_APP_DIAG
+#define APP_DIAG_TASK_STACK_SIZE    CONFIG_APP_DIAG_TASK_STACK_SIZE
+#define APP_DIAG_TASK_PRIO          1
+#define APP_DIAG_STATIC_RAM         (APP_DIAG_TASK_STACK_SIZE + sizeof(StaticTask_t))
+#define APP_DIAG_TASKS              1
+#else
+#define APP_DIAG_STATIC_RAM         0
+#define APP_DIAG_TASKS              0
+#endif
+
+#if CONFIG_APP_PULSE_CAPTURE
+#define APP_PULSE_TASK_STACK_SIZE   CONFIG_APP_PULSE_CAPTURE_TASK_STACK_SIZE
+#define APP_PULSE_TASK_PRIO         1
+#define APP_PULSE_STATIC_RAM        (APP_PULSE_TASK_STACK_SIZE + sizeof(StaticTask_t))
+#define APP_PULSE_TASKS             1
+#else
+#define APP_PULSE_STATIC_RAM        0
+#define APP_PULSE_TASKS             0
+#endif
+
+#if CONFIG_APP_UART_PROXY
+#define APP_PROXY_TASK_STACK_SIZE   CONFIG_APP_UART_PROXY_TASK_STACK_SIZE
+// Above every other application task: each byte waits for it.
+#define APP_PROXY_TASK_PRIO         5
+#define APP_PROXY_STATIC_RAM        (2 * (APP_PROXY_TASK_STACK_SIZE + sizeof(StaticTask_t)))
+#define APP_PROXY_TASKS             2
+#else
+#define APP_PROXY_STATIC_RAM        0
+#define APP_PROXY_TASKS             0
+#endif
+
+// Long-lived tasks registered with sysmon: the NimBLE host, LED, control and
+// console tasks, plus the optional ones above.
+#define APP_TASKS_COUNT \
+    (4 + APP_DIAG_TASKS + APP_PULSE_TASKS + APP_PROXY_TASKS)
+
+// Everything the application reserves statically for its long-lived
+// FreeRTOS objects. Checked against the Kconfig budget at build time.
+#define APP_TASKS_STATIC_RAM \
+    (APP_LED_TASK_STACK_SIZE + sizeof(StaticTask_t) + \
+     APP_SCLI_TASK_STACK_SIZE + sizeof(StaticTask_t) + \
+     sizeof(StaticQueue_t) + sizeof(int) + \
+     APP_CTRL_TASK_STACK_SIZE + sizeof(StaticTask_t) + \
+     APP_CTRL_QUEUE_LEN * APP_CTRL_CMD_SIZE + \
+     APP_DIAG_STATIC_RAM + \
+     APP_PULSE_STATIC_RAM + \
+     APP_PROXY_STATIC_RAM)
+
+#endif // APP_TASKS
@@ -0,0 +1,203 @@
+#include "assist.h"
+
+#if CONFIG_APP_ASSIST
+
+#include <stdlib.h>
+#include <string.h>
+#include "mailbox.h"
+#include "esp_console.h"
+#include "esp_log.h"
+#include "host/ble_hs.h"
+#include "nvs.h"
+#include "os/endian.h"
+
+#define TAG "ASSIST"
+#define NVS_NAMESPACE "assist"
+
+// Written by the host task only, after init.
+static tsdz2_assist_curve_t g_curves[TSDZ2_ASSIST_LEVELS];
+static uint8_t g_read_level = 1;
+
+static tsdz2_assist_curve_t g_curves_box_buf[TSDZ2_ASSIST_LEVELS];
+static mailbox_t g_curves_box;
+
+// Current in proportion to torque above 5 Nm, up to 4, 8, 12 and 16 A at
+// 80 Nm. No assist until the cranks turn, full from 20 rpm, easing off
+// above 100 rpm.
+static void default_curve(tsdz2_assist_curve_t* c, int level) {
+    *c = (tsdz2_assist_curve_t){
+        .interp = TSDZ2_ASSIST_LINEAR,
+        .torque_knots = 3,
+        .torque_dnm = { 0, 50, 800 },
+        .current_ma = { 0, 0, 4000 * level },
+        .cadence_knots = 4,
+        .cadence_rpm = { 0, 20, 100, 120 },
+        .gain_pct = { 0, 100, 100, 60 },
+    };
+}
+
+static void save(void) {
+    nvs_handle_t nvs;
+    if (nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs) != ESP_OK) {
+        ESP_LOGE(TAG, "cannot open NVS; curves last until reboot");
+        return;
+    }
+    nvs_set_blob(nvs, "curves", g_curves, sizeof(g_curves));
+    nvs_commit(nvs);
+    nvs_close(nvs);
+}
+
+static void load(void) {
+    size_t len = sizeof(g_curves);
+    nvs_handle_t nvs;
+    bool ok = false;
+
+    if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvs) == ESP_OK) {
+        ok = nvs_get_blob(nvs, "curves", g_curves, &len) == ESP_OK &&
+             len == sizeof(g_curves);
+        nvs_close(nvs);
+    }
+    for (int i = 0; ok && i < TSDZ2_ASSIST_LEVELS; i++) {
+        ok = tsdz2_assist_curve_valid(&g_curves[i]);
+    }
+    if (!ok) {
+        for (int i = 0; i < TSDZ2_ASSIST_LEVELS; i++) {
+            default_curve(&g_curves[i], i + 1);
+        }
+    }
+}
+
+int assist_on_write(const uint8_t* buf, uint16_t len) {
+    uint8_t level = buf[0];
+    tsdz2_assist_curve_t c;
+
+    if (level == 0 || level > TSDZ2_ASSIST_LEVELS) {
+        return BLE_ATT_ERR_VALUE_NOT_ALLOWED;
+    }
+    if (len == 1) {
+        g_read_level = level;
+        return 0;
+    }
+    if (len < 4) {
+        return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+    }
+    c = (tsdz2_assist_curve_t){
+        .interp = buf[1],
+        .torque_knots = buf[2],
+        .cadence_knots = buf[3],
+    };
+    if (c.torque_knots > TSDZ2_ASSIST_KNOTS ||
+        c.cadence_knots > TSDZ2_ASSIST_KNOTS) {
+        return BLE_ATT_ERR_VALUE_NOT_ALLOWED;
+    }
+    if (len != 4 + c.torque_knots * 4 + c.cadence_knots * 2) {
+        return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+    }
+    buf += 4;
+    for (int i = 0; i < c.torque_knots; i++, buf += 4) {
+        c.torque_dnm[i] = get_le16(buf);
+        c.current_ma[i] = get_le16(buf + 2);
+    }
+    for (int i = 0; i < c.cadence_knots; i++, buf += 2) {
+        c.cadence_rpm[i] = buf[0];
+        c.gain_pct[i] = buf[1];
+    }
+    if (!tsdz2_assist_curve_valid(&c)) {
+        return BLE_ATT_ERR_VALUE_NOT_ALLOWED;
+    }
+
+    g_curves[level - 1] = c;
+    g_read_level = level;
+    mailbox_publish(&g_curves_box, g_curves);
+    save();
+    ESP_LOGI(TAG, "level %u: %s, %u torque and %u cadence knots", level,
+             c.interp == TSDZ2_ASSIST_SPLINE ? "spline" : "linear",
+             c.torque_knots, c.cadence_knots);
+    return 0;
+}
+
+int assist_on_read(uint8_t* buf) {
+    const tsdz2_assist_curve_t* c = &g_curves[g_read_level - 1];
+    uint8_t* p = buf + 4;
+
+    buf[0] = g_read_level;
+    buf[1] = c->interp;
+    buf[2] = c->torque_knots;
+    buf[3] = c->cadence_knots;
+    for (int i = 0; i < c->torque_knots; i++, p += 4) {
+        put_le16(p, c->torque_dnm[i]);
+        put_le16(p + 2, c->current_ma[i]);
+    }
+    for (int i = 0; i < c->cadence_knots; i++, p += 2) {
+        p[0] = c->cadence_rpm[i];
+        p[1] = c->gain_pct[i];
+    }
+    return p - buf;
+}
+
+void assist_tables_refresh(assist_tables_t* t) {
+    tsdz2_assist_curve_t curves[TSDZ2_ASSIST_LEVELS];
+
+    if (mailbox_version(&g_curves_box) == t->version) {
+        return;
+    }
+    t->version = mailbox_read(&g_curves_box, curves);
+    for (int i = 0; i < TSDZ2_ASSIST_LEVELS; i++) {
+        tsdz2_assist_compile(&t->level[i], &curves[i]);
+    }
+}
+
+// Compiled for the console; commands only ever run in the CLI task.
+static assist_tables_t g_cmd_tables;
+
+static int assist_cmd_handler(int argc, char *argv[]) {
+    tsdz2_assist_curve_t curves[TSDZ2_ASSIST_LEVELS];
+
+    mailbox_read(&g_curves_box, curves);
+    if (argc == 4) {
+        int level = atoi(argv[1]);
+        if (level < 1 || level > TSDZ2_ASSIST_LEVELS) {
+            ESP_LOGE(TAG, "level is 1 to %d", TSDZ2_ASSIST_LEVELS);
+            return 1;
+        }
+        uint32_t torque_mnm = atof(argv[2]) * 1000;
+        int rpm = atoi(argv[3]);
+        uint8_t cadence_rpm = rpm < 0 ? 0 : rpm < UINT8_MAX ? rpm : UINT8_MAX;
+        // What the motor path would get, next to the exact curve.
+        assist_tables_refresh(&g_cmd_tables);
+        double ma = tsdz2_assist_reference_ma(&curves[level - 1], torque_mnm,
+                                              cadence_rpm);
+        ESP_LOGI(TAG, "level %d: %u mA (curve %u mA)", level,
+                 assist_current_ma(&g_cmd_tables, level, torque_mnm,
+                                   cadence_rpm),
+                 (uint32_t)(ma + 0.5));
+        return 0;
+    }
+    for (int i = 0; i < TSDZ2_ASSIST_LEVELS; i++) {
+        const tsdz2_assist_curve_t* c = &curves[i];
+        ESP_LOGI(TAG, "level %d: %s, %u mA at %u.%u Nm, gain %u%% at %u rpm",
+                 i + 1, c->interp == TSDZ2_ASSIST_SPLINE ? "spline" : "linear",
+                 c->current_ma[c->torque_knots - 1],
+                 c->torque_dnm[c->torque_knots - 1] / 10,
+                 c->torque_dnm[c->torque_knots - 1] % 10,
+                 c->gain_pct[c->cadence_knots - 1],
+                 c->cadence_rpm[c->cadence_knots - 1]);
+    }
+    return 0;
+}
+
+static const esp_console_cmd_t g_assist_cmd = {
+    .command = "assist",
+    .help = "Print the last knot of each assist curve, or "
+            "'assist <level> <Nm> <rpm>' for the motor current target",
+    .func = assist_cmd_handler,
+};
+
+void assist_init(void) {
+    load();
+    mailbox_init(&g_curves_box, g_curves_box_buf, sizeof(g_curves_box_buf));
+    mailbox_publish(&g_curves_box, g_curves);
+    esp_console_cmd_register(&g_assist_cmd);
+}
+
+#endif // CONFIG_APP_ASSIST
@@ -0,0 +1,68 @@
+#ifndef ASSIST
+#define ASSIST
+
+// Assist curves set from the phone, compiled into lookup tables.
+//
+// Each assist level 1..TSDZ2_ASSIST_LEVELS has a curve (tsdz2_assist.h);
+// level 0 is off. The host task validates curves written to the assist
+// curve characteristic, keeps them in NVS and publishes them in a mailbox.
+// A user owns an assist_tables_t and calls assist_tables_refresh() before
+// each lookup: that recompiles only after the curves have changed, so a
+// lookup normally costs the lookup alone. The "assist <level> <Nm> <rpm>"
+// console command is the only user so far; nothing sends the result to
+// the motor.
+//
+// Curve characteristic, little-endian:
+//     u8        level, 1..TSDZ2_ASSIST_LEVELS
+//     u8        0 piecewise-linear, 1 monotone cubic spline
+//     u8        nt, torque knots, 2..TSDZ2_ASSIST_KNOTS
+//     u8        nc, cadence knots, 2..TSDZ2_ASSIST_KNOTS
+//     nt times  u16 pedal torque (0.1 Nm), u16 motor current (mA)
+//     nc times  u8 cadence (rpm), u8 gain (%)
+// Knots must increase strictly. Writing only the level byte selects the
+// level that reads return; a curve write selects its own level.
+
+#include <stdint.h>
+#include "sdkconfig.h"
+#include "tsdz2_assist.h"
+
+#define ASSIST_CURVE_MIN 1
+#define ASSIST_CURVE_MAX (4 + TSDZ2_ASSIST_KNOTS * 6)
+
+typedef struct {
+    uint32_t version;   // of the curves compiled
+    tsdz2_assist_table_t level[TSDZ2_ASSIST_LEVELS];
+} assist_tables_t;
+
+#if CONFIG_APP_ASSIST
+
+// Host task: the assist curve characteristic. Return 0 or a BLE_ATT_ERR_*
+// code; on_read returns the length it filled, up to ASSIST_CURVE_MAX.
+int assist_on_write(const uint8_t* buf, uint16_t len);
+int assist_on_read(uint8_t* buf);
+
+// Owner of t only. Call with t zeroed the first time.
+void assist_tables_refresh(assist_tables_t* t);
+
+// Call after NVS is initialised.
+void assist_init(void);
+
+#else
+
+static inline void assist_tables_refresh(assist_tables_t* t) {}
+static inline void assist_init(void) {}
+
+#endif // CONFIG_APP_ASSIST
+
+// Motor current target for a level, 0 when off.
+static inline uint16_t assist_current_ma(const assist_tables_t* t,
+                                         uint8_t level, uint32_t torque_mnm,
+                                         uint8_t cadence_rpm) {
+    if (level == 0 || level > TSDZ2_ASSIST_LEVELS) {
+        return 0;
+    }
+    return tsdz2_assist_current_ma(&t->level[level - 1], torque_mnm,
+                                   cadence_rpm);
+}
+
+#endif // ASSIST
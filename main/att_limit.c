@@ -0,0 +1,183 @@
+#include "att_limit.h"
+
+#if CONFIG_APP_ATT_LIMIT
+
+#include "esp_console.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "host/ble_hs.h"
+
+#define TAG "ATT_LIMIT"
+#define MAX_CONNS CONFIG_BT_NIMBLE_MAX_CONNECTIONS
+
+// Tokens are kept in thousandths so slow rates still refill smoothly.
+#define MILLI 1000
+
+typedef struct {
+    uint32_t rate;      // tokens per second
+    uint32_t burst;     // bucket depth in tokens
+    uint32_t milli;     // tokens * MILLI
+    int64_t refill_us;
+} bucket_t;
+
+typedef struct {
+    bool in_use;
+    bucket_t reads;
+    bucket_t writes;
+    att_limit_conn_stats_t stats;
+} limit_conn_t;
+
+// Written only by the host task.
+static limit_conn_t g_conns[MAX_CONNS];
+
+// Shared by every connection and taken from any task.
+static portMUX_TYPE g_notify_lock = portMUX_INITIALIZER_UNLOCKED;
+static bucket_t g_notify_pool;
+static att_limit_stats_t g_stats;
+
+static void bucket_init(bucket_t* b, uint32_t rate, uint32_t burst,
+                        int64_t now) {
+    b->rate = rate;
+    b->burst = burst;
+    b->milli = burst * MILLI;
+    b->refill_us = now;
+}
+
+static bool bucket_take(bucket_t* b, int64_t now) {
+    int64_t elapsed = now - b->refill_us;
+    uint64_t add = (uint64_t)elapsed * b->rate / (1000000 / MILLI);
+    uint32_t cap = b->burst * MILLI;
+
+    // Only advance the refill time by what was credited, so the remainder
+    // of a partial token is not lost between frequent calls.
+    if (add > 0) {
+        b->refill_us += (int64_t)(add * (1000000 / MILLI) / b->rate);
+        b->milli = add >= cap - b->milli ? cap : b->milli + add;
+        if (b->milli == cap) {
+            b->refill_us = now;
+        }
+    }
+    if (b->milli < MILLI) {
+        return false;
+    }
+    b->milli -= MILLI;
+    return true;
+}
+
+static limit_conn_t* find_conn(uint16_t conn_handle) {
+    for (int i = 0; i < MAX_CONNS; i++) {
+        if (g_conns[i].in_use && g_conns[i].stats.conn_handle == conn_handle) {
+            return &g_conns[i];
+        }
+    }
+    return NULL;
+}
+
+void att_limit_on_connect(uint16_t conn_handle) {
+    int64_t now = esp_timer_get_time();
+    for (int i = 0; i < MAX_CONNS; i++) {
+        limit_conn_t* c = &g_conns[i];
+        if (!c->in_use) {
+            *c = (limit_conn_t){
+                .in_use = true,
+                .stats = {.conn_handle = conn_handle},
+            };
+            bucket_init(&c->reads, CONFIG_APP_ATT_READ_RATE,
+                        CONFIG_APP_ATT_BURST, now);
+            bucket_init(&c->writes, CONFIG_APP_ATT_WRITE_RATE,
+                        CONFIG_APP_ATT_BURST, now);
+            return;
+        }
+    }
+}
+
+void att_limit_on_disconnect(uint16_t conn_handle) {
+    limit_conn_t* c = find_conn(conn_handle);
+    if (c != NULL) {
+        ESP_LOGI(TAG, "conn %d: %u reads (%u throttled), %u writes "
+                 "(%u throttled)", conn_handle, c->stats.reads,
+                 c->stats.reads_throttled, c->stats.writes,
+                 c->stats.writes_throttled);
+        c->in_use = false;
+    }
+}
+
+int att_limit_access(uint16_t conn_handle, bool write) {
+    limit_conn_t* c = find_conn(conn_handle);
+    if (c == NULL) {
+        return 0;
+    }
+    bucket_t* b = write ? &c->writes : &c->reads;
+    if (!bucket_take(b, esp_timer_get_time())) {
+        if (write) {
+            c->stats.writes_throttled++;
+        } else {
+            c->stats.reads_throttled++;
+        }
+        return BLE_ATT_ERR_INSUFFICIENT_RES;
+    }
+    if (write) {
+        c->stats.writes++;
+    } else {
+        c->stats.reads++;
+    }
+    return 0;
+}
+
+bool att_limit_notify(uint16_t conn_handle) {
+    // A notification holds at least one mbuf until the controller has sent
+    // it; leave a reserve for ATT responses and the host's own traffic.
+    bool low_mbuf = os_msys_num_free() <= CONFIG_APP_ATT_MBUF_RESERVE;
+    bool ok = false;
+
+    portENTER_CRITICAL(&g_notify_lock);
+    if (low_mbuf) {
+        g_stats.notifies_low_mbuf++;
+    } else if (!bucket_take(&g_notify_pool, esp_timer_get_time())) {
+        g_stats.notifies_throttled++;
+    } else {
+        g_stats.notifies++;
+        ok = true;
+    }
+    portEXIT_CRITICAL(&g_notify_lock);
+    return ok;
+}
+
+void att_limit_get_stats(att_limit_stats_t* stats) {
+    portENTER_CRITICAL(&g_notify_lock);
+    *stats = g_stats;
+    portEXIT_CRITICAL(&g_notify_lock);
+}
+
+static int attlimit_cmd_handler(int argc, char *argv[]) {
+    att_limit_stats_t stats;
+    att_limit_get_stats(&stats);
+    ESP_LOGI(TAG, "notify: %u sent, %u throttled, %u dropped at mbuf reserve "
+             "(%d free)", stats.notifies, stats.notifies_throttled,
+             stats.notifies_low_mbuf, os_msys_num_free());
+    for (int i = 0; i < MAX_CONNS; i++) {
+        const limit_conn_t* c = &g_conns[i];
+        if (c->in_use) {
+            ESP_LOGI(TAG, "conn %d: %u reads (%u throttled), %u writes "
+                     "(%u throttled)", c->stats.conn_handle, c->stats.reads,
+                     c->stats.reads_throttled, c->stats.writes,
+                     c->stats.writes_throttled);
+        }
+    }
+    return 0;
+}
+
+static const esp_console_cmd_t g_attlimit_cmd = {
+    .command = "attlimit",
+    .help = "Print per-connection and notification throttling counters",
+    .func = attlimit_cmd_handler,
+};
+
+void att_limit_init(void) {
+    bucket_init(&g_notify_pool, CONFIG_APP_ATT_NOTIFY_RATE,
+                CONFIG_APP_ATT_NOTIFY_BURST, esp_timer_get_time());
+    esp_console_cmd_register(&g_attlimit_cmd);
+}
+
+#endif // CONFIG_APP_ATT_LIMIT
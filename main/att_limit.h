@@ -0,0 +1,62 @@
+#ifndef ATT_LIMIT
+#define ATT_LIMIT
+
+// ATT rate limiting and notification backpressure.
+//
+// Every connection gets a token bucket for reads and one for writes, checked
+// before a characteristic access is dispatched, so a central flooding the
+// LED characteristics is answered with an error instead of filling the
+// control ring and taking the host task's time away from everyone else.
+// Notifications draw on one credit pool shared by all connections and are
+// refused while the msys mbuf pool is down to its reserve, so queued
+// notifications to a slow peer cannot starve the host of buffers.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "sdkconfig.h"
+
+typedef struct {
+    uint16_t conn_handle;
+    uint32_t reads;
+    uint32_t writes;
+    uint32_t reads_throttled;
+    uint32_t writes_throttled;
+} att_limit_conn_stats_t;
+
+typedef struct {
+    uint32_t notifies;
+    uint32_t notifies_throttled; // no credit left
+    uint32_t notifies_low_mbuf;  // mbuf pool at its reserve
+} att_limit_stats_t;
+
+#if CONFIG_APP_ATT_LIMIT
+
+void att_limit_init(void);
+
+// Host task callbacks.
+void att_limit_on_connect(uint16_t conn_handle);
+void att_limit_on_disconnect(uint16_t conn_handle);
+
+// Called from the access callback in the host task before the operation is
+// served. Returns 0, or the ATT error to answer with.
+int att_limit_access(uint16_t conn_handle, bool write);
+
+// Takes one notification credit; returns false if the notification should
+// be dropped. Callable from any task.
+bool att_limit_notify(uint16_t conn_handle);
+
+void att_limit_get_stats(att_limit_stats_t* stats);
+
+#else
+
+static inline void att_limit_init(void) {}
+static inline void att_limit_on_connect(uint16_t conn_handle) {}
+static inline void att_limit_on_disconnect(uint16_t conn_handle) {}
+static inline int att_limit_access(uint16_t conn_handle, bool write) {
+    return 0;
+}
+static inline bool att_limit_notify(uint16_t conn_handle) { return true; }
+
+#endif // CONFIG_APP_ATT_LIMIT
+
+#endif // ATT_LIMIT
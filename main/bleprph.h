@@ -24,6 +24,7 @@
 #include "nimble/ble.h"
 #include "modlog/modlog.h"
 #include "esp_peripheral.h"
+#include "gatt_svr_schema.h"
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -38,9 +39,21 @@ struct ble_gatt_register_ctxt;
 #define GATT_SVR_CHR_SUP_UNR_ALERT_CAT_UUID   0x2A48
 #define GATT_SVR_CHR_UNR_ALERT_STAT_UUID      0x2A45
 #define GATT_SVR_CHR_ALERT_NOT_CTRL_PT        0x2A44
+#define GATT_SVR_SVC_CYCLING_POWER_UUID       0x1818
+#define GATT_SVR_SVC_CSC_UUID                 0x1816
+
+/** Dispatch slot of every schema characteristic. */
+enum gatt_svr_chr_id {
+#define GATT_SVR_CHR_ENUM(id_, ...) GATT_SVR_CHR_##id_,
+    GATT_SVR_CHRS(GATT_SVR_CHR_ENUM)
+#undef GATT_SVR_CHR_ENUM
+    GATT_SVR_CHR_COUNT,
+};
 
 void gatt_svr_register_cb(struct ble_gatt_register_ctxt *ctxt, void *arg);
 int gatt_svr_init(void);
+uint16_t gatt_svr_chr_val_handle(enum gatt_svr_chr_id id);
+void gatt_svr_on_disconnect(uint16_t conn_handle);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,59 @@
+#include "boot_prof.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+static const char *tag = "BOOT";
+
+static const char *const g_phase_names[BOOT_PHASE_COUNT] = {
+    [BOOT_APP_MAIN] = "app_main",
+    [BOOT_LED_TASK_STARTED] = "led task",
+    [BOOT_NVS_READY] = "nvs",
+    [BOOT_NIMBLE_READY] = "nimble init",
+    [BOOT_GATT_READY] = "gatt/store",
+    [BOOT_HOST_STARTED] = "host task",
+    [BOOT_CONSOLE_READY] = "console",
+    [BOOT_LED_STRIP_READY] = "led strip",
+    [BOOT_SYNCED] = "host sync",
+    [BOOT_ADVERTISING] = "advertising",
+};
+
+// Zero means "not reached"; esp_timer is already running before app_main.
+static int64_t g_marks[BOOT_PHASE_COUNT];
+
+void boot_mark(boot_phase_t phase) {
+    if (phase < BOOT_PHASE_COUNT && g_marks[phase] == 0) {
+        g_marks[phase] = esp_timer_get_time();
+    }
+}
+
+void boot_report(void) {
+    int order[BOOT_PHASE_COUNT];
+    int n = 0;
+    int64_t prev = 0;
+
+    // Phases in other tasks overlap app_main's, so list them in the order
+    // they were reached; each delta is then time since the previous mark,
+    // whichever task set it.
+    for (int i = 0; i < BOOT_PHASE_COUNT; i++) {
+        if (g_marks[i] == 0) {
+            continue;
+        }
+        int j = n++;
+        for (; j > 0 && g_marks[order[j - 1]] > g_marks[i]; j--) {
+            order[j] = order[j - 1];
+        }
+        order[j] = i;
+    }
+    for (int k = 0; k < n; k++) {
+        int i = order[k];
+        ESP_LOGI(tag, "%-12s %7lld us (+%lld us)", g_phase_names[i],
+                 (long long)g_marks[i],
+                 (long long)(prev == 0 ? 0 : g_marks[i] - prev));
+        prev = g_marks[i];
+    }
+    for (int i = 0; i < BOOT_PHASE_COUNT; i++) {
+        if (g_marks[i] == 0) {
+            ESP_LOGI(tag, "%-12s        -", g_phase_names[i]);
+        }
+    }
+}
@@ -0,0 +1,30 @@
+#ifndef BOOT_PROF
+#define BOOT_PROF
+
+#include <stdint.h>
+
+// Startup milestones, in the order they are expected on a normal boot.
+// Phases that run in other tasks (LED strip, console) may complete out of order.
+typedef enum {
+    BOOT_APP_MAIN,
+    BOOT_LED_TASK_STARTED,
+    BOOT_NVS_READY,
+    BOOT_NIMBLE_READY,
+    BOOT_GATT_READY,
+    BOOT_HOST_STARTED,
+    BOOT_CONSOLE_READY,
+    BOOT_LED_STRIP_READY,
+    BOOT_SYNCED,
+    BOOT_ADVERTISING,
+    BOOT_PHASE_COUNT,
+} boot_phase_t;
+
+// Records the first time a phase is reached, in microseconds since boot.
+void boot_mark(boot_phase_t phase);
+
+// Logs every recorded phase in the order it was reached, with its absolute
+// time and the delta to the previous one, then the phases not reached.
+// Called once advertising has started.
+void boot_report(void);
+
+#endif // BOOT_PROF
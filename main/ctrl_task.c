@@ -0,0 +1,158 @@
+#include "ctrl_task.h"
+#include "app_tasks.h"
+#include "led_task.h"
+#include "spsc_ring.h"
+#include "esp_console.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/task.h"
+
+#define CTRL_MAX_ARGS 7
+#define CTRL_MAX_DELAY_MS 60000
+
+_Static_assert((APP_CTRL_QUEUE_LEN & (APP_CTRL_QUEUE_LEN - 1)) == 0,
+               "control queue length must be a power of two");
+
+typedef struct {
+    uint8_t op;
+    uint8_t args[CTRL_MAX_ARGS];
+    int64_t written_at;
+} ctrl_cmd_t;
+
+_Static_assert(sizeof(ctrl_cmd_t) == APP_CTRL_CMD_SIZE,
+               "APP_CTRL_CMD_SIZE out of date");
+
+static ctrl_cmd_t g_storage[APP_CTRL_QUEUE_LEN];
+static spsc_ring_t g_ring;
+static TaskHandle_t g_ctrl_task;
+
+// Written only by the control task.
+static uint32_t g_applied = 0;
+static uint32_t g_rate = 0;
+static uint32_t g_peak_rate = 0;
+// Written only by the producer.
+static uint32_t g_invalid = 0;
+
+static int ctrlstats_cmd_handler(int argc, char *argv[]) {
+    ctrl_stats_t stats;
+    getCtrlStats(&stats);
+    ESP_LOGI("CTRL", "accepted %u dropped %u invalid %u applied %u "
+             "max depth %u/%u rate %u/s peak %u/s",
+             stats.accepted, stats.dropped, stats.invalid, stats.applied,
+             stats.max_depth, APP_CTRL_QUEUE_LEN, stats.rate, stats.peak_rate);
+    return 0;
+}
+
+static const esp_console_cmd_t g_ctrlstats_cmd = {
+    .command = "ctrlstats",
+    .help = "Print control command queue statistics",
+    .func = ctrlstats_cmd_handler,
+};
+
+void initCtrl(void) {
+    spsc_ring_init(&g_ring, g_storage, sizeof(ctrl_cmd_t), APP_CTRL_QUEUE_LEN);
+    esp_console_cmd_register(&g_ctrlstats_cmd);
+}
+
+ctrl_status_t ctrlSubmit(const uint8_t* buf, uint16_t len) {
+    ctrl_cmd_t cmd = {0};
+    uint32_t delay;
+
+    if (len == 0 || len > 1 + CTRL_MAX_ARGS) {
+        g_invalid++;
+        return CTRL_ERR_INVALID;
+    }
+    cmd.op = buf[0];
+    switch (cmd.op) {
+        case CTRL_OP_SET_RGB:
+            if (len != 1 + 3) {
+                g_invalid++;
+                return CTRL_ERR_INVALID;
+            }
+            break;
+        case CTRL_OP_SET_COLOR:
+            if (len != 1 + 2 || buf[1] >= NO_COLOR) {
+                g_invalid++;
+                return CTRL_ERR_INVALID;
+            }
+            break;
+        case CTRL_OP_SET_DELAY:
+            if (len != 1 + 4) {
+                g_invalid++;
+                return CTRL_ERR_INVALID;
+            }
+            delay = buf[1] | buf[2] << 8 | buf[3] << 16 | (uint32_t)buf[4] << 24;
+            if (delay > CTRL_MAX_DELAY_MS) {
+                g_invalid++;
+                return CTRL_ERR_INVALID;
+            }
+            break;
+        default:
+            g_invalid++;
+            return CTRL_ERR_INVALID;
+    }
+    memcpy(cmd.args, buf + 1, len - 1);
+    cmd.written_at = esp_timer_get_time();
+
+    if (!spsc_ring_push(&g_ring, &cmd)) {
+        return CTRL_ERR_FULL;
+    }
+    if (g_ctrl_task != NULL) {
+        xTaskNotifyGive(g_ctrl_task);
+    }
+    return CTRL_OK;
+}
+
+static void applyCmd(const ctrl_cmd_t* cmd) {
+    switch (cmd->op) {
+        case CTRL_OP_SET_RGB:
+            setColors(cmd->args[0], cmd->args[1], cmd->args[2], cmd->written_at);
+            break;
+        case CTRL_OP_SET_COLOR:
+            setColor(cmd->args[0], cmd->args[1], cmd->written_at);
+            break;
+        case CTRL_OP_SET_DELAY:
+            setDelay(cmd->args[0] | cmd->args[1] << 8 | cmd->args[2] << 16 |
+                     (uint32_t)cmd->args[3] << 24, cmd->written_at);
+            break;
+        default:
+            break;
+    }
+}
+
+void runCtrlTask(void* pvParameters) {
+    ctrl_cmd_t cmd;
+    int64_t window_start = esp_timer_get_time();
+    uint32_t window_applied = 0;
+
+    g_ctrl_task = xTaskGetCurrentTaskHandle();
+
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(1000));
+        while (spsc_ring_pop(&g_ring, &cmd)) {
+            applyCmd(&cmd);
+            g_applied++;
+            window_applied++;
+        }
+
+        int64_t now = esp_timer_get_time();
+        if (now - window_start >= 1000000) {
+            g_rate = window_applied * 1000000LL / (now - window_start);
+            if (g_rate > g_peak_rate) {
+                g_peak_rate = g_rate;
+            }
+            window_applied = 0;
+            window_start = now;
+        }
+    }
+}
+
+void getCtrlStats(ctrl_stats_t* stats) {
+    stats->accepted = g_ring.pushed;
+    stats->dropped = g_ring.dropped;
+    stats->invalid = g_invalid;
+    stats->applied = g_applied;
+    stats->max_depth = g_ring.max_depth;
+    stats->rate = g_rate;
+    stats->peak_rate = g_peak_rate;
+}
@@ -0,0 +1,54 @@
+#ifndef CTRL_TASK
+#define CTRL_TASK
+
+#include <stdint.h>
+
+// High-rate control path. Commands arrive as write-without-response on the
+// control characteristic; the GATT handler only validates them and pushes
+// them into a lock-free SPSC ring, and the control task applies them.
+//
+// The control task is also the only writer of the LED settings; the
+// per-color and delay characteristics submit their writes here too.
+//
+// A write is acknowledged once it is queued, not once it is applied: the
+// write response (or, without response, the next packet) can reach the
+// central before the control task runs, and a read straight after may still
+// show the old value. On a full ring a write with response fails with
+// Insufficient Resources; one without response is dropped and counted.
+//
+// Wire format: one opcode byte followed by its payload.
+//     CTRL_OP_SET_RGB    red, green, blue (3 bytes)
+//     CTRL_OP_SET_DELAY  rainbow delay in ms, uint32 LE, at most 60000
+//     CTRL_OP_SET_COLOR  color_t index, value (2 bytes)
+
+typedef enum {
+    CTRL_OP_SET_RGB = 0x01,
+    CTRL_OP_SET_DELAY = 0x02,
+    CTRL_OP_SET_COLOR = 0x03,
+} ctrl_op_t;
+
+typedef enum {
+    CTRL_OK,
+    CTRL_ERR_INVALID, // unknown opcode, bad length or out-of-range value
+    CTRL_ERR_FULL,    // ring full; command dropped
+} ctrl_status_t;
+
+typedef struct {
+    uint32_t accepted;
+    uint32_t dropped;
+    uint32_t invalid;
+    uint32_t applied;
+    uint32_t max_depth;
+    uint32_t rate;      // commands applied per second, last full second
+    uint32_t peak_rate;
+} ctrl_stats_t;
+
+void initCtrl(void);
+void runCtrlTask(void* pvParameters);
+
+// Producer side; only ever called from the NimBLE host task.
+ctrl_status_t ctrlSubmit(const uint8_t* buf, uint16_t len);
+
+void getCtrlStats(ctrl_stats_t* stats);
+
+#endif // CTRL_TASK
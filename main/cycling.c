@@ -0,0 +1,302 @@
+#include <stdlib.h>
+#include <string.h>
+#include "cycling.h"
+#include "att_limit.h"
+#include "bleprph.h"
+#include "mailbox.h"
+#include "subs.h"
+#include "esp_console.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "host/ble_hs.h"
+#include "os/endian.h"
+#include "sdkconfig.h"
+
+#define CYCLING_NOTIFY_PERIOD_US (1000000 / CONFIG_APP_CYCLING_NOTIFY_HZ)
+
+// Cycling Power Measurement flags: wheel and crank revolution data present.
+#define CP_FLAG_WHEEL 0x0010
+#define CP_FLAG_CRANK 0x0020
+#define CP_MEAS_LEN   14
+// CSC Measurement flags.
+#define CSC_FLAG_WHEEL 0x01
+#define CSC_FLAG_CRANK 0x02
+#define CSC_MEAS_LEN   11
+
+// Revolutions integrated from a period: the count and the time of the last
+// whole revolution, which is what the measurements report.
+typedef struct {
+    uint32_t revs;
+    int64_t event_us;
+    int64_t phase_us; // time into the current revolution
+} rev_counter_t;
+
+typedef struct {
+    uint16_t power_w;
+    uint32_t crank_revs;
+    int64_t crank_event_us;
+    uint32_t wheel_revs;
+    int64_t wheel_event_us;
+} cycling_state_t;
+
+// Producer state, then the mailbox handing it to the notify timer.
+static rev_counter_t g_crank;
+static rev_counter_t g_wheel;
+static bool g_started;
+static timesync_stamp_t g_last_at;
+static int64_t g_clock_us;
+static cycling_state_t g_state_box_buf;
+static mailbox_t g_state_box;
+
+// "cycling sim": the console hands the rates over here and the producer
+// applies them on each of its samples, so revolutions keep counting between
+// commands. The producer is the capture task with sensors fitted, otherwise
+// the notify timer.
+typedef struct {
+    bool on;
+    cycling_sample_t sample;
+} cycling_sim_t;
+
+static cycling_sim_t g_sim_box_buf;
+static mailbox_t g_sim_box;
+
+static esp_timer_handle_t g_notify_timer;
+static bool g_notify_running;
+
+// Written only by the timer.
+static uint32_t g_cp_sent;
+static uint32_t g_csc_sent;
+static uint32_t g_failed;
+
+static void rev_counter_advance(rev_counter_t* c, uint32_t period_us,
+                                int64_t elapsed_us, int64_t now) {
+    if (period_us == 0) {
+        // Stopped: hold the last event time, start afresh when moving again.
+        c->phase_us = 0;
+        return;
+    }
+    c->phase_us += elapsed_us;
+    if (c->phase_us >= period_us) {
+        uint32_t n = c->phase_us / period_us;
+        c->revs += n;
+        c->phase_us -= (int64_t)n * period_us;
+        c->event_us = now - c->phase_us;
+    }
+}
+
+// Always integrates, even with nobody subscribed: the revolution counts are
+// cumulative and must not stall while the bike is moving. It is a handful of
+// arithmetic operations per sample; encoding and sending are what is skipped.
+//
+// Time comes from the sample stamps, so revolution times follow when the
+// motor measured rather than when this ran; the difference of two stamps is
+// valid across their wraparound. A sample stamped before the previous one
+// adds no time, rather than wrapping to 12 days of it.
+void cycling_update(const cycling_sample_t* sample) {
+#if CONFIG_APP_PULSE_CAPTURE
+    cycling_sim_t sim;
+    if (mailbox_version(&g_sim_box) != 0) {
+        mailbox_read(&g_sim_box, &sim);
+        if (sim.on) {
+            sim.sample.at = sample->at;
+            sample = &sim.sample;
+        }
+    }
+#endif
+    int64_t elapsed = 0;
+    if (!g_started) {
+        g_clock_us = (int64_t)sample->at * TIMESYNC_TICK_US;
+        g_last_at = sample->at;
+        g_started = true;
+    } else {
+        int32_t ticks = (int32_t)(sample->at - g_last_at);
+        if (ticks > 0) {
+            elapsed = (int64_t)ticks * TIMESYNC_TICK_US;
+            g_last_at = sample->at;
+        }
+    }
+    g_clock_us += elapsed;
+    int64_t now = g_clock_us;
+
+    uint32_t crank_period_us =
+        sample->cadence_rpm ? 60000000 / sample->cadence_rpm : 0;
+    rev_counter_advance(&g_crank, crank_period_us, elapsed, now);
+    rev_counter_advance(&g_wheel, sample->wheel_period_us, elapsed, now);
+
+    cycling_state_t state = {
+        .power_w = sample->power_w,
+        .crank_revs = g_crank.revs,
+        .crank_event_us = g_crank.event_us,
+        .wheel_revs = g_wheel.revs,
+        .wheel_event_us = g_wheel.event_us,
+    };
+    mailbox_publish(&g_state_box, &state);
+}
+
+// Event times roll over in units of 1/1024 s (1/2048 s for the CP wheel).
+static uint16_t event_time(int64_t us, uint32_t ticks_per_s) {
+    return (uint64_t)us * ticks_per_s / 1000000;
+}
+
+static void encode_cp(const cycling_state_t* s, uint8_t* buf) {
+    put_le16(buf + 0, CP_FLAG_WHEEL | CP_FLAG_CRANK);
+    put_le16(buf + 2, s->power_w);
+    put_le32(buf + 4, s->wheel_revs);
+    put_le16(buf + 8, event_time(s->wheel_event_us, 2048));
+    put_le16(buf + 10, s->crank_revs);
+    put_le16(buf + 12, event_time(s->crank_event_us, 1024));
+}
+
+static void encode_csc(const cycling_state_t* s, uint8_t* buf) {
+    buf[0] = CSC_FLAG_WHEEL | CSC_FLAG_CRANK;
+    put_le32(buf + 1, s->wheel_revs);
+    put_le16(buf + 5, event_time(s->wheel_event_us, 1024));
+    put_le16(buf + 7, s->crank_revs);
+    put_le16(buf + 9, event_time(s->crank_event_us, 1024));
+}
+
+static bool notify(uint16_t conn_handle, uint16_t val_handle,
+                   const uint8_t* buf, uint16_t len) {
+    if (!att_limit_notify(conn_handle)) {
+        return false; // counted by att_limit
+    }
+    // The host consumes the mbuf, so each subscriber gets its own copy of
+    // the shared encoding.
+    struct os_mbuf* om = ble_hs_mbuf_from_flat(buf, len);
+    if (om == NULL || ble_gatts_notify_custom(conn_handle, val_handle, om) != 0) {
+        g_failed++;
+        return false;
+    }
+    return true;
+}
+
+// Sends buf to every connection in mask; returns the number sent.
+static uint32_t notify_all(uint32_t mask, uint16_t val_handle,
+                           const uint8_t* buf, uint16_t len) {
+    uint32_t sent = 0;
+    while (mask != 0) {
+        int slot = __builtin_ctz(mask);
+        mask &= mask - 1;
+        sent += notify(subs_conn_handle(slot), val_handle, buf, len);
+    }
+    return sent;
+}
+
+#if !CONFIG_APP_PULSE_CAPTURE
+// Producer without sensors: the simulated rates while "cycling sim" is on,
+// a stopped bike otherwise. Only runs with the notify timer, so nothing is
+// counted while no one is subscribed; the next sample's stamp then covers
+// the whole gap.
+static void feed_sim(void) {
+    cycling_sim_t sim;
+    mailbox_read(&g_sim_box, &sim);
+    cycling_sample_t sample = sim.on ? sim.sample : (cycling_sample_t){ 0 };
+    sample.at = timesync_now();
+    cycling_update(&sample);
+}
+#endif
+
+static void notify_timer_cb(void* arg) {
+    uint32_t cp_mask = subs_conn_mask(GATT_SVR_CHR_CP_MEASUREMENT);
+    uint32_t csc_mask = subs_conn_mask(GATT_SVR_CHR_CSC_MEASUREMENT);
+    cycling_state_t state;
+    uint8_t cp[CP_MEAS_LEN];
+    uint8_t csc[CSC_MEAS_LEN];
+
+    if ((cp_mask | csc_mask) == 0) {
+        return;
+    }
+#if !CONFIG_APP_PULSE_CAPTURE
+    feed_sim();
+#endif
+    // Encode each measurement once per cycle, and only if someone wants it.
+    mailbox_read(&g_state_box, &state);
+    if (cp_mask != 0) {
+        encode_cp(&state, cp);
+        g_cp_sent += notify_all(cp_mask,
+            gatt_svr_chr_val_handle(GATT_SVR_CHR_CP_MEASUREMENT), cp, sizeof(cp));
+    }
+    if (csc_mask != 0) {
+        encode_csc(&state, csc);
+        g_csc_sent += notify_all(csc_mask,
+            gatt_svr_chr_val_handle(GATT_SVR_CHR_CSC_MEASUREMENT), csc, sizeof(csc));
+    }
+}
+
+// Subscription watcher: runs the timer only while either measurement has a
+// subscriber.
+static void on_subs_change(enum gatt_svr_chr_id id, bool active) {
+    bool any = subs_any(GATT_SVR_CHR_CP_MEASUREMENT) ||
+               subs_any(GATT_SVR_CHR_CSC_MEASUREMENT);
+
+    if (any && !g_notify_running) {
+        ESP_ERROR_CHECK(esp_timer_start_periodic(g_notify_timer,
+                                                 CYCLING_NOTIFY_PERIOD_US));
+        g_notify_running = true;
+    } else if (!any && g_notify_running) {
+        esp_timer_stop(g_notify_timer);
+        g_notify_running = false;
+    }
+}
+
+void cycling_get_stats(cycling_stats_t* stats) {
+    stats->subscribers =
+        __builtin_popcount(subs_conn_mask(GATT_SVR_CHR_CP_MEASUREMENT) |
+                           subs_conn_mask(GATT_SVR_CHR_CSC_MEASUREMENT));
+    stats->cp_sent = g_cp_sent;
+    stats->csc_sent = g_csc_sent;
+    stats->failed = g_failed;
+}
+
+static int cycling_cmd_handler(int argc, char *argv[]) {
+    if (argc == 3 && strcmp(argv[1], "sim") == 0 &&
+        strcmp(argv[2], "off") == 0) {
+        cycling_sim_t sim = { .on = false };
+        mailbox_publish(&g_sim_box, &sim);
+        return 0;
+    }
+    if (argc == 5 && strcmp(argv[1], "sim") == 0) {
+        cycling_sim_t sim = {
+            .on = true,
+            .sample = {
+                .power_w = atoi(argv[2]),
+                .cadence_rpm = atoi(argv[3]),
+                // Given in ms.
+                .wheel_period_us = atoi(argv[4]) * 1000,
+            },
+        };
+        mailbox_publish(&g_sim_box, &sim);
+        return 0;
+    }
+    cycling_stats_t stats;
+    cycling_get_stats(&stats);
+    ESP_LOGI("CYCLING", "subscribers %u sent cp %u csc %u failed %u",
+             stats.subscribers, stats.cp_sent, stats.csc_sent, stats.failed);
+    return 0;
+}
+
+static const esp_console_cmd_t g_cycling_cmd = {
+    .command = "cycling",
+#if CONFIG_APP_PULSE_CAPTURE
+    .help = "Print notification stats, or 'sim <W> <rpm> <wheel ms>' to "
+            "report those rates instead of the sensors' until 'sim off'",
+#else
+    .help = "Print notification stats, or 'sim <W> <rpm> <wheel ms>' to "
+            "report those rates until 'sim off'",
+#endif
+    .func = cycling_cmd_handler,
+};
+
+void cycling_init(void) {
+    mailbox_init(&g_state_box, &g_state_box_buf, sizeof(g_state_box_buf));
+    mailbox_init(&g_sim_box, &g_sim_box_buf, sizeof(g_sim_box_buf));
+
+    const esp_timer_create_args_t args = {
+        .callback = notify_timer_cb,
+        .name = "cycling",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&args, &g_notify_timer));
+    subs_watch(GATT_SVR_CHR_CP_MEASUREMENT, on_subs_change);
+    subs_watch(GATT_SVR_CHR_CSC_MEASUREMENT, on_subs_change);
+    esp_console_cmd_register(&g_cycling_cmd);
+}
@@ -0,0 +1,57 @@
+#ifndef CYCLING
+#define CYCLING
+
+// Cycling Power (0x1818) and Cycling Speed and Cadence (0x1816) measurements.
+//
+// The producer reports rates with cycling_update(); this module integrates
+// them into the cumulative revolution counts and event times the services
+// expect. One periodic timer at CONFIG_APP_CYCLING_NOTIFY_HZ, running only
+// while the subscription registry (subs.h) reports a subscriber, encodes
+// each measurement once per cycle and sends a copy to every connection
+// subscribed to it; all subscribers share its rate and phase.
+//
+// Sources: speed and cadence come from the magnet sensors when
+// CONFIG_APP_PULSE_CAPTURE is on. Nothing measures power: the stock motor
+// link the proxy forwards carries no torque, cadence or power, so power,
+// and without the sensors speed and cadence too, are only ever what
+// "cycling sim" sets. On a bike without it, CP reports 0 W.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "timesync.h"
+
+// Cycling Power Feature: wheel and crank revolution data supported.
+#define CYCLING_CP_FEATURES    0x0000000C
+// CSC Feature: wheel and crank revolution data supported.
+#define CYCLING_CSC_FEATURES   0x0003
+// Sensor Location: spider, the closest match for a bottom bracket motor.
+#define CYCLING_SENSOR_SPIDER  15
+// GAP Appearance: cycling power sensor.
+#define CYCLING_APPEARANCE     0x0484
+
+typedef struct {
+    uint16_t power_w;        // instantaneous rider + motor power
+    uint8_t cadence_rpm;     // 0 when not pedalling
+    uint32_t wheel_period_us; // time per wheel revolution, 0 when stopped
+    timesync_stamp_t at;     // timesync_now() when measured
+} cycling_sample_t;
+
+typedef struct {
+    uint32_t subscribers;     // connections subscribed to either measurement
+    uint32_t cp_sent;
+    uint32_t csc_sent;
+    uint32_t failed;          // notifications the host could not queue
+} cycling_stats_t;
+
+// Call after subs_init().
+void cycling_init(void);
+
+// Single producer: the speed and cadence capture task when magnet sensors
+// are fitted (pulse_capture.h), otherwise the notify timer. "cycling sim"
+// only hands its rates to the producer, which reports them in place of its
+// own until "cycling sim off"; the timer's own are a stopped bike.
+void cycling_update(const cycling_sample_t* sample);
+
+void cycling_get_stats(cycling_stats_t* stats);
+
+#endif // CYCLING
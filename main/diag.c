@@ -0,0 +1,182 @@
+#include <stdatomic.h>
+#include <string.h>
+#include "diag.h"
+
+#if CONFIG_APP_DIAG
+
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "host/ble_hs.h"
+#include "os/endian.h"
+#include "os/os_mbuf.h"
+
+#define RUN_TIME_STATS \
+    (CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS && CONFIG_FREERTOS_USE_TRACE_FACILITY)
+#define MAX_CONNS CONFIG_BT_NIMBLE_MAX_CONNECTIONS
+
+// A read in progress goes stale if its next piece is this late, so a client
+// that gave up halfway does not get an old snapshot on its next read.
+#define LATCH_TIMEOUT_US 2000000
+
+// Host task only: one snapshot per connection, latched at offset 0.
+typedef struct {
+    bool in_use;
+    uint16_t conn_handle;
+    uint16_t len;
+    uint16_t next_offset; // 0 when the next request starts a new read
+    int64_t at;
+    uint8_t buf[DIAG_SNAPSHOT_MAX];
+} diag_latch_t;
+
+snapshot_t diag_snap;
+static uint8_t g_snap_buf[2 * DIAG_SNAPSHOT_MAX];
+static _Atomic uint32_t g_conns;
+static diag_latch_t g_latches[MAX_CONNS];
+
+// Diag task only.
+static uint32_t g_built;
+#if RUN_TIME_STATS
+static uint32_t g_last_run_time[SYSMON_MAX_TASKS];
+static uint32_t g_last_total;
+#endif
+
+static void put_task(uint8_t* rec, int i, uint32_t elapsed) {
+    uint32_t stack_size;
+    TaskHandle_t task = sysmon_task(i, &stack_size);
+    uint16_t cpu = DIAG_CPU_UNKNOWN;
+    uint32_t run_time = 0;
+    uint8_t prio;
+    uint8_t state;
+    uint32_t stack_free;
+
+#if RUN_TIME_STATS
+    TaskStatus_t status;
+    vTaskGetInfo(task, &status, pdTRUE, eInvalid);
+    run_time = status.ulRunTimeCounter;
+    if (elapsed > 0) {
+        cpu = (uint64_t)(run_time - g_last_run_time[i]) * 1000 / elapsed;
+    }
+    g_last_run_time[i] = run_time;
+    prio = status.uxCurrentPriority;
+    state = status.eCurrentState;
+    stack_free = status.usStackHighWaterMark;
+#else
+    prio = uxTaskPriorityGet(task);
+    state = eTaskGetState(task);
+    stack_free = uxTaskGetStackHighWaterMark(task);
+#endif
+
+    memset(rec, 0, 8);
+    strncpy((char*)rec, pcTaskGetName(task), 8);
+    put_le32(rec + 8, run_time);
+    put_le16(rec + 12, cpu);
+    put_le16(rec + 14, stack_size);
+    put_le16(rec + 16, stack_free);
+    rec[18] = prio;
+    rec[19] = state;
+}
+
+// Builds the whole snapshot off the read path; readers only ever copy it.
+static void build(void) {
+    uint8_t* p = snapshot_back(&diag_snap);
+    int n = sysmon_task_count();
+    uint32_t elapsed = 0;
+
+#if RUN_TIME_STATS
+    uint32_t total = portGET_RUN_TIME_COUNTER_VALUE();
+    elapsed = total - g_last_total;
+    g_last_total = total;
+#endif
+
+    p[0] = DIAG_VERSION;
+    p[1] = n;
+    p[2] = atomic_load_explicit(&g_conns, memory_order_relaxed);
+    p[3] = RUN_TIME_STATS ? DIAG_FLAG_RUN_TIME : 0;
+    put_le32(p + 4, ++g_built);
+    put_le32(p + 8, esp_timer_get_time() / 1000);
+    put_le32(p + 12, heap_caps_get_free_size(MALLOC_CAP_DEFAULT));
+    put_le32(p + 16, heap_caps_get_minimum_free_size(MALLOC_CAP_DEFAULT));
+    put_le16(p + 20, os_msys_num_free());
+    put_le16(p + 22, os_msys_count());
+    for (int i = 0; i < n; i++) {
+        put_task(p + DIAG_HEADER_LEN + i * DIAG_TASK_RECORD_LEN, i, elapsed);
+    }
+    snapshot_commit(&diag_snap, DIAG_HEADER_LEN + n * DIAG_TASK_RECORD_LEN);
+}
+
+void diag_task(void* param) {
+    TickType_t wake = xTaskGetTickCount();
+    while (true) {
+        build();
+        vTaskDelayUntil(&wake, pdMS_TO_TICKS(CONFIG_APP_DIAG_PERIOD_MS));
+    }
+}
+
+static diag_latch_t* find_latch(uint16_t conn_handle) {
+    for (int i = 0; i < MAX_CONNS; i++) {
+        if (g_latches[i].in_use && g_latches[i].conn_handle == conn_handle) {
+            return &g_latches[i];
+        }
+    }
+    return NULL;
+}
+
+void diag_on_connect(uint16_t conn_handle) {
+    atomic_fetch_add(&g_conns, 1);
+    for (int i = 0; i < MAX_CONNS; i++) {
+        if (!g_latches[i].in_use) {
+            g_latches[i] = (diag_latch_t){
+                .in_use = true,
+                .conn_handle = conn_handle,
+            };
+            return;
+        }
+    }
+}
+
+void diag_on_disconnect(uint16_t conn_handle) {
+    diag_latch_t* l = find_latch(conn_handle);
+    if (l != NULL) {
+        l->in_use = false;
+    }
+    atomic_fetch_sub(&g_conns, 1);
+}
+
+int diag_on_read(uint16_t conn_handle, struct os_mbuf* om) {
+    diag_latch_t* l = find_latch(conn_handle);
+    int64_t now = esp_timer_get_time();
+    const uint8_t* data;
+    uint32_t seq;
+
+    if (l == NULL) {
+        return BLE_ATT_ERR_UNLIKELY;
+    }
+    if (l->next_offset == 0 || now - l->at > LATCH_TIMEOUT_US) {
+        do {
+            seq = snapshot_read_begin(&diag_snap, &data, &l->len);
+            memcpy(l->buf, data, l->len);
+        } while (snapshot_read_retry(&diag_snap, seq));
+        l->next_offset = 0;
+    }
+    if (os_mbuf_append(om, l->buf, l->len) != 0) {
+        return BLE_ATT_ERR_INSUFFICIENT_RES;
+    }
+    // Read and Read Blob responses carry up to MTU - 1 bytes of the value,
+    // and the client goes on until one is short of that: a value that is an
+    // exact multiple still gets a last, empty request at offset len.
+    l->next_offset += ble_att_mtu(conn_handle) - 1;
+    if (l->next_offset > l->len) {
+        l->next_offset = 0;
+    }
+    l->at = now;
+    return 0;
+}
+
+void diag_init(void) {
+    atomic_init(&g_conns, 0);
+    snapshot_init(&diag_snap, g_snap_buf, DIAG_SNAPSHOT_MAX);
+}
+
+#endif // CONFIG_APP_DIAG
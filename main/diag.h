@@ -0,0 +1,78 @@
+#ifndef DIAG
+#define DIAG
+
+// Diagnostics snapshot served by the diagnostics GATT service.
+//
+// A low-priority task rebuilds the snapshot every CONFIG_APP_DIAG_PERIOD_MS
+// from the tasks registered with sysmon, encoding it straight into the back
+// buffer of diag_snap, so a read only copies the latest one out.
+// tools/diag_decode.py decodes it.
+//
+// Below an MTU of DIAG_SNAPSHOT_MAX + 1 the client reads the snapshot in
+// pieces with Read Blob, and a new snapshot may be published between them.
+// So each connection latches a copy when a read starts at offset 0 and
+// serves the rest of that read from it; see diag_on_read().
+//
+// Wire format, little-endian:
+//     0  u8   version (DIAG_VERSION)
+//     1  u8   task record count
+//     2  u8   connections
+//     3  u8   flags (DIAG_FLAG_*)
+//     4  u32  snapshots built since boot
+//     8  u32  uptime, ms
+//    12  u32  free heap, bytes
+//    16  u32  minimum free heap since boot, bytes
+//    20  u16  free msys mbufs
+//    22  u16  msys mbufs in total
+//    24  task records of DIAG_TASK_RECORD_LEN bytes:
+//         0  char[8] name, NUL-padded and truncated
+//         8  u32  run-time counter (FreeRTOS run-time stats units)
+//        12  u16  CPU use over the last period, per mille of one core
+//        14  u16  stack size, bytes
+//        16  u16  minimum free stack since start, bytes
+//        18  u8   priority
+//        19  u8   state (eTaskState)
+
+#include <stdint.h>
+#include "sdkconfig.h"
+#include "snapshot.h"
+#include "sysmon.h"
+
+#define DIAG_VERSION 1
+#define DIAG_HEADER_LEN 24
+#define DIAG_TASK_RECORD_LEN 20
+#define DIAG_SNAPSHOT_MAX (DIAG_HEADER_LEN + SYSMON_MAX_TASKS * DIAG_TASK_RECORD_LEN)
+
+// Run-time counter and CPU fields are valid (FreeRTOS run-time stats on).
+#define DIAG_FLAG_RUN_TIME 0x01
+
+#define DIAG_CPU_UNKNOWN 0xFFFF
+
+#if CONFIG_APP_DIAG
+
+extern snapshot_t diag_snap;
+
+void diag_init(void);
+void diag_task(void* param);
+
+// Host task callbacks.
+void diag_on_connect(uint16_t conn_handle);
+void diag_on_disconnect(uint16_t conn_handle);
+
+// Host task: appends the snapshot to om for a read of the characteristic.
+// NimBLE hands the callback no offset; it takes the piece it needs from the
+// whole value. This tracks the offset the connection's next request should
+// have from the ATT MTU, latching a fresh copy when it is back at 0. Returns
+// 0 or a BLE_ATT_ERR_* code.
+struct os_mbuf;
+int diag_on_read(uint16_t conn_handle, struct os_mbuf* om);
+
+#else
+
+static inline void diag_init(void) {}
+static inline void diag_on_connect(uint16_t conn_handle) {}
+static inline void diag_on_disconnect(uint16_t conn_handle) {}
+
+#endif // CONFIG_APP_DIAG
+
+#endif // DIAG
@@ -0,0 +1,198 @@
+#ifndef EVBUS
+#define EVBUS
+
+// Statically sized publish/subscribe topics.
+//
+// A topic is a ring of fixed-size events with exactly one writer and any
+// number of readers. The writer never blocks and never looks at readers: it
+// overwrites the oldest event when the ring is full. Each reader keeps its
+// own position and consumes at its own pace, either in place (peek, use,
+// done) or by copying out; one that falls more than a ring behind skips
+// ahead and counts what it lost. Nothing allocates or takes a lock, so
+// publishing is safe from the host task, a timer callback or an ISR.
+//
+// Each slot carries the number of the event it holds; a reader checks it
+// again after using the event, which tells it whether the writer came round
+// and overwrote the slot meanwhile.
+//
+// This is one of four single-writer primitives; pick by what readers need:
+//     mailbox.h    the latest value of a struct, any number of readers;
+//                  intermediate values do not matter (stats, estimates).
+//     snapshot.h   the latest value, already in wire format, for GATT
+//                  reads that must copy bytes and never wait.
+//     spsc_ring.h  every item, in order, to exactly one consumer; the
+//                  producer learns when it is full (control commands).
+//     evbus.h      every event, to several readers at their own pace; a
+//                  reader that falls a ring behind loses the oldest.
+//
+// Define a topic once, in the module that publishes it:
+//     EVBUS_TOPIC_DEFINE(led_settings_topic, led_settings_t, 8);
+// declare it where it is read:
+//     EVBUS_TOPIC_DECLARE(led_settings_topic, led_settings_t);
+// and read it with a typed reader:
+//     evbus_reader_t r;
+//     evbus_reader_init(&r, &led_settings_topic);
+//     const led_settings_t* ev;
+//     while ((ev = led_settings_topic_peek(&r)) != NULL) {
+//         ...use *ev...
+//         if (!evbus_done(&r)) { ...the writer overwrote it, discard... }
+//     }
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+typedef struct {
+    const char* name;
+    uint8_t* buf;
+    _Atomic uint32_t* stamps; // per slot: number of the event held, plus 1
+    uint32_t elem_size;
+    uint32_t mask;
+    _Atomic uint32_t head;    // events published
+} evbus_topic_t;
+
+typedef struct {
+    evbus_topic_t* topic;
+    uint32_t next; // number of the next event to consume
+    uint32_t lost; // overwritten before this reader got to them
+} evbus_reader_t;
+
+#define EVBUS_TOPIC_DEFINE(name_, type_, capacity_)                          \
+    _Static_assert((capacity_) >= 2 &&                                      \
+                   ((capacity_) & ((capacity_) - 1)) == 0,                  \
+                   #name_ " capacity must be a power of two, at least 2");  \
+    static type_ name_##_slots[capacity_];                                  \
+    static _Atomic uint32_t name_##_stamps[capacity_];                      \
+    evbus_topic_t name_ = {                                                 \
+        .name = #name_,                                                     \
+        .buf = (uint8_t*)name_##_slots,                                     \
+        .stamps = name_##_stamps,                                           \
+        .elem_size = sizeof(type_),                                         \
+        .mask = (capacity_) - 1,                                            \
+    }
+
+#define EVBUS_TOPIC_DECLARE(name_, type_)                                   \
+    extern evbus_topic_t name_;                                             \
+    static inline void name_##_publish(const type_* ev) {                   \
+        evbus_publish(&name_, ev);                                          \
+    }                                                                       \
+    static inline const type_* name_##_peek(evbus_reader_t* r) {            \
+        return (const type_*)evbus_peek(r);                                 \
+    }                                                                       \
+    static inline bool name_##_read(evbus_reader_t* r, type_* ev) {         \
+        type_ tmp;                                                          \
+        if (!evbus_read(r, &tmp)) {                                         \
+            return false;                                                   \
+        }                                                                   \
+        *ev = tmp;                                                          \
+        return true;                                                        \
+    }                                                                       \
+    static inline bool name_##_latest(type_* ev) {                          \
+        return evbus_latest(&name_, ev);                                    \
+    }
+
+/*** Writer. */
+
+// The slot the next event is built in; publish it with evbus_commit().
+static inline void* evbus_claim(evbus_topic_t* t) {
+    uint32_t n = atomic_load_explicit(&t->head, memory_order_relaxed);
+    uint32_t slot = n & t->mask;
+    // Readers still on the event this slot held must see it invalidated
+    // before any of the new bytes.
+    atomic_store_explicit(&t->stamps[slot], 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    return t->buf + slot * t->elem_size;
+}
+
+static inline void evbus_commit(evbus_topic_t* t) {
+    uint32_t n = atomic_load_explicit(&t->head, memory_order_relaxed);
+    atomic_store_explicit(&t->stamps[n & t->mask], n + 1, memory_order_release);
+    atomic_store_explicit(&t->head, n + 1, memory_order_release);
+}
+
+static inline void evbus_publish(evbus_topic_t* t, const void* ev) {
+    memcpy(evbus_claim(t), ev, t->elem_size);
+    evbus_commit(t);
+}
+
+/*** Readers. */
+
+// Starts after the events already published.
+static inline void evbus_reader_init(evbus_reader_t* r, evbus_topic_t* t) {
+    r->topic = t;
+    r->next = atomic_load_explicit(&t->head, memory_order_acquire);
+    r->lost = 0;
+}
+
+// The next event, in place, or NULL if there is none yet. Valid until
+// evbus_done(), which must follow before the next peek.
+static inline const void* evbus_peek(evbus_reader_t* r) {
+    evbus_topic_t* t = r->topic;
+    uint32_t head = atomic_load_explicit(&t->head, memory_order_acquire);
+
+    if (head == r->next) {
+        return NULL;
+    }
+    if (head - r->next > t->mask + 1) {
+        r->lost += head - r->next - (t->mask + 1);
+        r->next = head - (t->mask + 1);
+    }
+    return t->buf + (r->next & t->mask) * t->elem_size;
+}
+
+// Moves past the peeked event. Returns false, and counts it lost, if the
+// writer overwrote it while it was in use.
+static inline bool evbus_done(evbus_reader_t* r) {
+    evbus_topic_t* t = r->topic;
+    uint32_t n = r->next++;
+
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(&t->stamps[n & t->mask], memory_order_relaxed) !=
+        n + 1) {
+        r->lost++;
+        return false;
+    }
+    return true;
+}
+
+// Copies out the next event that is still intact. Returns false if there is
+// none, in which case *ev may hold part of an overwritten event; the typed
+// name_read() wrappers leave it untouched instead.
+static inline bool evbus_read(evbus_reader_t* r, void* ev) {
+    const void* p;
+
+    while ((p = evbus_peek(r)) != NULL) {
+        memcpy(ev, p, r->topic->elem_size);
+        if (evbus_done(r)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Copies the newest event without a reader. Returns false if nothing has
+// been published yet. The writer is always filling a different slot, so
+// this never waits on it.
+static inline bool evbus_latest(evbus_topic_t* t, void* ev) {
+    uint32_t head;
+
+    do {
+        head = atomic_load_explicit(&t->head, memory_order_acquire);
+        if (head == 0) {
+            return false;
+        }
+        memcpy(ev, t->buf + ((head - 1) & t->mask) * t->elem_size,
+               t->elem_size);
+        atomic_thread_fence(memory_order_acquire);
+    } while (atomic_load_explicit(&t->stamps[(head - 1) & t->mask],
+                                  memory_order_relaxed) != head);
+    return true;
+}
+
+// Events published so far; readers can compare it with their position.
+static inline uint32_t evbus_published(evbus_topic_t* t) {
+    return atomic_load_explicit(&t->head, memory_order_acquire);
+}
+
+#endif // EVBUS
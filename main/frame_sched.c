@@ -0,0 +1,80 @@
+#include "frame_sched.h"
+#include <string.h>
+
+void frame_sched_reset_stats(frame_sched_t *sched) {
+    sched->last_start = 0;
+    sched->frames = 0;
+    sched->missed = 0;
+    sched->period_min = UINT32_MAX;
+    sched->period_max = 0;
+    sched->period_sum = 0;
+    sched->periods = 0;
+    sched->jitter_max = 0;
+    sched->jitter_sum = 0;
+}
+
+void frame_sched_init(frame_sched_t *sched, uint32_t period_us, int64_t now) {
+    sched->period_us = period_us;
+    sched->deadline = now;
+    frame_sched_reset_stats(sched);
+}
+
+void frame_sched_set_period(frame_sched_t *sched, uint32_t period_us, int64_t now) {
+    sched->period_us = period_us;
+    sched->deadline = now + period_us;
+    // Periods measured across the change would be meaningless.
+    sched->last_start = 0;
+}
+
+void frame_sched_frame_start(frame_sched_t *sched, int64_t now) {
+    int64_t late = now - sched->deadline;
+    uint32_t jitter = late < 0 ? -late : late;
+
+    if (jitter > sched->jitter_max) {
+        sched->jitter_max = jitter;
+    }
+    sched->jitter_sum += jitter;
+
+    if (sched->last_start != 0) {
+        uint32_t period = now - sched->last_start;
+        if (period < sched->period_min) {
+            sched->period_min = period;
+        }
+        if (period > sched->period_max) {
+            sched->period_max = period;
+        }
+        sched->period_sum += period;
+        sched->periods++;
+    }
+    sched->last_start = now;
+    sched->frames++;
+}
+
+int64_t frame_sched_wait_us(frame_sched_t *sched, int64_t now) {
+    sched->deadline += sched->period_us;
+    if (sched->deadline > now) {
+        return sched->deadline - now;
+    }
+
+    // Overran: drop the frames we can no longer make instead of bursting
+    // through them, and stay on the original phase.
+    uint32_t behind = (now - sched->deadline) / sched->period_us + 1;
+    sched->missed += behind;
+    sched->deadline += (int64_t)behind * sched->period_us;
+    return sched->deadline - now;
+}
+
+void frame_sched_get_stats(const frame_sched_t *sched, frame_stats_t *stats) {
+    memset(stats, 0, sizeof(*stats));
+    stats->frames = sched->frames;
+    stats->missed = sched->missed;
+    if (sched->periods > 0) {
+        stats->period_min_us = sched->period_min;
+        stats->period_max_us = sched->period_max;
+        stats->period_avg_us = sched->period_sum / sched->periods;
+    }
+    if (sched->frames > 0) {
+        stats->jitter_max_us = sched->jitter_max;
+        stats->jitter_avg_us = sched->jitter_sum / sched->frames;
+    }
+}
@@ -0,0 +1,54 @@
+#ifndef FRAME_SCHED
+#define FRAME_SCHED
+
+#include <stdint.h>
+
+// Fixed-rate frame scheduler based on absolute deadlines.
+//
+// Frame n is due at start + n * period, so the loop body's own run time never
+// accumulates into drift. The scheduler only does arithmetic on timestamps
+// passed in by the caller (microseconds from any monotonic clock), so it runs
+// unchanged on target and on the Linux host build.
+
+typedef struct {
+    uint32_t frames;
+    uint32_t missed;        // deadlines that had already passed when waited for
+    uint32_t period_min_us; // achieved period between frame starts
+    uint32_t period_max_us;
+    uint32_t period_avg_us;
+    uint32_t jitter_max_us; // largest |frame start - deadline|
+    uint32_t jitter_avg_us;
+} frame_stats_t;
+
+typedef struct {
+    uint32_t period_us;
+    int64_t deadline;
+    int64_t last_start;
+    uint32_t frames;
+    uint32_t missed;
+    uint32_t period_min;
+    uint32_t period_max;
+    uint64_t period_sum;
+    uint32_t periods;
+    uint32_t jitter_max;
+    uint64_t jitter_sum;
+} frame_sched_t;
+
+// First frame is due immediately at now.
+void frame_sched_init(frame_sched_t *sched, uint32_t period_us, int64_t now);
+
+// Changes the period; the next deadline is re-anchored at now + period_us.
+void frame_sched_set_period(frame_sched_t *sched, uint32_t period_us, int64_t now);
+
+// Call at the start of each frame; records period and jitter.
+void frame_sched_frame_start(frame_sched_t *sched, int64_t now);
+
+// Advances to the next deadline and returns how long to wait for it, in
+// microseconds. If the deadline has already passed, the frames that can no
+// longer be made count as missed and the wait is to the next future deadline.
+int64_t frame_sched_wait_us(frame_sched_t *sched, int64_t now);
+
+void frame_sched_get_stats(const frame_sched_t *sched, frame_stats_t *stats);
+void frame_sched_reset_stats(frame_sched_t *sched);
+
+#endif // FRAME_SCHED
@@ -0,0 +1,407 @@
+#include <string.h>
+#include "gatt_cache.h"
+
+#if CONFIG_APP_GATT_CACHING
+
+#include "esp_console.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "host/ble_hs.h"
+#include "host/ble_store.h"
+#include "host/ble_uuid.h"
+#include "mbedtls/cipher.h"
+#include "mbedtls/cmac.h"
+#include "nvs.h"
+#include "os/endian.h"
+
+#define TAG "GATT_CACHE"
+#define NVS_NAMESPACE "gatt_cache"
+#define MAX_CONNS CONFIG_BT_NIMBLE_MAX_CONNECTIONS
+#define MAX_BONDS CONFIG_BT_NIMBLE_MAX_BONDS
+#define HASH_LEN 16
+
+#define UUID_PRIMARY_SVC   0x2800
+#define UUID_SECONDARY_SVC 0x2801
+#define UUID_CHR           0x2803
+#define UUID_CCCD          0x2902
+
+// Client Supported Features bits. None is implemented yet: there is no
+// change-aware client state or Database Out Of Sync error (robust caching),
+// no EATT bearer and no Multiple Handle Value Notification, so a client
+// that sets them reads them back cleared and does not expect them. Add a
+// bit to CSF_SUPPORTED once the server behaves as it promises.
+#define CSF_ROBUST_CACHING 0x01
+#define CSF_EATT           0x02
+#define CSF_MULTI_NOTIFY   0x04
+#define CSF_SUPPORTED      0
+
+typedef struct {
+    bool in_use;
+    uint16_t conn_handle;
+    uint8_t features;     // Client Supported Features written by the peer
+    int64_t connected_at;
+    bool accessed;        // an application characteristic has been used
+} cache_conn_t;
+
+static mbedtls_cipher_context_t g_cmac;
+static bool g_hashing;
+static uint16_t g_last_handle;
+static uint8_t g_hash[HASH_LEN];
+
+static uint16_t g_sc_handle;
+static ble_addr_t g_pending[MAX_BONDS]; // bonded peers owed Service Changed
+static int g_pending_count;
+
+static cache_conn_t g_conns[MAX_CONNS];
+
+// Connect to first application access, in ms.
+static uint32_t g_first_access_count;
+static uint32_t g_first_access_last;
+static uint32_t g_first_access_min = UINT32_MAX;
+static uint32_t g_first_access_max;
+static uint64_t g_first_access_sum;
+
+/*** Database hash (Core Spec Vol 3 Part G 7.3). */
+
+static void hash_attr(uint16_t handle, uint16_t type, const void* value,
+                      size_t len) {
+    uint8_t hdr[4];
+
+    if (handle <= g_last_handle) {
+        ESP_LOGW(TAG, "attribute 0x%04x registered out of order", handle);
+    }
+    g_last_handle = handle;
+    put_le16(hdr, handle);
+    put_le16(hdr + 2, type);
+    mbedtls_cipher_cmac_update(&g_cmac, hdr, sizeof(hdr));
+    if (len > 0) {
+        mbedtls_cipher_cmac_update(&g_cmac, value, len);
+    }
+}
+
+static void hash_start(void) {
+    static const uint8_t zero_key[HASH_LEN] = {0};
+
+    if (g_hashing) {
+        mbedtls_cipher_free(&g_cmac);
+    }
+    mbedtls_cipher_init(&g_cmac);
+    mbedtls_cipher_setup(&g_cmac,
+                         mbedtls_cipher_info_from_type(MBEDTLS_CIPHER_AES_128_ECB));
+    mbedtls_cipher_cmac_starts(&g_cmac, zero_key, 128);
+    g_hashing = true;
+    g_last_handle = 0;
+}
+
+static void hash_finish(void) {
+    uint8_t mac[HASH_LEN];
+
+    mbedtls_cipher_cmac_finish(&g_cmac, mac);
+    mbedtls_cipher_free(&g_cmac);
+    g_hashing = false;
+    // The CMAC is big-endian; the characteristic carries it little-endian.
+    for (int i = 0; i < HASH_LEN; i++) {
+        g_hash[i] = mac[HASH_LEN - 1 - i];
+    }
+}
+
+void gatt_cache_register_cb(const struct ble_gatt_register_ctxt* ctxt) {
+    uint8_t value[3 + 16];
+    uint16_t type;
+
+    switch (ctxt->op) {
+        case BLE_GATT_REGISTER_OP_SVC:
+            // The first service starts a new table (a host reset re-registers).
+            if (!g_hashing || ctxt->svc.handle == 1) {
+                hash_start();
+            }
+            type = ctxt->svc.svc_def->type == BLE_GATT_SVC_TYPE_PRIMARY
+                       ? UUID_PRIMARY_SVC : UUID_SECONDARY_SVC;
+            ble_uuid_flat(ctxt->svc.svc_def->uuid, value);
+            hash_attr(ctxt->svc.handle, type, value,
+                      ble_uuid_length(ctxt->svc.svc_def->uuid));
+            break;
+
+        case BLE_GATT_REGISTER_OP_CHR: {
+            ble_gatt_chr_flags flags = ctxt->chr.chr_def->flags;
+            value[0] = flags & 0x7f;
+            if (flags & (BLE_GATT_CHR_F_RELIABLE_WRITE | BLE_GATT_CHR_F_AUX_WRITE)) {
+                value[0] |= 0x80;
+            }
+            put_le16(value + 1, ctxt->chr.val_handle);
+            ble_uuid_flat(ctxt->chr.chr_def->uuid, value + 3);
+            hash_attr(ctxt->chr.def_handle, UUID_CHR, value,
+                      3 + ble_uuid_length(ctxt->chr.chr_def->uuid));
+            // The host adds the CCCD right after the value attribute.
+            if (flags & (BLE_GATT_CHR_F_NOTIFY | BLE_GATT_CHR_F_INDICATE)) {
+                hash_attr(ctxt->chr.val_handle + 1, UUID_CCCD, NULL, 0);
+            }
+            break;
+        }
+
+        case BLE_GATT_REGISTER_OP_DSC: {
+            // User description, CCCD, SCCD, presentation and aggregate format
+            // descriptors contribute their handle and type only.
+            const ble_uuid_t* uuid = ctxt->dsc.dsc_def->uuid;
+            if (uuid->type == BLE_UUID_TYPE_16) {
+                uint16_t u16 = BLE_UUID16(uuid)->value;
+                if (u16 >= 0x2901 && u16 <= 0x2905) {
+                    hash_attr(ctxt->dsc.handle, u16, NULL, 0);
+                }
+            }
+            break;
+        }
+
+        default:
+            break;
+    }
+}
+
+/*** Service Changed bookkeeping. */
+
+static void save_pending(void) {
+    nvs_handle_t nvs;
+    if (nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs) != ESP_OK) {
+        return;
+    }
+    nvs_set_blob(nvs, "pending", g_pending, g_pending_count * sizeof(ble_addr_t));
+    nvs_commit(nvs);
+    nvs_close(nvs);
+}
+
+static int find_pending(const ble_addr_t* addr) {
+    for (int i = 0; i < g_pending_count; i++) {
+        if (ble_addr_cmp(&g_pending[i], addr) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void gatt_cache_on_sync(void) {
+    uint8_t stored[HASH_LEN];
+    size_t len = sizeof(stored);
+    nvs_handle_t nvs;
+
+    if (g_hashing) {
+        hash_finish();
+    }
+    if (nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs) != ESP_OK) {
+        ESP_LOGE(TAG, "cannot open NVS; Service Changed will not be sent");
+        return;
+    }
+
+    if (nvs_get_blob(nvs, "hash", stored, &len) == ESP_OK &&
+        len == HASH_LEN && memcmp(stored, g_hash, HASH_LEN) == 0) {
+        len = sizeof(g_pending);
+        if (nvs_get_blob(nvs, "pending", g_pending, &len) == ESP_OK) {
+            g_pending_count = len / sizeof(ble_addr_t);
+        }
+    } else {
+        // Attribute table changed (or first boot with caching): every bond
+        // made so far may hold a stale cache.
+        ble_store_util_bonded_peers(g_pending, &g_pending_count, MAX_BONDS);
+        nvs_set_blob(nvs, "pending", g_pending,
+                     g_pending_count * sizeof(ble_addr_t));
+        nvs_set_blob(nvs, "hash", g_hash, HASH_LEN);
+        nvs_commit(nvs);
+        ESP_LOGI(TAG, "attribute table changed; %d bonded peer(s) to notify",
+                 g_pending_count);
+    }
+    nvs_close(nvs);
+}
+
+static cache_conn_t* find_conn(uint16_t conn_handle) {
+    for (int i = 0; i < MAX_CONNS; i++) {
+        if (g_conns[i].in_use && g_conns[i].conn_handle == conn_handle) {
+            return &g_conns[i];
+        }
+    }
+    return NULL;
+}
+
+void gatt_cache_on_connect(uint16_t conn_handle) {
+    for (int i = 0; i < MAX_CONNS; i++) {
+        if (!g_conns[i].in_use) {
+            g_conns[i] = (cache_conn_t){
+                .in_use = true,
+                .conn_handle = conn_handle,
+                .connected_at = esp_timer_get_time(),
+            };
+            return;
+        }
+    }
+}
+
+void gatt_cache_on_disconnect(uint16_t conn_handle) {
+    cache_conn_t* conn = find_conn(conn_handle);
+    if (conn != NULL) {
+        conn->in_use = false;
+    }
+}
+
+void gatt_cache_on_subscribe(uint16_t conn_handle, uint16_t attr_handle,
+                             bool indicate) {
+    struct ble_gap_conn_desc desc;
+    uint8_t range[4];
+
+    if (attr_handle != g_sc_handle || !indicate ||
+        ble_gap_conn_find(conn_handle, &desc) != 0 ||
+        find_pending(&desc.peer_id_addr) < 0) {
+        return;
+    }
+    put_le16(range, 0x0001);
+    put_le16(range + 2, 0xffff);
+    struct os_mbuf* om = ble_hs_mbuf_from_flat(range, sizeof(range));
+    if (om != NULL) {
+        ble_gatts_indicate_custom(conn_handle, g_sc_handle, om);
+    }
+}
+
+void gatt_cache_on_indicate_done(uint16_t conn_handle, uint16_t attr_handle,
+                                 int status) {
+    struct ble_gap_conn_desc desc;
+
+    if (attr_handle != g_sc_handle || status != BLE_HS_EDONE ||
+        ble_gap_conn_find(conn_handle, &desc) != 0) {
+        return;
+    }
+    int i = find_pending(&desc.peer_id_addr);
+    if (i >= 0) {
+        g_pending[i] = g_pending[--g_pending_count];
+        save_pending();
+    }
+}
+
+void gatt_cache_on_app_access(uint16_t conn_handle) {
+    cache_conn_t* conn = find_conn(conn_handle);
+    if (conn == NULL || conn->accessed) {
+        return;
+    }
+    conn->accessed = true;
+    uint32_t ms = (esp_timer_get_time() - conn->connected_at) / 1000;
+    g_first_access_count++;
+    g_first_access_last = ms;
+    g_first_access_sum += ms;
+    if (ms < g_first_access_min) {
+        g_first_access_min = ms;
+    }
+    if (ms > g_first_access_max) {
+        g_first_access_max = ms;
+    }
+    ESP_LOGI(TAG, "conn %d: first application access %u ms after connect",
+             conn_handle, ms);
+}
+
+/*** Generic Attribute service. */
+
+static int gatt_cache_access(uint16_t conn_handle, uint16_t attr_handle,
+                             struct ble_gatt_access_ctxt* ctxt, void* arg);
+
+static const ble_uuid16_t g_svc_uuid = BLE_UUID16_INIT(0x1801);
+static const ble_uuid16_t g_sc_uuid = BLE_UUID16_INIT(0x2A05);
+static const ble_uuid16_t g_csf_uuid = BLE_UUID16_INIT(0x2B29);
+static const ble_uuid16_t g_hash_uuid = BLE_UUID16_INIT(0x2B2A);
+
+static const struct ble_gatt_svc_def g_svcs[] = {
+    {
+        .type = BLE_GATT_SVC_TYPE_PRIMARY,
+        .uuid = &g_svc_uuid.u,
+        .characteristics = (struct ble_gatt_chr_def[]) { {
+            .uuid = &g_sc_uuid.u,
+            .access_cb = gatt_cache_access,
+            .val_handle = &g_sc_handle,
+            .flags = BLE_GATT_CHR_F_INDICATE,
+        }, {
+            .uuid = &g_csf_uuid.u,
+            .access_cb = gatt_cache_access,
+            .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE,
+        }, {
+            .uuid = &g_hash_uuid.u,
+            .access_cb = gatt_cache_access,
+            .flags = BLE_GATT_CHR_F_READ,
+        }, {
+            0,
+        } },
+    },
+    {
+        0,
+    },
+};
+
+static int gatt_cache_access(uint16_t conn_handle, uint16_t attr_handle,
+                             struct ble_gatt_access_ctxt* ctxt, void* arg) {
+    const ble_uuid_t* uuid = ctxt->chr->uuid;
+    cache_conn_t* conn = find_conn(conn_handle);
+    uint8_t features;
+    uint16_t len;
+
+    if (ble_uuid_cmp(uuid, &g_hash_uuid.u) == 0) {
+        return os_mbuf_append(ctxt->om, g_hash, HASH_LEN) == 0
+                   ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
+    }
+    if (ble_uuid_cmp(uuid, &g_csf_uuid.u) != 0) {
+        return BLE_ATT_ERR_READ_NOT_PERMITTED;
+    }
+
+    if (ctxt->op == BLE_GATT_ACCESS_OP_READ_CHR) {
+        features = conn != NULL ? conn->features : 0;
+        return os_mbuf_append(ctxt->om, &features, 1) == 0
+                   ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
+    }
+    if (OS_MBUF_PKTLEN(ctxt->om) < 1 ||
+        ble_hs_mbuf_to_flat(ctxt->om, &features, 1, &len) != 0) {
+        return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+    }
+    if (conn == NULL) {
+        return BLE_ATT_ERR_UNLIKELY;
+    }
+    // A client may enable features but never disable them. Bits the server
+    // does not support are dropped rather than stored.
+    features &= CSF_SUPPORTED;
+    if ((conn->features & ~features) != 0) {
+        return BLE_ATT_ERR_VALUE_NOT_ALLOWED;
+    }
+    conn->features = features;
+    return 0;
+}
+
+static int gattcache_cmd_handler(int argc, char *argv[]) {
+    char hex[2 * HASH_LEN + 1];
+    for (int i = 0; i < HASH_LEN; i++) {
+        sprintf(hex + 2 * i, "%02x", g_hash[HASH_LEN - 1 - i]);
+    }
+    ESP_LOGI(TAG, "hash %s, %d bonded peer(s) owed Service Changed", hex,
+             g_pending_count);
+    ESP_LOGI(TAG, "connect to first access: n %u last %u min %u avg %u "
+             "max %u ms",
+             g_first_access_count, g_first_access_last,
+             g_first_access_count ? g_first_access_min : 0,
+             g_first_access_count
+                 ? (uint32_t)(g_first_access_sum / g_first_access_count) : 0,
+             g_first_access_max);
+    return 0;
+}
+
+static const esp_console_cmd_t g_gattcache_cmd = {
+    .command = "gattcache",
+    .help = "Print the database hash and connect-to-first-access times",
+    .func = gattcache_cmd_handler,
+};
+
+int gatt_cache_init(void) {
+    int rc;
+
+    rc = ble_gatts_count_cfg(g_svcs);
+    if (rc != 0) {
+        return rc;
+    }
+    rc = ble_gatts_add_svcs(g_svcs);
+    if (rc != 0) {
+        return rc;
+    }
+    esp_console_cmd_register(&g_gattcache_cmd);
+    return 0;
+}
+
+#endif // CONFIG_APP_GATT_CACHING
@@ -0,0 +1,58 @@
+#ifndef GATT_CACHE
+#define GATT_CACHE
+
+// GATT Caching: the Generic Attribute service (0x1801) with Service Changed,
+// Client Supported Features and Database Hash.
+//
+// The hash is accumulated from the registration callbacks while the host
+// builds the attribute table, finalized on sync and compared with the one
+// saved in NVS. If it changed, every bonded peer is owed a Service Changed
+// indication, which is sent when the peer next subscribes (bonded CCCDs are
+// restored on encryption) and forgotten once confirmed. Peers whose cache is
+// still valid can therefore skip discovery on reconnect.
+//
+// Also measures the time from connect to the first access of an application
+// characteristic, the cost that caching is meant to cut.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "sdkconfig.h"
+
+struct ble_gatt_register_ctxt;
+
+#if CONFIG_APP_GATT_CACHING
+
+// Replaces ble_svc_gatt_init(); queues the service for registration.
+int gatt_cache_init(void);
+
+// Host task callbacks.
+void gatt_cache_register_cb(const struct ble_gatt_register_ctxt* ctxt);
+void gatt_cache_on_sync(void);
+void gatt_cache_on_connect(uint16_t conn_handle);
+void gatt_cache_on_disconnect(uint16_t conn_handle);
+void gatt_cache_on_subscribe(uint16_t conn_handle, uint16_t attr_handle,
+                             bool indicate);
+void gatt_cache_on_indicate_done(uint16_t conn_handle, uint16_t attr_handle,
+                                 int status);
+
+// Called on every application characteristic access.
+void gatt_cache_on_app_access(uint16_t conn_handle);
+
+#else
+
+// Without caching the stock GATT service is used and nothing is tracked.
+static inline void gatt_cache_register_cb(const struct ble_gatt_register_ctxt* ctxt) {}
+static inline void gatt_cache_on_sync(void) {}
+static inline void gatt_cache_on_connect(uint16_t conn_handle) {}
+static inline void gatt_cache_on_disconnect(uint16_t conn_handle) {}
+static inline void gatt_cache_on_subscribe(uint16_t conn_handle,
+                                           uint16_t attr_handle,
+                                           bool indicate) {}
+static inline void gatt_cache_on_indicate_done(uint16_t conn_handle,
+                                               uint16_t attr_handle,
+                                               int status) {}
+static inline void gatt_cache_on_app_access(uint16_t conn_handle) {}
+
+#endif
+
+#endif // GATT_CACHE
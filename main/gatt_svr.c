@@ -19,223 +19,308 @@
 
 #include <assert.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "host/ble_hs.h"
 #include "host/ble_uuid.h"
 #include "services/gap/ble_svc_gap.h"
 #include "services/gatt/ble_svc_gatt.h"
 #include "bleprph.h"
+#if CONFIG_APP_GATT_ANS_SVC
 #include "services/ans/ble_svc_ans.h"
+#endif
+#include "assist.h"
+#include "att_limit.h"
+#include "ctrl_task.h"
+#include "cycling.h"
+#include "diag.h"
+#include "gatt_cache.h"
 #include "led_task.h"
+#include "log_bridge.h"
+#include "timesync.h"
+#include "uart_proxy.h"
 #include "esp_log.h"
+#include "esp_random.h"
+#include "os/endian.h"
+
+/* Log prefix */
+static const char *tag = "GATT";
+
+#if CONFIG_APP_GATT_SEC_TEST_SVC
+static uint8_t gatt_svr_sec_test_static_val;
+#endif
+
+/* Value handles of every schema characteristic, filled in at registration. */
+static uint16_t gatt_svr_val_handles[GATT_SVR_CHR_COUNT];
+
+#define GATT_SVR_MAX_CONNS    CONFIG_BT_NIMBLE_MAX_CONNECTIONS
+/* Large enough for every data characteristic at once. */
+#define GATT_SVR_CHANGES_MAX  128
+
+/*
+ * Change tracking; host task only.  Versions restart at a random point on
+ * every boot, so a version a client kept from before a reboot is almost
+ * certainly outside [gatt_svr_version_base - 1, gatt_svr_version] and is
+ * answered with everything.
+ */
+static uint32_t gatt_svr_version_base;
+static uint32_t gatt_svr_version;
+static uint32_t gatt_svr_chr_versions[GATT_SVR_CHR_COUNT];
+static uint32_t gatt_svr_chr_seqs[GATT_SVR_CHR_COUNT];
+
+/* Changed-since response of each connection, built when it is requested. */
+struct gatt_svr_changes {
+    uint16_t conn_handle;  /* BLE_HS_CONN_HANDLE_NONE if unused */
+    uint16_t len;
+    uint8_t buf[GATT_SVR_CHANGES_MAX];
+};
+static struct gatt_svr_changes gatt_svr_changes[GATT_SVR_MAX_CONNS];
 
 /**
- * The vendor specific security test service consists of two characteristics:
- *     o random-number-generator: generates a random 32-bit number each time
- *       it is read.  This characteristic can only be read over an encrypted
- *       connection.
- *     o static-value: a single-byte characteristic that can always be read,
- *       but can only be written over an encrypted connection.
+ * Dispatch slot of a schema characteristic.  Reads of a slot with a snapshot
+ * are served from it; otherwise scalar and snapshot slots are served by
+ * gatt_svr_chr_access_scalar() and a custom slot forwards to its own
+ * callback.
  */
+struct gatt_svr_chr_slot {
+    ble_gatt_access_fn *access_cb;
+    snapshot_t *snap;  /* reads are served from here if set */
+    uint8_t len;
+    uint32_t min;
+    uint32_t max;
+    uint32_t (*get)(void);
+    int (*set)(uint32_t val); /* 0 or a BLE_ATT_ERR_* code */
+};
 
-/* 59462f12-9543-9999-12c8-58b459a2712d */
-static const ble_uuid128_t gatt_svr_svc_sec_test_uuid =
-    BLE_UUID128_INIT(0x2d, 0x71, 0xa2, 0x59, 0xb4, 0x58, 0xc8, 0x12,
-                     0x99, 0x99, 0x43, 0x95, 0x12, 0x2f, 0x46, 0x59);
+#define GATT_SVR_SCALAR(len_, min_, max_, get_, set_)                       \
+    { .len = (len_), .min = (min_), .max = (max_),                          \
+      .get = (get_), .set = (set_) }
+#define GATT_SVR_SNAPSHOT(snap_, len_, min_, max_, set_)                    \
+    { .snap = (snap_), .len = (len_), .min = (min_), .max = (max_),         \
+      .set = (set_) }
+#define GATT_SVR_CUSTOM(access_cb_)                                         \
+    { .access_cb = (access_cb_) }
 
-/* 5c3a659e-897e-45e1-b016-007107c96df6 */
-static const ble_uuid128_t gatt_svr_chr_sec_test_rand_uuid =
-    BLE_UUID128_INIT(0xf6, 0x6d, 0xc9, 0x07, 0x71, 0x00, 0x16, 0xb0,
-                     0xe1, 0x45, 0x7e, 0x89, 0x9e, 0x65, 0x3a, 0x5c);
+/**
+ * Appends the current value of a snapshot.  If the producer published while
+ * it was being copied, the copy is trimmed off again and retried; the
+ * producer never waits for readers and readers never wait for it.
+ */
+static int
+gatt_svr_snapshot_append(snapshot_t *snap, struct os_mbuf *om)
+{
+    const uint8_t *data;
+    uint16_t len;
+    uint32_t seq;
+
+    while (1) {
+        seq = snapshot_read_begin(snap, &data, &len);
+        if (os_mbuf_append(om, data, len) != 0) {
+            return BLE_ATT_ERR_INSUFFICIENT_RES;
+        }
+        if (!snapshot_read_retry(snap, seq)) {
+            return 0;
+        }
+        os_mbuf_adj(om, -(int)len);
+    }
+}
 
-/* 5c3a659e-897e-45e1-b016-007107c96df7 */
-static const ble_uuid128_t gatt_svr_chr_sec_test_static_uuid =
-    BLE_UUID128_INIT(0xf7, 0x6d, 0xc9, 0x07, 0x71, 0x00, 0x16, 0xb0,
-                     0xe1, 0x45, 0x7e, 0x89, 0x9e, 0x65, 0x3a, 0x5c);
+/*** Scalar accessors referenced by the schema. */
 
-static uint8_t gatt_svr_sec_test_static_val;
+static int
+gatt_svr_ctrl_cmd_access(uint16_t conn_handle, uint16_t attr_handle,
+                         struct ble_gatt_access_ctxt *ctxt, void *arg);
+
+#if CONFIG_APP_GATT_SEC_TEST_SVC
+static uint32_t
+gatt_svr_sec_test_rand_get(void)
+{
+    return (uint32_t)rand();
+}
+
+static uint32_t
+gatt_svr_sec_test_static_get(void)
+{
+    return gatt_svr_sec_test_static_val;
+}
 
 static int
-gatt_svr_chr_access_sec_test(uint16_t conn_handle, uint16_t attr_handle,
-                             struct ble_gatt_access_ctxt *ctxt,
-                             void *arg);
-
-// UUIDs for LED service
-// TODO: currently backwards
-/* 41c6b692-0ba0-4b73-b586-35a268a320ef */
-static const ble_uuid128_t gatt_svr_svc_led_uuid =
-    BLE_UUID128_INIT(0x41, 0xc6, 0xb6, 0x92, 0x0b, 0xa0, 0x4b, 0x73,
-                     0xb5, 0x86, 0x35, 0xa2, 0x68, 0xa3, 0x20, 0xef);
-
-/* d7419b26-1437-4f29-a6c8-259cf01bc815 */
-static const ble_uuid128_t gatt_svr_chr_led_static_red_uuid =
-    BLE_UUID128_INIT(0xd7, 0x41, 0x9b, 0x26, 0x14, 0x37, 0x4f, 0x29,
-                     0xa6, 0xc8, 0x25, 0x9c, 0xf0, 0x1b, 0xc8, 0x15);
-
-/* 3fa4eea9-5368-4f1b-9687-10574f0adcae */
-static const ble_uuid128_t gatt_svr_chr_led_static_green_uuid =
-    BLE_UUID128_INIT(0x3f, 0xa4, 0xee, 0xa9, 0x53, 0x68, 0x4f, 0x1b,
-                     0x96, 0x87, 0x10, 0x57, 0x4f, 0x0a, 0xdc, 0xae);
-
-/* 8f61467a-c4ff-4ebb-943d-49596f9fd4e7 */
-static const ble_uuid128_t gatt_svr_chr_led_static_blue_uuid =
-    BLE_UUID128_INIT(0x8f, 0x61, 0x46, 0x7a, 0xc4, 0xff, 0x4e, 0xbb,
-                     0x94, 0x3d, 0x49, 0x59, 0x6f, 0x9f, 0xd4, 0xe7);
-
-/* dfae6ade-d0fe-453e-ba47-07b8a3c6bbb5 */
-static const ble_uuid128_t gatt_svr_chr_led_delay_uuid =
-    BLE_UUID128_INIT(0xdf, 0xae, 0x6a, 0xde, 0xd0, 0xfe, 0x45, 0x3e,
-                     0xba, 0x47, 0x07, 0xb8, 0xa3, 0xc6, 0xbb, 0xb5);
+gatt_svr_sec_test_static_set(uint32_t val)
+{
+    gatt_svr_sec_test_static_val = val;
+    return 0;
+}
+#endif
 
-static const ble_uuid16_t user_description_uuid = BLE_UUID16_INIT(0x2901);
-static const char* red_user_desc = "RedLedBrightness";
-static const char* green_user_desc = "GreenLedBrightness";
-static const char* blue_user_desc = "BlueLedBrightness";
-static const char* delay_user_desc = "LedDelayBrightness";
+static int
+gatt_svr_ctrl_status_to_att(ctrl_status_t status)
+{
+    switch (status) {
+    case CTRL_OK:
+        return 0;
+    case CTRL_ERR_FULL:
+        return BLE_ATT_ERR_INSUFFICIENT_RES;
+    default:
+        return BLE_ATT_ERR_VALUE_NOT_ALLOWED;
+    }
+}
 
-// Log prefix
-static const char *tag = "GATT";
+/* LED settings are owned by the control task; writes are queued to it. */
+static int
+gatt_svr_led_color_set(color_t color, uint32_t val)
+{
+    uint8_t cmd[] = { CTRL_OP_SET_COLOR, color, val };
+    return gatt_svr_ctrl_status_to_att(ctrlSubmit(cmd, sizeof cmd));
+}
+
+static int
+gatt_svr_led_delay_set(uint32_t val)
+{
+    uint8_t cmd[] = { CTRL_OP_SET_DELAY, val, val >> 8, val >> 16, val >> 24 };
+    return gatt_svr_ctrl_status_to_att(ctrlSubmit(cmd, sizeof cmd));
+}
 
-// Callback for LED service
+static int gatt_svr_led_red_set(uint32_t val) { return gatt_svr_led_color_set(RED, val); }
+static int gatt_svr_led_green_set(uint32_t val) { return gatt_svr_led_color_set(GREEN, val); }
+static int gatt_svr_led_blue_set(uint32_t val) { return gatt_svr_led_color_set(BLUE, val); }
 
+#if CONFIG_APP_UART_PROXY
 static int
-gatt_svr_chr_access_led(uint16_t conn_handle, uint16_t attr_handle,
-                        struct ble_gatt_access_ctxt *ctxt,
-                        void *arg);
+gatt_svr_proxy_level_set(uint32_t val)
+{
+    return uart_proxy_set_level(val) ? 0 : BLE_ATT_ERR_VALUE_NOT_ALLOWED;
+}
+#endif
 
+/* Reads are served from led_latency_snap. */
 static int
-gatt_svr_usr_chr_red(uint16_t conn_handle, uint16_t attr_handle,
-                        struct ble_gatt_access_ctxt *ctxt,
-                        void *arg) {
-    int rc;
-    ESP_LOGI(tag, "Red\n");
-    rc = os_mbuf_append(ctxt->om, &red_user_desc,
-                        sizeof(red_user_desc));
-    return rc == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
+gatt_svr_led_latency_access(uint16_t conn_handle, uint16_t attr_handle,
+                            struct ble_gatt_access_ctxt *ctxt, void *arg)
+{
+    switch (ctxt->op) {
+    case BLE_GATT_ACCESS_OP_READ_CHR:
+        return gatt_svr_snapshot_append(&led_latency_snap, ctxt->om);
+    case BLE_GATT_ACCESS_OP_WRITE_CHR:
+        resetLedLatency();
+        return 0;
+    default:
+        return BLE_ATT_ERR_UNLIKELY;
+    }
 }
 
+static uint32_t gatt_svr_cp_feature_get(void) { return CYCLING_CP_FEATURES; }
+static uint32_t gatt_svr_csc_feature_get(void) { return CYCLING_CSC_FEATURES; }
+static uint32_t gatt_svr_sensor_location_get(void) { return CYCLING_SENSOR_SPIDER; }
+
+/**
+ * Characteristics that are only ever notified; cycling.c and log_bridge.c
+ * send them with ble_gatts_notify_custom(), so the stack never asks this
+ * callback for a value.
+ */
 static int
-gatt_svr_usr_chr_green(uint16_t conn_handle, uint16_t attr_handle,
-                        struct ble_gatt_access_ctxt *ctxt,
-                        void *arg) {
-    int rc;
-    ESP_LOGI(tag, "Green\n");
-    rc = os_mbuf_append(ctxt->om, &green_user_desc,
-                        sizeof(green_user_desc));
-    return rc == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
+gatt_svr_notify_only_access(uint16_t conn_handle, uint16_t attr_handle,
+                            struct ble_gatt_access_ctxt *ctxt, void *arg)
+{
+    return BLE_ATT_ERR_READ_NOT_PERMITTED;
 }
 
+#if CONFIG_APP_DIAG
 static int
-gatt_svr_usr_chr_blue(uint16_t conn_handle, uint16_t attr_handle,
-                        struct ble_gatt_access_ctxt *ctxt,
-                        void *arg) {
-    int rc;
-    ESP_LOGI(tag, "Blue\n");
-    rc = os_mbuf_append(ctxt->om, &blue_user_desc,
-                        sizeof(blue_user_desc));
-    return rc == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
+gatt_svr_diag_access(uint16_t conn_handle, uint16_t attr_handle,
+                     struct ble_gatt_access_ctxt *ctxt, void *arg)
+{
+    if (ctxt->op != BLE_GATT_ACCESS_OP_READ_CHR) {
+        return BLE_ATT_ERR_UNLIKELY;
+    }
+    return diag_on_read(conn_handle, ctxt->om);
 }
+#endif
 
+#if CONFIG_APP_LOG_BRIDGE
 static int
-gatt_svr_usr_chr_delay(uint16_t conn_handle, uint16_t attr_handle,
-                        struct ble_gatt_access_ctxt *ctxt,
-                        void *arg) {
+gatt_svr_log_rx_access(uint16_t conn_handle, uint16_t attr_handle,
+                       struct ble_gatt_access_ctxt *ctxt, void *arg);
+#endif
+
+#if CONFIG_APP_ASSIST
+static int
+gatt_svr_assist_curve_access(uint16_t conn_handle, uint16_t attr_handle,
+                             struct ble_gatt_access_ctxt *ctxt, void *arg);
+#endif
+
+static int
+gatt_svr_changed_since_access(uint16_t conn_handle, uint16_t attr_handle,
+                              struct ble_gatt_access_ctxt *ctxt, void *arg);
+static int
+gatt_svr_time_sync_access(uint16_t conn_handle, uint16_t attr_handle,
+                          struct ble_gatt_access_ctxt *ctxt, void *arg);
+
+/*** Tables generated from gatt_svr_schema.h. */
+
+#define GATT_SVR_SVC_UUID_DEF(id_, uuid_, chrs_)                            \
+    static const ble_uuid_any_t gatt_svr_svc_##id_##_uuid = uuid_;
+#define GATT_SVR_CHR_UUID_DEF(id_, uuid_, ...)                              \
+    static const ble_uuid_any_t gatt_svr_chr_##id_##_uuid = uuid_;
+GATT_SVR_SVCS(GATT_SVR_SVC_UUID_DEF)
+GATT_SVR_CHRS(GATT_SVR_CHR_UUID_DEF)
+
+static const struct gatt_svr_chr_slot gatt_svr_chr_slots[GATT_SVR_CHR_COUNT] = {
+#define GATT_SVR_CHR_SLOT_DEF(id_, uuid_, flags_, desc_, access_)           \
+    [GATT_SVR_CHR_##id_] = access_,
+    GATT_SVR_CHRS(GATT_SVR_CHR_SLOT_DEF)
+};
+
+static const ble_uuid16_t user_description_uuid = BLE_UUID16_INIT(0x2901);
+
+static int
+gatt_svr_chr_access(uint16_t conn_handle, uint16_t attr_handle,
+                    struct ble_gatt_access_ctxt *ctxt, void *arg);
+
+/**
+ * Serves a Characteristic User Description straight from the schema string;
+ * the string itself is passed as the descriptor argument.
+ */
+static int
+gatt_svr_dsc_access_user_desc(uint16_t conn_handle, uint16_t attr_handle,
+                              struct ble_gatt_access_ctxt *ctxt, void *arg)
+{
+    const char *desc = arg;
     int rc;
-    ESP_LOGI(tag, "Delay\n");
-    rc = os_mbuf_append(ctxt->om, &delay_user_desc,
-                        sizeof(delay_user_desc));
+
+    rc = os_mbuf_append(ctxt->om, desc, strlen(desc));
     return rc == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
 }
 
-static const struct ble_gatt_svc_def gatt_svr_svcs[] = {
-    {
-        /*** Service: Security test. */
-        .type = BLE_GATT_SVC_TYPE_PRIMARY,
-        .uuid = &gatt_svr_svc_sec_test_uuid.u,
-        .characteristics = (struct ble_gatt_chr_def[])
-        { {
-                /*** Characteristic: Random number generator. */
-                .uuid = &gatt_svr_chr_sec_test_rand_uuid.u,
-                .access_cb = gatt_svr_chr_access_sec_test,
-                .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_READ_ENC,
-            }, {
-                /*** Characteristic: Static value. */
-                .uuid = &gatt_svr_chr_sec_test_static_uuid.u,
-                .access_cb = gatt_svr_chr_access_sec_test,
-                .flags = BLE_GATT_CHR_F_READ |
-                BLE_GATT_CHR_F_WRITE | BLE_GATT_CHR_F_WRITE_ENC,
-            }, {
-                0, /* No more characteristics in this service. */
-            }
-        },
+#define GATT_SVR_CHR_DEF(id_, uuid_, flags_, desc_, access_)                \
+    {                                                                       \
+        .uuid = &gatt_svr_chr_##id_##_uuid.u,                               \
+        .access_cb = gatt_svr_chr_access,                                   \
+        .arg = (void *)&gatt_svr_chr_slots[GATT_SVR_CHR_##id_],             \
+        .flags = (flags_),                                                  \
+        .val_handle = &gatt_svr_val_handles[GATT_SVR_CHR_##id_],            \
+        .descriptors = (struct ble_gatt_dsc_def[]) { {                      \
+            .uuid = &user_description_uuid.u,                               \
+            .att_flags = BLE_ATT_F_READ,                                    \
+            .access_cb = gatt_svr_dsc_access_user_desc,                     \
+            .arg = (void *)(desc_),                                         \
+        }, {                                                                \
+            0,                                                              \
+        } },                                                                \
     },
-    {
-        /*** Service: LED control. */
-        .type = BLE_GATT_SVC_TYPE_PRIMARY,
-        .uuid = &gatt_svr_svc_led_uuid.u,
-        .characteristics = (struct ble_gatt_chr_def[])
-        { {
-                /*** Characteristic: Amount of red when LED is static. */
-                .uuid = &gatt_svr_chr_led_static_red_uuid.u,
-                .access_cb = gatt_svr_chr_access_led,
-                .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE,
-                .descriptors = (struct ble_gatt_dsc_def[])
-                { {
-                    .uuid = &user_description_uuid.u,
-                    .access_cb = gatt_svr_usr_chr_red,
-                    .att_flags = BLE_ATT_F_READ,
-                    }, {
-                    0,
-                    }
-                }
-            }, {
-                /*** Characteristic: Amount of green when LED is static. */
-                .uuid = &gatt_svr_chr_led_static_green_uuid.u,
-                .access_cb = gatt_svr_chr_access_led,
-                .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE,
-                .descriptors = (struct ble_gatt_dsc_def[])
-                { {
-                    .uuid = &user_description_uuid.u,
-                    .access_cb = gatt_svr_usr_chr_green,
-                    .att_flags = BLE_ATT_F_READ,
-                    }, {
-                    0,
-                    }
-                }
-            }, {
-                /*** Characteristic: Amount of blue when LED is static. */
-                .uuid = &gatt_svr_chr_led_static_blue_uuid.u,
-                .access_cb = gatt_svr_chr_access_led,
-                .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE,
-                .descriptors = (struct ble_gatt_dsc_def[])
-                { {
-                    .uuid = &user_description_uuid.u,
-                    .access_cb = gatt_svr_usr_chr_blue,
-                    .att_flags = BLE_ATT_F_READ,
-                    }, {
-                    0,
-                    }
-                }
-            }, {
-                /*** Characteristic: Delay in ms between changing rainbow LED colors.
-                 *   If 0, uses the RGB value set by other chars instead. */
-                .uuid = &gatt_svr_chr_led_delay_uuid.u,
-                .access_cb = gatt_svr_chr_access_led,
-                .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE,
-                .descriptors = (struct ble_gatt_dsc_def[])
-                { {
-                    .uuid = &user_description_uuid.u,
-                    .access_cb = gatt_svr_usr_chr_delay,
-                    .att_flags = BLE_ATT_F_READ,
-                    }, {
-                    0,
-                    }
-                }
-            }, {
-                0, /* No more characteristics in this service. */
-            }
-        },
+#define GATT_SVR_SVC_DEF(id_, uuid_, chrs_)                                 \
+    {                                                                       \
+        .type = BLE_GATT_SVC_TYPE_PRIMARY,                                  \
+        .uuid = &gatt_svr_svc_##id_##_uuid.u,                               \
+        .characteristics = (struct ble_gatt_chr_def[]) {                    \
+            chrs_(GATT_SVR_CHR_DEF)                                         \
+            {                                                               \
+                0, /* No more characteristics in this service. */           \
+            },                                                              \
+        },                                                                  \
     },
+
+static const struct ble_gatt_svc_def gatt_svr_svcs[] = {
+    GATT_SVR_SVCS(GATT_SVR_SVC_DEF)
     {
         0, /* No more services. */
     },
@@ -261,161 +346,368 @@ gatt_svr_chr_write(struct os_mbuf *om, uint16_t min_len, uint16_t max_len,
     return 0;
 }
 
-
 static int
-gatt_svr_chr_access_led(uint16_t conn_handle, uint16_t attr_handle,
-                        struct ble_gatt_access_ctxt *ctxt,
-                        void *arg) {
-    const ble_uuid_t *uuid = ctxt->chr->uuid;
-    uint8_t color_val;
-    uint32_t delay_val;
+gatt_svr_chr_access_scalar(const struct gatt_svr_chr_slot *slot,
+                           struct ble_gatt_access_ctxt *ctxt)
+{
+    uint8_t buf[sizeof(uint32_t)];
+    uint32_t val;
     int rc;
+    int i;
 
-    /* Determine which characteristic is being accessed by examining its
-     * 128-bit UUID.
-     */
-
-    if (ble_uuid_cmp(uuid, &gatt_svr_chr_led_static_red_uuid.u) == 0) {
-        ESP_LOGI(tag, "Log %i, rw %i\n", 0, ctxt->op);
-        switch (ctxt->op) {
-        case BLE_GATT_ACCESS_OP_READ_CHR:
-            color_val = getColor(RED);
-            rc = os_mbuf_append(ctxt->om, &color_val,
-                                sizeof(color_val));
-            return rc == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
-
-        case BLE_GATT_ACCESS_OP_WRITE_CHR:
-            rc = gatt_svr_chr_write(ctxt->om,
-                                    sizeof(color_val),
-                                    sizeof(color_val),
-                                    &color_val, NULL);
-            if (rc == 0) {
-                setColor(RED, color_val);
-            }
-            return rc;
+    switch (ctxt->op) {
+    case BLE_GATT_ACCESS_OP_READ_CHR:
+        if (slot->get == NULL) {
+            return BLE_ATT_ERR_READ_NOT_PERMITTED;
+        }
+        val = slot->get();
+        for (i = 0; i < slot->len; i++) {
+            buf[i] = val >> (8 * i);
+        }
+        rc = os_mbuf_append(ctxt->om, buf, slot->len);
+        return rc == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
 
-        default:
-            return BLE_ATT_ERR_UNLIKELY;
+    case BLE_GATT_ACCESS_OP_WRITE_CHR:
+        if (slot->set == NULL) {
+            return BLE_ATT_ERR_WRITE_NOT_PERMITTED;
         }
-    } else if (ble_uuid_cmp(uuid, &gatt_svr_chr_led_static_green_uuid.u) == 0) {
-        ESP_LOGI(tag, "Log %i, rw %i\n", 0, ctxt->op);
-        switch (ctxt->op) {
-        case BLE_GATT_ACCESS_OP_READ_CHR:
-            color_val = getColor(GREEN);
-            rc = os_mbuf_append(ctxt->om, &color_val,
-                                sizeof(color_val));
-            return rc == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
-
-        case BLE_GATT_ACCESS_OP_WRITE_CHR:
-            rc = gatt_svr_chr_write(ctxt->om,
-                                    sizeof(color_val),
-                                    sizeof(color_val),
-                                    &color_val, NULL);
-            if (rc == 0) {
-                setColor(GREEN, color_val);
-            }
+        rc = gatt_svr_chr_write(ctxt->om, slot->len, slot->len, buf, NULL);
+        if (rc != 0) {
             return rc;
-
-        default:
-            return BLE_ATT_ERR_UNLIKELY;
         }
-    } else if (ble_uuid_cmp(uuid, &gatt_svr_chr_led_static_blue_uuid.u) == 0) {
-        ESP_LOGI(tag, "Log %i, rw %i\n", 0, ctxt->op);
-        switch (ctxt->op) {
-        case BLE_GATT_ACCESS_OP_READ_CHR:
-            color_val = getColor(BLUE);
-            rc = os_mbuf_append(ctxt->om, &color_val,
-                                sizeof(color_val));
-            return rc == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
-
-        case BLE_GATT_ACCESS_OP_WRITE_CHR:
-            rc = gatt_svr_chr_write(ctxt->om,
-                                    sizeof(color_val),
-                                    sizeof(color_val),
-                                    &color_val, NULL);
-            if (rc == 0) {
-                setColor(BLUE, color_val);
-            }
+        val = 0;
+        for (i = 0; i < slot->len; i++) {
+            val |= (uint32_t)buf[i] << (8 * i);
+        }
+        if (val < slot->min || val > slot->max) {
+            return BLE_ATT_ERR_VALUE_NOT_ALLOWED;
+        }
+        return slot->set(val);
+
+    default:
+        return BLE_ATT_ERR_UNLIKELY;
+    }
+}
+
+/**
+ * Control commands are only validated and queued here; the control task
+ * applies them, so a burst of writes never stalls the host task.
+ */
+static int
+gatt_svr_ctrl_cmd_access(uint16_t conn_handle, uint16_t attr_handle,
+                         struct ble_gatt_access_ctxt *ctxt, void *arg)
+{
+    uint8_t buf[8];
+    uint16_t len;
+    int rc;
+
+    if (ctxt->op != BLE_GATT_ACCESS_OP_WRITE_CHR) {
+        return BLE_ATT_ERR_UNLIKELY;
+    }
+
+    rc = gatt_svr_chr_write(ctxt->om, 1, sizeof buf, buf, &len);
+    if (rc != 0) {
+        return rc;
+    }
+
+    return gatt_svr_ctrl_status_to_att(ctrlSubmit(buf, len));
+}
+
+#if CONFIG_APP_LOG_BRIDGE
+static int
+gatt_svr_log_rx_access(uint16_t conn_handle, uint16_t attr_handle,
+                       struct ble_gatt_access_ctxt *ctxt, void *arg)
+{
+    uint8_t buf[LOG_BRIDGE_CMD_MAX];
+    uint16_t len;
+    int rc;
+
+    if (ctxt->op != BLE_GATT_ACCESS_OP_WRITE_CHR) {
+        return BLE_ATT_ERR_UNLIKELY;
+    }
+
+    rc = gatt_svr_chr_write(ctxt->om, 1, sizeof buf, buf, &len);
+    if (rc != 0) {
+        return rc;
+    }
+
+    return log_bridge_on_write(conn_handle, buf, len);
+}
+#endif
+
+#if CONFIG_APP_ASSIST
+/**
+ * Curves are validated and stored here; the motor packet path compiles
+ * them into its tables the next time it runs.
+ */
+static int
+gatt_svr_assist_curve_access(uint16_t conn_handle, uint16_t attr_handle,
+                             struct ble_gatt_access_ctxt *ctxt, void *arg)
+{
+    uint8_t buf[ASSIST_CURVE_MAX];
+    uint16_t len;
+    int rc;
+
+    switch (ctxt->op) {
+    case BLE_GATT_ACCESS_OP_READ_CHR:
+        len = assist_on_read(buf);
+        rc = os_mbuf_append(ctxt->om, buf, len);
+        return rc == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
+
+    case BLE_GATT_ACCESS_OP_WRITE_CHR:
+        rc = gatt_svr_chr_write(ctxt->om, ASSIST_CURVE_MIN, ASSIST_CURVE_MAX,
+                                buf, &len);
+        if (rc != 0) {
             return rc;
+        }
+        return assist_on_write(buf, len);
+
+    default:
+        return BLE_ATT_ERR_UNLIKELY;
+    }
+}
+#endif
+
+/**
+ * Single entry point for every schema characteristic; the slot to serve is
+ * carried in the registration argument, so no UUID comparisons are needed.
+ */
+static int
+gatt_svr_chr_access(uint16_t conn_handle, uint16_t attr_handle,
+                    struct ble_gatt_access_ctxt *ctxt, void *arg)
+{
+    const struct gatt_svr_chr_slot *slot = arg;
+    int rc;
+
+    ESP_LOGD(tag, "access slot %d, op %d",
+             (int)(slot - gatt_svr_chr_slots), ctxt->op);
+    gatt_cache_on_app_access(conn_handle);
+
+    /* Throttled before any handler runs, so a flooding peer never fills
+     * the control ring or spends the host task's time on snapshot copies. */
+    rc = att_limit_access(conn_handle,
+                          ctxt->op == BLE_GATT_ACCESS_OP_WRITE_CHR);
+    if (rc != 0) {
+        return rc;
+    }
+
+    if (slot->snap != NULL && ctxt->op == BLE_GATT_ACCESS_OP_READ_CHR) {
+        return gatt_svr_snapshot_append(slot->snap, ctxt->om);
+    }
+    if (slot->access_cb != NULL) {
+        return slot->access_cb(conn_handle, attr_handle, ctxt, NULL);
+    }
+    return gatt_svr_chr_access_scalar(slot, ctxt);
+}
 
-        default:
-            return BLE_ATT_ERR_UNLIKELY;
+/*** Change tracking for the changed-since characteristic. */
+
+/**
+ * Versions are handed out lazily: whenever a response is built, every data
+ * characteristic whose snapshot was published since the previous look gets
+ * the next version.  Host task only.
+ */
+static void
+gatt_svr_versions_refresh(void)
+{
+    uint32_t seq;
+    int id;
+
+    for (id = 0; id < GATT_SVR_CHR_COUNT; id++) {
+        if (gatt_svr_chr_slots[id].snap == NULL) {
+            continue;
         }
-    } else if (ble_uuid_cmp(uuid, &gatt_svr_chr_led_delay_uuid.u) == 0) {
-        switch (ctxt->op) {
-        case BLE_GATT_ACCESS_OP_READ_CHR:
-            delay_val = getDelay();
-            rc = os_mbuf_append(ctxt->om, &delay_val,
-                                sizeof(delay_val));
-            return rc == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
-
-        case BLE_GATT_ACCESS_OP_WRITE_CHR:
-            rc = gatt_svr_chr_write(ctxt->om,
-                                    sizeof(delay_val),
-                                    sizeof(delay_val),
-                                    &delay_val, NULL);
-            if (rc == 0) {
-                setDelay(delay_val);
-            }
-            return rc;
+        seq = snapshot_seq(gatt_svr_chr_slots[id].snap);
+        if (seq != gatt_svr_chr_seqs[id]) {
+            gatt_svr_chr_seqs[id] = seq;
+            gatt_svr_chr_versions[id] = ++gatt_svr_version;
+        }
+    }
+}
+
+/*
+ * Bytes a data characteristic takes in a changed-since response: handle,
+ * length and value.  Every one of them must fit at once, and the length
+ * goes out as a u8.
+ */
+#define GATT_SVR_CHANGE_LEN_GATT_SVR_SNAPSHOT(snap_, len_, ...) + 3 + (len_)
+#define GATT_SVR_CHANGE_LEN_GATT_SVR_SCALAR(...)
+#define GATT_SVR_CHANGE_LEN_GATT_SVR_CUSTOM(...)
+#define GATT_SVR_CHR_CHANGE_LEN(id_, uuid_, flags_, desc_, access_)         \
+    GATT_SVR_CHANGE_LEN_##access_
+_Static_assert(4 GATT_SVR_CHRS(GATT_SVR_CHR_CHANGE_LEN) <= GATT_SVR_CHANGES_MAX,
+               "changed-since response cannot hold every data characteristic");
+
+#define GATT_SVR_CHANGE_CHECK_GATT_SVR_SNAPSHOT(snap_, len_, ...)           \
+    _Static_assert((len_) <= UINT8_MAX, "data characteristic too long for "  \
+                   "the u8 length of a changed-since entry");
+#define GATT_SVR_CHANGE_CHECK_GATT_SVR_SCALAR(...)
+#define GATT_SVR_CHANGE_CHECK_GATT_SVR_CUSTOM(...)
+#define GATT_SVR_CHR_CHANGE_CHECK(id_, uuid_, flags_, desc_, access_)       \
+    GATT_SVR_CHANGE_CHECK_##access_
+GATT_SVR_CHRS(GATT_SVR_CHR_CHANGE_CHECK)
 
-        default:
-            return BLE_ATT_ERR_UNLIKELY;
+/**
+ * Packs every data characteristic changed since `since` into c->buf, oldest
+ * change first.  If they do not all fit, the version returned is the one
+ * just below the first change left out, so the client picks up that one and
+ * every later one on its next poll.
+ */
+static void
+gatt_svr_changes_build(struct gatt_svr_changes *c, uint32_t since)
+{
+    int order[GATT_SVR_CHR_COUNT];
+    uint32_t next;
+    uint32_t seq;
+    const uint8_t *data;
+    uint16_t len;
+    uint16_t off;
+    int n;
+    int i;
+    int id;
+
+    gatt_svr_versions_refresh();
+    if (since < gatt_svr_version_base - 1 || since > gatt_svr_version) {
+        since = 0;  /* from an earlier boot */
+    }
+
+    /* Changed characteristics by version; there are only a few. */
+    n = 0;
+    for (id = 0; id < GATT_SVR_CHR_COUNT; id++) {
+        if (gatt_svr_chr_slots[id].snap == NULL ||
+            gatt_svr_chr_versions[id] <= since) {
+            continue;
+        }
+        for (i = n; i > 0 && gatt_svr_chr_versions[order[i - 1]] >
+                              gatt_svr_chr_versions[id]; i--) {
+            order[i] = order[i - 1];
         }
+        order[i] = id;
+        n++;
     }
 
-    return BLE_ATT_ERR_UNLIKELY;
+    next = gatt_svr_version;
+    off = 4;
+    for (i = 0; i < n; i++) {
+        id = order[i];
+        do {
+            seq = snapshot_read_begin(gatt_svr_chr_slots[id].snap, &data, &len);
+            if (off + 3 + len > GATT_SVR_CHANGES_MAX || len > UINT8_MAX) {
+                break;
+            }
+            put_le16(c->buf + off, gatt_svr_val_handles[id]);
+            c->buf[off + 2] = len;
+            memcpy(c->buf + off + 3, data, len);
+        } while (snapshot_read_retry(gatt_svr_chr_slots[id].snap, seq));
+
+        if (off + 3 + len > GATT_SVR_CHANGES_MAX || len > UINT8_MAX) {
+            next = gatt_svr_chr_versions[id] - 1;
+            break;
+        }
+        off += 3 + len;
+    }
+    put_le32(c->buf, next);
+    c->len = off;
+}
+
+static struct gatt_svr_changes *
+gatt_svr_changes_find(uint16_t conn_handle, bool allocate)
+{
+    struct gatt_svr_changes *free_entry = NULL;
+    int i;
+
+    for (i = 0; i < GATT_SVR_MAX_CONNS; i++) {
+        if (gatt_svr_changes[i].conn_handle == conn_handle) {
+            return &gatt_svr_changes[i];
+        }
+        if (free_entry == NULL &&
+            gatt_svr_changes[i].conn_handle == BLE_HS_CONN_HANDLE_NONE) {
+            free_entry = &gatt_svr_changes[i];
+        }
+    }
+    if (allocate && free_entry != NULL) {
+        free_entry->conn_handle = conn_handle;
+        gatt_svr_changes_build(free_entry, 0);
+    }
+    return allocate ? free_entry : NULL;
 }
 
 static int
-gatt_svr_chr_access_sec_test(uint16_t conn_handle, uint16_t attr_handle,
-                             struct ble_gatt_access_ctxt *ctxt,
-                             void *arg)
+gatt_svr_changed_since_access(uint16_t conn_handle, uint16_t attr_handle,
+                              struct ble_gatt_access_ctxt *ctxt, void *arg)
 {
-    const ble_uuid_t *uuid;
-    int rand_num;
+    struct gatt_svr_changes *c;
+    uint8_t buf[4];
     int rc;
 
-    uuid = ctxt->chr->uuid;
+    c = gatt_svr_changes_find(conn_handle, true);
+    if (c == NULL) {
+        return BLE_ATT_ERR_INSUFFICIENT_RES;
+    }
 
-    /* Determine which characteristic is being accessed by examining its
-     * 128-bit UUID.
-     */
+    switch (ctxt->op) {
+    case BLE_GATT_ACCESS_OP_READ_CHR:
+        rc = os_mbuf_append(ctxt->om, c->buf, c->len);
+        return rc == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
 
-    if (ble_uuid_cmp(uuid, &gatt_svr_chr_sec_test_rand_uuid.u) == 0) {
-        assert(ctxt->op == BLE_GATT_ACCESS_OP_READ_CHR);
+    case BLE_GATT_ACCESS_OP_WRITE_CHR:
+        rc = gatt_svr_chr_write(ctxt->om, sizeof buf, sizeof buf, buf, NULL);
+        if (rc != 0) {
+            return rc;
+        }
+        gatt_svr_changes_build(c, get_le32(buf));
+        return 0;
 
-        /* Respond with a 32-bit random number. */
-        rand_num = rand();
-        rc = os_mbuf_append(ctxt->om, &rand_num, sizeof rand_num);
-        return rc == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
+    default:
+        return BLE_ATT_ERR_UNLIKELY;
     }
+}
+
+static int
+gatt_svr_time_sync_access(uint16_t conn_handle, uint16_t attr_handle,
+                          struct ble_gatt_access_ctxt *ctxt, void *arg)
+{
+    uint8_t buf[TIMESYNC_READ_LEN];  /* longer than any write */
+    uint16_t len;
+    int rc;
 
-    if (ble_uuid_cmp(uuid, &gatt_svr_chr_sec_test_static_uuid.u) == 0) {
-        switch (ctxt->op) {
-        case BLE_GATT_ACCESS_OP_READ_CHR:
-            rc = os_mbuf_append(ctxt->om, &gatt_svr_sec_test_static_val,
-                                sizeof gatt_svr_sec_test_static_val);
-            return rc == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
-
-        case BLE_GATT_ACCESS_OP_WRITE_CHR:
-            rc = gatt_svr_chr_write(ctxt->om,
-                                    sizeof gatt_svr_sec_test_static_val,
-                                    sizeof gatt_svr_sec_test_static_val,
-                                    &gatt_svr_sec_test_static_val, NULL);
+    switch (ctxt->op) {
+    case BLE_GATT_ACCESS_OP_READ_CHR:
+        rc = timesync_on_read(conn_handle, buf);
+        if (rc != 0) {
             return rc;
+        }
+        rc = os_mbuf_append(ctxt->om, buf, TIMESYNC_READ_LEN);
+        return rc == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
 
-        default:
-            assert(0);
-            return BLE_ATT_ERR_UNLIKELY;
+    case BLE_GATT_ACCESS_OP_WRITE_CHR:
+        rc = gatt_svr_chr_write(ctxt->om, TIMESYNC_WRITE_MIN,
+                                TIMESYNC_WRITE_MAX, buf, &len);
+        if (rc != 0) {
+            return rc;
         }
+        return timesync_on_write(conn_handle, buf, len);
+
+    default:
+        return BLE_ATT_ERR_UNLIKELY;
     }
+}
+
+void
+gatt_svr_on_disconnect(uint16_t conn_handle)
+{
+    struct gatt_svr_changes *c;
+
+    c = gatt_svr_changes_find(conn_handle, false);
+    if (c != NULL) {
+        c->conn_handle = BLE_HS_CONN_HANDLE_NONE;
+    }
+}
 
-    /* Unknown characteristic; the nimble stack should not have called this
-     * function.
-     */
-    assert(0);
-    return BLE_ATT_ERR_UNLIKELY;
+uint16_t
+gatt_svr_chr_val_handle(enum gatt_svr_chr_id id)
+{
+    return gatt_svr_val_handles[id];
 }
 
 void
@@ -423,6 +715,8 @@ gatt_svr_register_cb(struct ble_gatt_register_ctxt *ctxt, void *arg)
 {
     char buf[BLE_UUID_STR_LEN];
 
+    gatt_cache_register_cb(ctxt);
+
     switch (ctxt->op) {
     case BLE_GATT_REGISTER_OP_SVC:
         MODLOG_DFLT(DEBUG, "registered service %s with handle=%d\n",
@@ -454,10 +748,27 @@ int
 gatt_svr_init(void)
 {
     int rc;
+    int i;
+
+    for (i = 0; i < GATT_SVR_MAX_CONNS; i++) {
+        gatt_svr_changes[i].conn_handle = BLE_HS_CONN_HANDLE_NONE;
+    }
+    /* Half the range is left above the base to count in. */
+    gatt_svr_version_base = 1 + (esp_random() >> 1);
+    gatt_svr_version = gatt_svr_version_base - 1;
 
     ble_svc_gap_init();
+#if CONFIG_APP_GATT_CACHING
+    rc = gatt_cache_init();
+    if (rc != 0) {
+        return rc;
+    }
+#else
     ble_svc_gatt_init();
+#endif
+#if CONFIG_APP_GATT_ANS_SVC
     ble_svc_ans_init();
+#endif
 
     rc = ble_gatts_count_cfg(gatt_svr_svcs);
     if (rc != 0) {
@@ -0,0 +1,386 @@
+/*
+ * Declarative schema for the application GATT services.
+ *
+ * Every service and characteristic exposed by gatt_svr.c is described here
+ * exactly once.  gatt_svr.c expands these lists at compile time into the
+ * UUID objects, the NimBLE service table, the user-description descriptors
+ * and the per-characteristic dispatch slots, so nothing in this file costs
+ * RAM: all generated tables are const and live in flash.
+ *
+ * UUIDs are written in their canonical textual byte order (the order used in
+ * the comment next to them); GATT_SVR_UUID128() reverses them into the
+ * little-endian layout NimBLE expects.
+ *
+ * Service entry:
+ *     SVC(id, uuid, chr_list)
+ *
+ * Characteristic entry:
+ *     CHR(id, uuid, flags, user_description, access)
+ *
+ * where access is one of:
+ *     GATT_SVR_SCALAR(len, min, max, get, set)
+ *         Little-endian unsigned value of len bytes.  Writes outside
+ *         [min, max] are rejected before set() is called.  get/set may be
+ *         NULL for write-only/read-only characteristics.
+ *     GATT_SVR_SNAPSHOT(snap, len, min, max, set)
+ *         Reads copy out a value its producer has already encoded into a
+ *         snapshot_t (snapshot.h), so they take no locks and do no
+ *         encoding.  Writes are handled as for GATT_SVR_SCALAR; set may be
+ *         NULL for read-only characteristics.
+ *     GATT_SVR_CUSTOM(access_cb)
+ *         Characteristic handles its own encoding.
+ *
+ * Snapshot-backed characteristics are the data characteristics: their
+ * changes are tracked for the changed-since characteristic.
+ */
+
+#ifndef H_GATT_SVR_SCHEMA_
+#define H_GATT_SVR_SCHEMA_
+
+#include <stdint.h>
+#include "sdkconfig.h"
+
+#define GATT_SVR_UUID16(v) { .u16 = BLE_UUID16_INIT(v) }
+
+#define GATT_SVR_UUID128(b0, b1, b2, b3, b4, b5, b6, b7,                    \
+                         b8, b9, b10, b11, b12, b13, b14, b15)              \
+    { .u128 = BLE_UUID128_INIT(0x##b15, 0x##b14, 0x##b13, 0x##b12,          \
+                               0x##b11, 0x##b10, 0x##b9, 0x##b8,            \
+                               0x##b7, 0x##b6, 0x##b5, 0x##b4,              \
+                               0x##b3, 0x##b2, 0x##b1, 0x##b0) }
+
+/*** Services. */
+#define GATT_SVR_SVCS(SVC)                                                  \
+    GATT_SVR_SEC_TEST_SVC(SVC)                                              \
+    /* 41c6b692-0ba0-4b73-b586-35a268a320ef.  Older firmware sent the       \
+       LED UUIDs byte-reversed; see "LED Service UUIDs" in README. */       \
+    SVC(LED,                                                                \
+        GATT_SVR_UUID128(41, c6, b6, 92, 0b, a0, 4b, 73,                    \
+                         b5, 86, 35, a2, 68, a3, 20, ef),                   \
+        GATT_SVR_LED_CHRS)                                                  \
+    /* a7f6fbde-5fc5-42de-8100-aed1bb8d8af2 */                              \
+    SVC(CTRL,                                                               \
+        GATT_SVR_UUID128(a7, f6, fb, de, 5f, c5, 42, de,                    \
+                         81, 00, ae, d1, bb, 8d, 8a, f2),                   \
+        GATT_SVR_CTRL_CHRS)                                                 \
+    SVC(CP, GATT_SVR_UUID16(0x1818), GATT_SVR_CP_CHRS)                      \
+    SVC(CSC, GATT_SVR_UUID16(0x1816), GATT_SVR_CSC_CHRS)                    \
+    GATT_SVR_DIAG_SVC(SVC)                                                  \
+    GATT_SVR_LOG_SVC(SVC)                                                   \
+    GATT_SVR_ASSIST_SVC(SVC)                                                \
+    GATT_SVR_PROXY_SVC(SVC)                                                 \
+    /* 85accdbf-7236-4d24-b95c-c46c2481e0e8 */                              \
+    SVC(SYNC,                                                               \
+        GATT_SVR_UUID128(85, ac, cd, bf, 72, 36, 4d, 24,                    \
+                         b9, 5c, c4, 6c, 24, 81, e0, e8),                   \
+        GATT_SVR_SYNC_CHRS)
+
+/**
+ * Optional services compile to nothing when disabled in menuconfig, so they
+ * cost neither attribute handles nor discovery round trips.
+ *
+ * The vendor specific security test service consists of two characteristics:
+ *     o random-number-generator: generates a random 32-bit number each time
+ *       it is read.  This characteristic can only be read over an encrypted
+ *       connection.
+ *     o static-value: a single-byte characteristic that can always be read,
+ *       but can only be written over an encrypted connection.
+ */
+#if CONFIG_APP_GATT_SEC_TEST_SVC
+#define GATT_SVR_SEC_TEST_SVC(SVC)                                          \
+    /* 59462f12-9543-9999-12c8-58b459a2712d */                              \
+    SVC(SEC_TEST,                                                           \
+        GATT_SVR_UUID128(59, 46, 2f, 12, 95, 43, 99, 99,                    \
+                         12, c8, 58, b4, 59, a2, 71, 2d),                   \
+        GATT_SVR_SEC_TEST_CHRS)
+#define GATT_SVR_SEC_TEST_CHRS(CHR)                                         \
+    /* 5c3a659e-897e-45e1-b016-007107c96df6 */                              \
+    CHR(SEC_TEST_RAND,                                                      \
+        GATT_SVR_UUID128(5c, 3a, 65, 9e, 89, 7e, 45, e1,                    \
+                         b0, 16, 00, 71, 07, c9, 6d, f6),                   \
+        BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_READ_ENC,                      \
+        "SecTestRandom",                                                    \
+        GATT_SVR_SCALAR(4, 0, UINT32_MAX, gatt_svr_sec_test_rand_get, NULL)) \
+    /* 5c3a659e-897e-45e1-b016-007107c96df7 */                              \
+    CHR(SEC_TEST_STATIC,                                                    \
+        GATT_SVR_UUID128(5c, 3a, 65, 9e, 89, 7e, 45, e1,                    \
+                         b0, 16, 00, 71, 07, c9, 6d, f7),                   \
+        BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE |                        \
+        BLE_GATT_CHR_F_WRITE_ENC,                                           \
+        "SecTestStatic",                                                    \
+        GATT_SVR_SCALAR(1, 0, UINT8_MAX, gatt_svr_sec_test_static_get,      \
+                        gatt_svr_sec_test_static_set))
+#else
+#define GATT_SVR_SEC_TEST_SVC(SVC)
+#define GATT_SVR_SEC_TEST_CHRS(CHR)
+#endif
+
+/**
+ * Diagnostics service: one read-only characteristic holding the latest
+ * snapshot of task CPU and stack use, heap, mbufs and connections, in the
+ * format documented in diag.h.  It changes every snapshot period, so it is
+ * left out of change tracking rather than resent on every poll.
+ */
+#if CONFIG_APP_DIAG
+#define GATT_SVR_DIAG_SVC(SVC)                                              \
+    /* 4fd96a18-8e5a-4769-9fb6-6f5b9a5b42f7 */                              \
+    SVC(DIAG,                                                               \
+        GATT_SVR_UUID128(4f, d9, 6a, 18, 8e, 5a, 47, 69,                    \
+                         9f, b6, 6f, 5b, 9a, 5b, 42, f7),                   \
+        GATT_SVR_DIAG_CHRS)
+#define GATT_SVR_DIAG_CHRS(CHR)                                             \
+    /* ee22d3f7-a421-4b0a-9ebb-3207811417c2 */                              \
+    CHR(DIAG_SNAPSHOT,                                                      \
+        GATT_SVR_UUID128(ee, 22, d3, f7, a4, 21, 4b, 0a,                    \
+                         9e, bb, 32, 07, 81, 14, 17, c2),                   \
+        BLE_GATT_CHR_F_READ,                                                \
+        "DiagSnapshot",                                                     \
+        GATT_SVR_CUSTOM(gatt_svr_diag_access))
+#else
+#define GATT_SVR_DIAG_SVC(SVC)
+#define GATT_SVR_DIAG_CHRS(CHR)
+#endif
+
+/**
+ * Log service, laid out as the Nordic UART Service so serial-terminal apps
+ * recognise it.  TX notifies log output in MTU-sized pieces of a byte
+ * stream, with no framing beyond the newlines of the lines themselves; RX
+ * takes console commands, one per line, and only over an authenticated,
+ * encrypted link since they can change settings.  See log_bridge.h.
+ */
+#if CONFIG_APP_LOG_BRIDGE
+#define GATT_SVR_LOG_SVC(SVC)                                               \
+    /* 6e400001-b5a3-f393-e0a9-e50e24dcca9e */                              \
+    SVC(LOG,                                                                \
+        GATT_SVR_UUID128(6e, 40, 00, 01, b5, a3, f3, 93,                    \
+                         e0, a9, e5, 0e, 24, dc, ca, 9e),                   \
+        GATT_SVR_LOG_CHRS)
+#define GATT_SVR_LOG_CHRS(CHR)                                              \
+    /* 6e400002-b5a3-f393-e0a9-e50e24dcca9e */                              \
+    CHR(LOG_RX,                                                             \
+        GATT_SVR_UUID128(6e, 40, 00, 02, b5, a3, f3, 93,                    \
+                         e0, a9, e5, 0e, 24, dc, ca, 9e),                   \
+        BLE_GATT_CHR_F_WRITE | BLE_GATT_CHR_F_WRITE_NO_RSP |                \
+        BLE_GATT_CHR_F_WRITE_ENC | BLE_GATT_CHR_F_WRITE_AUTHEN,             \
+        "ConsoleRx",                                                        \
+        GATT_SVR_CUSTOM(gatt_svr_log_rx_access))                            \
+    /* 6e400003-b5a3-f393-e0a9-e50e24dcca9e */                              \
+    CHR(LOG_TX,                                                             \
+        GATT_SVR_UUID128(6e, 40, 00, 03, b5, a3, f3, 93,                    \
+                         e0, a9, e5, 0e, 24, dc, ca, 9e),                   \
+        BLE_GATT_CHR_F_NOTIFY,                                              \
+        "LogTx",                                                            \
+        GATT_SVR_CUSTOM(gatt_svr_notify_only_access))
+#else
+#define GATT_SVR_LOG_SVC(SVC)
+#define GATT_SVR_LOG_CHRS(CHR)
+#endif
+
+/**
+ * Assist service: one curve per assist level, mapping pedal torque and
+ * cadence to the motor current target.  Curves set how hard the motor
+ * pushes, so writes need an authenticated, encrypted link.  See assist.h
+ * for the encoding.
+ */
+#if CONFIG_APP_ASSIST
+#define GATT_SVR_ASSIST_SVC(SVC)                                            \
+    /* 1e342b97-c821-42b2-96a6-bc950fdfbfb5 */                              \
+    SVC(ASSIST,                                                             \
+        GATT_SVR_UUID128(1e, 34, 2b, 97, c8, 21, 42, b2,                    \
+                         96, a6, bc, 95, 0f, df, bf, b5),                   \
+        GATT_SVR_ASSIST_CHRS)
+#define GATT_SVR_ASSIST_CHRS(CHR)                                           \
+    /* 7dbe043e-a186-465b-a1e0-0052e7b30f80 */                              \
+    CHR(ASSIST_CURVE,                                                       \
+        GATT_SVR_UUID128(7d, be, 04, 3e, a1, 86, 46, 5b,                    \
+                         a1, e0, 00, 52, e7, b3, 0f, 80),                   \
+        BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE |                        \
+        BLE_GATT_CHR_F_WRITE_ENC | BLE_GATT_CHR_F_WRITE_AUTHEN,             \
+        "AssistCurve",                                                      \
+        GATT_SVR_CUSTOM(gatt_svr_assist_curve_access))
+#else
+#define GATT_SVR_ASSIST_SVC(SVC)
+#define GATT_SVR_ASSIST_CHRS(CHR)
+#endif
+
+/**
+ * Display link proxy: reads the latest frames each way and the assist level
+ * in effect, writes override the level sent to the motor and so need an
+ * authenticated, encrypted link.  See uart_proxy.h.
+ */
+#if CONFIG_APP_UART_PROXY
+#define GATT_SVR_PROXY_SVC(SVC)                                             \
+    /* 5c0b8d28-a39f-4335-ad28-44a5ec97979e */                              \
+    SVC(PROXY,                                                              \
+        GATT_SVR_UUID128(5c, 0b, 8d, 28, a3, 9f, 43, 35,                    \
+                         ad, 28, 44, a5, ec, 97, 97, 9e),                   \
+        GATT_SVR_PROXY_CHRS)
+#define GATT_SVR_PROXY_CHRS(CHR)                                            \
+    /* 6962c731-1920-4ba7-8d9c-e3da562cb7bf */                              \
+    CHR(PROXY_STATUS,                                                       \
+        GATT_SVR_UUID128(69, 62, c7, 31, 19, 20, 4b, a7,                    \
+                         8d, 9c, e3, da, 56, 2c, b7, bf),                   \
+        BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE |                        \
+        BLE_GATT_CHR_F_WRITE_ENC | BLE_GATT_CHR_F_WRITE_AUTHEN,             \
+        "MotorLink",                                                        \
+        GATT_SVR_SNAPSHOT(&uart_proxy_snap, 1, 0, UINT8_MAX,                \
+                          gatt_svr_proxy_level_set))
+#else
+#define GATT_SVR_PROXY_SVC(SVC)
+#define GATT_SVR_PROXY_CHRS(CHR)
+#endif
+
+/**
+ * LED control service.  The delay characteristic is the time in ms between
+ * rainbow steps; if 0, the static RGB value set by the other three is shown.
+ * The latency characteristic reads back write-to-refresh latency as seven
+ * little-endian uint32: count, mean, p50, p90, p99, max (us) and the number
+ * of writes superseded before they were shown.  Writing it resets the
+ * histogram.  It changes with every LED write, so like the diagnostics it is
+ * left out of change tracking.
+ */
+#define GATT_SVR_LED_CHRS(CHR)                                              \
+    /* d7419b26-1437-4f29-a6c8-259cf01bc815 */                              \
+    CHR(LED_STATIC_RED,                                                     \
+        GATT_SVR_UUID128(d7, 41, 9b, 26, 14, 37, 4f, 29,                    \
+                         a6, c8, 25, 9c, f0, 1b, c8, 15),                   \
+        BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE,                         \
+        "RedLedBrightness",                                                 \
+        GATT_SVR_SNAPSHOT(&led_color_snap[RED], 1, 0, UINT8_MAX,            \
+                          gatt_svr_led_red_set))                              \
+    /* 3fa4eea9-5368-4f1b-9687-10574f0adcae */                              \
+    CHR(LED_STATIC_GREEN,                                                   \
+        GATT_SVR_UUID128(3f, a4, ee, a9, 53, 68, 4f, 1b,                    \
+                         96, 87, 10, 57, 4f, 0a, dc, ae),                   \
+        BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE,                         \
+        "GreenLedBrightness",                                               \
+        GATT_SVR_SNAPSHOT(&led_color_snap[GREEN], 1, 0, UINT8_MAX,          \
+                          gatt_svr_led_green_set))                            \
+    /* 8f61467a-c4ff-4ebb-943d-49596f9fd4e7 */                              \
+    CHR(LED_STATIC_BLUE,                                                    \
+        GATT_SVR_UUID128(8f, 61, 46, 7a, c4, ff, 4e, bb,                    \
+                         94, 3d, 49, 59, 6f, 9f, d4, e7),                   \
+        BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE,                         \
+        "BlueLedBrightness",                                                \
+        GATT_SVR_SNAPSHOT(&led_color_snap[BLUE], 1, 0, UINT8_MAX,           \
+                          gatt_svr_led_blue_set))                             \
+    /* dfae6ade-d0fe-453e-ba47-07b8a3c6bbb5 */                              \
+    CHR(LED_DELAY,                                                          \
+        GATT_SVR_UUID128(df, ae, 6a, de, d0, fe, 45, 3e,                    \
+                         ba, 47, 07, b8, a3, c6, bb, b5),                   \
+        BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE,                         \
+        "LedDelay",                                                         \
+        GATT_SVR_SNAPSHOT(&led_delay_snap, 4, 0, 60000,                     \
+                          gatt_svr_led_delay_set))                            \
+    /* 625d6f47-1c01-4150-8b19-93dbe0c945b7 */                              \
+    CHR(LED_LATENCY,                                                        \
+        GATT_SVR_UUID128(62, 5d, 6f, 47, 1c, 01, 41, 50,                    \
+                         8b, 19, 93, db, e0, c9, 45, b7),                   \
+        BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE,                         \
+        "LedWriteLatency",                                                  \
+        GATT_SVR_CUSTOM(gatt_svr_led_latency_access))
+
+/**
+ * Control service.  The command characteristic accepts write-without-response
+ * so a client can stream updates faster than one per connection event; see
+ * ctrl_task.h for the command format.
+ */
+#define GATT_SVR_CTRL_CHRS(CHR)                                             \
+    /* c9c95d40-ee21-4db3-a0a9-f93181c088e4 */                              \
+    CHR(CTRL_CMD,                                                           \
+        GATT_SVR_UUID128(c9, c9, 5d, 40, ee, 21, 4d, b3,                    \
+                         a0, a9, f9, 31, 81, c0, 88, e4),                   \
+        BLE_GATT_CHR_F_WRITE | BLE_GATT_CHR_F_WRITE_NO_RSP,                 \
+        "ControlCommand",                                                   \
+        GATT_SVR_CUSTOM(gatt_svr_ctrl_cmd_access))
+
+/**
+ * Cycling Power and Cycling Speed and Cadence services, as defined by the
+ * Bluetooth SIG, so bike computers can pair with the controller directly.
+ * The measurement characteristics are notify-only; cycling.c encodes them and
+ * paces the notifications.
+ */
+#define GATT_SVR_CP_CHRS(CHR)                                               \
+    CHR(CP_MEASUREMENT, GATT_SVR_UUID16(0x2A63),                            \
+        BLE_GATT_CHR_F_NOTIFY,                                              \
+        "CyclingPowerMeasurement",                                          \
+        GATT_SVR_CUSTOM(gatt_svr_notify_only_access))                       \
+    CHR(CP_FEATURE, GATT_SVR_UUID16(0x2A65),                                \
+        BLE_GATT_CHR_F_READ,                                                \
+        "CyclingPowerFeature",                                              \
+        GATT_SVR_SCALAR(4, 0, UINT32_MAX, gatt_svr_cp_feature_get, NULL))   \
+    CHR(CP_SENSOR_LOCATION, GATT_SVR_UUID16(0x2A5D),                        \
+        BLE_GATT_CHR_F_READ,                                                \
+        "SensorLocation",                                                   \
+        GATT_SVR_SCALAR(1, 0, UINT8_MAX, gatt_svr_sensor_location_get,      \
+                        NULL))
+
+#define GATT_SVR_CSC_CHRS(CHR)                                              \
+    CHR(CSC_MEASUREMENT, GATT_SVR_UUID16(0x2A5B),                           \
+        BLE_GATT_CHR_F_NOTIFY,                                              \
+        "CscMeasurement",                                                   \
+        GATT_SVR_CUSTOM(gatt_svr_notify_only_access))                       \
+    CHR(CSC_FEATURE, GATT_SVR_UUID16(0x2A5C),                               \
+        BLE_GATT_CHR_F_READ,                                                \
+        "CscFeature",                                                       \
+        GATT_SVR_SCALAR(2, 0, UINT16_MAX, gatt_svr_csc_feature_get, NULL))  \
+    CHR(CSC_SENSOR_LOCATION, GATT_SVR_UUID16(0x2A5D),                       \
+        BLE_GATT_CHR_F_READ,                                                \
+        "SensorLocation",                                                   \
+        GATT_SVR_SCALAR(1, 0, UINT8_MAX, gatt_svr_sensor_location_get,      \
+                        NULL))
+
+/**
+ * Sync service: keeping the phone in step with the bike.
+ *
+ * The time sync characteristic runs NTP-style exchanges so the firmware can
+ * convert its sample timestamps to the phone's clock; see timesync.h for the
+ * exchange.
+ *
+ * The changed-since characteristic is for clients that poll instead of
+ * subscribing.  Every data characteristic has a version, taken from one
+ * counter that grows whenever any of them changes.  A client writes the
+ * highest version it has seen (uint32 LE) to the changed-since
+ * characteristic and reads back:
+ *     uint32 LE   version to send next time
+ *     then for each data characteristic changed since the written version,
+ *     oldest change first:
+ *     uint16 LE   value handle
+ *     uint8       value length
+ *     ...         value, as a read of that characteristic returns it
+ * Reading without a prior write, or writing 0, returns every data
+ * characteristic.  The counter starts at a random point on every boot, so a
+ * version kept from before a reboot returns every one as well.  The
+ * response is built at the write and stays the same until the next one, so
+ * it can be read in several parts.  On a quiet bike it is 4 bytes.
+ */
+#define GATT_SVR_SYNC_CHRS(CHR)                                             \
+    /* 145d0ae2-769d-4f75-b227-1af6c5afc0f3 */                              \
+    CHR(TIME_SYNC,                                                          \
+        GATT_SVR_UUID128(14, 5d, 0a, e2, 76, 9d, 4f, 75,                    \
+                         b2, 27, 1a, f6, c5, af, c0, f3),                   \
+        BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE,                         \
+        "TimeSync",                                                         \
+        GATT_SVR_CUSTOM(gatt_svr_time_sync_access))                         \
+    /* cb84720e-b239-46ce-8ef6-94574f5ae450 */                              \
+    CHR(CHANGED_SINCE,                                                      \
+        GATT_SVR_UUID128(cb, 84, 72, 0e, b2, 39, 46, ce,                    \
+                         8e, f6, 94, 57, 4f, 5a, e4, 50),                   \
+        BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE,                         \
+        "ChangedSince",                                                     \
+        GATT_SVR_CUSTOM(gatt_svr_changed_since_access))
+
+/* Every characteristic of every service, in table order. */
+#define GATT_SVR_CHRS(CHR)                                                  \
+    GATT_SVR_SEC_TEST_CHRS(CHR)                                             \
+    GATT_SVR_LED_CHRS(CHR)                                                  \
+    GATT_SVR_CTRL_CHRS(CHR)                                                 \
+    GATT_SVR_CP_CHRS(CHR)                                                   \
+    GATT_SVR_CSC_CHRS(CHR)                                                  \
+    GATT_SVR_DIAG_CHRS(CHR)                                                 \
+    GATT_SVR_LOG_CHRS(CHR)                                                  \
+    GATT_SVR_ASSIST_CHRS(CHR)                                               \
+    GATT_SVR_PROXY_CHRS(CHR)                                                \
+    GATT_SVR_SYNC_CHRS(CHR)
+
+#endif
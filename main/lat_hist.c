@@ -0,0 +1,65 @@
+#include "lat_hist.h"
+#include <string.h>
+
+static int bucket_of(uint32_t value) {
+    if (value < LAT_HIST_SUB) {
+        return value;
+    }
+    int msb = 31 - __builtin_clz(value);
+    int sub = (value >> (msb - LAT_HIST_SUB_BITS)) & (LAT_HIST_SUB - 1);
+    return (msb - LAT_HIST_SUB_BITS + 1) * LAT_HIST_SUB + sub;
+}
+
+// Largest value that falls into the bucket.
+static uint32_t bucket_limit(int bucket) {
+    if (bucket < LAT_HIST_SUB) {
+        return bucket;
+    }
+    int msb = bucket / LAT_HIST_SUB + LAT_HIST_SUB_BITS - 1;
+    uint64_t lower = (uint64_t)(LAT_HIST_SUB + bucket % LAT_HIST_SUB)
+                     << (msb - LAT_HIST_SUB_BITS);
+    uint64_t width = (uint64_t)1 << (msb - LAT_HIST_SUB_BITS);
+    return lower + width - 1;
+}
+
+void lat_hist_reset(lat_hist_t *hist) {
+    memset(hist, 0, sizeof(*hist));
+}
+
+void lat_hist_record(lat_hist_t *hist, uint32_t value) {
+    hist->buckets[bucket_of(value)]++;
+    hist->count++;
+    hist->sum += value;
+    if (value > hist->max) {
+        hist->max = value;
+    }
+}
+
+uint32_t lat_hist_percentile(const lat_hist_t *hist, uint32_t percent) {
+    if (hist->count == 0) {
+        return 0;
+    }
+    // Rank of the sample at the percentile, 1-based, rounded up.
+    uint64_t rank = ((uint64_t)hist->count * percent + 99) / 100;
+    if (rank == 0) {
+        rank = 1;
+    }
+    uint64_t seen = 0;
+    for (int i = 0; i < LAT_HIST_BUCKETS; i++) {
+        seen += hist->buckets[i];
+        if (seen >= rank) {
+            uint32_t limit = bucket_limit(i);
+            return limit < hist->max ? limit : hist->max;
+        }
+    }
+    return hist->max;
+}
+
+void lat_hist_summary(const lat_hist_t *hist, lat_summary_t *summary) {
+    summary->count = hist->count;
+    summary->mean = hist->count ? hist->sum / hist->count : 0;
+    summary->p50 = lat_hist_percentile(hist, 50);
+    summary->p90 = lat_hist_percentile(hist, 90);
+    summary->p99 = lat_hist_percentile(hist, 99);
+    summary->max = hist->max;
+}
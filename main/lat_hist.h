@@ -0,0 +1,40 @@
+#ifndef LAT_HIST
+#define LAT_HIST
+
+#include <stdint.h>
+
+// Log-linear latency histogram: four sub-buckets per power of two, so any
+// reported percentile is within 25% of the true value across the whole
+// uint32_t range. Recording is O(1) and allocation-free.
+
+#define LAT_HIST_SUB_BITS 2
+#define LAT_HIST_SUB      (1 << LAT_HIST_SUB_BITS)
+#define LAT_HIST_BUCKETS  ((32 - LAT_HIST_SUB_BITS + 1) * LAT_HIST_SUB)
+
+typedef struct {
+    uint32_t count;
+    uint32_t max;
+    uint64_t sum;
+    uint32_t buckets[LAT_HIST_BUCKETS];
+} lat_hist_t;
+
+// Summary in the units that were recorded.
+typedef struct {
+    uint32_t count;
+    uint32_t mean;
+    uint32_t p50;
+    uint32_t p90;
+    uint32_t p99;
+    uint32_t max;
+} lat_summary_t;
+
+void lat_hist_reset(lat_hist_t *hist);
+void lat_hist_record(lat_hist_t *hist, uint32_t value);
+
+// Upper bound of the bucket holding the given percentile (0-100), clamped
+// to the largest recorded value.
+uint32_t lat_hist_percentile(const lat_hist_t *hist, uint32_t percent);
+
+void lat_hist_summary(const lat_hist_t *hist, lat_summary_t *summary);
+
+#endif // LAT_HIST
@@ -1,14 +1,132 @@
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <string.h>
 #include "led_task.h"
 #include "led_strip.h"
+#include "boot_prof.h"
+#include "frame_sched.h"
+#include "lat_hist.h"
+#include "mailbox.h"
+#include "esp_console.h"
+#include "esp_log.h"
+#include "esp_timer.h"
 #include "nimble/nimble_port_freertos.h"
+#include "os/endian.h"
 
-// Don't strictly need a mutex for these as reads and writes should be atomic, but
-// adding one for good practice.
-static uint8_t g_red = 0;
-static uint8_t g_green = 0;
-static uint8_t g_blue = 0;
-static uint32_t g_delay = 50;
-static SemaphoreHandle_t g_mutex;
+// Frame period when showing a static color and nothing needs animating.
+#define STATIC_PERIOD_MS 100
+
+typedef struct {
+    frame_stats_t frames;
+    lat_summary_t latency;
+    uint32_t superseded;
+} led_stats_t;
+
+// Settings flow control task -> LED task on the led_settings topic, stats
+// flow LED task -> everyone through a mailbox. Each has exactly one writer,
+// so nothing here takes a lock.
+EVBUS_TOPIC_DEFINE(led_settings_topic, led_settings_t, 8);
+static led_settings_t g_settings = {.delay = 50}; // writer's copy
+static led_stats_t g_stats_box_buf;
+static mailbox_t g_stats_box;
+static atomic_bool g_reset_latency;
+static TaskHandle_t g_led_task;
+
+// Colors and delay are written by the control task, latency by the LED task.
+snapshot_t led_color_snap[NO_COLOR];
+snapshot_t led_delay_snap;
+snapshot_t led_latency_snap;
+static uint8_t g_color_snap_buf[NO_COLOR][2 * 1];
+static uint8_t g_delay_snap_buf[2 * 4];
+static uint8_t g_latency_snap_buf[2 * LED_LATENCY_WIRE_LEN];
+
+static void publishColor(color_t color, uint8_t val) {
+    snapshot_publish(&led_color_snap[color], &val, 1);
+}
+
+static void publishDelay(uint32_t ms) {
+    put_le32(snapshot_back(&led_delay_snap), ms);
+    snapshot_commit(&led_delay_snap, 4);
+}
+
+static void publishLatency(const led_stats_t* stats) {
+    uint8_t* p = snapshot_back(&led_latency_snap);
+    put_le32(p + 0, stats->latency.count);
+    put_le32(p + 4, stats->latency.mean);
+    put_le32(p + 8, stats->latency.p50);
+    put_le32(p + 12, stats->latency.p90);
+    put_le32(p + 16, stats->latency.p99);
+    put_le32(p + 20, stats->latency.max);
+    put_le32(p + 24, stats->superseded);
+    snapshot_commit(&led_latency_snap, LED_LATENCY_WIRE_LEN);
+}
+
+static int ledstats_cmd_handler(int argc, char *argv[]) {
+    frame_stats_t stats;
+    getLedFrameStats(&stats);
+    ESP_LOGI("LED", "frames %u missed %u period min/avg/max %u/%u/%u us "
+             "jitter avg/max %u/%u us",
+             stats.frames, stats.missed, stats.period_min_us,
+             stats.period_avg_us, stats.period_max_us,
+             stats.jitter_avg_us, stats.jitter_max_us);
+    return 0;
+}
+
+static const esp_console_cmd_t g_ledstats_cmd = {
+    .command = "ledstats",
+    .help = "Print LED frame period, jitter and missed deadlines",
+    .func = ledstats_cmd_handler,
+};
+
+static int ledlat_cmd_handler(int argc, char *argv[]) {
+    if (argc == 2 && strcmp(argv[1], "reset") == 0) {
+        resetLedLatency();
+        return 0;
+    }
+    lat_summary_t lat;
+    uint32_t superseded;
+    getLedLatency(&lat, &superseded);
+    ESP_LOGI("LED", "write-to-refresh latency: n %u mean %u p50 %u p90 %u "
+             "p99 %u max %u us, superseded %u",
+             lat.count, lat.mean, lat.p50, lat.p90, lat.p99, lat.max,
+             superseded);
+    return 0;
+}
+
+static const esp_console_cmd_t g_ledlat_cmd = {
+    .command = "ledlat",
+    .help = "Print (or 'reset') write-to-refresh latency percentiles",
+    .func = ledlat_cmd_handler,
+};
+
+void initLedState(void) {
+    // Published before the BLE host starts so GATT reads see the defaults.
+    mailbox_init(&g_stats_box, &g_stats_box_buf, sizeof(led_stats_t));
+    led_settings_topic_publish(&g_settings);
+
+    for (color_t c = RED; c < NO_COLOR; c++) {
+        snapshot_init(&led_color_snap[c], g_color_snap_buf[c], 1);
+    }
+    snapshot_init(&led_delay_snap, g_delay_snap_buf, 4);
+    snapshot_init(&led_latency_snap, g_latency_snap_buf, LED_LATENCY_WIRE_LEN);
+    publishColor(RED, g_settings.red);
+    publishColor(GREEN, g_settings.green);
+    publishColor(BLUE, g_settings.blue);
+    publishDelay(g_settings.delay);
+    const led_stats_t no_stats = {0};
+    publishLatency(&no_stats);
+
+    esp_console_cmd_register(&g_ledstats_cmd);
+    esp_console_cmd_register(&g_ledlat_cmd);
+}
+
+static void frameTimerCallback(void* arg) {
+    xTaskNotifyGive(g_led_task);
+}
+
+static uint32_t periodUs(uint32_t delay_ms) {
+    return (delay_ms == 0 ? STATIC_PERIOD_MS : delay_ms) * 1000;
+}
 
 void runLedTask(void* pvParameters) {
     led_strip_config_t strip_config = {
@@ -22,34 +140,51 @@ void runLedTask(void* pvParameters) {
     ESP_ERROR_CHECK(led_strip_new_rmt_device(&strip_config, &rmt_config, &led_strip));
     /* Set all LED off to clear all pixels */
     led_strip_clear(led_strip);
+    boot_mark(BOOT_LED_STRIP_READY);
 
-    g_mutex = xSemaphoreCreateMutex();
-    if (g_mutex == NULL) {
-        return;
-    }
+    // Frames are paced by a one-shot esp_timer armed for each absolute
+    // deadline, which gives microsecond resolution instead of whole ticks.
+    g_led_task = xTaskGetCurrentTaskHandle();
+    const esp_timer_create_args_t timer_args = {
+        .callback = frameTimerCallback,
+        .name = "led_frame",
+    };
+    esp_timer_handle_t frame_timer;
+    ESP_ERROR_CHECK(esp_timer_create(&timer_args, &frame_timer));
 
     color_t state = RED;
     const int max_intens = 20;
     int cur_intens = max_intens;
     int next_intens = 0;
-    uint8_t static_red;
-    uint8_t static_green;
-    uint8_t static_blue;
     uint8_t red;
     uint8_t green;
     uint8_t blue;
-    uint32_t delay;
+    led_settings_t settings;
+    led_stats_t stats = {0};
+    frame_sched_t sched;
+    lat_hist_t latency;
+    evbus_reader_t settings_reader;
+    uint32_t changes;
+    uint32_t dropped;
+    uint32_t lost = 0;
+
+    evbus_reader_init(&settings_reader, &led_settings_topic);
+    led_settings_topic_latest(&settings);
+    uint32_t period_us = periodUs(settings.delay);
+
+    lat_hist_reset(&latency);
+    frame_sched_init(&sched, period_us, esp_timer_get_time());
 
     while(true) {
-        xSemaphoreTake(g_mutex, portMAX_DELAY);
-        static_red = g_red;
-        static_green = g_green;
-        static_blue = g_blue;
-        delay = g_delay;
-        xSemaphoreGive(g_mutex);
-
-        if (delay == 0) {
-            led_strip_set_pixel(led_strip, 0, static_red, static_green, static_blue);
+        frame_sched_frame_start(&sched, esp_timer_get_time());
+        for (changes = 0; led_settings_topic_read(&settings_reader, &settings);
+             changes++) {
+        }
+        dropped = settings_reader.lost - lost;
+        lost = settings_reader.lost;
+
+        if (settings.delay == 0) {
+            led_strip_set_pixel(led_strip, 0, settings.red, settings.green, settings.blue);
         } else {
             if (next_intens < max_intens) {
                 next_intens++;
@@ -88,57 +223,119 @@ void runLedTask(void* pvParameters) {
         }
         /* Refresh the strip to send data */
         led_strip_refresh(led_strip);
-        vTaskDelay((delay == 0 ? 100 : delay) / portTICK_PERIOD_MS);
+
+        int64_t now = esp_timer_get_time();
+        bool latency_changed = false;
+        if (atomic_exchange(&g_reset_latency, false)) {
+            lat_hist_reset(&latency);
+            stats.superseded = 0;
+            latency_changed = true;
+        }
+        // Values published and overwritten between two frames were never
+        // shown, nor were any the ring dropped before this task got to them;
+        // only the newest one gets a latency sample.
+        stats.superseded += dropped;
+        if (changes > 0) {
+            stats.superseded += changes - 1;
+            lat_hist_record(&latency, now - settings.written_at);
+            latency_changed = true;
+        }
+        int64_t wait_us;
+        if (periodUs(settings.delay) != period_us) {
+            period_us = periodUs(settings.delay);
+            frame_sched_set_period(&sched, period_us, now);
+            wait_us = period_us;
+        } else {
+            wait_us = frame_sched_wait_us(&sched, now);
+        }
+
+        frame_sched_get_stats(&sched, &stats.frames);
+        lat_hist_summary(&latency, &stats.latency);
+        mailbox_publish(&g_stats_box, &stats);
+        if (latency_changed) {
+            publishLatency(&stats);
+        }
+
+        if (wait_us > 0) {
+            esp_timer_start_once(frame_timer, wait_us);
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        }
     }
 }
 
-void setColor(color_t color, uint8_t val) {
-    xSemaphoreTake(g_mutex, portMAX_DELAY);
+void setColor(color_t color, uint8_t val, int64_t written_at) {
     switch(color) {
         case RED:
-            g_red = val;
+            g_settings.red = val;
             break;
         case GREEN:
-            g_green = val;
+            g_settings.green = val;
             break;
         case BLUE:
-            g_blue = val;
+            g_settings.blue = val;
             break;
         default:
             break;
     }
-    xSemaphoreGive(g_mutex);
+    g_settings.written_at = written_at;
+    led_settings_topic_publish(&g_settings);
+    if (color < NO_COLOR) {
+        publishColor(color, val);
+    }
+}
+
+void setColors(uint8_t red, uint8_t green, uint8_t blue, int64_t written_at) {
+    g_settings.red = red;
+    g_settings.green = green;
+    g_settings.blue = blue;
+    g_settings.written_at = written_at;
+    led_settings_topic_publish(&g_settings);
+    publishColor(RED, red);
+    publishColor(GREEN, green);
+    publishColor(BLUE, blue);
+}
+
+void setDelay(uint32_t ms, int64_t written_at) {
+    g_settings.delay = ms;
+    g_settings.written_at = written_at;
+    led_settings_topic_publish(&g_settings);
+    publishDelay(ms);
 }
 
 uint8_t getColor(color_t color) {
-    uint8_t val = 0;
-    xSemaphoreTake(g_mutex, portMAX_DELAY);
+    led_settings_t settings;
+    led_settings_topic_latest(&settings);
     switch(color) {
         case RED:
-            val = g_red;
-            break;
+            return settings.red;
         case GREEN:
-            val = g_green;
-            break;
+            return settings.green;
         case BLUE:
-            val = g_blue;
-            break;
+            return settings.blue;
         default:
-            break;
+            return 0;
     }
-    xSemaphoreGive(g_mutex);
-    return val;
 }
 
 uint32_t getDelay() {
-    xSemaphoreTake(g_mutex, portMAX_DELAY);
-    uint8_t val = g_delay;
-    xSemaphoreGive(g_mutex);
-    return val;
+    led_settings_t settings;
+    led_settings_topic_latest(&settings);
+    return settings.delay;
+}
+
+void getLedFrameStats(frame_stats_t* frames) {
+    led_stats_t stats;
+    mailbox_read(&g_stats_box, &stats);
+    *frames = stats.frames;
+}
+
+void getLedLatency(lat_summary_t* latency, uint32_t* superseded) {
+    led_stats_t stats;
+    mailbox_read(&g_stats_box, &stats);
+    *latency = stats.latency;
+    *superseded = stats.superseded;
 }
 
-void setDelay(uint32_t ms) {
-    xSemaphoreTake(g_mutex, portMAX_DELAY);
-    g_delay = ms;
-    xSemaphoreGive(g_mutex);
+void resetLedLatency(void) {
+    atomic_store(&g_reset_latency, true);
 }
@@ -2,6 +2,10 @@
 #define LED_TASK
 
 #include <stdint.h>
+#include "evbus.h"
+#include "frame_sched.h"
+#include "lat_hist.h"
+#include "snapshot.h"
 
 typedef enum {
     RED,
@@ -10,11 +14,46 @@ typedef enum {
     NO_COLOR,
 } color_t;
 
+typedef struct {
+    uint8_t red;
+    uint8_t green;
+    uint8_t blue;
+    uint32_t delay;
+    int64_t written_at; // esp_timer time the request for this value arrived
+} led_settings_t;
+
+// Every change of the LED settings, published by the control task through
+// the setters below. The LED task reads it; so can anything else that wants
+// to follow the settings.
+EVBUS_TOPIC_DECLARE(led_settings_topic, led_settings_t);
+
+void initLedState(void);
 void runLedTask(void* pvParameters);
 
+// Readers; safe from any task, never block.
 uint8_t getColor(color_t color);
-void setColor(color_t color, uint8_t val);
 uint32_t getDelay();
-void setDelay(uint32_t ms);
+
+// Writers; call only from the control task, which owns the LED settings.
+// written_at is the esp_timer time the request arrived over BLE.
+void setColor(color_t color, uint8_t val, int64_t written_at);
+void setColors(uint8_t red, uint8_t green, uint8_t blue, int64_t written_at);
+void setDelay(uint32_t ms, int64_t written_at);
+
+void getLedFrameStats(frame_stats_t* stats);
+
+// Wire-format values of the LED characteristics, published by their writers
+// so GATT reads only copy them out: one byte per color, the delay as uint32
+// LE, and the latency summary as LED_LATENCY_WIRE_LEN bytes (count, mean,
+// p50, p90, p99, max in us, then superseded; uint32 LE each).
+#define LED_LATENCY_WIRE_LEN (7 * 4)
+extern snapshot_t led_color_snap[NO_COLOR];
+extern snapshot_t led_delay_snap;
+extern snapshot_t led_latency_snap;
+
+// Latency from a request's arrival to the end of the strip refresh that
+// first shows the value, in microseconds.
+void getLedLatency(lat_summary_t* latency, uint32_t* superseded);
+void resetLedLatency(void);
 
 #endif // LED_TASK
@@ -0,0 +1,392 @@
+#include "log_bridge.h"
+
+#if CONFIG_APP_LOG_BRIDGE
+
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include "bleprph.h"
+#include "subs.h"
+#include "timesync.h"
+#include "esp_console.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "host/ble_hs.h"
+
+#define LOG_BRIDGE_BUF_SIZE CONFIG_APP_LOG_BRIDGE_BUF_SIZE
+#define LOG_BRIDGE_PERIOD_US (CONFIG_APP_LOG_BRIDGE_PERIOD_MS * 1000)
+// One notification per link-layer packet once data length extension is on.
+#define LOG_BRIDGE_CHUNK_MAX 244
+// A notification can take two msys blocks until the controller has it; the
+// pool keeps this many more for responses and other notifications.
+#define LOG_BRIDGE_MBUFS_PER_NOTIFY 2
+#ifdef CONFIG_APP_ATT_MBUF_RESERVE
+#define LOG_BRIDGE_MBUF_RESERVE CONFIG_APP_ATT_MBUF_RESERVE
+#else
+#define LOG_BRIDGE_MBUF_RESERVE 4
+#endif
+
+_Static_assert((LOG_BRIDGE_BUF_SIZE & (LOG_BRIDGE_BUF_SIZE - 1)) == 0,
+               "APP_LOG_BRIDGE_BUF_SIZE must be a power of two");
+
+#define TAG "LOG_BRIDGE"
+
+// Bytes head - tail of the ring wait to be sent; both only grow. The ring
+// is guarded by a spinlock held for one piece's copy; the drain timer takes
+// it as well.
+static uint8_t g_ring[LOG_BRIDGE_BUF_SIZE];
+static uint32_t g_head;
+static uint32_t g_tail;
+static portMUX_TYPE g_ring_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Producers are any task that logs. They take turns through g_put_lock,
+// formatting into one shared buffer rather than on their own stacks, which
+// also leaves the state below to whoever holds it.
+static SemaphoreHandle_t g_put_lock;
+static StaticSemaphore_t g_put_lock_buf;
+static char g_line[LOG_BRIDGE_LINE_MAX];
+static uint32_t g_dropped_pending; // lines to report before the next one
+static bool g_mid_line;            // the last piece did not end a line
+static bool g_skipping;            // dropping the rest of the current line
+static bool g_ring_cut;            // the ring ends in a line cut short
+
+static vprintf_like_t g_prev_vprintf;
+static atomic_bool g_active;
+// Set while the drain timer is inside the host, whose own log lines about
+// the notifications must not be fed back into the ring.
+static _Atomic TaskHandle_t g_sender;
+
+static esp_timer_handle_t g_drain_timer;
+static bool g_drain_running;
+
+// Console line being received; host task only.
+static char g_rx_line[LOG_BRIDGE_CMD_MAX];
+static uint16_t g_rx_len;
+static uint16_t g_rx_conn = BLE_HS_CONN_HANDLE_NONE;
+static bool g_rx_overflow;
+
+// Counters; producers' under g_put_lock, the rest by their one writer.
+static uint32_t g_lines_dropped;
+static uint32_t g_bytes_sent;
+static uint32_t g_notifies;
+static uint32_t g_notify_failed;
+static uint32_t g_low_mbuf;
+static uint32_t g_commands;
+
+/*** Ring. */
+
+static void ring_copy_in(const void* src, uint32_t len) {
+    uint32_t at = g_head & (LOG_BRIDGE_BUF_SIZE - 1);
+    uint32_t first = LOG_BRIDGE_BUF_SIZE - at;
+
+    if (first > len) {
+        first = len;
+    }
+    memcpy(g_ring + at, src, first);
+    memcpy(g_ring, (const uint8_t*)src + first, len - first);
+    g_head += len;
+}
+
+// Appends one piece of log output: vprintf is called once per ESP_LOG line
+// but may be called several times for one line of other output. The time
+// prefix and any drop marker go in only ahead of a piece that starts a
+// line. A piece that does not fit is dropped with the rest of its line; a
+// line already partly in the ring is ended before the next one. Caller
+// holds g_put_lock.
+static void ring_put(const char* prefix, uint32_t prefix_len,
+                     const char* piece, uint32_t len) {
+    bool starts = !g_mid_line;
+    bool ends = piece[len - 1] == '\n';
+    char marker[32];
+    uint32_t marker_len = 0;
+
+    g_mid_line = !ends;
+    if (g_skipping) {
+        if (ends) {
+            g_skipping = false;
+            g_dropped_pending++;
+            g_lines_dropped++;
+        }
+        return;
+    }
+    if (starts && g_dropped_pending > 0) {
+        marker_len = snprintf(marker, sizeof(marker), "[%u lines dropped]\n",
+                              (unsigned)g_dropped_pending);
+    }
+    if (!starts) {
+        prefix_len = 0;
+    }
+    uint32_t cut = starts && g_ring_cut;
+
+    portENTER_CRITICAL(&g_ring_lock);
+    bool fits = LOG_BRIDGE_BUF_SIZE - (g_head - g_tail) >=
+                cut + marker_len + prefix_len + len;
+    if (fits) {
+        ring_copy_in("\n", cut);
+        ring_copy_in(marker, marker_len);
+        ring_copy_in(prefix, prefix_len);
+        ring_copy_in(piece, len);
+    }
+    portEXIT_CRITICAL(&g_ring_lock);
+
+    if (fits) {
+        if (starts) {
+            g_dropped_pending = 0;
+            g_ring_cut = false;
+        }
+    } else {
+        g_ring_cut |= !starts;
+        if (ends) {
+            g_dropped_pending++;
+            g_lines_dropped++;
+        } else {
+            g_skipping = true;
+        }
+    }
+}
+
+// Copies out up to cap bytes from the tail without consuming them.
+static uint32_t ring_peek(uint8_t* dst, uint32_t cap) {
+    portENTER_CRITICAL(&g_ring_lock);
+    uint32_t len = g_head - g_tail;
+    if (len > cap) {
+        len = cap;
+    }
+    uint32_t at = g_tail & (LOG_BRIDGE_BUF_SIZE - 1);
+    uint32_t first = LOG_BRIDGE_BUF_SIZE - at;
+    if (first > len) {
+        first = len;
+    }
+    memcpy(dst, g_ring + at, first);
+    memcpy(dst + first, g_ring, len - first);
+    portEXIT_CRITICAL(&g_ring_lock);
+    return len;
+}
+
+static void ring_consume(uint32_t len) {
+    portENTER_CRITICAL(&g_ring_lock);
+    g_tail += len;
+    portEXIT_CRITICAL(&g_ring_lock);
+}
+
+/*** Log capture. */
+
+static int log_bridge_vprintf(const char* fmt, va_list args) {
+    va_list copy;
+    int ret;
+
+    va_copy(copy, args);
+    ret = g_prev_vprintf(fmt, args);
+    if (atomic_load_explicit(&g_active, memory_order_relaxed) &&
+        atomic_load_explicit(&g_sender, memory_order_relaxed) !=
+            xTaskGetCurrentTaskHandle()) {
+        char prefix[24];
+        int prefix_len = 0;
+        int64_t unix_us;
+        // Phone time, so the log lines up with the ride's GPS track.
+        if (timesync_local_to_unix_us(esp_timer_get_time(), &unix_us)) {
+            prefix_len = snprintf(prefix, sizeof(prefix), "[%lld.%03d] ",
+                                  (long long)(unix_us / 1000000),
+                                  (int)(unix_us / 1000 % 1000));
+        }
+        xSemaphoreTake(g_put_lock, portMAX_DELAY);
+        int n = vsnprintf(g_line, sizeof(g_line), fmt, copy);
+        if (n >= (int)sizeof(g_line)) {
+            // Cut short; still ends the line.
+            n = sizeof(g_line) - 1;
+            g_line[n - 1] = '\n';
+        }
+        if (n > 0) {
+            ring_put(prefix, prefix_len, g_line, n);
+        }
+        xSemaphoreGive(g_put_lock);
+    }
+    va_end(copy);
+    return ret;
+}
+
+/*** Draining. */
+
+// Largest notification payload every subscriber can take.
+static uint16_t chunk_len(uint32_t mask) {
+    uint16_t len = LOG_BRIDGE_CHUNK_MAX;
+
+    while (mask != 0) {
+        int slot = __builtin_ctz(mask);
+        mask &= mask - 1;
+        uint16_t mtu = ble_att_mtu(subs_conn_handle(slot));
+        if (mtu > 3 && mtu - 3 < len) {
+            len = mtu - 3;
+        }
+    }
+    return len;
+}
+
+static void notify_all(uint32_t mask, uint16_t val_handle,
+                       const uint8_t* buf, uint16_t len) {
+    while (mask != 0) {
+        int slot = __builtin_ctz(mask);
+        mask &= mask - 1;
+        struct os_mbuf* om = ble_hs_mbuf_from_flat(buf, len);
+        if (om == NULL ||
+            ble_gatts_notify_custom(subs_conn_handle(slot), val_handle, om) != 0) {
+            g_notify_failed++;
+            continue;
+        }
+        g_notifies++;
+        g_bytes_sent += len;
+    }
+}
+
+// Sends whole chunks while there is log output and the mbuf pool has room.
+// What does not go out this tick stays in the ring for the next.
+static void drain_timer_cb(void* arg) {
+    uint32_t mask = subs_conn_mask(GATT_SVR_CHR_LOG_TX);
+    uint16_t val_handle = gatt_svr_chr_val_handle(GATT_SVR_CHR_LOG_TX);
+    uint8_t chunk[LOG_BRIDGE_CHUNK_MAX];
+
+    if (mask == 0) {
+        return;
+    }
+    uint16_t cap = chunk_len(mask);
+    int need = LOG_BRIDGE_MBUF_RESERVE +
+               LOG_BRIDGE_MBUFS_PER_NOTIFY * __builtin_popcount(mask);
+
+    atomic_store_explicit(&g_sender, xTaskGetCurrentTaskHandle(),
+                          memory_order_relaxed);
+    while (true) {
+        uint32_t len = ring_peek(chunk, cap);
+        if (len == 0) {
+            break;
+        }
+        if (os_msys_num_free() < need) {
+            g_low_mbuf++;
+            break;
+        }
+        notify_all(mask, val_handle, chunk, len);
+        ring_consume(len);
+    }
+    atomic_store_explicit(&g_sender, NULL, memory_order_relaxed);
+}
+
+// Subscription watcher: captures and drains only while someone listens.
+static void on_subs_change(enum gatt_svr_chr_id id, bool active) {
+    atomic_store(&g_active, active);
+    if (active && !g_drain_running) {
+        ESP_ERROR_CHECK(esp_timer_start_periodic(g_drain_timer,
+                                                 LOG_BRIDGE_PERIOD_US));
+        g_drain_running = true;
+    } else if (!active && g_drain_running) {
+        esp_timer_stop(g_drain_timer);
+        g_drain_running = false;
+    }
+}
+
+/*** Console. */
+
+// CLI task, after a line from RX has run.
+static void cmd_done(const char* line, esp_err_t err, int ret) {
+    if (err == ESP_ERR_NOT_FOUND) {
+        ESP_LOGW(TAG, "unknown command: %s", line);
+    } else if (err == ESP_OK && ret != 0) {
+        ESP_LOGW(TAG, "command returned %d", ret);
+    }
+    g_commands++;
+}
+
+static void rx_reset(void) {
+    g_rx_len = 0;
+    g_rx_conn = BLE_HS_CONN_HANDLE_NONE;
+    g_rx_overflow = false;
+}
+
+int log_bridge_on_write(uint16_t conn_handle, const uint8_t* buf,
+                        uint16_t len) {
+    // Lines are not interleaved: another connection's write starts over.
+    if (g_rx_conn != conn_handle) {
+        rx_reset();
+        g_rx_conn = conn_handle;
+    }
+    for (uint16_t i = 0; i < len; i++) {
+        char c = buf[i];
+        if (c != '\n' && c != '\r') {
+            if (g_rx_len < sizeof(g_rx_line) - 1) {
+                g_rx_line[g_rx_len++] = c;
+            } else {
+                g_rx_overflow = true;
+            }
+            continue;
+        }
+        if (g_rx_len == 0) {
+            continue;
+        }
+        if (g_rx_overflow) {
+            ESP_LOGW(TAG, "command longer than %d bytes dropped",
+                     LOG_BRIDGE_CMD_MAX - 1);
+        } else {
+            g_rx_line[g_rx_len] = '\0';
+            if (!scli_run_line(g_rx_line, cmd_done)) {
+                rx_reset();
+                return BLE_ATT_ERR_INSUFFICIENT_RES;
+            }
+        }
+        g_rx_len = 0;
+        g_rx_overflow = false;
+    }
+    return 0;
+}
+
+void log_bridge_on_disconnect(uint16_t conn_handle) {
+    if (g_rx_conn == conn_handle) {
+        rx_reset();
+    }
+}
+
+void log_bridge_get_stats(log_bridge_stats_t* stats) {
+    stats->bytes_sent = g_bytes_sent;
+    stats->notifies = g_notifies;
+    stats->notify_failed = g_notify_failed;
+    stats->low_mbuf = g_low_mbuf;
+    stats->commands = g_commands;
+    stats->lines_dropped = g_lines_dropped;
+    portENTER_CRITICAL(&g_ring_lock);
+    stats->buffered = g_head - g_tail;
+    portEXIT_CRITICAL(&g_ring_lock);
+}
+
+static int log_bridge_cmd_handler(int argc, char *argv[]) {
+    log_bridge_stats_t stats;
+
+    log_bridge_get_stats(&stats);
+    ESP_LOGI(TAG, "sent %u B in %u notifies, failed %u, low mbuf %u; "
+             "dropped %u lines, buffered %u B; commands %u",
+             stats.bytes_sent, stats.notifies, stats.notify_failed,
+             stats.low_mbuf, stats.lines_dropped, stats.buffered,
+             stats.commands);
+    return 0;
+}
+
+static const esp_console_cmd_t g_log_bridge_cmd = {
+    .command = "logbridge",
+    .help = "Print BLE log bridge throughput and drop counters",
+    .func = log_bridge_cmd_handler,
+};
+
+void log_bridge_init(void) {
+    const esp_timer_create_args_t drain_args = {
+        .callback = drain_timer_cb,
+        .name = "log_drain",
+    };
+
+    g_put_lock = xSemaphoreCreateMutexStatic(&g_put_lock_buf);
+    ESP_ERROR_CHECK(esp_timer_create(&drain_args, &g_drain_timer));
+    subs_watch(GATT_SVR_CHR_LOG_TX, on_subs_change);
+    esp_console_cmd_register(&g_log_bridge_cmd);
+    g_prev_vprintf = esp_log_set_vprintf(log_bridge_vprintf);
+}
+
+#endif // CONFIG_APP_LOG_BRIDGE
@@ -0,0 +1,63 @@
+#ifndef LOG_BRIDGE
+#define LOG_BRIDGE
+
+// Log output and the console over BLE, for bikes without a serial cable.
+//
+// The log service follows the Nordic UART Service layout, so generic
+// serial-terminal apps can open it. While a connection is subscribed to its
+// TX characteristic every ESP_LOG and MODLOG_DFLT line is copied, besides
+// going to the UART as before, into a byte ring. A timer drains the ring in
+// notifications as long as the connection MTU allows, and stops for the
+// tick once the mbuf pool runs low, so a slow link backs up into the ring
+// rather than into the host. Logging tasks take turns formatting into one
+// shared line buffer, so the bridge adds no line to their stacks, and copy
+// it in: when the ring is full the line is dropped and counted, and a
+// marker saying how many were lost goes out at the start of the next one.
+// Once the phone has synced the clock (timesync.h), each line is prefixed
+// with its phone time as "[<unix seconds>.<ms>] ", once however many
+// vprintf calls make it up.
+//
+// Lines written to the RX characteristic run as console commands in the CLI
+// task, one at a time between lines typed on the UART, since the console is
+// not re-entrant; whatever they log comes back on TX. A line sent while the
+// previous one is still running is refused. printf() output is not captured.
+
+#include <stdint.h>
+#include "sdkconfig.h"
+#include "esp_peripheral.h"
+
+// Longest line forwarded; longer ones are cut short on BLE only.
+#define LOG_BRIDGE_LINE_MAX 128
+// Longest console command, including a trailing newline.
+#define LOG_BRIDGE_CMD_MAX SCLI_REMOTE_LINE_MAX
+
+typedef struct {
+    uint32_t bytes_sent;
+    uint32_t notifies;
+    uint32_t notify_failed;
+    uint32_t lines_dropped; // ring full
+    uint32_t low_mbuf;      // ticks cut short by the mbuf reserve
+    uint32_t commands;
+    uint32_t buffered;      // bytes waiting in the ring
+} log_bridge_stats_t;
+
+#if CONFIG_APP_LOG_BRIDGE
+
+// Host task: a write to the RX characteristic. Returns 0 or a BLE_ATT_ERR_*.
+int log_bridge_on_write(uint16_t conn_handle, const uint8_t* buf,
+                        uint16_t len);
+void log_bridge_on_disconnect(uint16_t conn_handle);
+
+void log_bridge_get_stats(log_bridge_stats_t* stats);
+
+// Hooks the log output; call once the console is up.
+void log_bridge_init(void);
+
+#else
+
+static inline void log_bridge_on_disconnect(uint16_t conn_handle) {}
+static inline void log_bridge_init(void) {}
+
+#endif // CONFIG_APP_LOG_BRIDGE
+
+#endif // LOG_BRIDGE
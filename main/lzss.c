@@ -0,0 +1,186 @@
+#include <string.h>
+#include "lzss.h"
+
+#define BUF_MASK (2 * LZSS_WINDOW - 1)
+#define WINDOW_MASK (LZSS_WINDOW - 1)
+#define LENGTH_MASK ((1 << LZSS_LENGTH_BITS) - 1)
+#define MATCH_BITS (1 + LZSS_OFFSET_BITS + LZSS_LENGTH_BITS)
+#define LITERAL_BITS 9
+
+/*** Encoder. */
+
+void lzss_enc_init(lzss_enc_t* e) {
+    memset(e, 0, sizeof(*e));
+}
+
+static uint32_t hash3(const lzss_enc_t* e, uint32_t pos) {
+    uint32_t v = e->buf[pos & BUF_MASK] << 16 |
+                 e->buf[(pos + 1) & BUF_MASK] << 8 |
+                 e->buf[(pos + 2) & BUF_MASK];
+    return (v * 2654435761u) >> (32 - LZSS_HASH_BITS);
+}
+
+// Chains every position before pos that has the three bytes a hash needs.
+static void insert_up_to(lzss_enc_t* e, uint32_t pos) {
+    while (e->hashed < pos && e->hashed + LZSS_MIN_MATCH <= e->end) {
+        uint32_t h = hash3(e, e->hashed);
+        e->prev[e->hashed & WINDOW_MASK] = e->head[h];
+        e->head[h] = e->hashed;
+        e->hashed++;
+    }
+}
+
+// Longest match for the bytes at e->pos within the window, 0 if none.
+static uint32_t find_match(const lzss_enc_t* e, uint32_t* dist_out) {
+    uint32_t pos = e->pos;
+    uint32_t max_len = e->end - pos;
+    uint32_t best = 0;
+    uint32_t last_dist = 0;
+
+    if (max_len < LZSS_MIN_MATCH) {
+        return 0;
+    }
+    if (max_len > LZSS_MAX_MATCH) {
+        max_len = LZSS_MAX_MATCH;
+    }
+    uint16_t cand = e->head[hash3(e, pos)];
+    for (int i = 0; i < LZSS_MAX_CHAIN; i++) {
+        // Chains hold the low 16 bits of positions; anything not strictly
+        // further back than the last candidate is stale.
+        uint32_t dist = (uint16_t)(pos - cand);
+        if (dist <= last_dist || dist > LZSS_WINDOW || dist > pos) {
+            break;
+        }
+        uint32_t len = 0;
+        while (len < max_len && e->buf[(pos - dist + len) & BUF_MASK] ==
+                                e->buf[(pos + len) & BUF_MASK]) {
+            len++;
+        }
+        if (len > best) {
+            best = len;
+            *dist_out = dist;
+            if (len == max_len) {
+                break;
+            }
+        }
+        last_dist = dist;
+        cand = e->prev[(pos - dist) & WINDOW_MASK];
+    }
+    return best >= LZSS_MIN_MATCH ? best : 0;
+}
+
+static size_t put_bits(lzss_enc_t* e, uint32_t v, uint8_t n, uint8_t* out) {
+    size_t written = 0;
+    e->bits = e->bits << n | v;
+    e->nbits += n;
+    while (e->nbits >= 8) {
+        e->nbits -= 8;
+        out[written++] = e->bits >> e->nbits;
+    }
+    return written;
+}
+
+size_t lzss_enc_run(lzss_enc_t* e, const uint8_t** in, size_t* in_len,
+                    uint8_t* out, size_t cap, bool finish) {
+    size_t n = 0;
+
+    while (true) {
+        // Take input while it keeps history plus lookahead in the buffer.
+        while (*in_len > 0 && e->end - e->pos < LZSS_WINDOW) {
+            uint32_t at = e->end & BUF_MASK;
+            size_t chunk = LZSS_WINDOW - (e->end - e->pos);
+            if (chunk > 2 * LZSS_WINDOW - at) {
+                chunk = 2 * LZSS_WINDOW - at;
+            }
+            if (chunk > *in_len) {
+                chunk = *in_len;
+            }
+            memcpy(e->buf + at, *in, chunk);
+            *in += chunk;
+            *in_len -= chunk;
+            e->end += chunk;
+        }
+
+        uint32_t avail = e->end - e->pos;
+        // Without a full lookahead a longer match may still be coming,
+        // unless the input has ended.
+        if (avail == 0 || (avail < LZSS_MAX_MATCH && !finish) ||
+            cap - n < (MATCH_BITS + 7) / 8) {
+            break;
+        }
+
+        insert_up_to(e, e->pos);
+        uint32_t dist;
+        uint32_t len = find_match(e, &dist);
+        if (len > 0) {
+            n += put_bits(e, (dist - 1) << LZSS_LENGTH_BITS |
+                             (len - LZSS_MIN_MATCH), MATCH_BITS, out + n);
+            e->pos += len;
+        } else {
+            n += put_bits(e, 0x100 | e->buf[e->pos & BUF_MASK], LITERAL_BITS,
+                          out + n);
+            e->pos++;
+        }
+    }
+
+    if (finish && e->pos == e->end && !e->done && cap > n) {
+        if (e->nbits > 0) {
+            out[n++] = e->bits << (8 - e->nbits);
+            e->nbits = 0;
+        }
+        e->done = true;
+    }
+    return n;
+}
+
+/*** Decoder. */
+
+void lzss_dec_init(lzss_dec_t* d) {
+    memset(d, 0, sizeof(*d));
+}
+
+static void dec_emit(lzss_dec_t* d, uint8_t b, uint8_t* out) {
+    *out = b;
+    d->window[d->pos & WINDOW_MASK] = b;
+    d->pos++;
+}
+
+size_t lzss_dec_run(lzss_dec_t* d, const uint8_t** in, size_t* in_len,
+                    uint8_t* out, size_t cap) {
+    size_t n = 0;
+
+    while (n < cap) {
+        if (d->copy_left > 0) {
+            dec_emit(d, d->window[(d->pos - d->copy_offset) & WINDOW_MASK],
+                     out + n++);
+            d->copy_left--;
+            continue;
+        }
+        while (d->nbits <= 24 && *in_len > 0) {
+            d->bits = d->bits << 8 | **in;
+            (*in)++;
+            (*in_len)--;
+            d->nbits += 8;
+        }
+        if (d->nbits == 0) {
+            break;
+        }
+        if (d->bits >> (d->nbits - 1) & 1) {
+            if (d->nbits < LITERAL_BITS) {
+                break;
+            }
+            d->nbits -= LITERAL_BITS;
+            dec_emit(d, d->bits >> d->nbits, out + n++);
+        } else {
+            // Also where the zero padding of the last byte ends up.
+            if (d->nbits < MATCH_BITS) {
+                break;
+            }
+            d->nbits -= MATCH_BITS;
+            uint32_t tok = d->bits >> d->nbits;
+            d->copy_offset = (tok >> LZSS_LENGTH_BITS & WINDOW_MASK) + 1;
+            d->copy_left = (tok & LENGTH_MASK) + LZSS_MIN_MATCH;
+        }
+    }
+    return n;
+}
@@ -0,0 +1,75 @@
+#ifndef LZSS
+#define LZSS
+
+// Streaming LZSS compression for ride logs and bulk transfers.
+//
+// Both sides work on caller-owned state of fixed size and never allocate, so
+// they can run in a task with a small stack and feed data through in pieces
+// of any size: log records as they are written, MTU-sized chunks as they
+// are sent. tools/lzss.py decompresses on the host.
+//
+// The stream is a sequence of tokens, most significant bit first:
+//     1 + 8 bits                          literal byte
+//     0 + LZSS_OFFSET_BITS + LZSS_LENGTH_BITS
+//                                         copy of (length + LZSS_MIN_MATCH)
+//                                         bytes from (offset + 1) back
+// The last byte is padded with zero bits, which never form a whole token.
+//
+// The encoder finds matches through hash chains over its window, so it
+// costs a few chain steps per input byte rather than a window scan.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define LZSS_OFFSET_BITS 10
+#define LZSS_LENGTH_BITS 5
+#define LZSS_WINDOW (1 << LZSS_OFFSET_BITS)
+#define LZSS_MIN_MATCH 3
+#define LZSS_MAX_MATCH (LZSS_MIN_MATCH + (1 << LZSS_LENGTH_BITS) - 1)
+
+#define LZSS_HASH_BITS 9
+// Candidates tried per position; more finds longer matches, slower.
+#define LZSS_MAX_CHAIN 16
+
+typedef struct {
+    // History and lookahead; byte i of the stream lives at buf[i % size].
+    uint8_t buf[2 * LZSS_WINDOW];
+    // Latest position with each hash, and for each position the previous
+    // one with the same hash; low 16 bits of the stream position.
+    uint16_t head[1 << LZSS_HASH_BITS];
+    uint16_t prev[LZSS_WINDOW];
+    uint32_t pos;    // next byte to encode
+    uint32_t end;    // bytes taken in
+    uint32_t hashed; // next position to add to the chains
+    uint32_t bits;
+    uint8_t nbits;
+    bool done;
+} lzss_enc_t;
+
+typedef struct {
+    uint8_t window[LZSS_WINDOW];
+    uint32_t pos;    // bytes produced
+    uint32_t bits;
+    uint8_t nbits;
+    uint16_t copy_offset;
+    uint8_t copy_left;
+} lzss_dec_t;
+
+void lzss_enc_init(lzss_enc_t* e);
+
+// Takes what it can from *in (advancing *in and *in_len) and writes up to
+// cap compressed bytes to out; returns how many it wrote. cap must be at
+// least 2, the longest token; with less nothing moves. Once the input has
+// ended, keep calling with finish set until it returns 0.
+size_t lzss_enc_run(lzss_enc_t* e, const uint8_t** in, size_t* in_len,
+                    uint8_t* out, size_t cap, bool finish);
+
+void lzss_dec_init(lzss_dec_t* d);
+
+// The same for decompression. Returns 0 once all of *in is consumed and
+// everything it encodes has been written.
+size_t lzss_dec_run(lzss_dec_t* d, const uint8_t** in, size_t* in_len,
+                    uint8_t* out, size_t cap);
+
+#endif // LZSS
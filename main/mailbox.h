@@ -0,0 +1,93 @@
+#ifndef MAILBOX
+#define MAILBOX
+
+// Lock-free single-writer mailbox holding the latest value of a struct.
+//
+// The writer never blocks. Readers copy the value out and retry if a write
+// raced with the copy (sequence lock), so they always see a consistent
+// value and never hold up the writer or each other. Use one mailbox per
+// producer; a second writer needs a mailbox of its own.
+//
+// On target the write runs in a critical section, so a reader can never
+// preempt a half-done write on its own core; one in progress is on the
+// other core and done within a copy. Readers therefore only spin and never
+// sleep, which keeps them safe in the NimBLE host task and GATT callbacks.
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef ESP_PLATFORM
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#define MAILBOX_RELAX() taskYIELD()
+#else
+#include <sched.h>
+#define MAILBOX_RELAX() sched_yield()
+#endif
+
+#define MAILBOX_SPINS_BEFORE_RELAX 16
+
+typedef struct {
+    _Atomic uint32_t seq; // odd while a write is in progress
+    uint32_t size;
+    void* data;
+#ifdef ESP_PLATFORM
+    portMUX_TYPE lock; // only ever taken by the one writer
+#endif
+} mailbox_t;
+
+static inline void mailbox_init(mailbox_t* mb, void* storage, uint32_t size) {
+    atomic_init(&mb->seq, 0);
+#ifdef ESP_PLATFORM
+    portMUX_INITIALIZE(&mb->lock);
+#endif
+    mb->size = size;
+    mb->data = storage;
+}
+
+// Writer only.
+static inline void mailbox_publish(mailbox_t* mb, const void* value) {
+#ifdef ESP_PLATFORM
+    portENTER_CRITICAL(&mb->lock);
+#endif
+    uint32_t seq = atomic_load_explicit(&mb->seq, memory_order_relaxed);
+    atomic_store_explicit(&mb->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    memcpy(mb->data, value, mb->size);
+    atomic_store_explicit(&mb->seq, seq + 2, memory_order_release);
+#ifdef ESP_PLATFORM
+    portEXIT_CRITICAL(&mb->lock);
+#endif
+}
+
+// Any reader. Returns the number of values published so far, which lets a
+// reader tell how many it skipped since its previous read.
+static inline uint32_t mailbox_read(mailbox_t* mb, void* value) {
+    uint32_t spins = 0;
+    uint32_t before;
+    uint32_t after;
+
+    do {
+        if (++spins % MAILBOX_SPINS_BEFORE_RELAX == 0) {
+            MAILBOX_RELAX();
+        }
+        before = atomic_load_explicit(&mb->seq, memory_order_acquire);
+        if (before & 1) {
+            continue;
+        }
+        memcpy(value, mb->data, mb->size);
+        atomic_thread_fence(memory_order_acquire);
+        after = atomic_load_explicit(&mb->seq, memory_order_relaxed);
+    } while ((before & 1) || before != after);
+
+    return before / 2;
+}
+
+// Any reader. The count mailbox_read() would return, without the copy; lets
+// a reader with an expensive use for the value skip it when nothing is new.
+static inline uint32_t mailbox_version(mailbox_t* mb) {
+    return atomic_load_explicit(&mb->seq, memory_order_acquire) / 2;
+}
+
+#endif // MAILBOX
@@ -28,19 +28,52 @@
 #include "services/gap/ble_svc_gap.h"
 #include "bleprph.h"
 
+#include "adv_sched.h"
+#include "att_limit.h"
+#include "app_tasks.h"
+#include "assist.h"
+#include "boot_prof.h"
+#include "ctrl_task.h"
+#include "cycling.h"
+#include "diag.h"
+#include "gatt_cache.h"
 #include "led_task.h"
+#include "log_bridge.h"
+#include "pulse_capture.h"
+#include "subs.h"
+#include "sysmon.h"
+#include "timesync.h"
+#include "uart_proxy.h"
 
 #if CONFIG_EXAMPLE_EXTENDED_ADV
 static uint8_t ext_adv_pattern_1[] = {
     0x02, 0x01, 0x06,
     0x03, 0x03, 0xab, 0xcd,
-    0x03, 0x03, 0x18, 0x11,
+    0x05, 0x03, 0x18, 0x18, 0x16, 0x18,
     0x11, 0X09, 'n', 'i', 'm', 'b', 'l', 'e', '-', 'b', 'l', 'e', 'p', 'r', 'p', 'h', '-', 'e',
 };
 #endif
 
 static const char *tag = "NimBLE_BLE_PRPH";
+static StaticTask_t led_task_tcb;
+static StackType_t led_task_stack[APP_LED_TASK_STACK_SIZE];
+static StaticTask_t ctrl_task_tcb;
+static StackType_t ctrl_task_stack[APP_CTRL_TASK_STACK_SIZE];
+#if CONFIG_APP_DIAG
+static StaticTask_t diag_task_tcb;
+static StackType_t diag_task_stack[APP_DIAG_TASK_STACK_SIZE];
+#endif
+#if CONFIG_APP_PULSE_CAPTURE
+static StaticTask_t pulse_task_tcb;
+static StackType_t pulse_task_stack[APP_PULSE_TASK_STACK_SIZE];
+#endif
+#if CONFIG_APP_UART_PROXY
+static StaticTask_t proxy_task_tcb[UART_PROXY_SIDES];
+static StackType_t proxy_task_stack[UART_PROXY_SIDES][APP_PROXY_TASK_STACK_SIZE];
+#endif
 static int bleprph_gap_event(struct ble_gap_event *event, void *arg);
+/* Connections up; advertising goes on while this is below the maximum. */
+static int bleprph_conn_count;
 #if CONFIG_EXAMPLE_RANDOM_ADDR
 static uint8_t own_addr_type = BLE_OWN_ADDR_RANDOM;
 #else
@@ -78,9 +111,9 @@ bleprph_print_conn_desc(struct ble_gap_conn_desc *desc)
 
 #if CONFIG_EXAMPLE_EXTENDED_ADV
 /**
- * Enables advertising with the following parameters:
- *     o General discoverable mode.
- *     o Undirected connectable mode.
+ * Enables advertising for the current step of the advertising schedule:
+ *     o High-duty directed to the last bonded peer, or
+ *     o General discoverable, undirected connectable at the step's interval.
  */
 static void
 ext_bleprph_advertise(void)
@@ -88,15 +121,26 @@ ext_bleprph_advertise(void)
     struct ble_gap_ext_adv_params params;
     struct os_mbuf *data;
     uint8_t instance = 1;
+    adv_step_t step;
     int rc;
 
+    adv_sched_current(&step);
+
     /* use defaults for non-set params */
     memset (&params, 0, sizeof(params));
 
     /* enable connectable advertising */
     params.connectable = 1;
-    params.scannable = 1;
     params.legacy_pdu = 1;
+    if (step.phase == ADV_PHASE_DIRECTED) {
+        params.directed = 1;
+        params.high_duty_directed = 1;
+        params.peer = step.peer;
+    } else {
+        params.scannable = 1;
+        params.itvl_min = step.itvl_min;
+        params.itvl_max = step.itvl_max;
+    }
 
     /* advertise using random addr */
     params.own_addr_type = BLE_OWN_ADDR_PUBLIC;
@@ -106,51 +150,67 @@ ext_bleprph_advertise(void)
     //params.tx_power = 127;
     params.sid = 1;
 
-    params.itvl_min = BLE_GAP_ADV_FAST_INTERVAL1_MIN;
-    params.itvl_max = BLE_GAP_ADV_FAST_INTERVAL1_MIN;
-
     /* configure instance 0 */
     rc = ble_gap_ext_adv_configure(instance, &params, NULL,
                                    bleprph_gap_event, NULL);
     assert (rc == 0);
 
-    /* in this case only scan response is allowed */
-
-    /* get mbuf for scan rsp data */
-    data = os_msys_get_pkthdr(sizeof(ext_adv_pattern_1), 0);
-    assert(data);
+    /* in this case only scan response is allowed; directed PDUs carry no
+     * data at all.
+     */
+    if (step.phase != ADV_PHASE_DIRECTED) {
+        /* get mbuf for scan rsp data */
+        data = os_msys_get_pkthdr(sizeof(ext_adv_pattern_1), 0);
+        assert(data);
 
-    /* fill mbuf with scan rsp data */
-    rc = os_mbuf_append(data, ext_adv_pattern_1, sizeof(ext_adv_pattern_1));
-    assert(rc == 0);
+        /* fill mbuf with scan rsp data */
+        rc = os_mbuf_append(data, ext_adv_pattern_1, sizeof(ext_adv_pattern_1));
+        assert(rc == 0);
 
-    rc = ble_gap_ext_adv_set_data(instance, data);
-    assert (rc == 0);
+        rc = ble_gap_ext_adv_set_data(instance, data);
+        assert (rc == 0);
+    }
 
-    /* start advertising */
-    rc = ble_gap_ext_adv_start(instance, 0, 0);
-    assert (rc == 0);
+    /* start advertising; the duration is in units of 10 ms */
+    rc = ble_gap_ext_adv_start(instance,
+                               step.duration_ms == BLE_HS_FOREVER ?
+                               0 : step.duration_ms / 10, 0);
+    if (rc != 0) {
+        MODLOG_DFLT(ERROR, "error enabling advertisement; rc=%d\n", rc);
+        if (step.phase != ADV_PHASE_SLOW) {
+            /* Skip to the next phase rather than stop advertising. */
+            adv_sched_timed_out();
+            ext_bleprph_advertise();
+        }
+        return;
+    }
+    adv_sched_started();
 }
 #else
 /**
- * Enables advertising with the following parameters:
- *     o General discoverable mode.
- *     o Undirected connectable mode.
+ * Enables advertising for the current step of the advertising schedule:
+ *     o High-duty directed to the last bonded peer, or
+ *     o General discoverable, undirected connectable at the step's interval.
  */
 static void
 bleprph_advertise(void)
 {
     struct ble_gap_adv_params adv_params;
     struct ble_hs_adv_fields fields;
+    const ble_addr_t *direct_addr = NULL;
+    adv_step_t step;
     const char *name;
     int rc;
 
+    adv_sched_current(&step);
+
     /**
      *  Set the advertisement data included in our advertisements:
      *     o Flags (indicates advertisement type and other general info).
      *     o Advertising tx power.
      *     o Device name.
-     *     o 16-bit service UUIDs (alert notifications).
+     *     o 16-bit service UUIDs (cycling power, speed and cadence), so bike
+     *       computers list the controller when searching for sensors.
      */
 
     memset(&fields, 0, sizeof fields);
@@ -175,9 +235,10 @@ bleprph_advertise(void)
     fields.name_is_complete = 1;
 
     fields.uuids16 = (ble_uuid16_t[]) {
-        BLE_UUID16_INIT(GATT_SVR_SVC_ALERT_UUID)
+        BLE_UUID16_INIT(GATT_SVR_SVC_CYCLING_POWER_UUID),
+        BLE_UUID16_INIT(GATT_SVR_SVC_CSC_UUID)
     };
-    fields.num_uuids16 = 1;
+    fields.num_uuids16 = 2;
     fields.uuids16_is_complete = 1;
 
     rc = ble_gap_adv_set_fields(&fields);
@@ -188,17 +249,59 @@ bleprph_advertise(void)
 
     /* Begin advertising. */
     memset(&adv_params, 0, sizeof adv_params);
-    adv_params.conn_mode = BLE_GAP_CONN_MODE_UND;
-    adv_params.disc_mode = BLE_GAP_DISC_MODE_GEN;
-    rc = ble_gap_adv_start(own_addr_type, NULL, BLE_HS_FOREVER,
+    if (step.phase == ADV_PHASE_DIRECTED) {
+        adv_params.conn_mode = BLE_GAP_CONN_MODE_DIR;
+        adv_params.high_duty_cycle = 1;
+        direct_addr = &step.peer;
+    } else {
+        adv_params.conn_mode = BLE_GAP_CONN_MODE_UND;
+        adv_params.disc_mode = BLE_GAP_DISC_MODE_GEN;
+        adv_params.itvl_min = step.itvl_min;
+        adv_params.itvl_max = step.itvl_max;
+    }
+    rc = ble_gap_adv_start(own_addr_type, direct_addr, step.duration_ms,
                            &adv_params, bleprph_gap_event, NULL);
     if (rc != 0) {
         MODLOG_DFLT(ERROR, "error enabling advertisement; rc=%d\n", rc);
+        if (step.phase != ADV_PHASE_SLOW) {
+            /* Skip to the next phase rather than stop advertising. */
+            adv_sched_timed_out();
+            bleprph_advertise();
+        }
         return;
     }
+    adv_sched_started();
 }
 #endif
 
+/**
+ * Restarts advertising from the schedule's current step while a connection
+ * slot is free, so more centrals can join.  Advertising still running for
+ * the free slots is stopped first, since a disconnect starts the schedule
+ * over.
+ */
+static void
+bleprph_advertise_if_free(void)
+{
+#if CONFIG_EXAMPLE_EXTENDED_ADV
+    if (ble_gap_ext_adv_active(1)) {
+        ble_gap_ext_adv_stop(1);
+    }
+#else
+    if (ble_gap_adv_active()) {
+        ble_gap_adv_stop();
+    }
+#endif
+    if (bleprph_conn_count >= CONFIG_BT_NIMBLE_MAX_CONNECTIONS) {
+        return;
+    }
+#if CONFIG_EXAMPLE_EXTENDED_ADV
+    ext_bleprph_advertise();
+#else
+    bleprph_advertise();
+#endif
+}
+
 /**
  * The nimble host executes this callback when a GAP event occurs.  The
  * application associates a GAP event callback with each connection that forms.
@@ -230,17 +333,18 @@ bleprph_gap_event(struct ble_gap_event *event, void *arg)
             rc = ble_gap_conn_find(event->connect.conn_handle, &desc);
             assert(rc == 0);
             bleprph_print_conn_desc(&desc);
+            gatt_cache_on_connect(event->connect.conn_handle);
+            att_limit_on_connect(event->connect.conn_handle);
+            diag_on_connect(event->connect.conn_handle);
+            adv_sched_connected();
+            bleprph_conn_count++;
         }
         MODLOG_DFLT(INFO, "\n");
 
-        if (event->connect.status != 0) {
-            /* Connection failed; resume advertising. */
-#if CONFIG_EXAMPLE_EXTENDED_ADV
-            ext_bleprph_advertise();
-#else
-            bleprph_advertise();
-#endif
-        }
+        /* Connection failed, or there is room for another; resume
+         * advertising.
+         */
+        bleprph_advertise_if_free();
         return 0;
 
     case BLE_GAP_EVENT_DISCONNECT:
@@ -248,12 +352,17 @@ bleprph_gap_event(struct ble_gap_event *event, void *arg)
         bleprph_print_conn_desc(&event->disconnect.conn);
         MODLOG_DFLT(INFO, "\n");
 
-        /* Connection terminated; resume advertising. */
-#if CONFIG_EXAMPLE_EXTENDED_ADV
-        ext_bleprph_advertise();
-#else
-        bleprph_advertise();
-#endif
+        subs_on_disconnect(event->disconnect.conn.conn_handle);
+        gatt_svr_on_disconnect(event->disconnect.conn.conn_handle);
+        att_limit_on_disconnect(event->disconnect.conn.conn_handle);
+        log_bridge_on_disconnect(event->disconnect.conn.conn_handle);
+        diag_on_disconnect(event->disconnect.conn.conn_handle);
+        gatt_cache_on_disconnect(event->disconnect.conn.conn_handle);
+
+        /* Connection terminated; resume advertising from the first phase. */
+        bleprph_conn_count--;
+        adv_sched_disconnected();
+        bleprph_advertise_if_free();
         return 0;
 
     case BLE_GAP_EVENT_CONN_UPDATE:
@@ -269,9 +378,17 @@ bleprph_gap_event(struct ble_gap_event *event, void *arg)
     case BLE_GAP_EVENT_ADV_COMPLETE:
         MODLOG_DFLT(INFO, "advertise complete; reason=%d",
                     event->adv_complete.reason);
-#if !CONFIG_EXAMPLE_EXTENDED_ADV
-        bleprph_advertise();
+        /* A phase ran its course; move on to the next one.  Advertising that
+         * ended in a connection is resumed on disconnect.
+         */
+        if (event->adv_complete.reason == BLE_HS_ETIMEOUT) {
+            adv_sched_timed_out();
+#if CONFIG_EXAMPLE_EXTENDED_ADV
+            ext_bleprph_advertise();
+#else
+            bleprph_advertise();
 #endif
+        }
         return 0;
 
     case BLE_GAP_EVENT_ENC_CHANGE:
@@ -282,6 +399,9 @@ bleprph_gap_event(struct ble_gap_event *event, void *arg)
         assert(rc == 0);
         bleprph_print_conn_desc(&desc);
         MODLOG_DFLT(INFO, "\n");
+        if (event->enc_change.status == 0 && desc.sec_state.bonded) {
+            adv_sched_set_peer(&desc.peer_id_addr);
+        }
         return 0;
 
     case BLE_GAP_EVENT_SUBSCRIBE:
@@ -294,6 +414,21 @@ bleprph_gap_event(struct ble_gap_event *event, void *arg)
                     event->subscribe.cur_notify,
                     event->subscribe.prev_indicate,
                     event->subscribe.cur_indicate);
+        subs_on_subscribe(event->subscribe.conn_handle,
+                          event->subscribe.attr_handle,
+                          event->subscribe.cur_notify,
+                          event->subscribe.cur_indicate);
+        gatt_cache_on_subscribe(event->subscribe.conn_handle,
+                                event->subscribe.attr_handle,
+                                event->subscribe.cur_indicate);
+        return 0;
+
+    case BLE_GAP_EVENT_NOTIFY_TX:
+        if (event->notify_tx.indication) {
+            gatt_cache_on_indicate_done(event->notify_tx.conn_handle,
+                                        event->notify_tx.attr_handle,
+                                        event->notify_tx.status);
+        }
         return 0;
 
     case BLE_GAP_EVENT_MTU:
@@ -397,6 +532,8 @@ bleprph_on_sync(void)
 {
     int rc;
 
+    boot_mark(BOOT_SYNCED);
+
 #if CONFIG_EXAMPLE_RANDOM_ADDR
     /* Generate a non-resolvable private address. */
     ble_app_set_addr();
@@ -424,17 +561,30 @@ bleprph_on_sync(void)
     MODLOG_DFLT(INFO, "Device Address: ");
     print_addr(addr_val);
     MODLOG_DFLT(INFO, "\n");
-    /* Begin advertising. */
+
+    /* The attribute table is complete by now; check whether bonded peers
+     * need to be told it changed.
+     */
+    gatt_cache_on_sync();
+
+    /* Begin advertising; bonds are loaded by now, so the schedule can pick a
+     * peer for directed advertising.
+     */
+    adv_sched_init();
 #if CONFIG_EXAMPLE_EXTENDED_ADV
     ext_bleprph_advertise();
 #else
     bleprph_advertise();
 #endif
+    boot_mark(BOOT_ADVERTISING);
+    boot_report();
 }
 
 void bleprph_host_task(void *param)
 {
     ESP_LOGI(tag, "BLE Host Task Started");
+    sysmon_register_task(xTaskGetCurrentTaskHandle(),
+                         CONFIG_BT_NIMBLE_HOST_TASK_STACK_SIZE);
     /* This function will return only when nimble_port_stop() is executed */
     nimble_port_run();
 
@@ -446,6 +596,40 @@ app_main(void)
 {
     int rc;
 
+    boot_mark(BOOT_APP_MAIN);
+
+    /* The LED strip and its state do not depend on NVS or the BLE stack, so
+     * start the LED task first; it brings up the RMT channel while this task
+     * is busy with NVS and controller initialization.
+     */
+    initLedState();
+    TaskHandle_t led_task =
+        xTaskCreateStaticPinnedToCore(runLedTask, "Rainbow LED",
+                                      APP_LED_TASK_STACK_SIZE, NULL, // bytes
+                                      APP_LED_TASK_PRIO, led_task_stack,
+                                      &led_task_tcb, APP_TASK_CORE);
+    sysmon_register_task(led_task, APP_LED_TASK_STACK_SIZE);
+    boot_mark(BOOT_LED_TASK_STARTED);
+
+    /* Consumer of the control characteristic's command ring */
+    initCtrl();
+    TaskHandle_t ctrl_task =
+        xTaskCreateStaticPinnedToCore(runCtrlTask, "Control",
+                                      APP_CTRL_TASK_STACK_SIZE, NULL,
+                                      APP_CTRL_TASK_PRIO, ctrl_task_stack,
+                                      &ctrl_task_tcb, APP_TASK_CORE);
+    sysmon_register_task(ctrl_task, APP_CTRL_TASK_STACK_SIZE);
+
+    /* Subscription registry first: producers register watchers with it. */
+    subs_init();
+    att_limit_init();
+    diag_init();
+    timesync_init();
+    cycling_init();
+    pulse_capture_init();
+    uart_proxy_init();
+    log_bridge_init();
+
     /* Initialize NVS — it is used to store PHY calibration data */
     esp_err_t ret = nvs_flash_init();
     if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
@@ -453,8 +637,11 @@ app_main(void)
         ret = nvs_flash_init();
     }
     ESP_ERROR_CHECK(ret);
+    boot_mark(BOOT_NVS_READY);
+    assist_init();
 
     nimble_port_init();
+    boot_mark(BOOT_NIMBLE_READY);
     /* Initialize the NimBLE host configuration. */
     ble_hs_cfg.reset_cb = bleprph_on_reset;
     ble_hs_cfg.sync_cb = bleprph_on_sync;
@@ -485,23 +672,66 @@ app_main(void)
     /* Set the default device name. */
     rc = ble_svc_gap_device_name_set("TSDZ2 Controller");
     assert(rc == 0);
+    rc = ble_svc_gap_device_appearance_set(CYCLING_APPEARANCE);
+    assert(rc == 0);
 
     /* XXX Need to have template for store */
     ble_store_config_init();
+    boot_mark(BOOT_GATT_READY);
 
+    /* Start the host as early as possible; everything below overlaps with
+     * host/controller sync and does not delay advertising.
+     */
     nimble_port_freertos_init(bleprph_host_task);
+    boot_mark(BOOT_HOST_STARTED);
 
     /* Initialize command line interface to accept input from user */
     rc = scli_init();
     if (rc != ESP_OK) {
         ESP_LOGE(tag, "scli_init() failed");
     }
+    sysmon_register_task(xTaskGetHandle("scli_cli"),
+                         CONFIG_APP_SCLI_TASK_STACK_SIZE);
+    sysmon_init();
+    boot_mark(BOOT_CONSOLE_READY);
+
+#if CONFIG_APP_PULSE_CAPTURE
+    /* Speed and cadence sensors; feeds the cycling measurements. */
+    TaskHandle_t pulse =
+        xTaskCreateStaticPinnedToCore(pulse_capture_task, "Capture",
+                                      APP_PULSE_TASK_STACK_SIZE, NULL,
+                                      APP_PULSE_TASK_PRIO, pulse_task_stack,
+                                      &pulse_task_tcb, APP_TASK_CORE);
+    sysmon_register_task(pulse, APP_PULSE_TASK_STACK_SIZE);
+#endif
 
-    // Low-priority rainbow LED task
-    xTaskCreate(runLedTask,
-                "Rainbow LED",
-                2048, // words, not bytes
-                NULL,
-                1,
-                NULL);
+#if CONFIG_APP_UART_PROXY
+    /* One task per direction between the display and the motor. */
+    static const char *const proxy_names[UART_PROXY_SIDES] = {
+        [UART_PROXY_DISPLAY] = "ProxyDisplay",
+        [UART_PROXY_MOTOR] = "ProxyMotor",
+    };
+    for (int side = 0; side < UART_PROXY_SIDES; side++) {
+        TaskHandle_t proxy =
+            xTaskCreateStaticPinnedToCore(uart_proxy_task, proxy_names[side],
+                                          APP_PROXY_TASK_STACK_SIZE,
+                                          (void *)(intptr_t)side,
+                                          APP_PROXY_TASK_PRIO,
+                                          proxy_task_stack[side],
+                                          &proxy_task_tcb[side],
+                                          APP_TASK_CORE);
+        sysmon_register_task(proxy, APP_PROXY_TASK_STACK_SIZE);
+    }
+#endif
+
+#if CONFIG_APP_DIAG
+    /* Last, so every other long-lived task is registered before the first
+     * diagnostics snapshot. */
+    TaskHandle_t diag =
+        xTaskCreateStaticPinnedToCore(diag_task, "Diag",
+                                      APP_DIAG_TASK_STACK_SIZE, NULL,
+                                      APP_DIAG_TASK_PRIO, diag_task_stack,
+                                      &diag_task_tcb, APP_TASK_CORE);
+    sysmon_register_task(diag, APP_DIAG_TASK_STACK_SIZE);
+#endif
 }
@@ -0,0 +1,204 @@
+#include "pulse_capture.h"
+
+/*** Estimator. */
+
+void pulse_est_init(pulse_est_t* e, uint8_t magnets) {
+    *e = (pulse_est_t){ .magnets = magnets };
+}
+
+uint32_t pulse_est_update(pulse_est_t* e, uint32_t edges, uint32_t edge_ticks,
+                          uint32_t tick_hz, int64_t now_us) {
+    uint32_t n = edges - e->edges;
+
+    if (n == 0) {
+        if (!e->running) {
+            return 0;
+        }
+        int64_t since_us = (now_us - e->seen_us) * e->magnets;
+        if (since_us > PULSE_STOP_US) {
+            e->running = false;
+            e->period_us = 0;
+            return 0;
+        }
+        // Once the next edge is later than a period would put it, the wheel
+        // is at least this slow. Before a first period there is nothing to
+        // stretch.
+        if (e->period_us == 0) {
+            return 0;
+        }
+        return since_us > e->period_us ? since_us : e->period_us;
+    }
+
+    // Periods only come from two hardware timestamps, never from when the
+    // poll happened to run.
+    uint64_t period_us = (uint64_t)(uint32_t)(edge_ticks - e->edge_ticks) *
+                         1000000 * e->magnets / tick_hz / n;
+    if (!e->running || (now_us - e->seen_us) * e->magnets > PULSE_STOP_US) {
+        // First edge after a stop: only a reference so far.
+        e->period_us = 0;
+    } else if (period_us < PULSE_MIN_PERIOD_US) {
+        e->bounces++;
+    } else {
+        e->period_us = period_us;
+    }
+    e->running = true;
+    e->edges = edges;
+    e->edge_ticks = edge_ticks;
+    e->seen_us = now_us;
+    return e->period_us;
+}
+
+uint8_t pulse_cadence_rpm(uint32_t crank_period_us) {
+    if (crank_period_us == 0) {
+        return 0;
+    }
+    uint32_t rpm = 60000000 / crank_period_us;
+    return rpm < UINT8_MAX ? rpm : UINT8_MAX;
+}
+
+#if CONFIG_APP_PULSE_CAPTURE
+
+/*** Capture task. */
+
+#include <stdlib.h>
+#include <string.h>
+#include "cycling.h"
+#include "mailbox.h"
+#include "esp_console.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#define TAG "PULSE"
+
+#if CONFIG_APP_PULSE_CAPTURE_SIM
+#define DRIVER pulse_capture_sim_driver
+#else
+#define DRIVER pulse_capture_hw_driver
+#endif
+
+static uint32_t g_tick_hz;
+static pulse_est_t g_est[PULSE_CHANNELS];
+
+static pulse_sample_t g_sample_box_buf;
+static mailbox_t g_sample_box;
+
+// Written only by the task.
+static pulse_capture_stats_t g_stats;
+
+static void poll(void) {
+    int64_t start = esp_timer_get_time();
+    uint32_t period_us[PULSE_CHANNELS];
+
+    for (int ch = 0; ch < PULSE_CHANNELS; ch++) {
+        uint32_t edges;
+        uint32_t edge_ticks;
+        DRIVER.read(ch, &edges, &edge_ticks);
+        period_us[ch] = pulse_est_update(&g_est[ch], edges, edge_ticks,
+                                         g_tick_hz, start);
+        g_stats.edges[ch] = edges;
+        g_stats.bounces[ch] = g_est[ch].bounces;
+    }
+
+    pulse_sample_t sample = {
+        .wheel_period_us = period_us[PULSE_WHEEL],
+        .crank_period_us = period_us[PULSE_CADENCE],
+        .at = timesync_now(),
+    };
+    mailbox_publish(&g_sample_box, &sample);
+
+    // Power comes from the motor; the sensors only know speed and cadence.
+    cycling_sample_t cs = {
+        .cadence_rpm = pulse_cadence_rpm(sample.crank_period_us),
+        .wheel_period_us = sample.wheel_period_us,
+        .at = sample.at,
+    };
+    cycling_update(&cs);
+
+    uint32_t took = esp_timer_get_time() - start;
+    g_stats.polls++;
+    g_stats.poll_us_total += took;
+    if (took > g_stats.poll_us_max) {
+        g_stats.poll_us_max = took;
+    }
+}
+
+void pulse_capture_task(void* param) {
+    TickType_t wake = xTaskGetTickCount();
+    while (true) {
+        poll();
+        vTaskDelayUntil(&wake, pdMS_TO_TICKS(CONFIG_APP_PULSE_CAPTURE_PERIOD_MS));
+    }
+}
+
+void pulse_capture_get(pulse_sample_t* sample) {
+    mailbox_read(&g_sample_box, sample);
+}
+
+void pulse_capture_get_stats(pulse_capture_stats_t* stats) {
+    *stats = g_stats;
+}
+
+static int pulse_cmd_handler(int argc, char *argv[]) {
+#if CONFIG_APP_PULSE_CAPTURE_SIM
+    if (argc == 4 && strcmp(argv[1], "sim") == 0) {
+        // One revolution takes circumference_mm * 3600 / km/h us.
+        uint32_t kmh = atoi(argv[2]);
+        uint32_t rpm = atoi(argv[3]);
+        uint32_t wheel_us = kmh ? (uint64_t)CONFIG_APP_WHEEL_CIRCUMFERENCE_MM *
+                                      3600 / kmh : 0;
+        pulse_capture_sim_set(PULSE_WHEEL,
+                              wheel_us / CONFIG_APP_PULSE_WHEEL_MAGNETS);
+        pulse_capture_sim_set(PULSE_CADENCE,
+                              rpm ? 60000000 / rpm /
+                                        CONFIG_APP_PULSE_CADENCE_MAGNETS : 0);
+        return 0;
+    }
+#endif
+    pulse_sample_t s;
+    pulse_capture_stats_t stats;
+    pulse_capture_get(&s);
+    pulse_capture_get_stats(&stats);
+    uint32_t speed_x10 = s.wheel_period_us
+        ? (uint64_t)CONFIG_APP_WHEEL_CIRCUMFERENCE_MM * 36000 / s.wheel_period_us
+        : 0;
+    ESP_LOGI(TAG, "speed %u.%u km/h (%u us), cadence %u rpm (%u us)",
+             speed_x10 / 10, speed_x10 % 10, s.wheel_period_us,
+             s.crank_period_us ? 60000000 / s.crank_period_us : 0,
+             s.crank_period_us);
+    int64_t unix_us;
+    if (timesync_to_unix_us(s.at, &unix_us)) {
+        ESP_LOGI(TAG, "measured at %lld.%03d phone time",
+                 (long long)(unix_us / 1000000), (int)(unix_us / 1000 % 1000));
+    }
+    ESP_LOGI(TAG, "edges %u/%u, bounces %u/%u; %u polls, %u us mean, "
+             "%u us max",
+             stats.edges[PULSE_WHEEL], stats.edges[PULSE_CADENCE],
+             stats.bounces[PULSE_WHEEL], stats.bounces[PULSE_CADENCE],
+             stats.polls,
+             stats.polls ? (uint32_t)(stats.poll_us_total / stats.polls) : 0,
+             stats.poll_us_max);
+    return 0;
+}
+
+static const esp_console_cmd_t g_pulse_cmd = {
+    .command = "capture",
+#if CONFIG_APP_PULSE_CAPTURE_SIM
+    .help = "Print wheel speed, cadence and capture cost, or "
+            "'sim <km/h> <rpm>' to set the synthetic sensors",
+#else
+    .help = "Print wheel speed, cadence and capture cost",
+#endif
+    .func = pulse_cmd_handler,
+};
+
+void pulse_capture_init(void) {
+    mailbox_init(&g_sample_box, &g_sample_box_buf, sizeof(g_sample_box_buf));
+    pulse_est_init(&g_est[PULSE_WHEEL], CONFIG_APP_PULSE_WHEEL_MAGNETS);
+    pulse_est_init(&g_est[PULSE_CADENCE], CONFIG_APP_PULSE_CADENCE_MAGNETS);
+    ESP_ERROR_CHECK(DRIVER.init(&g_tick_hz));
+    esp_console_cmd_register(&g_pulse_cmd);
+}
+
+#endif // CONFIG_APP_PULSE_CAPTURE
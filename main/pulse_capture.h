@@ -0,0 +1,108 @@
+#ifndef PULSE_CAPTURE
+#define PULSE_CAPTURE
+
+// Wheel speed and cadence from magnet sensors, without an interrupt per
+// edge.
+//
+// The hardware does the per-edge work: PCNT counts the edges of each sensor
+// and an MCPWM capture channel latches the capture timer on every edge, so
+// the latest edge is timestamped to the APB clock however late software
+// looks at it. A low-priority task polls both every
+// CONFIG_APP_PULSE_CAPTURE_PERIOD_MS and turns the edges seen since the last
+// poll, and the time between the first and last of them, into a period. The
+// BLE stack never sees an interrupt from the sensors.
+//
+// Drivers hide where the edges come from: the hardware one above, or a
+// synthetic generator for benches without sensors and for the host build.
+// The estimator is plain arithmetic on what a driver reports.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "sdkconfig.h"
+#include "timesync.h"
+
+typedef enum {
+    PULSE_WHEEL,
+    PULSE_CADENCE,
+    PULSE_CHANNELS,
+} pulse_channel_t;
+
+// Revolutions slower than this read as stopped: about 1.9 km/h on a 2.1 m
+// wheel, 15 rpm at the crank. Keeps the gap well inside the capture
+// timer's wrap.
+#define PULSE_STOP_US 4000000
+// Revolutions faster than this are taken for contact bounce.
+#define PULSE_MIN_PERIOD_US 30000
+
+typedef struct {
+    // Returns the capture clock rate in *tick_hz.
+    esp_err_t (*init)(uint32_t* tick_hz);
+    // Edges counted since init, and the capture clock at the latest one.
+    // Callers poll often enough that neither wraps twice in between.
+    void (*read)(pulse_channel_t ch, uint32_t* edges, uint32_t* edge_ticks);
+} pulse_capture_driver_t;
+
+extern const pulse_capture_driver_t pulse_capture_hw_driver;
+extern const pulse_capture_driver_t pulse_capture_sim_driver;
+
+/*** Estimator, one per channel. */
+
+typedef struct {
+    uint8_t magnets;     // edges per revolution
+    bool running;        // edges/edge_ticks are a valid reference
+    uint32_t edges;
+    uint32_t edge_ticks;
+    int64_t seen_us;     // local time a poll first saw the latest edge
+    uint32_t period_us;  // revolution period between the last edges seen
+    uint32_t bounces;
+} pulse_est_t;
+
+void pulse_est_init(pulse_est_t* e, uint8_t magnets);
+
+// Feeds one poll of a driver. Returns the revolution period in us, 0 when
+// stopped. While no new edge arrives the result grows with the time since
+// the last one, so a wheel slowing to a stop reads as slowing down.
+uint32_t pulse_est_update(pulse_est_t* e, uint32_t edges, uint32_t edge_ticks,
+                          uint32_t tick_hz, int64_t now_us);
+
+// Crank period to cadence in the one byte the cycling service carries, 0
+// when stopped. Periods down to PULSE_MIN_PERIOD_US would give up to 2000
+// rpm, so it saturates at 255.
+uint8_t pulse_cadence_rpm(uint32_t crank_period_us);
+
+/*** Capture task. */
+
+typedef struct {
+    uint32_t wheel_period_us; // 0 when stopped
+    uint32_t crank_period_us;
+    timesync_stamp_t at;
+} pulse_sample_t;
+
+typedef struct {
+    uint32_t polls;
+    uint32_t poll_us_max;     // CPU time of the slowest poll
+    uint64_t poll_us_total;
+    uint32_t edges[PULSE_CHANNELS];
+    uint32_t bounces[PULSE_CHANNELS];
+} pulse_capture_stats_t;
+
+#if CONFIG_APP_PULSE_CAPTURE
+
+void pulse_capture_init(void);
+void pulse_capture_task(void* param);
+
+// Latest sample; any task.
+void pulse_capture_get(pulse_sample_t* sample);
+void pulse_capture_get_stats(pulse_capture_stats_t* stats);
+
+// Synthetic driver: time between edges on a channel, 0 to stop it.
+void pulse_capture_sim_set(pulse_channel_t ch, uint32_t edge_period_us);
+
+#else
+
+static inline void pulse_capture_init(void) {}
+
+#endif // CONFIG_APP_PULSE_CAPTURE
+
+#endif // PULSE_CAPTURE
@@ -0,0 +1,124 @@
+#include "pulse_capture.h"
+
+#if CONFIG_APP_PULSE_CAPTURE_HW
+
+#include "driver/mcpwm_cap.h"
+#include "driver/pulse_cnt.h"
+#include "hal/mcpwm_ll.h"
+#include "esp_check.h"
+
+#define TAG "PULSE"
+
+// Each sensor GPIO feeds a PCNT unit, counting rising edges, and a capture
+// channel of MCPWM group 0, latching the capture timer on the same edges.
+// The capture channel raises no interrupt: the latched value is read from
+// its register when the task polls. This module owns the group's capture
+// timer, so its channels are 0 and 1 in creation order.
+
+#define GROUP 0
+// PCNT counters are 16-bit and restart from 0 at the high limit; the
+// driver extends them in software.
+#define PCNT_HIGH_LIMIT 32767
+// Longest glitch the PCNT filter can reject; slower contact bounce needs an
+// RC filter on the sensor line.
+#define PCNT_GLITCH_NS 12000
+
+static const int g_gpio[PULSE_CHANNELS] = {
+    [PULSE_WHEEL] = CONFIG_APP_PULSE_WHEEL_GPIO,
+    [PULSE_CADENCE] = CONFIG_APP_PULSE_CADENCE_GPIO,
+};
+
+static pcnt_unit_handle_t g_pcnt[PULSE_CHANNELS];
+static int g_last_count[PULSE_CHANNELS];
+static uint32_t g_edges[PULSE_CHANNELS];
+
+static esp_err_t init_pcnt(pulse_channel_t ch) {
+    const pcnt_unit_config_t unit_config = {
+        .low_limit = -1,
+        .high_limit = PCNT_HIGH_LIMIT,
+    };
+    const pcnt_chan_config_t chan_config = {
+        .edge_gpio_num = g_gpio[ch],
+        .level_gpio_num = -1,
+    };
+    const pcnt_glitch_filter_config_t filter_config = {
+        .max_glitch_ns = PCNT_GLITCH_NS,
+    };
+    pcnt_channel_handle_t chan;
+
+    ESP_RETURN_ON_ERROR(pcnt_new_unit(&unit_config, &g_pcnt[ch]),
+                        TAG, "pcnt unit");
+    ESP_RETURN_ON_ERROR(pcnt_new_channel(g_pcnt[ch], &chan_config, &chan),
+                        TAG, "pcnt channel");
+    ESP_RETURN_ON_ERROR(pcnt_channel_set_edge_action(
+                            chan, PCNT_CHANNEL_EDGE_ACTION_INCREASE,
+                            PCNT_CHANNEL_EDGE_ACTION_HOLD),
+                        TAG, "pcnt edge");
+    ESP_RETURN_ON_ERROR(pcnt_unit_set_glitch_filter(g_pcnt[ch], &filter_config),
+                        TAG, "pcnt filter");
+    ESP_RETURN_ON_ERROR(pcnt_unit_enable(g_pcnt[ch]), TAG, "pcnt enable");
+    ESP_RETURN_ON_ERROR(pcnt_unit_clear_count(g_pcnt[ch]), TAG, "pcnt clear");
+    return pcnt_unit_start(g_pcnt[ch]);
+}
+
+static esp_err_t init_cap(mcpwm_cap_timer_handle_t timer, pulse_channel_t ch) {
+    const mcpwm_capture_channel_config_t config = {
+        .gpio_num = g_gpio[ch],
+        .prescale = 1,
+        .flags.pos_edge = true,
+        .flags.pull_up = true,
+    };
+    mcpwm_cap_channel_handle_t chan;
+
+    ESP_RETURN_ON_ERROR(mcpwm_new_capture_channel(timer, &config, &chan),
+                        TAG, "capture channel");
+    return mcpwm_capture_channel_enable(chan);
+}
+
+static esp_err_t hw_init(uint32_t* tick_hz) {
+    const mcpwm_capture_timer_config_t timer_config = {
+        .group_id = GROUP,
+        .clk_src = MCPWM_CAPTURE_CLK_SRC_DEFAULT,
+    };
+    mcpwm_cap_timer_handle_t timer;
+
+    ESP_RETURN_ON_ERROR(mcpwm_new_capture_timer(&timer_config, &timer),
+                        TAG, "capture timer");
+    for (int ch = 0; ch < PULSE_CHANNELS; ch++) {
+        ESP_RETURN_ON_ERROR(init_pcnt(ch), TAG, "pcnt");
+        ESP_RETURN_ON_ERROR(init_cap(timer, ch), TAG, "capture");
+    }
+    ESP_RETURN_ON_ERROR(mcpwm_capture_timer_enable(timer),
+                        TAG, "capture enable");
+    ESP_RETURN_ON_ERROR(mcpwm_capture_timer_get_resolution(timer, tick_hz),
+                        TAG, "capture resolution");
+    return mcpwm_capture_timer_start(timer);
+}
+
+static void hw_read(pulse_channel_t ch, uint32_t* edges, uint32_t* edge_ticks) {
+    int before;
+    int after;
+
+    // An edge between the two reads would pair a count with the wrong
+    // timestamp; read again until the count holds still around the latch.
+    do {
+        pcnt_unit_get_count(g_pcnt[ch], &before);
+        *edge_ticks = mcpwm_ll_capture_get_value(MCPWM_LL_GET_HW(GROUP), ch);
+        pcnt_unit_get_count(g_pcnt[ch], &after);
+    } while (before != after);
+
+    int delta = after - g_last_count[ch];
+    if (delta < 0) {
+        delta += PCNT_HIGH_LIMIT;
+    }
+    g_last_count[ch] = after;
+    g_edges[ch] += delta;
+    *edges = g_edges[ch];
+}
+
+const pulse_capture_driver_t pulse_capture_hw_driver = {
+    .init = hw_init,
+    .read = hw_read,
+};
+
+#endif // CONFIG_APP_PULSE_CAPTURE_HW
@@ -0,0 +1,58 @@
+#include "pulse_capture.h"
+
+#if CONFIG_APP_PULSE_CAPTURE_SIM
+
+#include <stdatomic.h>
+#include "esp_timer.h"
+
+// Synthetic sensors: edges at a set period, generated lazily from the
+// system clock whenever the task reads them, so a bench without magnets
+// exercises the same estimator and task as the hardware. Periods are set
+// from the console.
+
+typedef struct {
+    _Atomic uint32_t period_us; // between edges, 0 when stopped
+    uint32_t edges;
+    int64_t last_edge_us;
+    int64_t next_edge_us;       // 0 while stopped
+} sim_channel_t;
+
+static sim_channel_t g_sim[PULSE_CHANNELS];
+
+void pulse_capture_sim_set(pulse_channel_t ch, uint32_t edge_period_us) {
+    atomic_store(&g_sim[ch].period_us, edge_period_us);
+}
+
+static esp_err_t sim_init(uint32_t* tick_hz) {
+    *tick_hz = 1000000;
+    return ESP_OK;
+}
+
+static void sim_read(pulse_channel_t ch, uint32_t* edges, uint32_t* edge_ticks) {
+    sim_channel_t* s = &g_sim[ch];
+    uint32_t period_us = atomic_load(&s->period_us);
+    int64_t now = esp_timer_get_time();
+
+    if (period_us == 0) {
+        s->next_edge_us = 0;
+    } else {
+        if (s->next_edge_us == 0) {
+            s->next_edge_us = now + period_us;
+        }
+        // The edge already scheduled keeps the old period.
+        while (s->next_edge_us <= now) {
+            s->edges++;
+            s->last_edge_us = s->next_edge_us;
+            s->next_edge_us += period_us;
+        }
+    }
+    *edges = s->edges;
+    *edge_ticks = (uint32_t)s->last_edge_us;
+}
+
+const pulse_capture_driver_t pulse_capture_sim_driver = {
+    .init = sim_init,
+    .read = sim_read,
+};
+
+#endif // CONFIG_APP_PULSE_CAPTURE_SIM
@@ -0,0 +1,213 @@
+#include "sensor_filter.h"
+
+/*** Moving average. */
+
+void filter_ma_init(filter_ma_t* f, int32_t* storage, uint16_t window) {
+    f->buf = storage;
+    f->window = window ? window : 1;
+    f->next = 0;
+    f->primed = false;
+    f->sum = 0;
+}
+
+int32_t filter_ma_push(filter_ma_t* f, int32_t x) {
+    if (!f->primed) {
+        for (int i = 0; i < f->window; i++) {
+            f->buf[i] = x;
+        }
+        f->sum = x * f->window;
+        f->primed = true;
+        return x;
+    }
+    f->sum += x - f->buf[f->next];
+    f->buf[f->next] = x;
+    if (++f->next == f->window) {
+        f->next = 0;
+    }
+    return f->sum / f->window;
+}
+
+/*** EMA. */
+
+void filter_ema_init(filter_ema_t* f, uint32_t alpha_q16) {
+    if (alpha_q16 == 0) {
+        alpha_q16 = 1;
+    } else if (alpha_q16 > 65536) {
+        alpha_q16 = 65536;
+    }
+    f->alpha_q16 = alpha_q16;
+    f->primed = false;
+    f->y_q16 = 0;
+}
+
+int32_t filter_ema_push(filter_ema_t* f, int32_t x) {
+    int64_t x_q16 = (int64_t)x << 16;
+    if (!f->primed) {
+        f->y_q16 = x_q16;
+        f->primed = true;
+    } else {
+        f->y_q16 += ((x_q16 - f->y_q16) * f->alpha_q16) >> 16;
+    }
+    // Round to nearest.
+    return (f->y_q16 + (1 << 15)) >> 16;
+}
+
+/*** Sliding median. */
+
+static inline int32_t median_val(const filter_median_t* f, uint16_t slot) {
+    return f->nodes[f->nodes[slot].heap].value;
+}
+
+static inline void median_swap(filter_median_t* f, uint16_t a, uint16_t b) {
+    uint16_t na = f->nodes[a].heap;
+    uint16_t nb = f->nodes[b].heap;
+    f->nodes[a].heap = nb;
+    f->nodes[b].heap = na;
+    f->nodes[na].pos = b;
+    f->nodes[nb].pos = a;
+}
+
+// True if heap slot a belongs above slot b: larger in the lower (max) heap,
+// smaller in the upper (min) heap.
+static inline bool median_above(const filter_median_t* f, bool upper,
+                                uint16_t a, uint16_t b) {
+    return upper ? median_val(f, a) < median_val(f, b)
+                 : median_val(f, a) > median_val(f, b);
+}
+
+// Heap operations on the half starting at slot `base` with `size` entries;
+// `i` is the index within that half.
+static void median_sift_up(filter_median_t* f, bool upper, uint16_t base,
+                           uint16_t i) {
+    while (i > 0) {
+        uint16_t parent = (i - 1) / 2;
+        if (!median_above(f, upper, base + i, base + parent)) {
+            break;
+        }
+        median_swap(f, base + i, base + parent);
+        i = parent;
+    }
+}
+
+static void median_sift_down(filter_median_t* f, bool upper, uint16_t base,
+                             uint16_t size, uint16_t i) {
+    for (;;) {
+        uint32_t child = 2 * (uint32_t)i + 1;
+        if (child >= size) {
+            break;
+        }
+        if (child + 1 < size &&
+            median_above(f, upper, base + child + 1, base + child)) {
+            child++;
+        }
+        if (!median_above(f, upper, base + child, base + i)) {
+            break;
+        }
+        median_swap(f, base + i, base + child);
+        i = child;
+    }
+}
+
+void filter_median_init(filter_median_t* f, filter_median_node_t* storage,
+                        uint16_t window) {
+    f->nodes = storage;
+    f->window = window ? window : 1;
+    f->lower = (f->window + 1) / 2;
+    f->next = 0;
+    f->primed = false;
+}
+
+int32_t filter_median_push(filter_median_t* f, int32_t x) {
+    uint16_t upper_size = f->window - f->lower;
+
+    if (!f->primed) {
+        // All samples equal, so any arrangement is a valid pair of heaps.
+        for (uint16_t i = 0; i < f->window; i++) {
+            f->nodes[i].value = x;
+            f->nodes[i].pos = i;
+            f->nodes[i].heap = i;
+        }
+        f->primed = true;
+        return x;
+    }
+
+    // Overwrite the oldest sample in place and repair the heap it sits in.
+    uint16_t node = f->next;
+    if (++f->next == f->window) {
+        f->next = 0;
+    }
+    f->nodes[node].value = x;
+    uint16_t slot = f->nodes[node].pos;
+    if (slot < f->lower) {
+        median_sift_up(f, false, 0, slot);
+        median_sift_down(f, false, 0, f->lower, f->nodes[node].pos);
+    } else {
+        median_sift_up(f, true, f->lower, slot - f->lower);
+        median_sift_down(f, true, f->lower, upper_size,
+                         f->nodes[node].pos - f->lower);
+    }
+
+    // At most the new sample is on the wrong side; swapping the roots and
+    // sinking both restores lower <= upper.
+    if (upper_size > 0 && median_val(f, 0) > median_val(f, f->lower)) {
+        median_swap(f, 0, f->lower);
+        median_sift_down(f, false, 0, f->lower, 0);
+        median_sift_down(f, true, f->lower, upper_size, 0);
+    }
+
+    if (f->window & 1) {
+        return median_val(f, 0);
+    }
+    return ((int64_t)median_val(f, 0) + median_val(f, f->lower)) >> 1;
+}
+
+/*** Decimator. */
+
+void filter_decim_init(filter_decim_t* f, uint16_t factor) {
+    f->factor = factor ? factor : 1;
+    f->count = 0;
+    f->sum = 0;
+}
+
+bool filter_decim_push(filter_decim_t* f, int32_t x, int32_t* out) {
+    f->sum += x;
+    if (++f->count < f->factor) {
+        return false;
+    }
+    *out = f->sum / f->factor;
+    f->count = 0;
+    f->sum = 0;
+    return true;
+}
+
+/*** Chaining. */
+
+bool filter_ma_stage(void* filter, int32_t in, int32_t* out) {
+    *out = filter_ma_push(filter, in);
+    return true;
+}
+
+bool filter_ema_stage(void* filter, int32_t in, int32_t* out) {
+    *out = filter_ema_push(filter, in);
+    return true;
+}
+
+bool filter_median_stage(void* filter, int32_t in, int32_t* out) {
+    *out = filter_median_push(filter, in);
+    return true;
+}
+
+bool filter_decim_stage(void* filter, int32_t in, int32_t* out) {
+    return filter_decim_push(filter, in, out);
+}
+
+bool filter_chain_push(const filter_stage_t* stages, uint8_t count,
+                       int32_t x, int32_t* out) {
+    for (uint8_t i = 0; i < count; i++) {
+        if (!stages[i].fn(stages[i].filter, x, &x)) {
+            return false;
+        }
+    }
+    *out = x;
+    return true;
+}
@@ -0,0 +1,105 @@
+#ifndef SENSOR_FILTER
+#define SENSOR_FILTER
+
+// Allocation-free filters for the torque and cadence sample streams.
+//
+// Every filter works on int32_t samples with caller-supplied storage and costs
+// a bounded amount of work per sample: the moving average, EMA and decimator
+// are O(1), the sliding median is O(log window). Windowed filters are primed
+// with the first sample, so they produce meaningful output immediately rather
+// than ramping up from zero. Stages can be chained with filter_chain_push().
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*** Moving average over the last `window` samples. */
+
+// |sample| * window must stay below 2^31.
+typedef struct {
+    int32_t* buf;
+    uint16_t window;
+    uint16_t next;
+    bool primed;
+    int32_t sum;
+} filter_ma_t;
+
+void filter_ma_init(filter_ma_t* f, int32_t* storage, uint16_t window);
+int32_t filter_ma_push(filter_ma_t* f, int32_t x);
+
+/*** Exponential moving average, y += alpha * (x - y). */
+
+typedef struct {
+    uint32_t alpha_q16; // 1..65536, 65536 passes samples through
+    bool primed;
+    int64_t y_q16;
+} filter_ema_t;
+
+void filter_ema_init(filter_ema_t* f, uint32_t alpha_q16);
+int32_t filter_ema_push(filter_ema_t* f, int32_t x);
+
+/*** Sliding median over the last `window` samples. */
+
+// One entry per window slot. `value`/`pos` describe the sample in ring slot
+// i and where it currently sits in the heap; `heap` is the heap array itself,
+// holding ring slot indices, so one array serves both views.
+typedef struct {
+    int32_t value;
+    uint16_t pos;
+    uint16_t heap;
+} filter_median_node_t;
+
+// The heap is split in two: slots [0, lower) are a max-heap of the smaller
+// half, slots [lower, window) a min-heap of the larger half. Replacing the
+// oldest sample only ever has to repair one heap plus a swap of the roots.
+typedef struct {
+    filter_median_node_t* nodes;
+    uint16_t window;
+    uint16_t lower;
+    uint16_t next;
+    bool primed;
+} filter_median_t;
+
+void filter_median_init(filter_median_t* f, filter_median_node_t* storage,
+                        uint16_t window);
+// For even windows, the floor of the mean of the two middle samples.
+int32_t filter_median_push(filter_median_t* f, int32_t x);
+
+/*** Decimator: averages `factor` samples into one output. */
+
+// |sample| * factor must stay below 2^31.
+typedef struct {
+    uint16_t factor;
+    uint16_t count;
+    int32_t sum;
+} filter_decim_t;
+
+void filter_decim_init(filter_decim_t* f, uint16_t factor);
+// Returns true and writes *out on every factor-th sample.
+bool filter_decim_push(filter_decim_t* f, int32_t x, int32_t* out);
+
+/*** Chaining. */
+
+// A stage consumes one sample and returns false if it has nothing to emit yet.
+typedef bool (*filter_stage_fn)(void* filter, int32_t in, int32_t* out);
+
+typedef struct {
+    filter_stage_fn fn;
+    void* filter;
+} filter_stage_t;
+
+bool filter_ma_stage(void* filter, int32_t in, int32_t* out);
+bool filter_ema_stage(void* filter, int32_t in, int32_t* out);
+bool filter_median_stage(void* filter, int32_t in, int32_t* out);
+bool filter_decim_stage(void* filter, int32_t in, int32_t* out);
+
+#define FILTER_STAGE_MA(f)     { filter_ma_stage, (f) }
+#define FILTER_STAGE_EMA(f)    { filter_ema_stage, (f) }
+#define FILTER_STAGE_MEDIAN(f) { filter_median_stage, (f) }
+#define FILTER_STAGE_DECIM(f)  { filter_decim_stage, (f) }
+
+// Feeds x through the stages in order. Returns true with the final output in
+// *out if every stage emitted; a decimating stage stops the chain otherwise.
+bool filter_chain_push(const filter_stage_t* stages, uint8_t count,
+                       int32_t x, int32_t* out);
+
+#endif // SENSOR_FILTER
@@ -0,0 +1,105 @@
+#ifndef SNAPSHOT
+#define SNAPSHOT
+
+// Double-buffered, pre-serialized value of a characteristic.
+//
+// The single writer encodes each new value in wire format into the back
+// buffer and publishes it by bumping the sequence number, which flips which
+// buffer is current. Readers copy the current buffer straight into their
+// response and check that no publish overlapped the copy; if one did, they
+// drop what they copied and go again. Unlike mailbox.h, a reader never
+// waits for a write in progress, because writes go to the other buffer, so
+// a read costs one copy even if it preempts the writer.
+//
+//     static uint8_t storage[2 * CAP];
+//     snapshot_init(&snap, storage, CAP);
+//
+//     uint8_t* p = snapshot_back(&snap);   // writer
+//     ...encode into p...
+//     snapshot_commit(&snap, len);
+//
+//     uint32_t seq;                       // reader
+//     do {
+//         seq = snapshot_read_begin(&snap, &data, &len);
+//         ...copy data, len...
+//     } while (snapshot_read_retry(&snap, seq));
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+typedef struct {
+    _Atomic uint32_t seq; // buf + (seq & 1) * cap is the current value
+    uint16_t cap;
+    uint16_t len[2];
+    uint8_t* buf;         // two buffers of cap bytes
+} snapshot_t;
+
+static inline void snapshot_init(snapshot_t* s, uint8_t* storage,
+                                 uint16_t cap) {
+    atomic_init(&s->seq, 0);
+    s->cap = cap;
+    s->len[0] = 0;
+    s->len[1] = 0;
+    s->buf = storage;
+}
+
+// Writer only: the buffer the next value is encoded into.
+static inline uint8_t* snapshot_back(snapshot_t* s) {
+    uint32_t seq = atomic_load_explicit(&s->seq, memory_order_relaxed);
+    // Readers that started on this buffer before the last publish must see
+    // that publish before any of the bytes written now.
+    atomic_thread_fence(memory_order_release);
+    return s->buf + ((seq + 1) & 1) * s->cap;
+}
+
+// Writer only: makes the back buffer current.
+static inline void snapshot_commit(snapshot_t* s, uint16_t len) {
+    uint32_t seq = atomic_load_explicit(&s->seq, memory_order_relaxed);
+    s->len[(seq + 1) & 1] = len;
+    atomic_store_explicit(&s->seq, seq + 1, memory_order_release);
+}
+
+static inline void snapshot_publish(snapshot_t* s, const void* value,
+                                    uint16_t len) {
+    memcpy(snapshot_back(s), value, len);
+    snapshot_commit(s, len);
+}
+
+// Any reader.
+static inline uint32_t snapshot_read_begin(snapshot_t* s, const uint8_t** data,
+                                           uint16_t* len) {
+    uint32_t seq = atomic_load_explicit(&s->seq, memory_order_acquire);
+    *data = s->buf + (seq & 1) * s->cap;
+    *len = s->len[seq & 1];
+    return seq;
+}
+
+// True if a publish may have overwritten what was read since
+// snapshot_read_begin() returned seq.
+static inline bool snapshot_read_retry(snapshot_t* s, uint32_t seq) {
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(&s->seq, memory_order_relaxed) != seq;
+}
+
+// Changes with every publish; lets a reader tell whether the value changed
+// without copying it.
+static inline uint32_t snapshot_seq(snapshot_t* s) {
+    return atomic_load_explicit(&s->seq, memory_order_acquire);
+}
+
+// Copies the current value into dst (cap bytes) and returns its length.
+static inline uint16_t snapshot_read(snapshot_t* s, void* dst) {
+    const uint8_t* data;
+    uint16_t len;
+    uint32_t seq;
+
+    do {
+        seq = snapshot_read_begin(s, &data, &len);
+        memcpy(dst, data, len);
+    } while (snapshot_read_retry(s, seq));
+    return len;
+}
+
+#endif // SNAPSHOT
@@ -0,0 +1,81 @@
+#ifndef SPSC_RING
+#define SPSC_RING
+
+// Lock-free single-producer/single-consumer ring of fixed-size elements.
+//
+// Exactly one context may push and exactly one may pop; neither ever blocks
+// or takes a lock, so the producer side is safe to call from the NimBLE host
+// task or an ISR. Storage is supplied by the caller (usually a static array),
+// capacity must be a power of two. Indices run freely and wrap naturally.
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+typedef struct {
+    uint8_t* buf;
+    uint32_t elem_size;
+    uint32_t mask;
+    _Atomic uint32_t head; // next slot to write, owned by the producer
+    _Atomic uint32_t tail; // next slot to read, owned by the consumer
+    // Producer-side statistics.
+    uint32_t pushed;
+    uint32_t dropped;
+    uint32_t max_depth;
+} spsc_ring_t;
+
+static inline void spsc_ring_init(spsc_ring_t* ring, void* storage,
+                                  uint32_t elem_size, uint32_t capacity) {
+    ring->buf = storage;
+    ring->elem_size = elem_size;
+    ring->mask = capacity - 1;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    ring->pushed = 0;
+    ring->dropped = 0;
+    ring->max_depth = 0;
+}
+
+// Producer only. Returns false (and counts a drop) if the ring is full.
+static inline bool spsc_ring_push(spsc_ring_t* ring, const void* elem) {
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    uint32_t depth = head - tail;
+
+    if (depth > ring->mask) {
+        ring->dropped++;
+        return false;
+    }
+    memcpy(ring->buf + (head & ring->mask) * ring->elem_size, elem,
+           ring->elem_size);
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+
+    ring->pushed++;
+    if (depth + 1 > ring->max_depth) {
+        ring->max_depth = depth + 1;
+    }
+    return true;
+}
+
+// Consumer only. Returns false if the ring is empty.
+static inline bool spsc_ring_pop(spsc_ring_t* ring, void* elem) {
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+    if (head == tail) {
+        return false;
+    }
+    memcpy(elem, ring->buf + (tail & ring->mask) * ring->elem_size,
+           ring->elem_size);
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+    return true;
+}
+
+// Either side; a snapshot that may be stale by the time it is used.
+static inline uint32_t spsc_ring_depth(spsc_ring_t* ring) {
+    return atomic_load_explicit(&ring->head, memory_order_acquire) -
+           atomic_load_explicit(&ring->tail, memory_order_acquire);
+}
+
+#endif // SPSC_RING
@@ -0,0 +1,162 @@
+#include <stdatomic.h>
+#include "subs.h"
+#include "esp_console.h"
+#include "esp_log.h"
+
+_Static_assert(SUBS_MAX_CONNS <= 32, "one mask bit per connection slot");
+
+typedef struct {
+    enum gatt_svr_chr_id id;
+    subs_watch_fn fn;
+} subs_watcher_t;
+
+// Written only by the host task. The handles and slot set are also read by
+// notifying tasks; a handle is stored before its slot's first mask bit is
+// set, so a reader that saw the bit through subs_conn_mask() sees it too.
+static _Atomic uint16_t g_conn_handles[SUBS_MAX_CONNS];
+static _Atomic uint32_t g_slots_used;
+static subs_watcher_t g_watchers[SUBS_MAX_WATCHERS];
+static int g_watcher_count;
+
+// Bit s of g_masks[id] is set while connection slot s is subscribed to id.
+static _Atomic uint32_t g_masks[GATT_SVR_CHR_COUNT];
+
+static int chr_of_handle(uint16_t attr_handle) {
+    for (int id = 0; id < GATT_SVR_CHR_COUNT; id++) {
+        if (gatt_svr_chr_val_handle(id) == attr_handle) {
+            return id;
+        }
+    }
+    return -1;
+}
+
+static int slot_of_conn(uint16_t conn_handle, bool allocate) {
+    uint32_t used = atomic_load_explicit(&g_slots_used, memory_order_relaxed);
+    int free_slot = -1;
+    for (int s = 0; s < SUBS_MAX_CONNS; s++) {
+        if (used & (1u << s)) {
+            if (atomic_load_explicit(&g_conn_handles[s],
+                                     memory_order_relaxed) == conn_handle) {
+                return s;
+            }
+        } else if (free_slot < 0) {
+            free_slot = s;
+        }
+    }
+    if (allocate && free_slot >= 0) {
+        atomic_store_explicit(&g_conn_handles[free_slot], conn_handle,
+                              memory_order_relaxed);
+        atomic_fetch_or(&g_slots_used, 1u << free_slot);
+        return free_slot;
+    }
+    return -1;
+}
+
+static void notify_watchers(enum gatt_svr_chr_id id, bool active) {
+    for (int i = 0; i < g_watcher_count; i++) {
+        if (g_watchers[i].id == id) {
+            g_watchers[i].fn(id, active);
+        }
+    }
+}
+
+static void set_bit(enum gatt_svr_chr_id id, int slot, bool on) {
+    uint32_t bit = 1u << slot;
+    uint32_t old = on ? atomic_fetch_or(&g_masks[id], bit)
+                      : atomic_fetch_and(&g_masks[id], ~bit);
+    uint32_t now = on ? old | bit : old & ~bit;
+    if ((old == 0) != (now == 0)) {
+        notify_watchers(id, now != 0);
+    }
+}
+
+// Releases the slot once it holds no subscriptions.
+static void release_if_idle(int slot) {
+    for (int id = 0; id < GATT_SVR_CHR_COUNT; id++) {
+        if (atomic_load(&g_masks[id]) & (1u << slot)) {
+            return;
+        }
+    }
+    atomic_fetch_and(&g_slots_used, ~(1u << slot));
+}
+
+void subs_on_subscribe(uint16_t conn_handle, uint16_t attr_handle,
+                       bool notify, bool indicate) {
+    int id = chr_of_handle(attr_handle);
+    if (id < 0) {
+        return;
+    }
+    bool on = notify || indicate;
+    int slot = slot_of_conn(conn_handle, on);
+    if (slot < 0) {
+        return;
+    }
+    set_bit(id, slot, on);
+    if (!on) {
+        release_if_idle(slot);
+    }
+}
+
+void subs_on_disconnect(uint16_t conn_handle) {
+    int slot = slot_of_conn(conn_handle, false);
+    if (slot < 0) {
+        return;
+    }
+    for (int id = 0; id < GATT_SVR_CHR_COUNT; id++) {
+        if (atomic_load(&g_masks[id]) & (1u << slot)) {
+            set_bit(id, slot, false);
+        }
+    }
+    atomic_fetch_and(&g_slots_used, ~(1u << slot));
+}
+
+bool subs_any(enum gatt_svr_chr_id id) {
+    return atomic_load_explicit(&g_masks[id], memory_order_relaxed) != 0;
+}
+
+uint32_t subs_conn_mask(enum gatt_svr_chr_id id) {
+    return atomic_load_explicit(&g_masks[id], memory_order_acquire);
+}
+
+uint16_t subs_conn_handle(int slot) {
+    return atomic_load_explicit(&g_conn_handles[slot], memory_order_relaxed);
+}
+
+int subs_conn_count(void) {
+    return __builtin_popcount(atomic_load(&g_slots_used));
+}
+
+void subs_watch(enum gatt_svr_chr_id id, subs_watch_fn fn) {
+    if (g_watcher_count < SUBS_MAX_WATCHERS) {
+        g_watchers[g_watcher_count++] = (subs_watcher_t){id, fn};
+    }
+}
+
+static int subs_cmd_handler(int argc, char *argv[]) {
+    ESP_LOGI("SUBS", "%d connection(s) subscribed", subs_conn_count());
+    for (int id = 0; id < GATT_SVR_CHR_COUNT; id++) {
+        uint32_t mask = subs_conn_mask(id);
+        if (mask != 0) {
+            ESP_LOGI("SUBS", "  chr %d (handle %d): %d subscriber(s)", id,
+                     gatt_svr_chr_val_handle(id), __builtin_popcount(mask));
+        }
+    }
+    return 0;
+}
+
+static const esp_console_cmd_t g_subs_cmd = {
+    .command = "subs",
+    .help = "List characteristics with active subscriptions",
+    .func = subs_cmd_handler,
+};
+
+void subs_init(void) {
+    for (int s = 0; s < SUBS_MAX_CONNS; s++) {
+        atomic_init(&g_conn_handles[s], 0);
+    }
+    atomic_init(&g_slots_used, 0);
+    for (int id = 0; id < GATT_SVR_CHR_COUNT; id++) {
+        atomic_init(&g_masks[id], 0);
+    }
+    esp_console_cmd_register(&g_subs_cmd);
+}
@@ -0,0 +1,42 @@
+#ifndef SUBS
+#define SUBS
+
+// Registry of CCCD subscriptions to the schema characteristics.
+//
+// Fed from the GAP subscribe and disconnect events in the host task; read
+// from any task. Producers of BLE-facing data check subs_any() before doing
+// any sampling, encoding or notification work for a characteristic, and can
+// register a watcher to be told when it gains its first or loses its last
+// subscriber. Queries are a single atomic load.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "bleprph.h"
+
+#define SUBS_MAX_CONNS CONFIG_BT_NIMBLE_MAX_CONNECTIONS
+#define SUBS_MAX_WATCHERS 8
+
+// Called in the host task when `id` goes from no subscribers to some
+// (active = true) or back.
+typedef void (*subs_watch_fn)(enum gatt_svr_chr_id id, bool active);
+
+void subs_on_subscribe(uint16_t conn_handle, uint16_t attr_handle,
+                       bool notify, bool indicate);
+void subs_on_disconnect(uint16_t conn_handle);
+
+bool subs_any(enum gatt_svr_chr_id id);
+
+// Connection slots subscribed to `id`, one bit per slot; see
+// subs_conn_handle(). A slot can be released by a disconnect right after
+// this returns, in which case notifying it simply fails.
+uint32_t subs_conn_mask(enum gatt_svr_chr_id id);
+uint16_t subs_conn_handle(int slot);
+
+// Number of connections subscribed to anything.
+int subs_conn_count(void);
+
+void subs_watch(enum gatt_svr_chr_id id, subs_watch_fn fn);
+
+void subs_init(void);
+
+#endif // SUBS
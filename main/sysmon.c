@@ -0,0 +1,166 @@
+#include <stdbool.h>
+#include "sysmon.h"
+#include "app_tasks.h"
+#include "esp_console.h"
+#include "esp_idf_version.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "os/os_mbuf.h"
+
+_Static_assert(APP_TASKS_STATIC_RAM <= CONFIG_APP_STATIC_RAM_BUDGET,
+               "application task stacks exceed CONFIG_APP_STATIC_RAM_BUDGET");
+
+static const char *tag = "SYSMON";
+
+typedef struct {
+    TaskHandle_t handle;
+    uint32_t stack_size;
+} sysmon_task_t;
+
+// Append-only. app_main and the NimBLE host task register concurrently and
+// the diagnostics task may already be reading, so entries are filled in and
+// counted under the lock; an entry is never changed once counted.
+static sysmon_task_t g_tasks[SYSMON_MAX_TASKS];
+static int g_num_tasks = 0;
+static portMUX_TYPE g_tasks_lock = portMUX_INITIALIZER_UNLOCKED;
+
+void sysmon_register_task(TaskHandle_t task, uint32_t stack_size) {
+    if (task == NULL) {
+        return;
+    }
+    bool full = false;
+    portENTER_CRITICAL(&g_tasks_lock);
+    if (g_num_tasks < SYSMON_MAX_TASKS) {
+        g_tasks[g_num_tasks].handle = task;
+        g_tasks[g_num_tasks].stack_size = stack_size;
+        g_num_tasks++;
+    } else {
+        full = true;
+    }
+    portEXIT_CRITICAL(&g_tasks_lock);
+    if (full) {
+        // A task was added without counting it in APP_TASKS_COUNT.
+        ESP_LOGE(tag, "task %s not monitored: table full (%d)",
+                 pcTaskGetName(task), SYSMON_MAX_TASKS);
+    }
+}
+
+int sysmon_task_count(void) {
+    int n;
+
+    portENTER_CRITICAL(&g_tasks_lock);
+    n = g_num_tasks;
+    portEXIT_CRITICAL(&g_tasks_lock);
+    return n;
+}
+
+TaskHandle_t sysmon_task(int i, uint32_t* stack_size) {
+    if (stack_size != NULL) {
+        *stack_size = g_tasks[i].stack_size;
+    }
+    return g_tasks[i].handle;
+}
+
+void sysmon_report(void) {
+    ESP_LOGI(tag, "static app RAM: %u of %u bytes",
+             (unsigned)APP_TASKS_STATIC_RAM, CONFIG_APP_STATIC_RAM_BUDGET);
+
+    int n = sysmon_task_count();
+    for (int i = 0; i < n; i++) {
+        // High-water mark is the minimum free stack seen, in bytes on ESP-IDF.
+        uint32_t free_min = uxTaskGetStackHighWaterMark(g_tasks[i].handle);
+        uint32_t size = g_tasks[i].stack_size;
+        ESP_LOGI(tag, "task %-12s stack used %5u of %5u bytes (%u%%)",
+                 pcTaskGetName(g_tasks[i].handle),
+                 (unsigned)(size - free_min), (unsigned)size,
+                 (unsigned)(100 * (size - free_min) / size));
+    }
+
+    ESP_LOGI(tag, "heap free %u bytes, low-water %u bytes, largest block %u",
+             (unsigned)heap_caps_get_free_size(MALLOC_CAP_DEFAULT),
+             (unsigned)heap_caps_get_minimum_free_size(MALLOC_CAP_DEFAULT),
+             (unsigned)heap_caps_get_largest_free_block(MALLOC_CAP_DEFAULT));
+
+    ESP_LOGI(tag, "msys mbufs free %d of %d",
+             os_msys_num_free(), os_msys_count());
+}
+
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS && CONFIG_FREERTOS_USE_TRACE_FACILITY
+#define SYSMON_MAX_SYS_TASKS 24
+
+static TaskStatus_t g_status[SYSMON_MAX_SYS_TASKS];
+static uint32_t g_last_total;
+static uint32_t g_last_idle[portNUM_PROCESSORS];
+
+static TaskHandle_t idle_task_of(int core) {
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 1, 0)
+    return xTaskGetIdleTaskHandleForCore(core);
+#else
+    return xTaskGetIdleTaskHandleForCPU(core);
+#endif
+}
+
+int sysmon_cpu_load(uint32_t load_pct[portNUM_PROCESSORS]) {
+    uint32_t total;
+    UBaseType_t n = uxTaskGetSystemState(g_status, SYSMON_MAX_SYS_TASKS, &total);
+    uint32_t elapsed = total - g_last_total;
+
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        TaskHandle_t idle = idle_task_of(core);
+        uint32_t idle_time = g_last_idle[core];
+        for (UBaseType_t i = 0; i < n; i++) {
+            if (g_status[i].xHandle == idle) {
+                idle_time = g_status[i].ulRunTimeCounter;
+                break;
+            }
+        }
+        uint32_t idle_elapsed = idle_time - g_last_idle[core];
+        g_last_idle[core] = idle_time;
+        load_pct[core] = elapsed == 0 || idle_elapsed >= elapsed
+                         ? 0 : 100 - (uint64_t)idle_elapsed * 100 / elapsed;
+    }
+    g_last_total = total;
+    return 0;
+}
+#else
+int sysmon_cpu_load(uint32_t load_pct[portNUM_PROCESSORS]) {
+    return -1;
+}
+#endif
+
+static int cpu_cmd_handler(int argc, char *argv[]) {
+    uint32_t load[portNUM_PROCESSORS];
+
+    if (sysmon_cpu_load(load) != 0) {
+        ESP_LOGW(tag, "enable FREERTOS_GENERATE_RUN_TIME_STATS and "
+                 "FREERTOS_USE_TRACE_FACILITY for CPU load");
+        return 0;
+    }
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        ESP_LOGI(tag, "core %d load %u%% since last 'cpu'", core,
+                 (unsigned)load[core]);
+    }
+    return 0;
+}
+
+static const esp_console_cmd_t g_cpu_cmd = {
+    .command = "cpu",
+    .help = "Print per-core CPU load since the previous 'cpu'",
+    .func = cpu_cmd_handler,
+};
+
+static int mem_cmd_handler(int argc, char *argv[]) {
+    sysmon_report();
+    return 0;
+}
+
+static const esp_console_cmd_t g_mem_cmd = {
+    .command = "mem",
+    .help = "Print stack, heap and mbuf usage",
+    .func = mem_cmd_handler,
+};
+
+void sysmon_init(void) {
+    esp_console_cmd_register(&g_mem_cmd);
+    esp_console_cmd_register(&g_cpu_cmd);
+}
@@ -0,0 +1,32 @@
+#ifndef SYSMON
+#define SYSMON
+
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "app_tasks.h"
+
+// One entry per task in app_tasks.h; registering more is a bug and is logged.
+#define SYSMON_MAX_TASKS APP_TASKS_COUNT
+
+// Registers a long-lived task so its stack usage shows up in reports.
+// stack_size is the size the task was created with, in bytes.
+void sysmon_register_task(TaskHandle_t task, uint32_t stack_size);
+
+// Registered tasks, in registration order. stack_size may be NULL.
+int sysmon_task_count(void);
+TaskHandle_t sysmon_task(int i, uint32_t* stack_size);
+
+// Registers the "mem" and "cpu" console commands.
+void sysmon_init(void);
+
+// Logs the memory budget: per-task stack usage, heap and mbuf pool.
+void sysmon_report(void);
+
+// Fills load_pct[core] with each core's busy percentage since the previous
+// call (or boot). Returns -1 if FreeRTOS run-time stats are not enabled
+// (CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS and
+// CONFIG_FREERTOS_USE_TRACE_FACILITY).
+int sysmon_cpu_load(uint32_t load_pct[portNUM_PROCESSORS]);
+
+#endif // SYSMON
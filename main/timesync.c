@@ -0,0 +1,269 @@
+#include <stdlib.h>
+#include "timesync.h"
+#include "mailbox.h"
+#include "esp_console.h"
+#include "esp_log.h"
+#include "host/ble_hs.h"
+#include "os/endian.h"
+
+#define TAG "TIMESYNC"
+
+// An offset this far from the fitted line means the phone stepped its
+// clock; the kept exchanges no longer describe it.
+#define STEP_US 500000
+// Drift is only fitted over this span or more, and never beyond what a
+// crystal can plausibly do.
+#define MIN_DRIFT_SPAN_US (2 * TIMESYNC_EPOCH_US)
+#define MAX_DRIFT_PPB 500000
+// Epochs whose best delay is this many times the overall best are left out
+// of the fit.
+#define DELAY_OUTLIER 4
+
+typedef struct {
+    int64_t local_us;  // our clock, midway between t2 and t3
+    int64_t offset_us; // phone clock minus ours
+    uint32_t delay_us;
+} sync_sample_t;
+
+// Everything a conversion needs, handed to readers through a mailbox.
+typedef struct {
+    bool synced;
+    int32_t drift_ppb;
+    uint32_t error_us;
+    uint32_t exchanges;
+    int64_t anchor_us;
+    int64_t anchor_offset_us; // offset at anchor_us
+} estimate_t;
+
+// Host task only.
+static sync_sample_t g_epochs[TIMESYNC_EPOCHS]; // ring of closed epochs' best
+static int g_nepochs;
+static int g_next_epoch;
+static sync_sample_t g_current; // best of the open epoch
+static bool g_have_current;
+static int64_t g_epoch_start_us;
+static estimate_t g_est;
+
+// Exchange in progress: t1 and t2 from the last write, t3 from the last read.
+static uint16_t g_conn_handle = BLE_HS_CONN_HANDLE_NONE;
+static uint64_t g_t1;
+static int64_t g_t2;
+static int64_t g_t3;
+
+static estimate_t g_est_box_buf;
+static mailbox_t g_est_box;
+
+static int64_t predict_offset(const estimate_t* e, int64_t local_us) {
+    return e->anchor_offset_us +
+           (local_us - e->anchor_us) * e->drift_ppb / 1000000000;
+}
+
+// Least-squares line through the kept exchanges, anchored at the newest.
+// Floating point is fine here: it runs once per exchange, in the host task.
+static void fit(void) {
+    sync_sample_t pts[TIMESYNC_EPOCHS + 1];
+    const sync_sample_t* last = &g_current;
+    const sync_sample_t* best = last;
+    int64_t oldest = last->local_us;
+    int n = 0;
+
+    for (int i = 0; i < g_nepochs; i++) {
+        pts[n++] = g_epochs[i];
+    }
+    pts[n++] = *last;
+    for (int i = 0; i < n; i++) {
+        if (pts[i].delay_us < best->delay_us) {
+            best = &pts[i];
+        }
+    }
+    uint64_t max_delay =
+        (uint64_t)(best->delay_us > 1000 ? best->delay_us : 1000) *
+        DELAY_OUTLIER;
+
+    // Weighted by 1 / delay^2: an exchange's offset error is bounded by
+    // half its delay, and the open epoch may not have seen a good one yet.
+    double sw = 0, sx = 0, sy = 0, sxx = 0, sxy = 0;
+    int used = 0;
+    for (int i = 0; i < n; i++) {
+        if (pts[i].delay_us > max_delay) {
+            continue;
+        }
+        double d = pts[i].delay_us > 1000 ? pts[i].delay_us : 1000;
+        double w = 1e6 / (d * d);
+        double x = pts[i].local_us - last->local_us;
+        double y = pts[i].offset_us - last->offset_us;
+        sw += w;
+        sx += w * x;
+        sy += w * y;
+        sxx += w * x * x;
+        sxy += w * x * y;
+        used++;
+        if (pts[i].local_us < oldest) {
+            oldest = pts[i].local_us;
+        }
+    }
+
+    g_est.synced = true;
+    g_est.error_us = best->delay_us / 2;
+    // A fitted slope of exactly 0 is a perfect phone clock, not a missing
+    // fit.
+    bool fitted = used >= 2 && last->local_us - oldest >= MIN_DRIFT_SPAN_US;
+    double slope = 0;
+    if (fitted) {
+        slope = (sxy - sx * sy / sw) / (sxx - sx * sx / sw);
+    }
+    if (!fitted || slope * 1e9 > MAX_DRIFT_PPB ||
+        slope * 1e9 < -MAX_DRIFT_PPB) {
+        // Too short a baseline: keep the drift fitted before, if any, and
+        // rest the offset on the exchange with the least delay.
+        g_est.anchor_us = best->local_us;
+        g_est.anchor_offset_us = best->offset_us;
+        return;
+    }
+    g_est.drift_ppb = slope * 1e9;
+    // The line passes through the weighted mean; evaluate it at the newest exchange.
+    g_est.anchor_us = last->local_us;
+    g_est.anchor_offset_us = last->offset_us +
+                             (int64_t)((sy - slope * sx) / sw);
+}
+
+void timesync_exchange(uint64_t t1, int64_t t2, int64_t t3, uint64_t t4) {
+    int64_t delay = (int64_t)(t4 - t1) - (t3 - t2);
+    if (t4 < t1 || t3 < t2 || delay < 0 || delay > UINT32_MAX) {
+        return;
+    }
+    sync_sample_t s = {
+        .local_us = t2 + (t3 - t2) / 2,
+        .offset_us = ((int64_t)(t1 - t2) + (int64_t)(t4 - t3)) / 2,
+        .delay_us = delay,
+    };
+
+    if (g_est.synced) {
+        int64_t step = s.offset_us - predict_offset(&g_est, s.local_us);
+        if (llabs(step) > STEP_US) {
+            ESP_LOGW(TAG, "phone clock stepped by %lld ms, starting over",
+                     (long long)(step / 1000));
+            g_nepochs = 0;
+            g_next_epoch = 0;
+            g_have_current = false;
+        }
+    }
+
+    if (!g_have_current || s.local_us - g_epoch_start_us >= TIMESYNC_EPOCH_US) {
+        if (g_have_current) {
+            g_epochs[g_next_epoch] = g_current;
+            g_next_epoch = (g_next_epoch + 1) % TIMESYNC_EPOCHS;
+            if (g_nepochs < TIMESYNC_EPOCHS) {
+                g_nepochs++;
+            }
+        }
+        g_current = s;
+        g_have_current = true;
+        g_epoch_start_us = s.local_us;
+    } else if (s.delay_us <= g_current.delay_us) {
+        g_current = s;
+    }
+
+    g_est.exchanges++;
+    fit();
+    mailbox_publish(&g_est_box, &g_est);
+}
+
+int timesync_on_write(uint16_t conn_handle, const uint8_t* buf, uint16_t len) {
+    int64_t now = esp_timer_get_time();
+
+    if (len != TIMESYNC_WRITE_MIN && len != TIMESYNC_WRITE_MAX) {
+        return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+    }
+    // t4 completes the exchange whose response this connection last read.
+    if (len == TIMESYNC_WRITE_MAX && conn_handle == g_conn_handle &&
+        g_t3 != 0) {
+        timesync_exchange(g_t1, g_t2, g_t3, get_le64(buf + 8));
+    }
+    g_conn_handle = conn_handle;
+    g_t1 = get_le64(buf);
+    g_t2 = now;
+    g_t3 = 0;
+    return 0;
+}
+
+int timesync_on_read(uint16_t conn_handle, uint8_t* buf) {
+    int64_t now = esp_timer_get_time();
+    bool pending = conn_handle == g_conn_handle;
+    struct ble_gap_conn_desc desc;
+
+    // The response only goes out at the next connection event. Stamping t3
+    // there, rather than now, keeps the two legs of the exchange alike;
+    // otherwise every offset is biased by half an interval.
+    if (ble_gap_conn_find(conn_handle, &desc) == 0) {
+        now += desc.conn_itvl * BLE_HCI_CONN_ITVL;
+    }
+
+    if (pending) {
+        g_t3 = now;
+    }
+    put_le32(buf, pending ? (uint32_t)g_t1 : 0);
+    put_le64(buf + 4, pending ? g_t2 : 0);
+    put_le32(buf + 12, pending ? now - g_t2 : 0);
+    put_le32(buf + 16, g_est.synced ? g_est.error_us : TIMESYNC_UNSYNCED);
+    return 0;
+}
+
+bool timesync_local_to_unix_us(int64_t local_us, int64_t* unix_us) {
+    estimate_t e;
+    mailbox_read(&g_est_box, &e);
+    if (!e.synced) {
+        return false;
+    }
+    *unix_us = local_us + predict_offset(&e, local_us);
+    return true;
+}
+
+bool timesync_to_unix_us(timesync_stamp_t stamp, int64_t* unix_us) {
+    int64_t now_ticks = esp_timer_get_time() >> TIMESYNC_TICK_SHIFT;
+    timesync_stamp_t age = (timesync_stamp_t)now_ticks - stamp;
+    // The middle of the tick the stamp was taken in.
+    int64_t local_us = ((now_ticks - age) << TIMESYNC_TICK_SHIFT) +
+                       TIMESYNC_TICK_US / 2;
+    return timesync_local_to_unix_us(local_us, unix_us);
+}
+
+void timesync_get_state(timesync_state_t* state) {
+    estimate_t e;
+    mailbox_read(&g_est_box, &e);
+    *state = (timesync_state_t){
+        .synced = e.synced,
+        .drift_ppb = e.drift_ppb,
+        .error_us = e.synced ? e.error_us : TIMESYNC_UNSYNCED,
+        .exchanges = e.exchanges,
+        .offset_us = e.synced ? predict_offset(&e, esp_timer_get_time()) : 0,
+    };
+}
+
+static int timesync_cmd_handler(int argc, char *argv[]) {
+    timesync_state_t state;
+    int64_t unix_us;
+
+    timesync_get_state(&state);
+    if (!timesync_local_to_unix_us(esp_timer_get_time(), &unix_us)) {
+        ESP_LOGI(TAG, "not synced");
+        return 0;
+    }
+    ESP_LOGI(TAG, "unix time %lld.%06lld, offset %lld us, drift %d ppb, "
+             "error %u us, %u exchanges", (long long)(unix_us / 1000000),
+             (long long)(unix_us % 1000000), (long long)state.offset_us,
+             state.drift_ppb,
+             state.error_us, state.exchanges);
+    return 0;
+}
+
+static const esp_console_cmd_t g_timesync_cmd = {
+    .command = "timesync",
+    .help = "Print the phone clock estimate",
+    .func = timesync_cmd_handler,
+};
+
+void timesync_init(void) {
+    mailbox_init(&g_est_box, &g_est_box_buf, sizeof(g_est_box_buf));
+    esp_console_cmd_register(&g_timesync_cmd);
+}
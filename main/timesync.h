@@ -0,0 +1,75 @@
+#ifndef TIMESYNC
+#define TIMESYNC
+
+// Wall-clock time from the phone, so rides line up with its GPS track.
+//
+// Samples are stamped with timesync_now(), a 32-bit count of
+// TIMESYNC_TICK_US ticks since boot that costs one counter read. The phone
+// runs NTP-style exchanges over the time sync characteristic, each giving
+// the offset between its clock and ours and the round-trip delay. The
+// exchange with the smallest delay in every TIMESYNC_EPOCH_US is kept, and a
+// line fitted through the kept ones gives the offset and drift that
+// timesync_to_unix_us() applies when a stamp is exported.
+//
+// Exchange, all times in us; the phone's since the Unix epoch, ours since
+// boot, little-endian:
+//     write  u64 t1   phone clock when it sent this write
+//            u64 t4   optional: phone clock when the response to its
+//                     previous read arrived
+//     read   u32      low half of the last t1, to match the response
+//            u64 t2   our clock when that write arrived
+//            u32      t3 - t2, t3 being our clock for the response
+//            u32      current error bound, TIMESYNC_UNSYNCED if none
+// Our clock minus the phone's is ((t2 - t1) + (t3 - t4)) / 2, give or take
+// half the round-trip delay (t4 - t1) - (t3 - t2). Passing t4 in the next
+// write lets the firmware work this out too. t3 is the connection event the
+// response goes out in, not when the read was served.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_timer.h"
+
+#define TIMESYNC_TICK_SHIFT 8
+#define TIMESYNC_TICK_US (1 << TIMESYNC_TICK_SHIFT)
+
+#define TIMESYNC_EPOCH_US (30 * 1000000LL)
+#define TIMESYNC_EPOCHS 16
+
+#define TIMESYNC_WRITE_MIN 8
+#define TIMESYNC_WRITE_MAX 16
+#define TIMESYNC_READ_LEN 20
+#define TIMESYNC_UNSYNCED UINT32_MAX
+
+// Wraps after about 12 days; stamps convert correctly until they are that
+// old.
+typedef uint32_t timesync_stamp_t;
+
+static inline timesync_stamp_t timesync_now(void) {
+    return esp_timer_get_time() >> TIMESYNC_TICK_SHIFT;
+}
+
+typedef struct {
+    bool synced;
+    int32_t drift_ppb;   // phone clock rate relative to ours, minus one
+    uint32_t error_us;   // half the round-trip delay the offset rests on
+    uint32_t exchanges;  // completed since boot
+    int64_t offset_us;   // phone clock minus ours, now
+} timesync_state_t;
+
+// Host task: the time sync characteristic. Return 0 or a BLE_ATT_ERR_* code.
+int timesync_on_write(uint16_t conn_handle, const uint8_t* buf, uint16_t len);
+// Fills TIMESYNC_READ_LEN bytes.
+int timesync_on_read(uint16_t conn_handle, uint8_t* buf);
+
+// Feeds one completed exchange; exposed for the host build.
+void timesync_exchange(uint64_t t1, int64_t t2, int64_t t3, uint64_t t4);
+
+// Any task. Return false until the first exchange has completed.
+bool timesync_to_unix_us(timesync_stamp_t stamp, int64_t* unix_us);
+bool timesync_local_to_unix_us(int64_t local_us, int64_t* unix_us);
+
+void timesync_get_state(timesync_state_t* state);
+
+void timesync_init(void);
+
+#endif // TIMESYNC
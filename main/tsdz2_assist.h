@@ -0,0 +1,183 @@
+#ifndef TSDZ2_ASSIST
+#define TSDZ2_ASSIST
+
+// Assist curves: motor current target from pedal torque and cadence.
+//
+// A curve is two sets of knots, joined piecewise-linearly or by a monotone
+// cubic spline: motor current against pedal torque, and a gain in percent
+// against cadence that scales it. Both hold their end values beyond the
+// last knot. tsdz2_assist_compile() runs when settings change: it samples
+// the current every 0.512 Nm and the gain at every whole rpm, the only
+// cadence the motor reports. tsdz2_assist_current_ma() then costs one
+// interpolated lookup, one direct lookup and a multiply, with no divides.
+// Header-only and free of ESP-IDF dependencies, like tsdz2_metrics.h.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define TSDZ2_ASSIST_LEVELS 4       // 1..4; level 0 is off
+#define TSDZ2_ASSIST_KNOTS 8
+
+// Pedal torque beyond the last sample reads as on it.
+#define TSDZ2_ASSIST_TORQUE_SHIFT 9
+#define TSDZ2_ASSIST_TORQUE_STEPS 256
+#define TSDZ2_ASSIST_GAIN_SHIFT 14
+
+typedef enum {
+    TSDZ2_ASSIST_LINEAR,
+    TSDZ2_ASSIST_SPLINE,
+} tsdz2_assist_interp_t;
+
+typedef struct {
+    uint8_t interp;                            // tsdz2_assist_interp_t
+    uint8_t torque_knots;                      // 2..TSDZ2_ASSIST_KNOTS
+    uint8_t cadence_knots;
+    uint16_t torque_dnm[TSDZ2_ASSIST_KNOTS];   // pedal torque, 0.1 Nm
+    uint16_t current_ma[TSDZ2_ASSIST_KNOTS];   // motor current at that torque
+    uint8_t cadence_rpm[TSDZ2_ASSIST_KNOTS];
+    uint8_t gain_pct[TSDZ2_ASSIST_KNOTS];      // scales the current
+} tsdz2_assist_curve_t;
+
+typedef struct {
+    uint16_t torque_ma[TSDZ2_ASSIST_TORQUE_STEPS + 1];
+    uint16_t gain[256];                        // by rpm, Q14
+} tsdz2_assist_table_t;
+
+static inline bool tsdz2_assist_curve_valid(const tsdz2_assist_curve_t* c) {
+    if (c->interp > TSDZ2_ASSIST_SPLINE ||
+        c->torque_knots < 2 || c->torque_knots > TSDZ2_ASSIST_KNOTS ||
+        c->cadence_knots < 2 || c->cadence_knots > TSDZ2_ASSIST_KNOTS) {
+        return false;
+    }
+    for (int i = 1; i < c->torque_knots; i++) {
+        if (c->torque_dnm[i] <= c->torque_dnm[i - 1]) {
+            return false;
+        }
+    }
+    for (int i = 1; i < c->cadence_knots; i++) {
+        if (c->cadence_rpm[i] <= c->cadence_rpm[i - 1]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*** Reference curve (settings change only). */
+
+// Slope at knot k of a monotone cubic (Fritsch-Butland, as in PCHIP): zero
+// at a local extremum, otherwise a weighted harmonic mean of the two
+// secants, which never overshoots the knots.
+static inline double tsdz2_assist_slope(const double* x, const double* y,
+                                        int n, int k) {
+    if (k == 0) {
+        return (y[1] - y[0]) / (x[1] - x[0]);
+    }
+    if (k == n - 1) {
+        return (y[k] - y[k - 1]) / (x[k] - x[k - 1]);
+    }
+    double h0 = x[k] - x[k - 1];
+    double h1 = x[k + 1] - x[k];
+    double d0 = (y[k] - y[k - 1]) / h0;
+    double d1 = (y[k + 1] - y[k]) / h1;
+    if (d0 * d1 <= 0) {
+        return 0;
+    }
+    double w0 = 2 * h1 + h0;
+    double w1 = h1 + 2 * h0;
+    return (w0 + w1) / (w0 / d0 + w1 / d1);
+}
+
+static inline double tsdz2_assist_interp(const double* x, const double* y,
+                                         int n, bool spline, double v) {
+    if (v <= x[0]) {
+        return y[0];
+    }
+    if (v >= x[n - 1]) {
+        return y[n - 1];
+    }
+    int i = 1;
+    while (v > x[i]) {
+        i++;
+    }
+    double h = x[i] - x[i - 1];
+    double t = (v - x[i - 1]) / h;
+    if (!spline) {
+        return y[i - 1] + t * (y[i] - y[i - 1]);
+    }
+    double m0 = tsdz2_assist_slope(x, y, n, i - 1) * h;
+    double m1 = tsdz2_assist_slope(x, y, n, i) * h;
+    double t2 = t * t;
+    double t3 = t2 * t;
+    return (2 * t3 - 3 * t2 + 1) * y[i - 1] + (t3 - 2 * t2 + t) * m0 +
+           (-2 * t3 + 3 * t2) * y[i] + (t3 - t2) * m1;
+}
+
+static inline double tsdz2_assist_torque_ma(const tsdz2_assist_curve_t* c,
+                                            double torque_mnm) {
+    double x[TSDZ2_ASSIST_KNOTS];
+    double y[TSDZ2_ASSIST_KNOTS];
+
+    for (int i = 0; i < c->torque_knots; i++) {
+        x[i] = c->torque_dnm[i] * 100.0;
+        y[i] = c->current_ma[i];
+    }
+    return tsdz2_assist_interp(x, y, c->torque_knots,
+                               c->interp == TSDZ2_ASSIST_SPLINE, torque_mnm);
+}
+
+static inline double tsdz2_assist_gain(const tsdz2_assist_curve_t* c,
+                                       double cadence_rpm) {
+    double x[TSDZ2_ASSIST_KNOTS];
+    double y[TSDZ2_ASSIST_KNOTS];
+
+    for (int i = 0; i < c->cadence_knots; i++) {
+        x[i] = c->cadence_rpm[i];
+        y[i] = c->gain_pct[i] / 100.0;
+    }
+    return tsdz2_assist_interp(x, y, c->cadence_knots,
+                               c->interp == TSDZ2_ASSIST_SPLINE, cadence_rpm);
+}
+
+// The exact target in mA, before sampling and rounding; c must be valid.
+static inline double tsdz2_assist_reference_ma(const tsdz2_assist_curve_t* c,
+                                               double torque_mnm,
+                                               double cadence_rpm) {
+    return tsdz2_assist_torque_ma(c, torque_mnm) *
+           tsdz2_assist_gain(c, cadence_rpm);
+}
+
+static inline void tsdz2_assist_compile(tsdz2_assist_table_t* t,
+                                        const tsdz2_assist_curve_t* c) {
+    for (int i = 0; i <= TSDZ2_ASSIST_TORQUE_STEPS; i++) {
+        double ma = tsdz2_assist_torque_ma(c, i << TSDZ2_ASSIST_TORQUE_SHIFT);
+        t->torque_ma[i] = ma > UINT16_MAX ? UINT16_MAX : ma + 0.5;
+    }
+    for (int rpm = 0; rpm < 256; rpm++) {
+        double gain = tsdz2_assist_gain(c, rpm) * (1 << TSDZ2_ASSIST_GAIN_SHIFT);
+        t->gain[rpm] = gain > UINT16_MAX ? UINT16_MAX : gain + 0.5;
+    }
+}
+
+/*** Per-packet lookup (hot path: no divides). */
+
+static inline uint16_t tsdz2_assist_current_ma(const tsdz2_assist_table_t* t,
+                                               uint32_t torque_mnm,
+                                               uint8_t cadence_rpm) {
+    const uint32_t torque_max = TSDZ2_ASSIST_TORQUE_STEPS
+                                << TSDZ2_ASSIST_TORQUE_SHIFT;
+    const uint32_t step = 1 << TSDZ2_ASSIST_TORQUE_SHIFT;
+
+    if (torque_mnm >= torque_max) {
+        torque_mnm = torque_max - 1;
+    }
+    uint32_t i = torque_mnm >> TSDZ2_ASSIST_TORQUE_SHIFT;
+    uint32_t f = torque_mnm & (step - 1);
+    uint32_t ma = (t->torque_ma[i] * (step - f) + t->torque_ma[i + 1] * f +
+                   step / 2) >> TSDZ2_ASSIST_TORQUE_SHIFT;
+    // Both factors are 16-bit, so the product fits.
+    ma = (ma * t->gain[cadence_rpm] + (1 << (TSDZ2_ASSIST_GAIN_SHIFT - 1))) >>
+         TSDZ2_ASSIST_GAIN_SHIFT;
+    return ma > UINT16_MAX ? UINT16_MAX : ma;
+}
+
+#endif // TSDZ2_ASSIST
@@ -0,0 +1,139 @@
+#ifndef TSDZ2_LINK
+#define TSDZ2_LINK
+
+// Frames of the stock TSDZ2 display link, tracked byte by byte.
+//
+// The display (VLCD5, VLCD6, XH18) sends a TSDZ2_DISPLAY_LEN frame starting
+// with TSDZ2_DISPLAY_START; the motor answers with a TSDZ2_MOTOR_LEN frame
+// starting with TSDZ2_MOTOR_START. The last byte of each is the low byte of
+// the sum of the others. Frames are sent back to back with a pause between
+// exchanges, so a silence also ends a frame.
+//
+// tsdz2_link_byte() sees each byte before it is passed on and may change
+// it: on the display side it can replace the assist level, and then shifts
+// the checksum by as much when that arrives, so a frame that was corrupt on
+// the wire stays corrupt. Nothing is held back; a frame is only known to be
+// good once its last byte has gone through. Header-only and free of ESP-IDF
+// dependencies, like tsdz2_metrics.h.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "tsdz2_assist.h"
+
+#define TSDZ2_LINK_BAUD 9600
+#define TSDZ2_DISPLAY_START 0x59
+#define TSDZ2_DISPLAY_LEN 7
+#define TSDZ2_DISPLAY_ASSIST 1      // byte holding the assist level code
+#define TSDZ2_MOTOR_START 0x43
+#define TSDZ2_MOTOR_LEN 9
+#define TSDZ2_LINK_FRAME_MAX 9
+// Three byte times at 9600 baud.
+#define TSDZ2_LINK_GAP_US 3000
+
+// Assist level codes sent by the display, for levels 0 (off) to 4.
+static const uint8_t tsdz2_assist_codes[TSDZ2_ASSIST_LEVELS + 1] = {
+    0x10, 0x40, 0x02, 0x04, 0x08,
+};
+
+// Level for an assist byte, -1 for anything else (walk assist, for one).
+static inline int tsdz2_assist_level_of(uint8_t code) {
+    for (int level = 0; level <= TSDZ2_ASSIST_LEVELS; level++) {
+        if (tsdz2_assist_codes[level] == code) {
+            return level;
+        }
+    }
+    return -1;
+}
+
+typedef enum {
+    TSDZ2_LINK_IDLE,      // outside a frame
+    TSDZ2_LINK_MORE,      // inside a frame
+    TSDZ2_LINK_FRAME,     // ended a frame that passed its checksum
+    TSDZ2_LINK_BAD,       // ended a frame that failed it
+} tsdz2_link_result_t;
+
+typedef struct {
+    uint8_t start;
+    uint8_t len;
+    // Display side only: assist level to send instead of the display's,
+    // -1 to pass it through. Read at the start of each frame.
+    int8_t rewrite_level;
+    bool synced;          // the last frame passed its checksum
+    int8_t level;         // rewrite_level for the frame in progress
+    uint8_t pos;          // bytes of the frame in progress, 0 while hunting
+    uint8_t sum;          // of those bytes as received
+    uint8_t delta;        // what was passed on minus what was received
+    int64_t last_us;
+    uint8_t frame[TSDZ2_LINK_FRAME_MAX]; // as received
+    uint32_t frames;
+    uint32_t bad;         // failed the checksum or were cut short
+    uint32_t rewritten;
+} tsdz2_link_t;
+
+static inline void tsdz2_link_init(tsdz2_link_t* l, uint8_t start,
+                                   uint8_t len) {
+    *l = (tsdz2_link_t){
+        .start = start, .len = len, .rewrite_level = -1, .level = -1,
+    };
+}
+
+// Call with the time each read returned, before its bytes.
+static inline void tsdz2_link_gap(tsdz2_link_t* l, int64_t now_us) {
+    if (l->pos != 0 && now_us - l->last_us > TSDZ2_LINK_GAP_US) {
+        l->pos = 0;
+        l->synced = false;
+        l->bad++;
+    }
+    l->last_us = now_us;
+}
+
+static inline tsdz2_link_result_t tsdz2_link_byte(tsdz2_link_t* l,
+                                                  uint8_t* b) {
+    uint8_t in = *b;
+
+    if (l->pos == 0) {
+        if (in != l->start) {
+            return TSDZ2_LINK_IDLE;
+        }
+        l->sum = 0;
+        l->delta = 0;
+        // Only once in step with the frames, so a stray start byte never
+        // gets a byte of something else rewritten.
+        l->level = l->synced ? l->rewrite_level : -1;
+    }
+    l->frame[l->pos++] = in;
+
+    if (l->pos < l->len) {
+        l->sum += in;
+        if (l->level >= 0 && l->pos - 1 == TSDZ2_DISPLAY_ASSIST &&
+            tsdz2_assist_level_of(in) >= 0) {
+            *b = tsdz2_assist_codes[l->level];
+            l->delta += *b - in;
+        }
+        return TSDZ2_LINK_MORE;
+    }
+
+    // Corrected either way, so the far end accepts the frame exactly when
+    // it would have without us.
+    *b = in + l->delta;
+    l->pos = 0;
+    if (in == l->sum) {
+        l->synced = true;
+        l->frames++;
+        l->rewritten += l->delta != 0;
+        return TSDZ2_LINK_FRAME;
+    }
+
+    // The bytes already gone through may hold the start of the next frame.
+    uint8_t rest[TSDZ2_LINK_FRAME_MAX];
+    memcpy(rest, l->frame + 1, l->len - 1);
+    l->synced = false;
+    l->bad++;
+    for (int i = 0; i < l->len - 1; i++) {
+        tsdz2_link_byte(l, &rest[i]);
+    }
+    return TSDZ2_LINK_BAD;
+}
+
+#endif // TSDZ2_LINK
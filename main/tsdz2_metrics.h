@@ -0,0 +1,181 @@
+#ifndef TSDZ2_METRICS
+#define TSDZ2_METRICS
+
+// Fixed-point conversions from raw TSDZ2 motor data to rider-facing metrics.
+//
+// Everything calibration-dependent is folded into tsdz2_metrics_t by
+// tsdz2_metrics_configure(), which runs when settings change and is the only
+// place that divides. The per-sample functions are inline and use only
+// multiplies, shifts and table lookups, so they are cheap enough to run on
+// every motor packet. Header-only and free of ESP-IDF dependencies.
+
+#include <stdint.h>
+
+#define TSDZ2_BATTERY_ADC_STEPS 1024 // 10-bit battery voltage ADC
+// Charge for a reading that cannot be a pack voltage.
+#define TSDZ2_BATTERY_PCT_INVALID 0xFF
+
+typedef struct {
+    uint16_t wheel_circumference_mm;
+    uint32_t wheel_tick_hz;         // clock of the wheel pulse period counter
+    uint16_t torque_adc_offset;     // torque ADC reading with no pedal load
+    uint16_t torque_mnm_per_step;   // pedal torque per torque ADC step
+    uint32_t battery_uv_per_step;   // battery voltage per ADC step
+    uint32_t current_ua_per_step;   // battery current per ADC step
+    uint8_t battery_cells;          // cells in series
+} tsdz2_calib_t;
+
+typedef struct {
+    // speed (km/h x10) = (speed_k << speed_shift) / period; the shift keeps
+    // speed_k in 32 bits with a fast tick clock.
+    uint32_t speed_k;
+    uint8_t speed_shift;
+    uint16_t torque_adc_offset;
+    uint16_t torque_mnm_per_step;
+    uint32_t human_power_q24;       // W per (mNm * rpm), Q24
+    uint32_t motor_power_q24;       // W per (voltage step * current step), Q24
+    uint32_t battery_mv_q16;        // pack mV per voltage step, Q16
+    uint8_t battery_pct[TSDZ2_BATTERY_ADC_STEPS];
+} tsdz2_metrics_t;
+
+/*** Reciprocal without a divide. */
+
+// 1 / x for x in [0.5, 1), sampled at the midpoint of 128 equal buckets, in
+// Q30. Computed by the compiler; seeds one Newton-Raphson step.
+#define TSDZ2_RECIP_SEED(i) \
+    ((uint32_t)(256.0 / (128.5 + (i)) * (double)(1UL << 30)))
+#define TSDZ2_RECIP_SEED4(i) \
+    TSDZ2_RECIP_SEED(i), TSDZ2_RECIP_SEED(i + 1), \
+    TSDZ2_RECIP_SEED(i + 2), TSDZ2_RECIP_SEED(i + 3)
+#define TSDZ2_RECIP_SEED16(i) \
+    TSDZ2_RECIP_SEED4(i), TSDZ2_RECIP_SEED4(i + 4), \
+    TSDZ2_RECIP_SEED4(i + 8), TSDZ2_RECIP_SEED4(i + 12)
+
+static const uint32_t tsdz2_recip_seed[128] = {
+    TSDZ2_RECIP_SEED16(0), TSDZ2_RECIP_SEED16(16),
+    TSDZ2_RECIP_SEED16(32), TSDZ2_RECIP_SEED16(48),
+    TSDZ2_RECIP_SEED16(64), TSDZ2_RECIP_SEED16(80),
+    TSDZ2_RECIP_SEED16(96), TSDZ2_RECIP_SEED16(112),
+};
+
+// 2^32 / d, rounded down, to within 2^-15 relative error before that
+// rounding; d = 0 and 1 saturate.
+static inline uint32_t tsdz2_recip32(uint32_t d) {
+    if (d < 2) {
+        return UINT32_MAX;
+    }
+    int shift = __builtin_clz(d);
+    uint32_t n = d << shift;                             // Q32 in [0.5, 1)
+    uint32_t y = tsdz2_recip_seed[(n >> 24) & 0x7f];      // Q30 in (1, 2]
+    uint32_t ny = ((uint64_t)n * y) >> 32;                // Q30, ~1.0
+    y = ((uint64_t)y * ((2u << 30) - ny)) >> 30;          // y * (2 - n * y)
+    // 2^32 / d = 2^shift / (n / 2^32), and shift <= 30 here.
+    return y >> (30 - shift);
+}
+
+/*** Calibration (settings change only). */
+
+// Li-ion open-circuit voltage per cell at 0, 10, ..., 100 % charge.
+static const uint16_t tsdz2_cell_mv_curve[11] = {
+    3000, 3450, 3550, 3620, 3680, 3740, 3800, 3870, 3950, 4050, 4200,
+};
+
+// Highest cell voltage still taken as full: a charger's overshoot. Above it
+// the reading or the calibration is wrong, and the charge is unknown.
+#define TSDZ2_CELL_MV_MAX 4300
+
+static inline uint8_t tsdz2_cell_pct(uint32_t cell_mv) {
+    if (cell_mv <= tsdz2_cell_mv_curve[0]) {
+        return 0;
+    }
+    for (int i = 1; i < 11; i++) {
+        if (cell_mv < tsdz2_cell_mv_curve[i]) {
+            uint32_t lo = tsdz2_cell_mv_curve[i - 1];
+            uint32_t hi = tsdz2_cell_mv_curve[i];
+            return (i - 1) * 10 + (cell_mv - lo) * 10 / (hi - lo);
+        }
+    }
+    return cell_mv <= TSDZ2_CELL_MV_MAX ? 100 : TSDZ2_BATTERY_PCT_INVALID;
+}
+
+static inline void tsdz2_metrics_configure(tsdz2_metrics_t* m,
+                                           const tsdz2_calib_t* c) {
+    // km/h x10 = circumference_mm / 1e6 km / (period / tick_hz) h * 3600 * 10
+    uint64_t speed_k = (uint64_t)c->wheel_circumference_mm * c->wheel_tick_hz * 36 / 1000;
+    m->speed_shift = 0;
+    while (speed_k > UINT32_MAX) {
+        speed_k >>= 1;
+        m->speed_shift++;
+    }
+    m->speed_k = speed_k;
+    m->torque_adc_offset = c->torque_adc_offset;
+    m->torque_mnm_per_step = c->torque_mnm_per_step;
+    // W = Nm * rad/s = mNm / 1000 * rpm * 2 * pi / 60
+    m->human_power_q24 = (uint32_t)(2.0 * 3.14159265358979 / 60.0 / 1000.0 *
+                                    (double)(1UL << 24) + 0.5);
+    // W = uV * uA / 1e12
+    m->motor_power_q24 = ((uint64_t)c->battery_uv_per_step * c->current_ua_per_step
+                          << 24) / 1000000000000ULL;
+    m->battery_mv_q16 = ((uint64_t)c->battery_uv_per_step << 16) / 1000;
+    for (uint32_t adc = 0; adc < TSDZ2_BATTERY_ADC_STEPS; adc++) {
+        uint32_t pack_mv = (uint64_t)adc * c->battery_uv_per_step / 1000;
+        m->battery_pct[adc] = tsdz2_cell_pct(pack_mv / (c->battery_cells ? c->battery_cells : 1));
+    }
+}
+
+/*** Per-sample conversions (hot path: no divides). */
+
+// Wheel speed in km/h x10 from the pulse period; 0 when the wheel is stopped
+// (period 0 or saturated at 0xffff).
+static inline uint16_t tsdz2_speed_kmh_x10(const tsdz2_metrics_t* m,
+                                           uint16_t period_ticks) {
+    if (period_ticks == 0 || period_ticks == UINT16_MAX) {
+        return 0;
+    }
+    int shift = 32 - m->speed_shift;
+    uint64_t speed = ((uint64_t)m->speed_k * tsdz2_recip32(period_ticks) +
+                      (1ULL << (shift - 1))) >> shift;
+    return speed > UINT16_MAX ? UINT16_MAX : speed;
+}
+
+static inline uint32_t tsdz2_torque_mnm(const tsdz2_metrics_t* m,
+                                        uint16_t torque_adc) {
+    if (torque_adc <= m->torque_adc_offset) {
+        return 0;
+    }
+    return (uint32_t)(torque_adc - m->torque_adc_offset) * m->torque_mnm_per_step;
+}
+
+static inline uint16_t tsdz2_human_power_w(const tsdz2_metrics_t* m,
+                                           uint32_t torque_mnm,
+                                           uint8_t cadence_rpm) {
+    uint64_t power = ((uint64_t)torque_mnm * cadence_rpm * m->human_power_q24 +
+                      (1 << 23)) >> 24;
+    return power > UINT16_MAX ? UINT16_MAX : power;
+}
+
+static inline uint16_t tsdz2_motor_power_w(const tsdz2_metrics_t* m,
+                                           uint16_t battery_adc,
+                                           uint16_t current_adc) {
+    uint64_t power = ((uint64_t)battery_adc * current_adc * m->motor_power_q24 +
+                      (1 << 23)) >> 24;
+    return power > UINT16_MAX ? UINT16_MAX : power;
+}
+
+static inline uint32_t tsdz2_battery_mv(const tsdz2_metrics_t* m,
+                                        uint16_t battery_adc) {
+    return ((uint64_t)battery_adc * m->battery_mv_q16) >> 16;
+}
+
+// Charge in percent. Readings below an empty pack read 0; readings above a
+// full one, or beyond the ADC range (a glitch, or a corrupt frame), read
+// TSDZ2_BATTERY_PCT_INVALID rather than full.
+static inline uint8_t tsdz2_battery_pct(const tsdz2_metrics_t* m,
+                                        uint16_t battery_adc) {
+    if (battery_adc >= TSDZ2_BATTERY_ADC_STEPS) {
+        return TSDZ2_BATTERY_PCT_INVALID;
+    }
+    return m->battery_pct[battery_adc];
+}
+
+#endif // TSDZ2_METRICS
@@ -0,0 +1,190 @@
+#include "uart_proxy.h"
+
+#if CONFIG_APP_UART_PROXY
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lat_hist.h"
+#include "mailbox.h"
+#include "esp_console.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#define TAG "PROXY"
+
+#ifdef ESP_PLATFORM
+#define DRIVER uart_proxy_uart_driver
+#else
+#define DRIVER uart_proxy_pty_driver
+#endif
+
+// At 9600 baud a task that keeps up reads one or two bytes at a time; the
+// rest is for catching up after being preempted.
+#define CHUNK 32
+
+typedef struct {
+    tsdz2_link_t link;
+    lat_hist_t latency;  // us from reading a frame's last byte to writing it
+} direction_t;
+
+// Each written only by the task reading its side.
+static direction_t g_dir[UART_PROXY_SIDES];
+
+static _Atomic int g_level = UART_PROXY_LEVEL_NONE;
+
+// Latest good display frame, from the display task to the motor task, which
+// publishes the snapshot for both.
+typedef struct {
+    uint8_t asked;
+    uint8_t sent;
+    uint8_t frame[TSDZ2_DISPLAY_LEN];
+} display_tap_t;
+
+static display_tap_t g_display_box_buf;
+static mailbox_t g_display_box;
+
+static uint8_t g_snap_buf[2 * UART_PROXY_STATUS_LEN];
+snapshot_t uart_proxy_snap;
+static uint8_t g_status[UART_PROXY_STATUS_LEN];
+
+static uint8_t level_or_none(int level) {
+    return level < 0 ? UART_PROXY_LEVEL_NONE : level;
+}
+
+static void tap_display(const uint8_t* frame) {
+    display_tap_t tap;
+    int asked = tsdz2_assist_level_of(frame[TSDZ2_DISPLAY_ASSIST]);
+    int8_t rewrite = g_dir[UART_PROXY_DISPLAY].link.level;
+
+    tap.asked = level_or_none(asked);
+    tap.sent = level_or_none(asked >= 0 && rewrite >= 0 ? rewrite : asked);
+    memcpy(tap.frame, frame, TSDZ2_DISPLAY_LEN);
+    mailbox_publish(&g_display_box, &tap);
+}
+
+// Publishes only on change, so a steady ride does not churn the
+// changed-since version.
+static void tap_motor(const uint8_t* frame) {
+    uint8_t status[UART_PROXY_STATUS_LEN];
+    display_tap_t tap;
+
+    mailbox_read(&g_display_box, &tap);
+    status[0] = tap.asked;
+    status[1] = tap.sent;
+    memcpy(status + 2, tap.frame, TSDZ2_DISPLAY_LEN);
+    memcpy(status + 2 + TSDZ2_DISPLAY_LEN, frame, TSDZ2_MOTOR_LEN);
+    if (memcmp(status, g_status, sizeof(status)) != 0) {
+        memcpy(g_status, status, sizeof(status));
+        snapshot_publish(&uart_proxy_snap, status, sizeof(status));
+    }
+}
+
+void uart_proxy_task(void* param) {
+    uart_proxy_side_t from = (uart_proxy_side_t)(intptr_t)param;
+    uart_proxy_side_t to = from == UART_PROXY_DISPLAY ? UART_PROXY_MOTOR
+                                                      : UART_PROXY_DISPLAY;
+    direction_t* d = &g_dir[from];
+    uint8_t buf[CHUNK];
+    uint8_t frame[TSDZ2_LINK_FRAME_MAX];
+
+    while (true) {
+        int n = DRIVER.read(from, buf, sizeof(buf));
+        if (n <= 0) {
+            continue;
+        }
+        int64_t read_us = esp_timer_get_time();
+        bool ended = false;
+
+        if (from == UART_PROXY_DISPLAY) {
+            int level = atomic_load_explicit(&g_level, memory_order_relaxed);
+            d->link.rewrite_level = level == UART_PROXY_LEVEL_NONE ? -1 : level;
+        }
+        tsdz2_link_gap(&d->link, read_us);
+        for (int i = 0; i < n; i++) {
+            if (tsdz2_link_byte(&d->link, &buf[i]) == TSDZ2_LINK_FRAME) {
+                memcpy(frame, d->link.frame, d->link.len);
+                ended = true;
+            }
+        }
+        DRIVER.write(to, buf, n);
+
+        // Everything else waits until the bytes are out.
+        if (ended) {
+            lat_hist_record(&d->latency, esp_timer_get_time() - read_us);
+            if (from == UART_PROXY_DISPLAY) {
+                tap_display(frame);
+            } else {
+                tap_motor(frame);
+            }
+        }
+    }
+}
+
+bool uart_proxy_set_level(uint32_t level) {
+    if (level > TSDZ2_ASSIST_LEVELS && level != UART_PROXY_LEVEL_NONE) {
+        return false;
+    }
+    atomic_store_explicit(&g_level, level, memory_order_relaxed);
+    return true;
+}
+
+static int proxy_cmd_handler(int argc, char *argv[]) {
+    static const char* const names[UART_PROXY_SIDES] = {
+        [UART_PROXY_DISPLAY] = "display->motor",
+        [UART_PROXY_MOTOR] = "motor->display",
+    };
+
+    if (argc == 3 && strcmp(argv[1], "level") == 0) {
+        uint32_t level = strcmp(argv[2], "off") == 0 ? UART_PROXY_LEVEL_NONE
+                                                     : atoi(argv[2]);
+        if (!uart_proxy_set_level(level)) {
+            ESP_LOGE(TAG, "level is 0 to %d, or off", TSDZ2_ASSIST_LEVELS);
+            return 1;
+        }
+        return 0;
+    }
+
+    int level = atomic_load(&g_level);
+    if (level == UART_PROXY_LEVEL_NONE) {
+        ESP_LOGI(TAG, "assist level from the display");
+    } else {
+        ESP_LOGI(TAG, "assist level %d for the motor", level);
+    }
+    for (int side = 0; side < UART_PROXY_SIDES; side++) {
+        const direction_t* d = &g_dir[side];
+        lat_summary_t s;
+        lat_hist_summary(&d->latency, &s);
+        ESP_LOGI(TAG, "%s: %u frames, %u bad, %u rewritten; latency mean %u "
+                 "p50 %u p99 %u max %u us", names[side], d->link.frames,
+                 d->link.bad, d->link.rewritten, s.mean, s.p50, s.p99, s.max);
+    }
+    return 0;
+}
+
+static const esp_console_cmd_t g_proxy_cmd = {
+    .command = "proxy",
+    .help = "Print frame counts and forwarding latency, or "
+            "'proxy level <0-4|off>' to set the assist level for the motor",
+    .func = proxy_cmd_handler,
+};
+
+void uart_proxy_init(void) {
+    tsdz2_link_init(&g_dir[UART_PROXY_DISPLAY].link, TSDZ2_DISPLAY_START,
+                    TSDZ2_DISPLAY_LEN);
+    tsdz2_link_init(&g_dir[UART_PROXY_MOTOR].link, TSDZ2_MOTOR_START,
+                    TSDZ2_MOTOR_LEN);
+    for (int side = 0; side < UART_PROXY_SIDES; side++) {
+        lat_hist_reset(&g_dir[side].latency);
+    }
+    g_display_box_buf.asked = UART_PROXY_LEVEL_NONE;
+    g_display_box_buf.sent = UART_PROXY_LEVEL_NONE;
+    mailbox_init(&g_display_box, &g_display_box_buf, sizeof(g_display_box_buf));
+    memset(g_status, UART_PROXY_LEVEL_NONE, 2);
+    snapshot_init(&uart_proxy_snap, g_snap_buf, UART_PROXY_STATUS_LEN);
+    snapshot_publish(&uart_proxy_snap, g_status, sizeof(g_status));
+    ESP_ERROR_CHECK(DRIVER.init());
+    esp_console_cmd_register(&g_proxy_cmd);
+}
+
+#endif // CONFIG_APP_UART_PROXY
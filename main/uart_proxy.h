@@ -0,0 +1,74 @@
+#ifndef UART_PROXY
+#define UART_PROXY
+
+// Pass-through between the stock display and the motor controller.
+//
+// The display and the motor each get a UART of their own. A task per
+// direction blocks on its input and writes every byte to the other side
+// as soon as it is read, never waiting for the rest of a frame, so the link
+// only gains the time from a byte arriving to it being written. Frames are
+// followed as they go through (tsdz2_link.h): the assist level can be
+// replaced on the way to the motor, and complete frames are tapped for the
+// proxy characteristic once they have been passed on.
+//
+// Per frame, the time from reading its last byte to having written it is
+// recorded in a histogram per direction; type "proxy" on the console.
+//
+// Drivers hide the ports: the UARTs, or a pair of ptys on the Linux host
+// build (host_test/proxy_host.c, "make -C host_test"), which
+// tools/proxy_replay.py drives with a recorded corpus.
+//
+// Proxy characteristic, read:
+//     u8   assist level the display asks for, 0xff if not a level
+//     u8   assist level sent to the motor, 0xff if not a level
+//     7    latest good display frame, as received
+//     9    latest good motor frame
+// Write one byte: an assist level 0..4 for the motor whatever the display
+// says, or 0xff to pass the display's through again.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "sdkconfig.h"
+#include "snapshot.h"
+#include "tsdz2_link.h"
+
+typedef enum {
+    UART_PROXY_DISPLAY,
+    UART_PROXY_MOTOR,
+    UART_PROXY_SIDES,
+} uart_proxy_side_t;
+
+#define UART_PROXY_LEVEL_NONE 0xff
+#define UART_PROXY_STATUS_LEN (2 + TSDZ2_DISPLAY_LEN + TSDZ2_MOTOR_LEN)
+
+typedef struct {
+    esp_err_t (*init)(void);
+    // Blocks until at least one byte has arrived; returns how many were
+    // read, at most max.
+    int (*read)(uart_proxy_side_t side, uint8_t* buf, int max);
+    // Returns once the bytes are on their way out.
+    void (*write)(uart_proxy_side_t side, const uint8_t* buf, int len);
+} uart_proxy_driver_t;
+
+extern const uart_proxy_driver_t uart_proxy_uart_driver;
+extern const uart_proxy_driver_t uart_proxy_pty_driver;
+
+#if CONFIG_APP_UART_PROXY
+
+extern snapshot_t uart_proxy_snap;
+
+void uart_proxy_init(void);
+// One task per side, reading it; param is the uart_proxy_side_t.
+void uart_proxy_task(void* param);
+
+// Any task. 0..4, or UART_PROXY_LEVEL_NONE; false for anything else.
+bool uart_proxy_set_level(uint32_t level);
+
+#else
+
+static inline void uart_proxy_init(void) {}
+
+#endif // CONFIG_APP_UART_PROXY
+
+#endif // UART_PROXY
@@ -0,0 +1,77 @@
+#include "uart_proxy.h"
+
+#if CONFIG_APP_UART_PROXY && !defined(ESP_PLATFORM)
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <unistd.h>
+
+// Linux host build: each side is a tty named in the environment, normally
+// the far end of a pty pair whose near end tools/proxy_replay.py holds,
+// standing in for the display or the motor. UART_PROXY_LEVEL, if set, is
+// the assist level to send the motor from the start, as "proxy level" sets
+// it on the console.
+
+static const char* const g_env[UART_PROXY_SIDES] = {
+    [UART_PROXY_DISPLAY] = "UART_PROXY_DISPLAY",
+    [UART_PROXY_MOTOR] = "UART_PROXY_MOTOR",
+};
+static int g_fd[UART_PROXY_SIDES];
+
+static esp_err_t pty_init(void) {
+    for (int side = 0; side < UART_PROXY_SIDES; side++) {
+        const char* path = getenv(g_env[side]);
+        struct termios t;
+
+        if (path == NULL) {
+            fprintf(stderr, "%s is not set\n", g_env[side]);
+            return ESP_ERR_INVALID_ARG;
+        }
+        g_fd[side] = open(path, O_RDWR | O_NOCTTY);
+        if (g_fd[side] < 0 || tcgetattr(g_fd[side], &t) != 0) {
+            perror(path);
+            return ESP_FAIL;
+        }
+        // Raw bytes, and a read returns as soon as there is one.
+        cfmakeraw(&t);
+        cfsetispeed(&t, B9600);
+        cfsetospeed(&t, B9600);
+        t.c_cc[VMIN] = 1;
+        t.c_cc[VTIME] = 0;
+        if (tcsetattr(g_fd[side], TCSANOW, &t) != 0) {
+            perror(path);
+            return ESP_FAIL;
+        }
+    }
+    const char* level = getenv("UART_PROXY_LEVEL");
+    if (level != NULL && !uart_proxy_set_level(atoi(level))) {
+        fprintf(stderr, "UART_PROXY_LEVEL is 0 to %d\n", TSDZ2_ASSIST_LEVELS);
+        return ESP_ERR_INVALID_ARG;
+    }
+    return ESP_OK;
+}
+
+static int pty_read(uart_proxy_side_t side, uint8_t* buf, int max) {
+    return read(g_fd[side], buf, max);
+}
+
+static void pty_write(uart_proxy_side_t side, const uint8_t* buf, int len) {
+    while (len > 0) {
+        ssize_t n = write(g_fd[side], buf, len);
+        if (n <= 0) {
+            return;
+        }
+        buf += n;
+        len -= n;
+    }
+}
+
+const uart_proxy_driver_t uart_proxy_pty_driver = {
+    .init = pty_init,
+    .read = pty_read,
+    .write = pty_write,
+};
+
+#endif // CONFIG_APP_UART_PROXY && !ESP_PLATFORM
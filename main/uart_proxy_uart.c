@@ -0,0 +1,96 @@
+#include "uart_proxy.h"
+
+#if CONFIG_APP_UART_PROXY && defined(ESP_PLATFORM)
+
+#include "driver/uart.h"
+#include "esp_check.h"
+
+#define TAG "PROXY"
+
+_Static_assert(CONFIG_APP_SCLI_UART != CONFIG_APP_UART_PROXY_DISPLAY_UART &&
+               CONFIG_APP_SCLI_UART != CONFIG_APP_UART_PROXY_MOTOR_UART,
+               "the console UART (APP_SCLI_UART) is taken by the proxy");
+_Static_assert(CONFIG_APP_UART_PROXY_DISPLAY_UART !=
+               CONFIG_APP_UART_PROXY_MOTOR_UART,
+               "the display and motor sides need a UART each");
+
+// Holds what arrives while the task is held up; must exceed the hardware
+// FIFO.
+#define RX_BUF_SIZE 256
+
+static const uart_port_t g_port[UART_PROXY_SIDES] = {
+    [UART_PROXY_DISPLAY] = CONFIG_APP_UART_PROXY_DISPLAY_UART,
+    [UART_PROXY_MOTOR] = CONFIG_APP_UART_PROXY_MOTOR_UART,
+};
+static const int g_tx_gpio[UART_PROXY_SIDES] = {
+    [UART_PROXY_DISPLAY] = CONFIG_APP_UART_PROXY_DISPLAY_TX_GPIO,
+    [UART_PROXY_MOTOR] = CONFIG_APP_UART_PROXY_MOTOR_TX_GPIO,
+};
+static const int g_rx_gpio[UART_PROXY_SIDES] = {
+    [UART_PROXY_DISPLAY] = CONFIG_APP_UART_PROXY_DISPLAY_RX_GPIO,
+    [UART_PROXY_MOTOR] = CONFIG_APP_UART_PROXY_MOTOR_RX_GPIO,
+};
+
+static esp_err_t init_side(uart_proxy_side_t side) {
+    const uart_config_t config = {
+        .baud_rate = TSDZ2_LINK_BAUD,
+        .data_bits = UART_DATA_8_BITS,
+        .parity = UART_PARITY_DISABLE,
+        .stop_bits = UART_STOP_BITS_1,
+        .flow_ctrl = UART_HW_FLOWCTRL_DISABLE,
+        .source_clk = UART_SCLK_DEFAULT,
+    };
+
+    // No TX buffer: a write goes straight into the hardware FIFO, which at
+    // this rate never holds more than the bytes still shifting out.
+    ESP_RETURN_ON_ERROR(uart_driver_install(g_port[side], RX_BUF_SIZE, 0, 0,
+                                            NULL, 0),
+                        TAG, "uart driver");
+    ESP_RETURN_ON_ERROR(uart_param_config(g_port[side], &config),
+                        TAG, "uart config");
+    ESP_RETURN_ON_ERROR(uart_set_pin(g_port[side], g_tx_gpio[side],
+                                     g_rx_gpio[side], UART_PIN_NO_CHANGE,
+                                     UART_PIN_NO_CHANGE),
+                        TAG, "uart pins");
+    // Hand each byte to the task as it arrives, rather than when the FIFO
+    // fills or the line goes idle for the RX timeout.
+    return uart_set_rx_full_threshold(g_port[side], 1);
+}
+
+static esp_err_t serial_init(void) {
+    for (int side = 0; side < UART_PROXY_SIDES; side++) {
+        ESP_RETURN_ON_ERROR(init_side(side), TAG, "uart");
+    }
+    return ESP_OK;
+}
+
+static int serial_read(uart_proxy_side_t side, uint8_t* buf, int max) {
+    size_t more = 0;
+    int n = uart_read_bytes(g_port[side], buf, 1, portMAX_DELAY);
+
+    if (n <= 0) {
+        return n;
+    }
+    // Whatever else came in while this task was waking up.
+    uart_get_buffered_data_len(g_port[side], &more);
+    if (more > (size_t)(max - 1)) {
+        more = max - 1;
+    }
+    if (more > 0) {
+        int m = uart_read_bytes(g_port[side], buf + 1, more, 0);
+        n += m > 0 ? m : 0;
+    }
+    return n;
+}
+
+static void serial_write(uart_proxy_side_t side, const uint8_t* buf, int len) {
+    uart_write_bytes(g_port[side], buf, len);
+}
+
+const uart_proxy_driver_t uart_proxy_uart_driver = {
+    .init = serial_init,
+    .read = serial_read,
+    .write = serial_write,
+};
+
+#endif // CONFIG_APP_UART_PROXY && ESP_PLATFORM
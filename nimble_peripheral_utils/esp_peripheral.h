@@ -8,6 +8,7 @@
 #define H_ESP_PERIPHERAL_
 
 #include <stdbool.h>
+#include "esp_err.h"
 #include "nimble/ble.h"
 #include "modlog/modlog.h"
 #ifdef __cplusplus
@@ -15,8 +16,18 @@ extern "C" {
 #endif
 
 /* Console */
+#define SCLI_REMOTE_LINE_MAX 128
+
+/* Called in the CLI task once a line passed to scli_run_line() has run. */
+typedef void (*scli_done_fn)(const char *line, esp_err_t err, int ret);
+
 int scli_init(void);
 int scli_receive_key(int *key);
+/* Queues line to run as a console command in the CLI task, between lines
+ * typed on the UART. Returns false if the line is too long, the console is
+ * not up yet, or an earlier line has not finished running.
+ */
+bool scli_run_line(const char *line, scli_done_fn done);
 
 /** Misc. */
 void print_bytes(const uint8_t *bytes, int len);
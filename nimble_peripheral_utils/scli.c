@@ -6,6 +6,7 @@
 
 #include <stdio.h>
 #include <ctype.h>
+#include <stdatomic.h>
 #include "esp_log.h"
 #include <string.h>
 #include <esp_log.h>
@@ -13,15 +14,51 @@
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 #include <freertos/queue.h>
+#include <freertos/semphr.h>
 #include <driver/uart.h>
 #include "esp_peripheral.h"
 
 #define BLE_RX_TIMEOUT (30000 / portTICK_PERIOD_MS)
 
+#ifdef CONFIG_APP_SCLI_TASK_STACK_SIZE
+#define SCLI_TASK_STACK_SIZE CONFIG_APP_SCLI_TASK_STACK_SIZE
+#else
+#define SCLI_TASK_STACK_SIZE 4096
+#endif
+
+#ifdef CONFIG_APP_SCLI_UART
+#define SCLI_UART CONFIG_APP_SCLI_UART
+#else
+#define SCLI_UART 0
+#endif
+
+#ifdef CONFIG_APP_TASK_CORE
+#define SCLI_TASK_CORE CONFIG_APP_TASK_CORE
+#else
+#define SCLI_TASK_CORE tskNO_AFFINITY
+#endif
+
 static TaskHandle_t cli_task;
+static StaticTask_t cli_task_tcb;
+static StackType_t cli_task_stack[SCLI_TASK_STACK_SIZE];
 static QueueHandle_t cli_handle;
+static StaticQueue_t cli_queue;
+static uint8_t cli_queue_storage[1 * sizeof(int)];
 static int stop;
 
+#define SCLI_UART_QUEUE_LEN 8
+
+/* A line from elsewhere than the UART, run by the CLI task so that
+ * esp_console_run() is never entered from two tasks at once. It is
+ * announced by giving cli_remote_ready, which the task waits on together
+ * with the UART driver's event queue through a queue set.
+ */
+static SemaphoreHandle_t cli_remote_ready;
+static StaticSemaphore_t cli_remote_ready_buf;
+static char cli_remote_line[SCLI_REMOTE_LINE_MAX];
+static scli_done_fn cli_remote_done;
+static atomic_bool cli_remote_busy;
+
 static int enter_passkey_handler(int argc, char *argv[])
 {
     int key;
@@ -75,6 +112,32 @@ static int ble_register_cli(void)
     return 0;
 }
 
+static void run_remote(void)
+{
+    int cmd_ret = 0;
+    esp_err_t err = esp_console_run(cli_remote_line, &cmd_ret);
+
+    if (cli_remote_done != NULL) {
+        cli_remote_done(cli_remote_line, err, cmd_ret);
+    }
+    atomic_store(&cli_remote_busy, false);
+}
+
+bool scli_run_line(const char *line, scli_done_fn done)
+{
+    bool expected = false;
+
+    if (cli_remote_ready == NULL || strlen(line) >= sizeof(cli_remote_line) ||
+        !atomic_compare_exchange_strong(&cli_remote_busy, &expected, true)) {
+        return false;
+    }
+    strcpy(cli_remote_line, line);
+    cli_remote_done = done;
+    /* Only one line is in flight, so the semaphore is always free here. */
+    xSemaphoreGive(cli_remote_ready);
+    return true;
+}
+
 static void scli_task(void *arg)
 {
     int uart_num = (int) arg;
@@ -82,9 +145,25 @@ static void scli_task(void *arg)
     int i, cmd_ret;
     esp_err_t ret;
     QueueHandle_t uart_queue;
+    QueueSetHandle_t wait_set;
+    QueueSetMemberHandle_t ready;
+    SemaphoreHandle_t remote_ready;
     uart_event_t event;
 
-    uart_driver_install(uart_num, 256, 0, 8, &uart_queue, 0);
+    remote_ready = xSemaphoreCreateBinaryStatic(&cli_remote_ready_buf);
+    wait_set = xQueueCreateSet(SCLI_UART_QUEUE_LEN + 1);
+    if (wait_set == NULL) {
+        ESP_LOGE("SCLI", "no memory for the queue set");
+        vTaskDelete(NULL);
+        return;
+    }
+    /* Without a UART, lines only come through scli_run_line(). */
+    if (uart_num >= 0) {
+        uart_driver_install(uart_num, 256, 0, SCLI_UART_QUEUE_LEN, &uart_queue, 0);
+        xQueueAddToSet(uart_queue, wait_set);
+    }
+    xQueueAddToSet(remote_ready, wait_set);
+    cli_remote_ready = remote_ready;
     /* Initialize the console */
     esp_console_config_t console_config = {
         .max_cmdline_args = 8,
@@ -97,15 +176,21 @@ static void scli_task(void *arg)
         i = 0;
         memset(linebuf, 0, sizeof(linebuf));
         do {
-            ret = xQueueReceive(uart_queue, (void * )&event, (TickType_t)portMAX_DELAY);
-            if (ret != pdPASS) {
+            ready = xQueueSelectFromSet(wait_set, (TickType_t)portMAX_DELAY);
+            if (ready == NULL) {
                 if (stop == 1) {
                     break;
                 } else {
                     continue;
                 }
             }
-            if (event.type == UART_DATA) {
+            if (ready == remote_ready) {
+                xSemaphoreTake(remote_ready, 0);
+                run_remote();
+                continue;
+            }
+            ret = xQueueReceive(uart_queue, (void * )&event, 0);
+            if (ret == pdPASS && event.type == UART_DATA) {
                 while (uart_read_bytes(uart_num, (uint8_t *) &linebuf[i], 1, 0)) {
                     if (linebuf[i] == '\r') {
                         uart_write_bytes(uart_num, "\r\n", 2);
@@ -115,7 +200,7 @@ static void scli_task(void *arg)
                     i++;
                 }
             }
-        } while ((i < 255) && linebuf[i - 1] != '\r');
+        } while ((i < 255) && (i == 0 || linebuf[i - 1] != '\r'));
         if (stop) {
             break;
         }
@@ -134,12 +219,16 @@ int scli_init(void)
     /* Register CLI "key <value>" to accept input from user during pairing */
     ble_register_cli();
 
-    xTaskCreate(scli_task, "scli_cli", 4096, (void *) 0, 3, &cli_task);
-    if (cli_task == NULL) {
+    /* The queue must exist before the task can push keys into it */
+    cli_handle = xQueueCreateStatic(1, sizeof(int), cli_queue_storage, &cli_queue);
+    if (cli_handle == NULL) {
         return ESP_FAIL;
     }
-    cli_handle = xQueueCreate( 1, sizeof(int) );
-    if (cli_handle == NULL) {
+    cli_task = xTaskCreateStaticPinnedToCore(scli_task, "scli_cli",
+                                             SCLI_TASK_STACK_SIZE, (void *) SCLI_UART, 3,
+                                             cli_task_stack, &cli_task_tcb,
+                                             SCLI_TASK_CORE);
+    if (cli_task == NULL) {
         return ESP_FAIL;
     }
     return ESP_OK;
@@ -0,0 +1,551 @@
+#!/usr/bin/env python
+#
+# Load and soak test: several centrals connecting to the controller at once
+# and keeping it busy, with throughput, latency, memory and error counts.
+#
+#     ble_load.py AA:BB:CC:DD:EE:FF --adapters hci0,hci1,hci2 --seconds 3600
+#     ble_load.py AA:BB:... --adapters hci0,hci1 --pair --ops 200 --json soak.jsonl
+#     ble_load.py --sim --centrals 3 --pair --seconds 5
+#
+# Each central runs on an adapter of its own, since BlueZ keeps one
+# connection per adapter to a given device; USB dongles and the virtual
+# controllers of btvirt both do. In a loop it connects, pairs with --pair,
+# subscribes to the Cycling Power and CSC measurements, alternates reads and
+# writes of the red LED characteristic for --ops operations (the encrypted
+# security test characteristic too, if paired and present), and disconnects
+# again. Every --report seconds the tool prints per interval and in total:
+# operations per second, p50/p99/max latency by kind, notifications
+# received, errors by kind, and operations the controller's rate limit
+# (APP_ATT_LIMIT) answered with Insufficient Resources. Those are counted
+# apart and do not fail the run: a central going flat out is meant to hit
+# them. Memory comes from the diagnostics snapshot
+# (see tools/diag_decode.py), read by one central every --diag seconds: the
+# heap minimum and the fewest free msys mbufs seen are the high-water marks
+# for the run. With --json every report is also appended to a file, one
+# JSON object per line. Needs bleak.
+#
+# With --sim the centrals talk to a peripheral simulated in-process instead,
+# so the tool, its reports and its exit status can be checked without BlueZ
+# or a board, as "make -C host_test" does. The simulation follows the
+# firmware's shape: the host task serves one request at a time, a request
+# and its response each wait for a connection event, it keeps advertising
+# until CONFIG_BT_NIMBLE_MAX_CONNECTIONS centrals are connected and refuses
+# more, every connection has att_limit.c's read and write token buckets,
+# the encrypted characteristic needs pairing, and the measurements notify
+# once a second. --sim-loss drops
+# that fraction of requests' links, to exercise the error paths. Timings are
+# nominal, so the numbers say nothing about the firmware.
+
+from __future__ import print_function
+
+import argparse
+import asyncio
+import json
+import math
+import random
+import signal
+import sys
+import time
+
+from diag_decode import DIAG_CHR_UUID, HEADER, decode
+
+LED_RED_UUID = 'd7419b26-1437-4f29-a6c8-259cf01bc815'
+SEC_TEST_STATIC_UUID = '5c3a659e-897e-45e1-b016-007107c96df7'
+CP_MEASUREMENT_UUID = '00002a63-0000-1000-8000-00805f9b34fb'
+CSC_MEASUREMENT_UUID = '00002a5b-0000-1000-8000-00805f9b34fb'
+
+KINDS = ['connect', 'pair', 'subscribe', 'read', 'write', 'enc_write',
+         'diag', 'disconnect']
+
+# Simulated peripheral, at the firmware's defaults.
+SIM_MAX_CONNECTIONS = 3
+SIM_CONN_INTERVAL_S = 0.0075
+SIM_SERVICE_S = 0.0004          # host task time per request
+SIM_NOTIFY_S = 1.0
+SIM_MSYS_TOTAL = 12
+SIM_HEAP = 120000
+SIM_HEAP_PER_CONN = 1800
+SIM_READ_RATE = 20              # APP_ATT_READ_RATE, per second
+SIM_WRITE_RATE = 100            # APP_ATT_WRITE_RATE
+SIM_BURST = 20                  # APP_ATT_BURST
+
+INSUFFICIENT_RES = 0x11
+
+
+def throttled(exc):
+    """Whether an operation failed on the controller's rate limit: ATT
+    Insufficient Resources, as BlueZ reports it."""
+    text = str(exc).lower()
+    return '0x11' in text or 'insufficient resources' in text
+
+
+class SimError(Exception):
+    pass
+
+
+class SimBucket(object):
+    """att_limit.c's token bucket."""
+
+    def __init__(self, rate, burst):
+        self.rate = rate
+        self.burst = burst
+        self.tokens = float(burst)
+        self.at = time.monotonic()
+
+    def take(self):
+        now = time.monotonic()
+        self.tokens = min(self.burst, self.tokens + (now - self.at) * self.rate)
+        self.at = now
+        if self.tokens < 1:
+            return False
+        self.tokens -= 1
+        return True
+
+
+class SimPeripheral(object):
+    """The controller, as far as a central can tell over the air."""
+
+    def __init__(self, args):
+        self.loss = args.sim_loss
+        self.random = random.Random(args.seed)
+        self.host = asyncio.Lock()
+        self.connections = 0
+        self.in_flight = 0
+        self.heap_min = SIM_HEAP
+        self.msys_min = SIM_MSYS_TOTAL
+        self.seq = 0
+        self.started = time.monotonic()
+        self.chrs = set([LED_RED_UUID, SEC_TEST_STATIC_UUID,
+                         CP_MEASUREMENT_UUID, CSC_MEASUREMENT_UUID,
+                         DIAG_CHR_UUID])
+
+    def heap_free(self):
+        return SIM_HEAP - self.connections * SIM_HEAP_PER_CONN
+
+    def msys_free(self):
+        # One block per connection for its pending events, one per request.
+        return SIM_MSYS_TOTAL - self.connections - self.in_flight
+
+    async def event(self):
+        """Until the next connection event, at a random phase."""
+        await asyncio.sleep(self.random.uniform(0, SIM_CONN_INTERVAL_S))
+
+    async def request(self, client, bucket=None):
+        """A request's round trip: an event out, the host task, an event
+        back. Raises if the link is lost on the way, or if the request is
+        one of a rate-limited kind and bucket is out of tokens."""
+        self.in_flight += 1
+        self.msys_min = min(self.msys_min, self.msys_free())
+        try:
+            await self.event()
+            async with self.host:
+                await asyncio.sleep(SIM_SERVICE_S)
+                allowed = bucket is None or bucket.take()
+            if self.random.random() < self.loss:
+                client.lose()
+                raise SimError('link lost')
+            await self.event()
+            if not allowed:
+                raise SimError('ATT error 0x%02x: insufficient resources'
+                               % INSUFFICIENT_RES)
+        finally:
+            self.in_flight -= 1
+
+    def diag(self):
+        self.seq += 1
+        self.heap_min = min(self.heap_min, self.heap_free())
+        uptime_ms = int((time.monotonic() - self.started) * 1000)
+        return HEADER.pack(1, 0, self.connections, 0, self.seq, uptime_ms,
+                           self.heap_free(), self.heap_min, self.msys_free(),
+                           SIM_MSYS_TOTAL)
+
+
+class SimServices(object):
+    def __init__(self, peripheral):
+        self.peripheral = peripheral
+
+    def get_characteristic(self, uuid):
+        return uuid if uuid in self.peripheral.chrs else None
+
+
+class SimClient(object):
+    """The part of bleak.BleakClient the centrals use."""
+
+    def __init__(self, peripheral, disconnected_callback):
+        self.peripheral = peripheral
+        self.on_lost = disconnected_callback
+        self.services = SimServices(peripheral)
+        self.is_connected = False
+        self.paired = False
+        self.notifiers = []
+        self.reads = None
+        self.writes = None
+
+    def lose(self):
+        if self.is_connected:
+            self.close()
+            self.on_lost(self)
+
+    def close(self):
+        self.is_connected = False
+        self.peripheral.connections -= 1
+        for task in self.notifiers:
+            task.cancel()
+        self.notifiers = []
+
+    def check(self):
+        if not self.is_connected:
+            raise SimError('not connected')
+
+    async def connect(self):
+        # Advertising, the connect request and service discovery from the
+        # cache: a few connection intervals.
+        await asyncio.sleep(4 * SIM_CONN_INTERVAL_S)
+        if self.peripheral.connections >= SIM_MAX_CONNECTIONS:
+            raise SimError('no free connection')
+        self.peripheral.connections += 1
+        self.is_connected = True
+        self.reads = SimBucket(SIM_READ_RATE, SIM_BURST)
+        self.writes = SimBucket(SIM_WRITE_RATE, SIM_BURST)
+
+    async def pair(self):
+        self.check()
+        for _ in range(6):
+            await self.peripheral.request(self)
+        self.paired = True
+
+    async def start_notify(self, uuid, callback):
+        self.check()
+        await self.peripheral.request(self)
+
+        async def notify():
+            while True:
+                await asyncio.sleep(SIM_NOTIFY_S)
+                callback(uuid, bytearray(4))
+        self.notifiers.append(asyncio.ensure_future(notify()))
+
+    async def read_gatt_char(self, uuid):
+        self.check()
+        await self.peripheral.request(self, self.reads)
+        if uuid == DIAG_CHR_UUID:
+            return bytearray(self.peripheral.diag())
+        return bytearray(1)
+
+    async def write_gatt_char(self, uuid, data, response):
+        self.check()
+        if uuid == SEC_TEST_STATIC_UUID and not self.paired:
+            raise SimError('insufficient authentication')
+        await self.peripheral.request(self, self.writes)
+
+    async def disconnect(self):
+        if self.is_connected:
+            await self.peripheral.event()
+            self.close()
+
+
+class Hist(object):
+    """Log-linear histogram like main/lat_hist.h, with eight sub-buckets per
+    power of two, so soaks of any length take the same memory."""
+
+    SUB = 8
+
+    def __init__(self):
+        self.buckets = {}
+        self.count = 0
+        self.max = 0.0
+
+    def add(self, us):
+        us = max(int(us), 1)
+        exp = us.bit_length() - 1
+        sub = (us << 3 >> exp) & (self.SUB - 1) if exp >= 3 else us
+        key = (exp, sub)
+        self.buckets[key] = self.buckets.get(key, 0) + 1
+        self.count += 1
+        self.max = max(self.max, us)
+
+    def merge(self, other):
+        for key, n in other.buckets.items():
+            self.buckets[key] = self.buckets.get(key, 0) + n
+        self.count += other.count
+        self.max = max(self.max, other.max)
+
+    def percentile(self, p):
+        """Upper bound of the bucket holding it, clamped to the maximum."""
+        if not self.count:
+            return 0
+        rank = int(math.ceil(self.count * p / 100.0))
+        seen = 0
+        for exp, sub in sorted(self.buckets):
+            seen += self.buckets[(exp, sub)]
+            if seen >= rank:
+                if exp < 3:
+                    top = sub
+                else:
+                    top = ((self.SUB + sub + 1) << exp >> 3) - 1
+                return min(top, self.max)
+        return self.max
+
+
+class Stats(object):
+    def __init__(self):
+        self.latency = dict((kind, Hist()) for kind in KINDS)
+        self.errors = {}
+        self.throttled = {}   # by kind, answered Insufficient Resources
+        self.notifications = 0
+        self.dropped = 0      # connections lost while in use
+
+    def error(self, kind, exc):
+        name = '%s: %s' % (kind, type(exc).__name__)
+        self.errors[name] = self.errors.get(name, 0) + 1
+
+    def merge(self, other):
+        for kind in KINDS:
+            self.latency[kind].merge(other.latency[kind])
+        for name, n in other.errors.items():
+            self.errors[name] = self.errors.get(name, 0) + n
+        for kind, n in other.throttled.items():
+            self.throttled[kind] = self.throttled.get(kind, 0) + n
+        self.notifications += other.notifications
+        self.dropped += other.dropped
+
+    def ops(self):
+        return sum(self.latency[k].count
+                   for k in ('read', 'write', 'enc_write'))
+
+    def summary(self, seconds):
+        return {
+            'ops_per_s': self.ops() / seconds if seconds else 0,
+            'notifications_per_s': (self.notifications / seconds
+                                    if seconds else 0),
+            'dropped': self.dropped,
+            'errors': dict(self.errors),
+            'throttled': dict(self.throttled),
+            'latency_us': dict(
+                (kind, {'count': h.count, 'p50': h.percentile(50),
+                        'p99': h.percentile(99), 'max': h.max})
+                for kind, h in self.latency.items() if h.count),
+        }
+
+
+class Memory(object):
+    def __init__(self):
+        self.heap_min = None
+        self.msys_min = None
+        self.msys_total = None
+        self.connections_max = 0
+        self.reads = 0
+
+    def add(self, snap):
+        self.reads += 1
+        self.heap_min = (snap['heap_min'] if self.heap_min is None
+                         else min(self.heap_min, snap['heap_min']))
+        self.msys_min = (snap['msys_free'] if self.msys_min is None
+                         else min(self.msys_min, snap['msys_free']))
+        self.msys_total = snap['msys_total']
+        self.connections_max = max(self.connections_max, snap['connections'])
+
+
+async def timed(stats, kind, coro):
+    """The result of coro, timed; None if the rate limit turned it away."""
+    start = time.monotonic()
+    try:
+        result = await coro
+    except Exception as exc:
+        if throttled(exc):
+            stats.throttled[kind] = stats.throttled.get(kind, 0) + 1
+            return None
+        stats.error(kind, exc)
+        exc.counted = True
+        raise
+    stats.latency[kind].add((time.monotonic() - start) * 1e6)
+    return result
+
+
+def make_client(args, adapter, sim, on_lost):
+    if sim:
+        return SimClient(sim, on_lost)
+    from bleak import BleakClient
+    return BleakClient(args.address, adapter=adapter, timeout=args.timeout,
+                       disconnected_callback=on_lost)
+
+
+async def central(n, args, adapter, sim, stats, memory, stop):
+    value = n & 0xff
+    next_diag = 0
+    while not stop.is_set():
+        lost = asyncio.Event()
+        client = make_client(args, adapter, sim, lambda _: lost.set())
+
+        def notified(_, data):
+            stats.notifications += 1
+
+        try:
+            await timed(stats, 'connect', client.connect())
+            if args.pair:
+                await timed(stats, 'pair', client.pair())
+            for uuid in (CP_MEASUREMENT_UUID, CSC_MEASUREMENT_UUID):
+                if client.services.get_characteristic(uuid):
+                    await timed(stats, 'subscribe',
+                                client.start_notify(uuid, notified))
+            enc = args.pair and \
+                client.services.get_characteristic(SEC_TEST_STATIC_UUID)
+            diag = client.services.get_characteristic(DIAG_CHR_UUID)
+
+            for op in range(args.ops):
+                if stop.is_set() or lost.is_set():
+                    break
+                if op % 2 == 0:
+                    await timed(stats, 'read',
+                                client.read_gatt_char(LED_RED_UUID))
+                else:
+                    value = (value + 1) & 0xff
+                    await timed(stats, 'write',
+                                client.write_gatt_char(LED_RED_UUID,
+                                                       bytes([value]), True))
+                if enc and op % 8 == 7:
+                    await timed(stats, 'enc_write',
+                                client.write_gatt_char(SEC_TEST_STATIC_UUID,
+                                                       bytes([value]), True))
+                if n == 0 and diag and time.monotonic() >= next_diag:
+                    next_diag = time.monotonic() + args.diag
+                    data = await timed(stats, 'diag',
+                                       client.read_gatt_char(DIAG_CHR_UUID))
+                    if data is not None:
+                        memory.add(decode(bytes(data)))
+                if args.interval:
+                    await asyncio.sleep(args.interval)
+            if lost.is_set():
+                stats.dropped += 1
+        except Exception as exc:
+            if not getattr(exc, 'counted', False):
+                stats.error('other', exc)
+            if lost.is_set():
+                stats.dropped += 1
+            await asyncio.sleep(1)
+        finally:
+            if client.is_connected:
+                try:
+                    await timed(stats, 'disconnect', client.disconnect())
+                except Exception:
+                    pass
+
+
+def print_report(label, stats, seconds, memory):
+    s = stats.summary(seconds)
+    print('%s: %.1f ops/s, %.1f notifications/s, %d dropped'
+          % (label, s['ops_per_s'], s['notifications_per_s'], s['dropped']))
+    for kind in KINDS:
+        lat = s['latency_us'].get(kind)
+        if lat:
+            print('  %-10s %7d  p50 %7.1f  p99 %7.1f  max %7.1f ms'
+                  % (kind, lat['count'], lat['p50'] / 1e3, lat['p99'] / 1e3,
+                     lat['max'] / 1e3))
+    for name, count in sorted(s['errors'].items()):
+        print('  error %s: %d' % (name, count))
+    for kind in KINDS:
+        if s['throttled'].get(kind):
+            print('  throttled %s: %d' % (kind, s['throttled'][kind]))
+    if memory.reads:
+        print('  heap min %d bytes, msys mbufs free min %d of %d, '
+              'up to %d connection(s)'
+              % (memory.heap_min, memory.msys_min, memory.msys_total,
+                 memory.connections_max))
+    sys.stdout.flush()
+    return s
+
+
+async def run(args):
+    adapters = args.adapters.split(',')
+    centrals = args.centrals or len(adapters)
+    sim = SimPeripheral(args) if args.sim else None
+    if sim:
+        adapters = ['sim%d' % n for n in range(centrals)]
+    if centrals > len(adapters):
+        raise SystemExit('%d centrals need as many adapters, have %d'
+                         % (centrals, len(adapters)))
+    stop = asyncio.Event()
+    memory = Memory()
+    interval = [Stats() for _ in range(centrals)]
+    total = Stats()
+    tasks = [asyncio.ensure_future(central(n, args, adapters[n], sim,
+                                           interval[n], memory, stop))
+             for n in range(centrals)]
+    out = open(args.json, 'a') if args.json else None
+
+    # ^C ends the run like --seconds does, with the totals.
+    asyncio.get_event_loop().add_signal_handler(signal.SIGINT, stop.set)
+    start = last = time.monotonic()
+    end = start + args.seconds if args.seconds else None
+    try:
+        while not stop.is_set() and (end is None or time.monotonic() < end):
+            wait = args.report if end is None else \
+                min(args.report, end - time.monotonic())
+            try:
+                await asyncio.wait_for(stop.wait(), max(wait, 0))
+            except asyncio.TimeoutError:
+                pass
+            now = time.monotonic()
+            # Swap in fresh counters; the centrals hold the list, not these.
+            period = Stats()
+            for n in range(centrals):
+                period.merge(interval[n])
+                interval[n].__init__()
+            total.merge(period)
+            s = print_report('%6.0f s' % (now - start), period, now - last,
+                             memory)
+            if out:
+                s.update({'t': now - start, 'heap_min': memory.heap_min,
+                          'msys_min': memory.msys_min})
+                out.write(json.dumps(s) + '\n')
+                out.flush()
+            last = now
+    finally:
+        stop.set()
+        await asyncio.gather(*tasks, return_exceptions=True)
+        if out:
+            out.close()
+    print()
+    s = print_report('total over %.0f s, %d central(s)'
+                     % (time.monotonic() - start, centrals),
+                     total, time.monotonic() - start, memory)
+    return 1 if s['errors'] or s['dropped'] else 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Multi-central BLE load and '
+                                     'soak test')
+    parser.add_argument('address', nargs='?', help='controller address')
+    parser.add_argument('--adapters', default='hci0',
+                        help='comma-separated BlueZ adapters, one per central')
+    parser.add_argument('--centrals', type=int,
+                        help='how many of the adapters to use (default all)')
+    parser.add_argument('--seconds', type=float, default=60,
+                        help='length of the run, 0 until ^C')
+    parser.add_argument('--ops', type=int, default=100,
+                        help='reads and writes per connection')
+    parser.add_argument('--interval', type=float, default=0,
+                        help='seconds between operations')
+    parser.add_argument('--pair', action='store_true',
+                        help='pair on every connection')
+    parser.add_argument('--timeout', type=float, default=10,
+                        help='connect timeout')
+    parser.add_argument('--report', type=float, default=10,
+                        help='seconds between reports')
+    parser.add_argument('--diag', type=float, default=5,
+                        help='seconds between diagnostics snapshot reads')
+    parser.add_argument('--json', help='append each report to this file')
+    parser.add_argument('--sim', action='store_true',
+                        help='load a simulated peripheral, no BlueZ needed')
+    parser.add_argument('--sim-loss', type=float, default=0,
+                        help='fraction of simulated requests that lose the '
+                        'link')
+    parser.add_argument('--seed', type=int, default=1,
+                        help='of the simulation')
+    args = parser.parse_args()
+    if not args.address and not args.sim:
+        parser.error('the controller address is needed without --sim')
+    return asyncio.run(run(args))
+
+
+if __name__ == '__main__':
+    sys.exit(main() or 0)
@@ -0,0 +1,137 @@
+#!/usr/bin/env python
+#
+# Decodes the diagnostics snapshot characteristic (see main/diag.h).
+#
+#     diag_decode.py 01050100...           decode a hex dump
+#     diag_decode.py --address AA:BB:...   read it over BLE (needs bleak)
+#     diag_decode.py --address ... --watch 2
+#
+# With --watch, CPU use is also recomputed from the run-time counters of
+# consecutive reads, which covers the whole interval rather than the
+# firmware's last snapshot period.
+
+from __future__ import print_function
+
+import argparse
+import struct
+import sys
+
+DIAG_CHR_UUID = 'ee22d3f7-a421-4b0a-9ebb-3207811417c2'
+
+DIAG_VERSION = 1
+HEADER = struct.Struct('<BBBBIIIIHH')
+TASK = struct.Struct('<8sIHHHBB')
+FLAG_RUN_TIME = 0x01
+CPU_UNKNOWN = 0xFFFF
+STATES = ['running', 'ready', 'blocked', 'suspended', 'deleted', 'invalid']
+
+
+def decode(data):
+    if len(data) < HEADER.size:
+        raise ValueError('snapshot too short: %d bytes' % len(data))
+    (version, ntasks, conns, flags, seq, uptime_ms, heap_free, heap_min,
+     msys_free, msys_total) = HEADER.unpack_from(data)
+    if version != DIAG_VERSION:
+        raise ValueError('unknown snapshot version %d' % version)
+    if len(data) < HEADER.size + ntasks * TASK.size:
+        raise ValueError('snapshot truncated: %d task records, %d bytes'
+                         % (ntasks, len(data)))
+    tasks = []
+    for i in range(ntasks):
+        name, run_time, cpu, stack_size, stack_free, prio, state = \
+            TASK.unpack_from(data, HEADER.size + i * TASK.size)
+        tasks.append({
+            'name': name.rstrip(b'\0').decode('ascii', 'replace'),
+            'run_time': run_time,
+            'cpu_permille': None if cpu == CPU_UNKNOWN else cpu,
+            'stack_size': stack_size,
+            'stack_free': stack_free,
+            'prio': prio,
+            'state': STATES[state] if state < len(STATES) else str(state),
+        })
+    return {
+        'seq': seq,
+        'uptime_ms': uptime_ms,
+        'connections': conns,
+        'run_time_stats': bool(flags & FLAG_RUN_TIME),
+        'heap_free': heap_free,
+        'heap_min': heap_min,
+        'msys_free': msys_free,
+        'msys_total': msys_total,
+        'tasks': tasks,
+    }
+
+
+def cpu_between(prev, cur):
+    """Per mille of one core for each task, from two snapshots' counters.
+
+    Assumes the run-time counter ticks in microseconds, the ESP-IDF default.
+    """
+    elapsed_us = (cur['uptime_ms'] - prev['uptime_ms']) * 1000
+    before = dict((t['name'], t['run_time']) for t in prev['tasks'])
+    cpu = {}
+    for t in cur['tasks']:
+        if elapsed_us > 0 and t['name'] in before:
+            delta = (t['run_time'] - before[t['name']]) & 0xFFFFFFFF
+            cpu[t['name']] = delta * 1000 // elapsed_us
+    return cpu
+
+
+def show(snap, cpu=None):
+    print('snapshot %d, uptime %.1f s, %d connection(s)'
+          % (snap['seq'], snap['uptime_ms'] / 1000.0, snap['connections']))
+    print('heap free %d, min %d bytes; msys mbufs free %d of %d'
+          % (snap['heap_free'], snap['heap_min'], snap['msys_free'],
+             snap['msys_total']))
+    print('%-8s %4s %-9s %7s %13s' % ('task', 'prio', 'state', 'cpu', 'stack used'))
+    for t in snap['tasks']:
+        permille = t['cpu_permille']
+        if cpu is not None and t['name'] in cpu:
+            permille = cpu[t['name']]
+        used = t['stack_size'] - t['stack_free']
+        print('%-8s %4d %-9s %7s %6d/%-6d'
+              % (t['name'], t['prio'], t['state'],
+                 '-' if permille is None else '%.1f%%' % (permille / 10.0),
+                 used, t['stack_size']))
+    if not snap['run_time_stats']:
+        print('(enable FREERTOS_GENERATE_RUN_TIME_STATS and '
+              'FREERTOS_USE_TRACE_FACILITY for CPU use)')
+
+
+def read_ble(address, interval):
+    import asyncio
+    from bleak import BleakClient
+
+    async def run():
+        async with BleakClient(address) as client:
+            prev = None
+            while True:
+                snap = decode(bytes(await client.read_gatt_char(DIAG_CHR_UUID)))
+                show(snap, cpu_between(prev, snap) if prev else None)
+                if not interval:
+                    return
+                prev = snap
+                print()
+                await asyncio.sleep(interval)
+
+    asyncio.run(run())
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument('hex', nargs='?', help='snapshot as a hex string')
+    parser.add_argument('--address', help='read the snapshot from this device')
+    parser.add_argument('--watch', type=float, metavar='SECONDS',
+                        help='keep reading at this interval')
+    args = parser.parse_args()
+
+    if args.address:
+        read_ble(args.address, args.watch)
+    elif args.hex:
+        show(decode(bytes.fromhex(args.hex.replace(' ', ''))))
+    else:
+        show(decode(bytes.fromhex(sys.stdin.read().strip().replace(' ', ''))))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,109 @@
+#!/usr/bin/env python
+#
+# Decompresses the LZSS streams the firmware writes (see main/lzss.h).
+#
+#     lzss.py ride.lz > ride.bin
+#     lzss.py -c ride.bin > ride.lz    compress, for tests
+#
+# The constants below must match main/lzss.h.
+
+from __future__ import print_function
+
+import argparse
+import sys
+
+OFFSET_BITS = 10
+LENGTH_BITS = 5
+MIN_MATCH = 3
+WINDOW = 1 << OFFSET_BITS
+MAX_MATCH = MIN_MATCH + (1 << LENGTH_BITS) - 1
+
+
+def decompress(data):
+    out = bytearray()
+    bits = 0
+    nbits = 0
+    pos = 0
+    while True:
+        # Refill so that any token fits, then decode one.
+        while nbits < 16 and pos < len(data):
+            bits = (bits << 8) | data[pos]
+            pos += 1
+            nbits += 8
+        if nbits == 0:
+            break
+        if (bits >> (nbits - 1)) & 1:
+            if nbits < 9:
+                break
+            nbits -= 9
+            out.append((bits >> nbits) & 0xFF)
+        else:
+            if nbits < 1 + OFFSET_BITS + LENGTH_BITS:
+                break  # zero padding of the last byte
+            nbits -= 1 + OFFSET_BITS + LENGTH_BITS
+            tok = bits >> nbits
+            offset = ((tok >> LENGTH_BITS) & (WINDOW - 1)) + 1
+            length = (tok & ((1 << LENGTH_BITS) - 1)) + MIN_MATCH
+            for _ in range(length):
+                # Bytes before the start of the stream read as zero, as the
+                # firmware's zeroed window does.
+                out.append(out[-offset] if offset <= len(out) else 0)
+        bits &= (1 << nbits) - 1
+    return bytes(out)
+
+
+def compress(data):
+    """Greedy reference encoder: slow, but produces a valid stream."""
+    bits = []
+    i = 0
+    while i < len(data):
+        best_len = 0
+        best_dist = 0
+        for dist in range(1, min(WINDOW, i) + 1):
+            n = 0
+            while (n < MAX_MATCH and i + n < len(data)
+                   and data[i + n - dist] == data[i + n]):
+                n += 1
+            if n > best_len:
+                best_len, best_dist = n, dist
+                if n == MAX_MATCH:
+                    break
+        if best_len >= MIN_MATCH:
+            tok = ((best_dist - 1) << LENGTH_BITS) | (best_len - MIN_MATCH)
+            bits.append((tok, 1 + OFFSET_BITS + LENGTH_BITS))
+            i += best_len
+        else:
+            bits.append((0x100 | data[i], 9))
+            i += 1
+    out = bytearray()
+    acc = 0
+    nacc = 0
+    for value, n in bits:
+        acc = (acc << n) | value
+        nacc += n
+        while nacc >= 8:
+            nacc -= 8
+            out.append((acc >> nacc) & 0xFF)
+        acc &= (1 << nacc) - 1
+    if nacc:
+        out.append((acc << (8 - nacc)) & 0xFF)
+    return bytes(out)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='LZSS stream (de)compressor')
+    parser.add_argument('file', nargs='?', help='input, stdin if omitted')
+    parser.add_argument('-c', '--compress', action='store_true')
+    args = parser.parse_args()
+
+    if args.file:
+        with open(args.file, 'rb') as f:
+            data = f.read()
+    else:
+        data = sys.stdin.buffer.read()
+    out = compress(data) if args.compress else decompress(data)
+    sys.stdout.buffer.write(out)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,355 @@
+#!/usr/bin/env python
+#
+# Exercises the display link proxy (see main/uart_proxy.h) with a corpus of
+# frames, standing in for both the display and the motor.
+#
+#     proxy_replay.py record corpus.txt --display /dev/ttyUSB0 --motor /dev/ttyUSB1
+#     proxy_replay.py synth corpus.txt --seconds 60
+#     proxy_replay.py replay corpus.txt -- host_test/build/proxy_host
+#     proxy_replay.py replay corpus.txt --level 3 --pace -- host_test/build/proxy_host
+#
+# record listens on two USB serial adapters tapped onto the display's and
+# the motor's TX lines and writes what each side sends, one frame per line.
+# synth writes a made-up corpus in the same format, with a few corrupt
+# frames, for when no bike is at hand.
+#
+# replay opens two pty pairs, starts the command with the far ends in
+# UART_PROXY_DISPLAY and UART_PROXY_MOTOR (the Linux host build of the
+# firmware reads these), and plays the corpus into the near ends at the
+# recorded times, each frame in one go, or one byte at a time at 9600 baud
+# with --pace. With --level the proxy is told, through UART_PROXY_LEVEL, to
+# send that assist level to the motor. The tool checks that every byte
+# comes out of the other side, rewritten where it should be, and prints the
+# latency per frame: from writing its last byte into one pty to reading it
+# from the other. Only the standard library is needed.
+#
+# Paced replay depends on sleeping no more than a few milliseconds too long;
+# where it does, the proxy ends the frame early, as it would on the wire,
+# and the bytes around it are left unchecked.
+#
+# Corpus lines: <seconds> <d|m> <hex>, d for display to motor, m for motor
+# to display; '#' starts a comment.
+
+from __future__ import print_function
+
+import argparse
+import os
+import random
+import select
+import subprocess
+import sys
+import termios
+import threading
+import time
+import tty
+
+BAUD = 9600
+BYTE_S = 10.0 / BAUD
+GAP_S = 0.003
+DISPLAY_START = 0x59
+DISPLAY_LEN = 7
+DISPLAY_ASSIST = 1
+MOTOR_START = 0x43
+MOTOR_LEN = 9
+ASSIST_CODES = [0x10, 0x40, 0x02, 0x04, 0x08]
+FRAMES = {'d': (DISPLAY_START, DISPLAY_LEN), 'm': (MOTOR_START, MOTOR_LEN)}
+
+
+def checksum(body):
+    return sum(body) & 0xff
+
+
+def read_corpus(path):
+    entries = []
+    with open(path) as f:
+        for n, line in enumerate(f, 1):
+            line = line.split('#', 1)[0].split()
+            if not line:
+                continue
+            if len(line) != 3 or line[1] not in FRAMES:
+                raise ValueError('%s:%d: expected <seconds> <d|m> <hex>'
+                                 % (path, n))
+            entries.append((float(line[0]), line[1],
+                            bytearray.fromhex(line[2])))
+    entries.sort(key=lambda e: e[0])
+    return entries
+
+
+def write_corpus(path, entries, comment):
+    with open(path, 'w') as f:
+        f.write('# %s\n' % comment)
+        for t, side, data in entries:
+            f.write('%.6f %s %s\n' % (t, side, bytes(data).hex()))
+
+
+class Link(object):
+    """The firmware's frame tracker (main/tsdz2_link.h), to predict what the
+    proxy passes on."""
+
+    def __init__(self, start, length, level=None):
+        self.start = start
+        self.len = length
+        self.rewrite_level = level
+        self.synced = False
+        self.level = None
+        self.frame = bytearray()
+        self.sum = 0
+        self.delta = 0
+        self.last = None
+        self.cut = 0
+        self.unsure = False
+
+    def gap(self, now):
+        # The replay cannot always keep bytes closer than the proxy's gap;
+        # when it falls behind, the proxy ends the frame, and so does this.
+        # The proxy times its reads, not these writes, and a busy host can
+        # hold either back by a millisecond or two, so past half the limit
+        # it may decide the other way: what goes through is unsure until a
+        # good frame has put both back in step.
+        if self.frame:
+            if now - self.last > GAP_S / 2:
+                self.unsure = True
+            if now - self.last > GAP_S:
+                self.frame = bytearray()
+                self.synced = False
+                self.cut += 1
+        self.last = now
+
+    def byte(self, b):
+        if not self.frame:
+            if b != self.start:
+                return b
+            self.sum = 0
+            self.delta = 0
+            self.level = self.rewrite_level if self.synced else None
+        self.frame.append(b)
+        if len(self.frame) < self.len:
+            self.sum = (self.sum + b) & 0xff
+            if (self.level is not None and
+                    len(self.frame) - 1 == DISPLAY_ASSIST and
+                    b in ASSIST_CODES):
+                out = ASSIST_CODES[self.level]
+                self.delta = (self.delta + out - b) & 0xff
+                return out
+            return b
+        out = (b + self.delta) & 0xff
+        frame, self.frame = self.frame, bytearray()
+        if b == self.sum:
+            self.synced = True
+            self.unsure = False
+        else:
+            self.synced = False
+            for c in frame[1:]:
+                self.byte(c)
+        return out
+
+
+def open_tty(path):
+    fd = os.open(path, os.O_RDWR | os.O_NOCTTY)
+    tty.setraw(fd)
+    attrs = termios.tcgetattr(fd)
+    attrs[4] = attrs[5] = termios.B9600
+    termios.tcsetattr(fd, termios.TCSANOW, attrs)
+    return fd
+
+
+def record(args):
+    fds = {'d': open_tty(args.display), 'm': open_tty(args.motor)}
+    pending = {'d': bytearray(), 'm': bytearray()}
+    last = {'d': 0.0, 'm': 0.0}
+    entries = []
+    t0 = time.time()
+    end = t0 + args.seconds if args.seconds else None
+    print('recording, ^C to stop', file=sys.stderr)
+
+    def flush(side):
+        if pending[side]:
+            entries.append((last[side] - t0, side, pending[side]))
+            pending[side] = bytearray()
+
+    try:
+        while end is None or time.time() < end:
+            ready, _, _ = select.select(list(fds.values()), [], [], GAP_S)
+            now = time.time()
+            for side, fd in fds.items():
+                if fd in ready:
+                    data = os.read(fd, 64)
+                    if now - last[side] > GAP_S:
+                        flush(side)
+                    if not pending[side]:
+                        last[side] = now
+                    pending[side] += data
+                elif now - last[side] > GAP_S:
+                    flush(side)
+    except KeyboardInterrupt:
+        pass
+    for side in fds:
+        flush(side)
+    entries.sort(key=lambda e: e[0])
+    write_corpus(args.corpus, entries, 'recorded from %s and %s'
+                 % (args.display, args.motor))
+    print('%d frames' % len(entries), file=sys.stderr)
+
+
+def synth(args):
+    rng = random.Random(args.seed)
+    entries = []
+    level = 2
+    t = 0.0
+    while t < args.seconds:
+        if rng.random() < 0.02:
+            level = rng.randrange(len(ASSIST_CODES))
+        body = bytearray([DISPLAY_START, ASSIST_CODES[level], 0x00, 0x1a,
+                          0x02, 0x46])
+        entries.append((t, 'd', body + bytearray([checksum(body)])))
+        body = bytearray([MOTOR_START] +
+                         [rng.randrange(256) for _ in range(MOTOR_LEN - 2)])
+        entries.append((t + 0.005 + DISPLAY_LEN * BYTE_S, 'm',
+                        body + bytearray([checksum(body)])))
+        t += args.period
+    for i in rng.sample(range(len(entries)), int(len(entries) * args.corrupt)):
+        t, side, data = entries[i]
+        data[rng.randrange(1, len(data))] ^= 1 << rng.randrange(8)
+    write_corpus(args.corpus, entries, 'synthetic, not from a bike')
+    print('%d frames' % len(entries), file=sys.stderr)
+
+
+def reader(fd, out, stop):
+    while not stop.is_set():
+        ready, _, _ = select.select([fd], [], [], 0.05)
+        if ready:
+            try:
+                data = os.read(fd, 256)
+            except OSError:
+                return
+            now = time.time()
+            out.extend((now, b) for b in bytearray(data))
+
+
+def wait(until):
+    # Spinning instead would starve the proxy on a single CPU; late bytes
+    # are allowed for through Link.gap().
+    delay = until - time.time()
+    if delay > 0:
+        time.sleep(delay)
+
+
+def percentile(values, p):
+    if not values:
+        return 0
+    values = sorted(values)
+    return values[min(len(values) - 1, int(len(values) * p / 100.0))]
+
+
+def replay(args):
+    entries = read_corpus(args.corpus)
+    near = {}
+    env = dict(os.environ)
+    for side, var in (('d', 'UART_PROXY_DISPLAY'), ('m', 'UART_PROXY_MOTOR')):
+        master, slave = os.openpty()
+        tty.setraw(master)
+        tty.setraw(slave)
+        near[side] = master
+        env[var] = os.ttyname(slave)
+    if args.level is not None:
+        env['UART_PROXY_LEVEL'] = str(args.level)
+    proc = subprocess.Popen(args.command, env=env)
+    time.sleep(args.startup)
+
+    # What comes out of the motor pty went in as d, and the other way round.
+    stop = threading.Event()
+    got = {'d': [], 'm': []}
+    threads = [threading.Thread(target=reader, args=(near['m'], got['d'], stop)),
+               threading.Thread(target=reader, args=(near['d'], got['m'], stop))]
+    for th in threads:
+        th.daemon = True
+        th.start()
+
+    links = {'d': Link(DISPLAY_START, DISPLAY_LEN, args.level),
+             'm': Link(MOTOR_START, MOTOR_LEN)}
+    expected = {'d': bytearray(), 'm': bytearray()}
+    unsure = {'d': set(), 'm': set()}  # indexes of bytes not to check
+    frame_ends = {'d': [], 'm': []}   # (index of last byte, time written)
+    t0 = time.time() + 0.1
+    for t, side, data in entries:
+        due = t0 + t / args.speed
+        chunks = [data[i:i + 1] for i in range(len(data))] if args.pace \
+            else [data]
+        for chunk in chunks:
+            wait(due)
+            # Before the write: the proxy may read the bytes before it returns.
+            written = time.time()
+            os.write(near[side], chunk)
+            links[side].gap(written)
+            for b in chunk:
+                if links[side].unsure:
+                    unsure[side].add(len(expected[side]))
+                expected[side].append(links[side].byte(b))
+            due = max(due, written) + BYTE_S
+        frame_ends[side].append((len(expected[side]) - 1, written))
+
+    time.sleep(args.drain)
+    stop.set()
+    for th in threads:
+        th.join()
+    proc.terminate()
+    proc.wait()
+
+    failed = False
+    for side, name in (('d', 'display->motor'), ('m', 'motor->display')):
+        out = bytearray(b for _, b in got[side])
+        wrong = sum(1 for i, (a, b) in enumerate(zip(out, expected[side]))
+                    if a != b and i not in unsure[side])
+        lat = [(got[side][i][0] - written) * 1e6
+               for i, written in frame_ends[side] if i < len(got[side])]
+        print('%s: %d frames, %d cut short by the replay, %d/%d bytes out, '
+              '%d wrong, %d not checked; latency p50 %.0f p99 %.0f max %.0f us'
+              % (name, len(frame_ends[side]), links[side].cut, len(out),
+                 len(expected[side]), wrong, len(unsure[side]),
+                 percentile(lat, 50),
+                 percentile(lat, 99), max(lat) if lat else 0))
+        failed |= wrong != 0 or len(out) != len(expected[side])
+    return 1 if failed else 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Display link proxy corpus '
+                                     'recorder and replayer')
+    sub = parser.add_subparsers(dest='mode')
+    sub.required = True
+
+    p = sub.add_parser('record', help='record a corpus from two serial taps')
+    p.add_argument('corpus')
+    p.add_argument('--display', required=True, help='tty on the display TX')
+    p.add_argument('--motor', required=True, help='tty on the motor TX')
+    p.add_argument('--seconds', type=float, default=0)
+
+    p = sub.add_parser('synth', help='write a synthetic corpus')
+    p.add_argument('corpus')
+    p.add_argument('--seconds', type=float, default=60)
+    p.add_argument('--period', type=float, default=0.1,
+                   help='seconds between exchanges')
+    p.add_argument('--corrupt', type=float, default=0.01,
+                   help='fraction of frames with a flipped bit')
+    p.add_argument('--seed', type=int, default=1)
+
+    p = sub.add_parser('replay', help='play a corpus through the proxy')
+    p.add_argument('corpus')
+    p.add_argument('command', nargs='+', help='proxy to run')
+    p.add_argument('--level', type=int, choices=range(len(ASSIST_CODES)),
+                   help='have the proxy send this assist level')
+    p.add_argument('--speed', type=float, default=1.0,
+                   help='play faster than recorded')
+    p.add_argument('--pace', action='store_true',
+                   help='write one byte at a time at 9600 baud, not each '
+                   'frame at once; wants a CPU to spare')
+    p.add_argument('--startup', type=float, default=0.5,
+                   help='seconds to let the proxy open its ptys')
+    p.add_argument('--drain', type=float, default=0.5)
+
+    args = parser.parse_args()
+    return {'record': record, 'synth': synth, 'replay': replay}[args.mode](args)
+
+
+if __name__ == '__main__':
+    sys.exit(main() or 0)